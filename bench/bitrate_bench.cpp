@@ -0,0 +1,164 @@
+/* Adaptive bitrate benchmark
+模擬 stream_video 經過一條頻寬會變的連線 (時間是算出來的，1ms 一格，不用真的等)：
+前 1/3 和後 1/3 的時間頻寬是 4 x <link_mbps>，中間 1/3 只有 <link_mbps>。
+sender 照 timestamp 送 <fps> 的 frame (和 FramePacer 一樣，落後超過 PACER_RESYNC_MS 就重新對時)，
+frame 在 quality 90、原本解析度時是 <frame_kb> KB，其他設定的大小用 JPEG 一般的比例估計。
+比較三種寫法每一段時間的 FPS、平均 quality、Mbps 和 capture 到完整收到的 p50 / p99 latency：
+- fixed：原本的寫法，固定 quality、kernel 的 send buffer 有 4 MB (Linux TCP autotuning 的上限)
+- fixed+limit：只加上 TCP_NOTSENT_LOWAT (ABR_UNSENT_LIMIT)
+- adaptive：TCP_NOTSENT_LOWAT + BitrateController
+
+Usage: ./bench/bitrate_bench [seconds] [link_mbps] [frame_kb] [fps]
+*/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <string>
+#include <cstdlib>
+#include "../shared/bitrate.hpp"
+#include "../shared/playout.hpp"
+
+#define TICK_US 1000
+#define DEFAULT_SEND_BUFFER (4 * 1024 * 1024)
+#define PHASES 3
+
+// quality 90 的幾倍大 (libjpeg 的 quality 和檔案大小大約是這個關係)
+static double quality_factor(int quality) {
+    static const int qualities[] = {10, 20, 30, 40, 50, 60, 70, 80, 90, 100};
+    static const double factors[] = {0.12, 0.18, 0.24, 0.29, 0.34, 0.39, 0.46, 0.60, 1.0, 2.4};
+    for (int i = 1; i < 10; i++) {
+        if (quality <= qualities[i]) {
+            double t = (quality - qualities[i - 1]) / 10.0;
+            return factors[i - 1] + t * (factors[i] - factors[i - 1]);
+        }
+    }
+    return factors[9];
+}
+
+static int64_t percentile(std::vector<int64_t>& values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+struct Phase {
+    uint64_t frames = 0;
+    uint64_t bytes = 0;
+    uint64_t quality_sum = 0;
+    std::vector<int64_t> latency_us;
+};
+
+struct InFlight {
+    int64_t capture_us;
+    int64_t remaining;  // 還沒從連線上送完的 bytes
+    int phase;
+    int quality;
+};
+
+static void run(const std::string& name, int seconds, double link_mbps, int frame_kb, int fps, int64_t unsent_limit, bool adaptive) {
+    int64_t duration_us = seconds * 1000000LL;
+    int64_t interval_us = 1000000 / fps;
+    BitrateController bitrate(fps);
+    Phase phases[PHASES];
+
+    std::deque<InFlight> link;      // 進了 kernel 還沒送到對方的 frame
+    int64_t unsent = 0;
+    int64_t pacer_base = 0;
+    uint64_t frame_index = 0;
+    bool writing = false;           // sender 卡在 send 裡
+    int64_t write_left = 0, write_start = 0, behind = 0;
+    int64_t next_due = 0;
+    double link_credit = 0;
+
+    for (int64_t now = 0; now < duration_us; now += TICK_US) {
+        int phase = (int)(now * PHASES / duration_us);
+        double mbps = phase == 1 ? link_mbps : link_mbps * 4;
+
+        // 連線送出這 1ms 能送的 bytes
+        link_credit += mbps * 1e6 / 8 * TICK_US / 1e6;
+        while (!link.empty() && link_credit >= 1) {
+            int64_t sent = std::min<int64_t>(link.front().remaining, (int64_t)link_credit);
+            link.front().remaining -= sent;
+            link_credit -= sent;
+            unsent -= sent;
+            if (link.front().remaining == 0) {
+                Phase& done = phases[link.front().phase];
+                done.frames++;
+                done.quality_sum += link.front().quality;
+                done.latency_us.push_back(now - link.front().capture_us);
+                link.pop_front();
+            }
+        }
+        if (link.empty()) link_credit = 0;
+
+        // sender：找下一個要送的 frame，等到它的時間，再寫進 kernel (超過 unsent_limit 就卡住)
+        if (!writing) {
+            while (adaptive && !bitrate.should_send(frame_index)) frame_index++;
+            int64_t pts = frame_index * interval_us;
+            next_due = pacer_base + pts;
+            if (now < next_due) continue;
+            behind = now - next_due;
+            if (behind > PACER_RESYNC_MS * 1000LL) pacer_base += behind;
+            int64_t capture = pacer_base + pts;     // live 的 source 在這個時候 capture
+
+            BitrateLevel level = adaptive ? bitrate.level() : BitrateLevel{ABR_QUALITY_MAX, 100, 1};
+            double scale = level.scale_percent / 100.0;
+            int64_t size = (int64_t)(frame_kb * 1024 * quality_factor(level.quality) * scale * scale);
+            link.push_back({capture, size, phase, level.quality});
+            phases[phase].bytes += size;
+            writing = true;
+            write_left = size;
+            write_start = now;
+            frame_index++;
+        }
+        int64_t room = std::max<int64_t>(0, unsent_limit - unsent);
+        int64_t written = std::min(room, write_left);
+        write_left -= written;
+        unsent += written;
+        if (write_left == 0) {
+            writing = false;
+            if (adaptive) bitrate.on_frame_sent(now - write_start, behind, now);
+        }
+    }
+
+    for (int i = 0; i < PHASES; i++) {
+        Phase& phase = phases[i];
+        double phase_seconds = seconds / (double)PHASES;
+        std::cout << std::left << std::setw(12) << (i == 0 ? name : "") << std::right
+                  << " link=" << std::setw(5) << (i == 1 ? link_mbps : link_mbps * 4) << "Mbps"
+                  << " fps=" << std::setw(5) << std::setprecision(1) << std::fixed << phase.frames / phase_seconds
+                  << " quality=" << std::setw(3) << (phase.frames ? phase.quality_sum / phase.frames : 0)
+                  << " sent=" << std::setw(6) << phase.bytes * 8 / phase_seconds / 1e6 << "Mbps"
+                  << " latency p50=" << std::setw(6) << percentile(phase.latency_us, 0.5) / 1000 << "ms"
+                  << " p99=" << std::setw(6) << percentile(phase.latency_us, 0.99) / 1000 << "ms" << std::endl;
+    }
+    if (adaptive) {
+        BitrateLevel lowest = bitrate.lowest();
+        std::cout << "adaptive downgrades=" << bitrate.downgrades() << " lowest: quality=" << lowest.quality
+                  << " scale=" << lowest.scale_percent << "% 1/" << lowest.frame_divisor << " frames" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " [seconds] [link_mbps] [frame_kb] [fps]\n";
+        return 1;
+    }
+
+    int seconds = (argc > 1) ? std::atoi(argv[1]) : 60;
+    double link_mbps = (argc > 2) ? std::atof(argv[2]) : 4;
+    int frame_kb = (argc > 3) ? std::atoi(argv[3]) : 60;
+    int fps = (argc > 4) ? std::atoi(argv[4]) : DEFAULT_VIDEO_FPS;
+    if (seconds < PHASES || link_mbps <= 0 || frame_kb < 1 || fps < 1) {
+        std::cerr << "seconds must be at least " << PHASES << ", link_mbps, frame_kb and fps must be positive\n";
+        return 1;
+    }
+
+    std::cout << "seconds=" << seconds << " frame=" << frame_kb << "KB fps=" << fps << std::endl;
+    run("fixed", seconds, link_mbps, frame_kb, fps, DEFAULT_SEND_BUFFER, false);
+    run("fixed+limit", seconds, link_mbps, frame_kb, fps, ABR_UNSENT_LIMIT, false);
+    run("adaptive", seconds, link_mbps, frame_kb, fps, ABR_UNSENT_LIMIT, true);
+    return 0;
+}
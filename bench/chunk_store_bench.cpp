@@ -0,0 +1,119 @@
+/* Relay dedup chunk store benchmark
+模擬 server 把同一個 <file_mb> MB 的檔案 relay 給 <rounds> 個 recipient：
+每一輪 sender 先算 manifest (每個 chunk 的 SHA-256)，server 查 ChunkStore，缺的 chunk 由 sender 上傳 (驗證 hash 後 put)，
+最後 server 從 store 讀出所有 chunk 送給 recipient。每一輪印出 sender 要上傳多少 MB，以及 hash / 查詢 / 上傳 / 讀出的 GB/s。
+<store_mb> 比檔案小時，同一次轉傳用到的 chunk 都被 pin 住不能淘汰，放不進 store 的部分每一輪都要重傳。store 放在 /tmp。
+
+Usage: ./bench/chunk_store_bench [file_mb] [store_mb] [rounds]
+*/
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <unistd.h>
+#include "../server/chunk_store.hpp"
+#include "../shared/checksum.hpp"
+
+static double seconds_since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " [file_mb] [store_mb] [rounds]\n";
+        return 1;
+    }
+
+    int file_mb = (argc > 1) ? std::atoi(argv[1]) : 512;
+    int store_mb = (argc > 2) ? std::atoi(argv[2]) : 1024;
+    int rounds = (argc > 3) ? std::atoi(argv[3]) : 4;
+    if (file_mb < 1 || store_mb < 1 || rounds < 1) {
+        std::cerr << "file_mb, store_mb and rounds must be positive\n";
+        return 1;
+    }
+
+    // rand_r 的低位元大約 64 MB 就重複一次，會讓 chunk 互相重複，所以用 mt19937_64
+    std::vector<char> file((size_t)file_mb * 1024 * 1024);
+    std::mt19937_64 random(1);
+    for (size_t i = 0; i + 8 <= file.size(); i += 8) {
+        uint64_t value = random();
+        memcpy(file.data() + i, &value, sizeof(value));
+    }
+    size_t count = (file.size() + CHUNK_STORE_SLOT_SIZE - 1) / CHUNK_STORE_SLOT_SIZE;
+
+    std::string dir = "/tmp/chunk_store_bench_" + std::to_string(getpid());
+    ChunkStore store;
+    if (!store.open(dir, (size_t)store_mb * 1024 * 1024)) return 1;
+
+    std::cout << "file=" << file_mb << "MB store=" << store_mb << "MB chunk=" << CHUNK_STORE_SLOT_SIZE / 1024
+              << "KB chunks=" << count << std::endl;
+
+    std::vector<unsigned char> manifest(count * CHUNK_HASH_SIZE);
+    std::vector<int> slots(count);
+    std::vector<char> chunk(CHUNK_STORE_SLOT_SIZE);
+    double gb = (double)file.size() / 1e9;
+    for (int round = 1; round <= rounds; round++) {
+        // sender：manifest
+        auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i++) {
+            size_t offset = i * CHUNK_STORE_SLOT_SIZE;
+            sha256(file.data() + offset, std::min<size_t>(CHUNK_STORE_SLOT_SIZE, file.size() - offset),
+                   manifest.data() + i * CHUNK_HASH_SIZE);
+        }
+        double hash_time = seconds_since(begin);
+
+        // server：查 store
+        begin = std::chrono::steady_clock::now();
+        std::vector<size_t> missing;
+        for (size_t i = 0; i < count; i++) {
+            slots[i] = store.acquire(manifest.data() + i * CHUNK_HASH_SIZE);
+            if (slots[i] < 0) missing.push_back(i);
+        }
+        double lookup_time = seconds_since(begin);
+
+        // sender 上傳缺的 chunk：server 驗證 hash、算 crc32c 後放進 store
+        begin = std::chrono::steady_clock::now();
+        size_t uploaded = 0;
+        for (size_t i : missing) {
+            size_t offset = i * CHUNK_STORE_SLOT_SIZE;
+            size_t len = std::min<size_t>(CHUNK_STORE_SLOT_SIZE, file.size() - offset);
+            unsigned char hash[CHUNK_HASH_SIZE];
+            sha256(file.data() + offset, len, hash);
+            slots[i] = store.put(hash, file.data() + offset, len, crc32c(file.data() + offset, len));
+            uploaded += len;
+        }
+        double upload_time = seconds_since(begin);
+
+        // server 從 store 讀出每個 chunk 送給 recipient
+        begin = std::chrono::steady_clock::now();
+        size_t served = 0, failed = 0;
+        for (size_t i = 0; i < count; i++) {
+            size_t len;
+            uint32_t crc;
+            if (slots[i] >= 0 && store.read(slots[i], chunk.data(), len, crc)) {
+                served += len;
+            } else {
+                failed++;
+            }
+            store.release(slots[i]);
+        }
+        double serve_time = seconds_since(begin);
+
+        std::cout << "round " << round << ": uploaded=" << uploaded / (1024.0 * 1024) << "MB"
+                  << " hash=" << gb / hash_time << "GB/s"
+                  << " lookup=" << lookup_time * 1e3 << "ms"
+                  << " upload=" << (uploaded ? uploaded / 1e9 / upload_time : 0) << "GB/s"
+                  << " serve=" << served / 1e9 / serve_time << "GB/s";
+        if (failed) std::cout << " (" << failed << " chunks not stored)";
+        std::cout << std::endl;
+    }
+
+    store.close();
+    unlink((dir + "/index.dat").c_str());
+    unlink((dir + "/chunks.dat").c_str());
+    rmdir(dir.c_str());
+    return 0;
+}
@@ -0,0 +1,135 @@
+/* Compression benchmark
+對幾種 <buffer_mb> MB 的資料，和傳檔案一樣每次處理一個 FILE_CHUNK_SIZE 的 chunk，量：
+- entropy 抽樣判斷要不要壓縮的速度
+- 用 <level> 壓縮 / 解壓縮的 MB/s 和壓縮率 (被判斷成不值得壓縮的 chunk 原樣算)
+資料：
+- text：像 log 一樣的文字 (時間、level、重複的訊息和一些數字)
+- records：固定格式的 binary record (很多欄位是 0 或很接近的數字)
+- random：亂數，代表已經壓縮過 (JPEG、zip …) 或加密過的檔案，應該整個被 entropy 擋掉
+
+Usage: ./bench/compress_bench [buffer_mb] [level]
+*/
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include "../shared/compress.hpp"
+#include "../shared/file_transfer.hpp"
+
+static double seconds_since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static std::vector<char> make_text(size_t size, std::mt19937_64& random) {
+    static const char* levels[] = {"INFO", "DEBUG", "WARN", "ERROR"};
+    static const char* messages[] = {"client joined", "file chunk received", "relay pipe opened",
+                                     "login succeeded", "out_queue drained", "handshake timeout"};
+    std::string text;
+    text.reserve(size + 256);
+    while (text.size() < size) {
+        text += "2024-05-" + std::to_string(10 + random() % 20) + " 12:" + std::to_string(10 + random() % 50) + ":" +
+                std::to_string(10 + random() % 50) + " [" + levels[random() % 4] + "] " + messages[random() % 6] +
+                " id=" + std::to_string(random() % 100000) + " bytes=" + std::to_string(random() % 1000000) + "\n";
+    }
+    text.resize(size);
+    return std::vector<char>(text.begin(), text.end());
+}
+
+static std::vector<char> make_records(size_t size, std::mt19937_64& random) {
+    struct Record {
+        uint64_t timestamp;
+        uint32_t client_id;
+        uint32_t msg_type;
+        uint64_t bytes;
+        uint32_t flags;
+        uint32_t reserved;
+    };
+    std::vector<char> data(size);
+    Record record{1700000000000ull, 0, 0, 0, 0, 0};
+    for (size_t offset = 0; offset + sizeof(Record) <= size; offset += sizeof(Record)) {
+        record.timestamp += random() % 1000;
+        record.client_id = random() % 64;
+        record.msg_type = random() % 20;
+        record.bytes = random() % 4096;
+        memcpy(data.data() + offset, &record, sizeof(record));
+    }
+    return data;
+}
+
+static std::vector<char> make_random(size_t size, std::mt19937_64& random) {
+    std::vector<char> data(size);
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        uint64_t value = random();
+        memcpy(data.data() + i, &value, sizeof(value));
+    }
+    return data;
+}
+
+static void run(const std::string& name, const std::vector<char>& data, int level) {
+    size_t count = (data.size() + FILE_CHUNK_SIZE - 1) / FILE_CHUNK_SIZE;
+    std::vector<std::vector<char>> compressed(count);
+    std::vector<char> restored(FILE_CHUNK_SIZE);
+
+    auto begin = std::chrono::steady_clock::now();
+    size_t skipped = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = i * FILE_CHUNK_SIZE;
+        if (!looks_compressible(data.data() + offset, std::min<size_t>(FILE_CHUNK_SIZE, data.size() - offset))) skipped++;
+    }
+    double entropy_time = seconds_since(begin);
+
+    // 和送檔案時一樣：entropy 太高或壓了沒有變小的 chunk 原樣送
+    set_compression_level(level);
+    begin = std::chrono::steady_clock::now();
+    size_t wire = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = i * FILE_CHUNK_SIZE;
+        size_t len = std::min<size_t>(FILE_CHUNK_SIZE, data.size() - offset);
+        wire += compress_payload(data.data() + offset, len, compressed[i]) ? compressed[i].size() : len;
+    }
+    double compress_time = seconds_since(begin);
+
+    begin = std::chrono::steady_clock::now();
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        if (compressed[i].empty()) continue;
+        size_t offset = i * FILE_CHUNK_SIZE;
+        size_t len = std::min<size_t>(FILE_CHUNK_SIZE, data.size() - offset);
+        ok = ok && decompress_payload(std::string_view(compressed[i].data(), compressed[i].size()), restored, FILE_CHUNK_SIZE) &&
+             restored.size() == len && memcmp(restored.data(), data.data() + offset, len) == 0;
+    }
+    double decompress_time = seconds_since(begin);
+
+    double mb = data.size() / 1e6;
+    std::cout << name << ": ratio=" << (double)data.size() / wire
+              << " entropy=" << mb / entropy_time << "MB/s"
+              << " compress=" << mb / compress_time << "MB/s"
+              << " decompress=" << mb / decompress_time << "MB/s"
+              << " skipped=" << skipped << "/" << count << " chunks"
+              << (ok ? "" : " ROUND TRIP FAILED") << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " [buffer_mb] [level]\n";
+        return 1;
+    }
+
+    int buffer_mb = (argc > 1) ? std::atoi(argv[1]) : 256;
+    int level = (argc > 2) ? std::atoi(argv[2]) : COMPRESS_LEVEL_DEFAULT;
+    if (buffer_mb < 1 || level < 1 || level > COMPRESS_LEVEL_MAX) {
+        std::cerr << "buffer_mb must be positive and level must be 1 - " << COMPRESS_LEVEL_MAX << "\n";
+        return 1;
+    }
+
+    std::mt19937_64 random(1);
+    size_t size = (size_t)buffer_mb * 1024 * 1024;
+    std::cout << "buffer=" << buffer_mb << "MB chunk=" << FILE_CHUNK_SIZE / 1024 << "KB level=" << level << std::endl;
+    run("text", make_text(size, random), level);
+    run("records", make_records(size, random), level);
+    run("random", make_random(size, random), level);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/* Delta sync benchmark
+產生一個 <file_mb> MB 的舊檔案，隨機做 <edits> 次小修改 (插入、刪除、覆寫幾十到幾千 bytes) 當成新檔案，量：
+- receiver 算舊檔案 block signature 的時間
+- sender 用 rolling checksum 找出相同範圍的時間 (MB/s)
+- 所有 chunk 編成 TRANSFER_DELTA / 一般 chunk 之後要送的 bytes，和整個檔案相比
+最後用 apply_delta_chunk 把每個 chunk 組回來，確認和新檔案一樣。
+另外量一次新舊檔案完全不同 (找不到任何相同 block) 時 rolling checksum 的速度，這是 sender 最慢的情況。
+
+Usage: ./bench/delta_bench [file_mb] [edits]
+*/
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include "../shared/delta.hpp"
+#include "../shared/checksum.hpp"
+#include "../shared/file_transfer.hpp"
+
+static double seconds_since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static void fill_random(std::vector<char>& data, std::mt19937_64& random) {
+    for (size_t i = 0; i + 8 <= data.size(); i += 8) {
+        uint64_t value = random();
+        memcpy(data.data() + i, &value, sizeof(value));
+    }
+}
+
+// 回傳 false 代表組回來的內容不對
+static bool run_case(const std::string& name, const std::vector<char>& old_file, const std::vector<char>& new_file) {
+    std::string path = "/tmp/delta_bench_" + std::to_string(getpid()) + ".bin";
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, old_file.data(), old_file.size()) != (ssize_t)old_file.size()) {
+        perror("write");
+        return false;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    DeltaSignatures signatures;
+    compute_signatures(fd, old_file.size(), signatures);
+    double signature_time = seconds_since(begin);
+
+    begin = std::chrono::steady_clock::now();
+    std::vector<DeltaCopy> copies = find_matches(new_file.data(), new_file.size(), signatures);
+    double match_time = seconds_since(begin);
+
+    // 每個 chunk 編成要送的 payload，再組回來比對
+    size_t wire_bytes = 0;
+    bool ok = true;
+    std::vector<char> payload, chunk;
+    for (uint64_t offset = 0; offset < new_file.size(); offset += FILE_CHUNK_SIZE) {
+        size_t len = std::min<uint64_t>(FILE_CHUNK_SIZE, new_file.size() - offset);
+        uint32_t crc = crc32c(new_file.data() + offset, len);
+        encode_delta_chunk(new_file.data(), offset, len, crc, copies.data(), copies.size(), payload);
+        wire_bytes += payload.size();
+
+        uint64_t decoded_offset;
+        uint32_t decoded_crc;
+        ok = ok && apply_delta_chunk(payload, fd, old_file.size(), chunk, decoded_offset, decoded_crc) &&
+             decoded_offset == offset && chunk.size() == len && memcmp(chunk.data(), new_file.data() + offset, len) == 0;
+    }
+    close(fd);
+    unlink(path.c_str());
+
+    std::cout << name << ": block=" << signatures.block_size << " blocks=" << signatures.blocks.size()
+              << " copies=" << copies.size()
+              << " signatures=" << signature_time * 1e3 << "ms"
+              << " match=" << new_file.size() / 1e6 / match_time << "MB/s"
+              << " wire=" << wire_bytes / 1024.0 << "KB (" << 100.0 * wire_bytes / new_file.size() << "% of file)"
+              << (ok ? "" : " RECONSTRUCTION FAILED") << std::endl;
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " [file_mb] [edits]\n";
+        return 1;
+    }
+
+    int file_mb = (argc > 1) ? std::atoi(argv[1]) : 256;
+    int edits = (argc > 2) ? std::atoi(argv[2]) : 100;
+    if (file_mb < 1 || edits < 0) {
+        std::cerr << "file_mb must be positive and edits must not be negative\n";
+        return 1;
+    }
+
+    std::mt19937_64 random(1);
+    std::vector<char> old_file((size_t)file_mb * 1024 * 1024);
+    fill_random(old_file, random);
+
+    // 小修改：插入、刪除或覆寫一段 16 ~ 4096 bytes
+    std::vector<char> new_file = old_file;
+    for (int i = 0; i < edits; i++) {
+        size_t pos = random() % new_file.size();
+        size_t len = 16 + random() % 4081;
+        std::vector<char> text(len);
+        fill_random(text, random);
+        switch (random() % 3) {
+            case 0:
+                new_file.insert(new_file.begin() + pos, text.begin(), text.end());
+                break;
+            case 1:
+                new_file.erase(new_file.begin() + pos, new_file.begin() + std::min(pos + len, new_file.size()));
+                break;
+            default:
+                memcpy(new_file.data() + pos, text.data(), std::min(len, new_file.size() - pos));
+        }
+    }
+
+    bool ok = run_case(std::to_string(edits) + " edits", old_file, new_file);
+
+    std::vector<char> unrelated(old_file.size());
+    fill_random(unrelated, random);
+    ok = run_case("unrelated file", old_file, unrelated) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+/* Video encode pipeline benchmark
+和 stream_video 一樣：capture (把一張 <width>x<height> 的畫面複製進 frame，代替讀影片檔) → JPEG imencode → send_frame，
+送到 TLS (socketpair) 的另一端由一個 thread 收掉，量每秒可以送出幾個 frame：
+- sequential：原本的寫法，三件事在同一個 thread 輪流做
+- pipeline：EncodePipeline 用 1, 2, 4 … <max_workers> 個 encoder thread
+要在專案的根目錄執行 (會讀 ./client/keys)。
+
+Usage: ./bench/encode_pipeline_bench [frames] [max_workers] [width] [height]
+*/
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <csignal>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <opencv2/opencv.hpp>
+#include "../shared/ssl.hpp"
+#include "../shared/streaming.hpp"
+#include "../shared/encode_pipeline.hpp"
+
+struct Pipe {
+    SSL* sender;
+    SSL* receiver;
+    int fds[2];
+    int received;
+};
+
+static SSL_CTX* server_ctx;
+static SSL_CTX* client_ctx;
+
+static void* accept_thread(void* arg) {
+    Pipe* pipe = static_cast<Pipe*>(arg);
+    SSL_accept(pipe->receiver);
+    return nullptr;
+}
+
+static bool open_pipe(Pipe& pipe) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pipe.fds) < 0) return false;
+    pipe.receiver = SSL_new(server_ctx);
+    SSL_set_fd(pipe.receiver, pipe.fds[0]);
+    pipe.sender = SSL_new(client_ctx);
+    SSL_set_fd(pipe.sender, pipe.fds[1]);
+    pipe.received = 0;
+
+    pthread_t thread;
+    pthread_create(&thread, nullptr, accept_thread, &pipe);
+    bool ok = SSL_connect(pipe.sender) == 1;
+    pthread_join(thread, nullptr);
+    return ok;
+}
+
+static void close_pipe(Pipe& pipe) {
+    SSL_free(pipe.sender);
+    SSL_free(pipe.receiver);
+    close(pipe.fds[0]);
+    close(pipe.fds[1]);
+}
+
+// 收到 EOF (空的 frame) 為止 (sequential 送的 frame 沒有 timestamp，開頭 8 bytes 會被當成 pts，不影響計數)
+static void* drain_thread(void* arg) {
+    Pipe* pipe = static_cast<Pipe*>(arg);
+    StreamFrame frame = StreamFrame::acquire();
+    while (receive_frame(pipe->receiver, frame) && !frame.eof()) pipe->received++;
+    return nullptr;
+}
+
+// 漸層加上一點雜訊，JPEG 壓起來的大小和速度接近真的影片
+static cv::Mat make_image(int width, int height) {
+    cv::Mat image(height, width, CV_8UC3);
+    unsigned int seed = 1;
+    for (int y = 0; y < height; y++) {
+        uchar* row = image.ptr<uchar>(y);
+        for (int x = 0; x < width; x++) {
+            row[x * 3] = (uchar)(x * 255 / width + rand_r(&seed) % 16);
+            row[x * 3 + 1] = (uchar)(y * 255 / height + rand_r(&seed) % 16);
+            row[x * 3 + 2] = (uchar)((x + y) % 256);
+        }
+    }
+    return image;
+}
+
+static void report(const std::string& name, int frames, int received, double seconds) {
+    std::cout << name << ": " << (received == frames ? "" : "FAILED ") << (int)(frames / seconds) << " frames/s" << std::endl;
+}
+
+static void run_sequential(const cv::Mat& image, int frames) {
+    Pipe pipe;
+    if (!open_pipe(pipe)) return;
+    pthread_t drain;
+    pthread_create(&drain, nullptr, drain_thread, &pipe);
+
+    auto begin = std::chrono::steady_clock::now();
+    cv::Mat frame;
+    for (int i = 0; i < frames; i++) {
+        image.copyTo(frame);
+        std::vector<uchar> buffer;
+        cv::imencode(".jpg", frame, buffer);
+        send_frame(pipe.sender, std::vector<char>(buffer.begin(), buffer.end()));
+    }
+    send_frame(pipe.sender, nullptr, 0);
+    pthread_join(drain, nullptr);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    report("sequential", frames, pipe.received, seconds);
+    close_pipe(pipe);
+}
+
+static void run_pipeline(const cv::Mat& image, int frames, int workers) {
+    Pipe pipe;
+    if (!open_pipe(pipe)) return;
+    pthread_t drain;
+    pthread_create(&drain, nullptr, drain_thread, &pipe);
+
+    auto begin = std::chrono::steady_clock::now();
+    {
+        EncodePipeline<cv::Mat> pipeline(workers,
+            [](const cv::Mat& frame, StreamFrame& encoded) {
+                return cv::imencode(".jpg", frame, encoded.data);
+            },
+            [&pipe](const StreamFrame& encoded) {
+                return send_frame(pipe.sender, encoded);
+            });
+        for (int i = 0; i < frames; i++) {
+            cv::Mat* frame = pipeline.next_input();
+            if (!frame) break;
+            image.copyTo(*frame);
+            pipeline.submit();
+        }
+        pipeline.finish();
+    }
+    send_frame(pipe.sender, StreamFrame());
+    pthread_join(drain, nullptr);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    report("pipeline workers=" + std::to_string(workers), frames, pipe.received, seconds);
+    close_pipe(pipe);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " [frames] [max_workers] [width] [height]\n";
+        return 1;
+    }
+
+    int frames = (argc > 1) ? std::atoi(argv[1]) : 600;
+    int max_workers = (argc > 2) ? std::atoi(argv[2]) : default_encode_workers();
+    int width = (argc > 3) ? std::atoi(argv[3]) : 1920;
+    int height = (argc > 4) ? std::atoi(argv[4]) : 1080;
+    if (frames < 1 || max_workers < 1 || max_workers > ENCODE_WORKERS_MAX || width < 1 || height < 1) {
+        std::cerr << "frames, width and height must be positive, max_workers must be between 1 and " << ENCODE_WORKERS_MAX << "\n";
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    init_openssl();
+    server_ctx = create_server_context("./client/keys/server.crt", "./client/keys/server.key");
+    client_ctx = create_client_context(nullptr);    // 不驗證憑證
+    if (!server_ctx || !client_ctx) return 1;
+
+    cv::Mat image = make_image(width, height);
+    std::cout << "frames=" << frames << " size=" << width << "x" << height << std::endl;
+    run_sequential(image, frames);
+    for (int workers = 1; workers <= max_workers; workers *= 2) {
+        run_pipeline(image, frames, workers);
+    }
+    return 0;
+}
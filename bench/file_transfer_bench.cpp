@@ -0,0 +1,208 @@
+/* Direct mode file transfer benchmark
+在 loopback 上用同一個 process 當 sender 和 receiver (receiver 的 listener 和 client 的 direct listener 一樣)，
+把一個 <size_mb> MB 的檔案分別用 send_file 和 1, 2, 4 ... <max_streams> 條 stream 的 send_file_parallel 傳過去，
+量從開始送到 receiver 收齊並改名為止的 GB/s。多條 stream 的加速要有多個 core 才看得出來。
+要在專案的根目錄執行 (會讀 ./client/keys)，暫存檔放在 /tmp。
+
+Usage: ./bench/file_transfer_bench [size_mb] [max_streams] [port]
+*/
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "../shared/ssl.hpp"
+#include "../shared/message.hpp"
+#include "../shared/protocol.hpp"
+#include "../shared/file_transfer.hpp"
+
+struct Connection {
+    SSL* ssl;
+    int fd;
+    std::string join;
+};
+
+static SSL_CTX* server_ctx;
+static SSL_CTX* client_ctx;
+static int listen_fd;
+static int port;
+
+static void free_connection(SSL* ssl, int fd) {
+    SSL_shutdown(ssl);
+    SSL_free(ssl);
+    close(fd);
+}
+
+static void* receiver_thread(void* arg) {
+    Connection* conn = static_cast<Connection*>(arg);
+    if (conn->join.empty()) {
+        recv_file(conn->ssl, true);
+    } else {
+        recv_file_stream(conn->ssl, conn->join);
+    }
+    free_connection(conn->ssl, conn->fd);
+    delete conn;
+    return nullptr;
+}
+
+// 和 client 的 direct listener 一樣：一次處理一條連線的握手和第一個 Message，傳檔案的連線交給自己的 thread
+static void* listener_thread(void*) {
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) break;
+
+        SSL* ssl = SSL_new(server_ctx);
+        SSL_set_fd(ssl, fd);
+        Message msg{};
+        if (SSL_accept(ssl) <= 0 || !read_message(ssl, msg) || msg.msg_type != DIRECT_SEND_FILE) {
+            free_connection(ssl, fd);
+            continue;
+        }
+
+        pthread_t thread;
+        pthread_create(&thread, nullptr, receiver_thread, new Connection{ssl, fd, msg.payload});
+        pthread_detach(thread);
+    }
+    return nullptr;
+}
+
+static SSL* connect_peer(int& fd) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    SSL* ssl = SSL_new(client_ctx);
+    SSL_set_fd(ssl, fd);
+    if (SSL_connect(ssl) != 1) {
+        free_connection(ssl, fd);
+        return nullptr;
+    }
+    return ssl;
+}
+
+// streams = 0 表示用單一連線的 send_file
+static void run_case(const std::string& path, const std::string& received, size_t size, int streams) {
+    unlink(received.c_str());
+    unlink((received + ".part").c_str());
+    unlink((received + ".part.map").c_str());
+
+    std::vector<SSL*> ssls;
+    std::vector<int> fds;
+    auto open_stream = [&]() -> SSL* {
+        int fd;
+        SSL* ssl = connect_peer(fd);
+        if (ssl) {
+            ssls.push_back(ssl);
+            fds.push_back(fd);
+        }
+        return ssl;
+    };
+
+    // 傳檔案時 send_file / recv_file 自己的輸出先關掉
+    std::streambuf* stdout_buf = std::cout.rdbuf(nullptr);
+    auto begin = std::chrono::steady_clock::now();
+
+    SSL* control = open_stream();
+    Message inform{};
+    inform.msg_type = DIRECT_SEND_FILE;
+    if (control && write_message(control, inform)) {
+        if (streams == 0) {
+            send_file(control, path, true);
+        } else {
+            send_file_parallel(control, path, streams, open_stream);
+        }
+    }
+
+    // 等 receiver 收齊 (.part 改名)
+    struct stat st;
+    while (stat(received.c_str(), &st) < 0 && std::chrono::steady_clock::now() - begin < std::chrono::seconds(60)) {
+        usleep(1000);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::cout.rdbuf(stdout_buf);
+
+    for (size_t i = 0; i < ssls.size(); i++) free_connection(ssls[i], fds[i]);
+
+    bool ok = stat(received.c_str(), &st) == 0 && (size_t)st.st_size == size;
+    std::cout << (streams == 0 ? "send_file" : "parallel streams=" + std::to_string(streams)) << ": "
+              << (ok ? "" : "FAILED ") << "time=" << elapsed << "s"
+              << " throughput=" << size / elapsed / 1e9 << "GB/s" << std::endl;
+    unlink(received.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " [size_mb] [max_streams] [port]\n";
+        return 1;
+    }
+
+    int size_mb = (argc > 1) ? std::atoi(argv[1]) : 1024;
+    int max_streams = (argc > 2) ? std::atoi(argv[2]) : 8;
+    port = (argc > 3) ? std::atoi(argv[3]) : 19400;
+    if (size_mb < 1 || max_streams < 1 || max_streams > MAX_FILE_STREAMS || port < 1) {
+        std::cerr << "size_mb and port must be positive, max_streams must be between 1 and " << MAX_FILE_STREAMS << "\n";
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    init_openssl();
+    server_ctx = create_server_context("./client/keys/server.crt", "./client/keys/server.key");
+    client_ctx = create_client_context(nullptr);    // 不驗證憑證
+    if (!server_ctx || !client_ctx) return 1;
+
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int opt = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+        perror("bind/listen");
+        return 1;
+    }
+    pthread_t listener;
+    pthread_create(&listener, nullptr, listener_thread, nullptr);
+
+    // 測試檔案 (recv_file 會寫到目前目錄的 recv_<檔名>，所以換到 /tmp)
+    if (chdir("/tmp") < 0) {
+        perror("chdir");
+        return 1;
+    }
+    std::string name = "file_transfer_bench_" + std::to_string(getpid()) + ".bin";
+    size_t size = (size_t)size_mb * 1024 * 1024;
+    {
+        std::ofstream file(name, std::ios::binary);
+        std::vector<char> block(1024 * 1024);
+        unsigned int seed = 1;
+        for (char& c : block) c = (char)rand_r(&seed);
+        for (int i = 0; i < size_mb; i++) file.write(block.data(), block.size());
+    }
+
+    run_case(name, "recv_" + name, size, 0);
+    for (int streams = 1; streams <= max_streams; streams *= 2) {
+        run_case(name, "recv_" + name, size, streams);
+    }
+
+    unlink(name.c_str());
+    shutdown(listen_fd, SHUT_RDWR);
+    close(listen_fd);
+    SSL_CTX_free(client_ctx);
+    SSL_CTX_free(server_ctx);
+    return 0;
+}
@@ -0,0 +1,275 @@
+/* Video frame path allocation benchmark
+模擬 client 的 video 路徑：encode → send_frame → TLS (socketpair) → receive_frame → StreamingQueue → display，
+每個 frame 的大小在 <frame_kb> 的 90% – 100% 之間變動 (和 JPEG 一樣)，量：
+- 穩定之後每個 frame 有幾次 heap allocation (operator new) 和幾 bytes
+- frames/sec
+old 是原本的寫法：imencode 進新的 vector<uchar>、再複製成 vector<char> 送出、receive_frame 每次配新的 vector、
+queue 的 push / pop 各複製一次；pooled 是 StreamFrame + FramePool。
+encode / decode 用 memcpy 代替，OpenCV codec 內部用的記憶體和 OpenSSL 的 malloc 不算在裡面。
+要在專案的根目錄執行 (會讀 ./client/keys)。
+
+Usage: ./bench/frame_pool_bench [frames] [frame_kb]
+*/
+#include <iostream>
+#include <vector>
+#include <queue>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "../shared/ssl.hpp"
+#include "../shared/streaming.hpp"
+
+#define WARMUP_FRAMES 32    // 前面這些 frame 讓 pool 和 TLS 的 buffer 長到夠大，不算
+
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> allocated_bytes{0};
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// 原本的 StreamingQueue
+class LockedQueue {
+public:
+    LockedQueue() {
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&cond, nullptr);
+    }
+
+    ~LockedQueue() {
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&cond);
+    }
+
+    void push(const std::vector<char>& frame) {
+        pthread_mutex_lock(&mutex);
+        queue.push(frame);
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    std::vector<char> pop() {
+        pthread_mutex_lock(&mutex);
+        while (queue.empty()) pthread_cond_wait(&cond, &mutex);
+        std::vector<char> frame = queue.front();
+        queue.pop();
+        pthread_mutex_unlock(&mutex);
+        return frame;
+    }
+
+private:
+    std::queue<std::vector<char>> queue;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+struct Pipe {
+    SSL* sender;
+    SSL* receiver;
+    int fds[2];
+};
+
+static SSL_CTX* server_ctx;
+static SSL_CTX* client_ctx;
+
+static void* accept_thread(void* arg) {
+    Pipe* pipe = static_cast<Pipe*>(arg);
+    SSL_accept(pipe->receiver);
+    return nullptr;
+}
+
+static bool open_pipe(Pipe& pipe) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pipe.fds) < 0) return false;
+    pipe.receiver = SSL_new(server_ctx);
+    SSL_set_fd(pipe.receiver, pipe.fds[0]);
+    pipe.sender = SSL_new(client_ctx);
+    SSL_set_fd(pipe.sender, pipe.fds[1]);
+
+    pthread_t thread;
+    pthread_create(&thread, nullptr, accept_thread, &pipe);
+    bool ok = SSL_connect(pipe.sender) == 1;
+    pthread_join(thread, nullptr);
+    return ok;
+}
+
+static void close_pipe(Pipe& pipe) {
+    SSL_free(pipe.sender);
+    SSL_free(pipe.receiver);
+    close(pipe.fds[0]);
+    close(pipe.fds[1]);
+}
+
+struct Source {
+    std::vector<unsigned char> image;   // 「encode」出來的內容從這裡複製
+    int frames;
+};
+
+static size_t frame_size(const Source& source, int i) {
+    size_t max = source.image.size();
+    return max - (size_t)(i * 2654435761u % 1000) * max / 10000;
+}
+
+/* ---------- old ---------- */
+
+struct OldArgs {
+    Pipe* pipe;
+    Source* source;
+    LockedQueue* queue;
+};
+
+static void* old_sender(void* arg) {
+    OldArgs* args = static_cast<OldArgs*>(arg);
+    for (int i = 0; i < args->source->frames; i++) {
+        std::vector<unsigned char> buffer(args->source->image.begin(), args->source->image.begin() + frame_size(*args->source, i));
+        send_frame(args->pipe->sender, std::vector<char>(buffer.begin(), buffer.end()));
+    }
+    send_frame(args->pipe->sender, std::vector<char>());
+    return nullptr;
+}
+
+static void* old_receiver(void* arg) {
+    OldArgs* args = static_cast<OldArgs*>(arg);
+    while (true) {
+        auto frame_data = receive_frame(args->pipe->receiver);
+        args->queue->push(frame_data);
+        if (frame_data.empty()) break;
+    }
+    return nullptr;
+}
+
+/* ---------- pooled ---------- */
+
+struct PooledArgs {
+    Pipe* pipe;
+    Source* source;
+    StreamingQueue* queue;
+};
+
+static void* pooled_sender(void* arg) {
+    PooledArgs* args = static_cast<PooledArgs*>(arg);
+    StreamFrame encoded = StreamFrame::acquire();
+    for (int i = 0; i < args->source->frames; i++) {
+        encoded.data.assign(args->source->image.begin(), args->source->image.begin() + frame_size(*args->source, i));
+        encoded.pts_us = i;
+        send_frame(args->pipe->sender, encoded);
+    }
+    send_frame(args->pipe->sender, StreamFrame());
+    return nullptr;
+}
+
+static void* pooled_receiver(void* arg) {
+    PooledArgs* args = static_cast<PooledArgs*>(arg);
+    enqueue_frame(*args->queue, args->pipe->receiver);
+    return nullptr;
+}
+
+static void report(const char* name, int frames, uint64_t count, uint64_t bytes, double seconds) {
+    int measured = frames - WARMUP_FRAMES;
+    std::cout << name << ": allocations/frame=" << (double)count / measured
+              << " bytes/frame=" << bytes / measured
+              << " frames/s=" << (uint64_t)(frames / seconds) << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " [frames] [frame_kb]\n";
+        return 1;
+    }
+
+    int frames = (argc > 1) ? std::atoi(argv[1]) : 5000;
+    int frame_kb = (argc > 2) ? std::atoi(argv[2]) : 100;
+    if (frames <= WARMUP_FRAMES || frame_kb < 1) {
+        std::cerr << "frames must be more than " << WARMUP_FRAMES << " and frame_kb must be positive\n";
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    init_openssl();
+    server_ctx = create_server_context("./client/keys/server.crt", "./client/keys/server.key");
+    client_ctx = create_client_context(nullptr);    // 不驗證憑證
+    if (!server_ctx || !client_ctx) return 1;
+
+    Source source;
+    source.image.resize((size_t)frame_kb * 1024);
+    for (size_t i = 0; i < source.image.size(); i++) source.image[i] = (unsigned char)(i * 131 + i / 7);
+    source.frames = frames;
+    std::vector<unsigned char> decoded(source.image.size());    // 「decode」的輸出，和 display 重複使用的 Mat 一樣
+
+    // enqueue_frame 收到 EOF 時會印訊息，先關掉
+    std::streambuf* stdout_buf = std::cout.rdbuf(nullptr);
+
+    Pipe pipe;
+    if (!open_pipe(pipe)) return 1;
+    LockedQueue old_queue;
+    OldArgs old_args{&pipe, &source, &old_queue};
+    auto begin = std::chrono::steady_clock::now();
+    pthread_t sender, receiver;
+    pthread_create(&sender, nullptr, old_sender, &old_args);
+    pthread_create(&receiver, nullptr, old_receiver, &old_args);
+    uint64_t start_count = 0, start_bytes = 0;
+    for (int i = 0;; i++) {
+        if (i == WARMUP_FRAMES) {
+            start_count = allocations.load();
+            start_bytes = allocated_bytes.load();
+        }
+        std::vector<char> frame = old_queue.pop();
+        if (frame.empty()) break;
+        memcpy(decoded.data(), frame.data(), frame.size());
+    }
+    uint64_t old_count = allocations.load() - start_count;
+    uint64_t old_bytes = allocated_bytes.load() - start_bytes;
+    pthread_join(sender, nullptr);
+    pthread_join(receiver, nullptr);
+    double old_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    close_pipe(pipe);
+
+    if (!open_pipe(pipe)) return 1;
+    StreamingQueue pooled_queue(STREAMING_QUEUE_CAPACITY, OverflowPolicy::Block);
+    PooledArgs pooled_args{&pipe, &source, &pooled_queue};
+    begin = std::chrono::steady_clock::now();
+    pthread_create(&sender, nullptr, pooled_sender, &pooled_args);
+    pthread_create(&receiver, nullptr, pooled_receiver, &pooled_args);
+    StreamFrame frame;
+    for (int i = 0;; i++) {
+        if (i == WARMUP_FRAMES) {
+            start_count = allocations.load();
+            start_bytes = allocated_bytes.load();
+        }
+        pooled_queue.pop(frame);
+        if (frame.eof()) break;
+        memcpy(decoded.data(), frame.data.data(), frame.data.size());
+    }
+    frame.release();
+    uint64_t pooled_count = allocations.load() - start_count;
+    uint64_t pooled_bytes = allocated_bytes.load() - start_bytes;
+    pthread_join(sender, nullptr);
+    pthread_join(receiver, nullptr);
+    double pooled_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    close_pipe(pipe);
+
+    std::cout.rdbuf(stdout_buf);
+    std::cout << "frames=" << frames << " frame=" << frame_kb << "KB (steady state, after " << WARMUP_FRAMES
+              << " frames)" << std::endl;
+    report("old", frames, old_count, old_bytes, old_time);
+    report("pooled", frames, pooled_count, pooled_bytes, pooled_time);
+    std::cout << "frame pool: " << FramePool::instance().allocated() << " buffers allocated, "
+              << FramePool::instance().reused() << " reused" << std::endl;
+    return 0;
+}
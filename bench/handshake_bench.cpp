@@ -0,0 +1,114 @@
+/* Handshakes-per-second benchmark
+多個 thread 不停地 connect + SSL_connect + close，量 server 每秒能完成幾次 TLS handshake。
+加上 <stalled> 個只連 TCP、永遠不送 ClientHello 的連線，可以看出慢 client 會不會卡住 accept。
+
+Usage: ./bench/handshake_bench <server_ip> <server_port> [threads] [seconds] [stalled]
+*/
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "../shared/ssl.hpp"
+
+struct BenchConfig {
+    std::string ip;
+    int port;
+    int seconds;
+    SSL_CTX* ctx;
+};
+
+static std::atomic<long> handshakes(0);
+static std::atomic<long> failures(0);
+static std::atomic<bool> running(true);
+
+static int tcp_connect(const BenchConfig& config) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    inet_pton(AF_INET, config.ip.c_str(), &addr.sin_addr);
+
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void* handshake_worker(void* arg) {
+    BenchConfig* config = static_cast<BenchConfig*>(arg);
+
+    while (running) {
+        int fd = tcp_connect(*config);
+        if (fd < 0) {
+            failures++;
+            continue;
+        }
+
+        SSL* ssl = SSL_new(config->ctx);
+        SSL_set_fd(ssl, fd);
+        if (SSL_connect(ssl) == 1) {
+            handshakes++;
+            SSL_shutdown(ssl);
+        } else {
+            failures++;
+        }
+        SSL_free(ssl);
+        close(fd);
+    }
+    return nullptr;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 6) {
+        std::cerr << "Usage: " << argv[0] << " <server_ip> <server_port> [threads] [seconds] [stalled]\n";
+        return 1;
+    }
+
+    BenchConfig config;
+    config.ip = argv[1];
+    config.port = std::atoi(argv[2]);
+    int thread_count = (argc > 3) ? std::atoi(argv[3]) : 8;
+    config.seconds = (argc > 4) ? std::atoi(argv[4]) : 5;
+    int stalled_count = (argc > 5) ? std::atoi(argv[5]) : 0;
+
+    init_openssl();
+    config.ctx = create_client_context(nullptr);    // 只量 handshake，不驗證憑證
+    if (!config.ctx) return 1;
+
+    // 先佔住幾個只連線、不握手的 socket
+    std::vector<int> stalled;
+    for (int i = 0; i < stalled_count; i++) {
+        int fd = tcp_connect(config);
+        if (fd >= 0) stalled.push_back(fd);
+    }
+
+    std::vector<pthread_t> threads(thread_count);
+    auto begin = std::chrono::steady_clock::now();
+    for (auto& t : threads) {
+        pthread_create(&t, nullptr, handshake_worker, &config);
+    }
+
+    sleep(config.seconds);
+    running = false;
+    for (auto& t : threads) {
+        pthread_join(t, nullptr);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    std::cout << "threads=" << thread_count << " stalled=" << stalled.size()
+              << " handshakes=" << handshakes << " failures=" << failures
+              << " handshakes/sec=" << handshakes / elapsed << std::endl;
+
+    for (int fd : stalled) close(fd);
+    SSL_CTX_free(config.ctx);
+    return 0;
+}
@@ -0,0 +1,187 @@
+/* Login storm benchmark
+<clients> 條連線不停地 LOGIN，同時另一條 probe 連線一直送 CHAT 給自己，量：
+- logins/sec：server 每秒完成幾次 login (每次都要驗證 PBKDF2)
+- probe 的 round-trip latency (p50 / p99)：login 在跑的時候，一般訊息會不會被拖慢
+probe 會先在沒有 login 的情況下量一次，當作比較的基準。
+
+Usage: ./bench/login_bench <server_ip> <server_port> [clients] [seconds]
+*/
+#include <iostream>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include "../shared/ssl.hpp"
+#include "../shared/message.hpp"
+#include "../shared/protocol.hpp"
+
+struct BenchConfig {
+    std::string ip;
+    int port;
+    SSL_CTX* ctx;
+};
+
+struct BenchClient {
+    int fd = -1;
+    SSL* ssl = nullptr;
+};
+
+static BenchConfig config;
+static std::atomic<bool> storming(false);
+static std::atomic<bool> running(true);
+static std::atomic<long> logins(0);
+static std::atomic<long> failures(0);
+
+static bool send_text(BenchClient& client, int msg_type, const std::string& text, int to_id = 0) {
+    Message msg{};
+    msg.msg_type = msg_type;
+    msg.to_id = to_id;
+    msg.payload_size = snprintf(msg.payload, MAX_PAYLOAD_SIZE, "%s", text.c_str());
+    return write_message(client.ssl, msg);
+}
+
+static bool connect_client(BenchClient& client) {
+    client.fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(config.port);
+    inet_pton(AF_INET, config.ip.c_str(), &addr.sin_addr);
+    if (connect(client.fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) return false;
+
+    client.ssl = SSL_new(config.ctx);
+    SSL_set_fd(client.ssl, client.fd);
+    return SSL_connect(client.ssl) == 1 && send_text(client, JOIN, "0");
+}
+
+static void close_client(BenchClient& client) {
+    if (client.ssl) {
+        SSL_shutdown(client.ssl);
+        SSL_free(client.ssl);
+    }
+    if (client.fd >= 0) close(client.fd);
+}
+
+// 註冊 (已經存在也沒關係) 然後登入一次，回傳 login 有沒有成功
+static bool register_and_login(BenchClient& client, const std::string& credentials) {
+    Message reply{};
+    if (!send_text(client, REGISTER, credentials) || !read_message(client.ssl, reply)) return false;
+    if (!send_text(client, LOGIN, credentials) || !read_message(client.ssl, reply)) return false;
+    return reply.msg_type == LOGIN;
+}
+
+static void* storm_thread(void* arg) {
+    long index = (long)arg;
+    std::string credentials = "storm_" + std::to_string(getpid()) + "_" + std::to_string(index) + " password";
+
+    BenchClient client;
+    if (!connect_client(client) || !register_and_login(client, credentials)) {
+        std::cerr << "storm client " << index << " failed to set up" << std::endl;
+        close_client(client);
+        return nullptr;
+    }
+
+    while (!storming && running) usleep(1000);
+    while (running) {
+        Message reply{};
+        if (!send_text(client, LOGIN, credentials) || !read_message(client.ssl, reply)) break;
+        if (reply.msg_type == LOGIN) {
+            logins++;
+        } else {
+            failures++;     // 例如 Server busy
+        }
+    }
+    close_client(client);
+    return nullptr;
+}
+
+// 送 CHAT 給自己，量 round trip，直到 seconds 秒過去
+static std::vector<double> probe_latency(BenchClient& probe, int probe_id, int seconds) {
+    std::vector<double> samples;
+    auto end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    while (std::chrono::steady_clock::now() < end) {
+        auto begin = std::chrono::steady_clock::now();
+        Message reply{};
+        if (!send_text(probe, CHAT, "ping", probe_id) || !read_message(probe.ssl, reply)) break;
+        samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+        usleep(1000);
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples;
+}
+
+static void print_latency(const char* label, const std::vector<double>& samples) {
+    if (samples.empty()) {
+        std::cout << label << ": no samples" << std::endl;
+        return;
+    }
+    std::cout << label << ": samples=" << samples.size()
+              << " p50=" << samples[samples.size() / 2] << "ms"
+              << " p99=" << samples[samples.size() * 99 / 100] << "ms" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " <server_ip> <server_port> [clients] [seconds]\n";
+        return 1;
+    }
+
+    config.ip = argv[1];
+    config.port = std::atoi(argv[2]);
+    int client_count = (argc > 3) ? std::atoi(argv[3]) : 64;
+    int seconds = (argc > 4) ? std::atoi(argv[4]) : 5;
+    if (config.port < 1 || client_count < 1 || seconds < 1) {
+        std::cerr << "port, clients and seconds must be positive\n";
+        return 1;
+    }
+
+    init_openssl();
+    config.ctx = create_client_context(nullptr);    // 不驗證憑證
+    if (!config.ctx) return 1;
+
+    // probe 登入之後用 REQUEST_PEER 找出自己的 ID
+    std::string probe_name = "probe_" + std::to_string(getpid());
+    BenchClient probe;
+    Message peers{};
+    if (!connect_client(probe) || !register_and_login(probe, probe_name + " password") ||
+        !send_text(probe, REQUEST_PEER, "") || !read_message(probe.ssl, peers)) {
+        std::cerr << "Failed to set up probe client" << std::endl;
+        return 1;
+    }
+    std::string peer_list(peers.payload, peers.payload_size);
+    size_t pos = peer_list.find(probe_name + " ID: ");
+    if (pos == std::string::npos) {
+        std::cerr << "Probe client is not in the peer list" << std::endl;
+        return 1;
+    }
+    int probe_id = std::atoi(peer_list.c_str() + pos + probe_name.size() + 5);
+
+    std::vector<pthread_t> threads(client_count);
+    for (long i = 0; i < client_count; i++) {
+        pthread_create(&threads[i], nullptr, storm_thread, (void*)i);
+    }
+
+    print_latency("idle  probe", probe_latency(probe, probe_id, 1));
+
+    storming = true;
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<double> storm_samples = probe_latency(probe, probe_id, seconds);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    long completed = logins;
+    running = false;
+
+    print_latency("storm probe", storm_samples);
+    std::cout << "clients=" << client_count << " logins=" << completed << " rejected=" << failures
+              << " logins/sec=" << completed / elapsed << std::endl;
+
+    for (auto& t : threads) pthread_join(t, nullptr);
+    close_client(probe);
+    SSL_CTX_free(config.ctx);
+    return 0;
+}
@@ -0,0 +1,114 @@
+/* Video playout benchmark
+模擬一個 <fps> 的 stream 經過網路送到 display (時間是算出來的，不用真的等)：
+每個 frame 在網路上要 20ms + 0~<jitter_ms> 的亂數延遲 (TCP 不會亂序，晚的會擋住後面的)，
+每 5 秒還會卡一次 <stall_ms>，比較 display 播出來的：
+- 相鄰兩個 frame 的間隔和原本間隔差多少 (p50 / p99，越小播放越順)
+- 從 capture 到播出的 p50 / p99 / max latency
+- 丟掉幾個 frame
+fixed 是原本的寫法：收到就播，每播一個 frame 之後 waitKey(30)；playout 是 PlayoutClock。
+
+Usage: ./bench/playout_bench [frames] [fps] [jitter_ms] [stall_ms]
+*/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstdlib>
+#include "../shared/playout.hpp"
+
+#define NETWORK_DELAY_MS 20
+#define STALL_EVERY_SECONDS 5
+#define FIXED_WAIT_MS 30            // 原本 display 每個 frame 之後的 cv::waitKey(30)
+
+static int64_t percentile(std::vector<int64_t>& values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+struct Result {
+    uint64_t dropped = 0;
+    std::vector<int64_t> interval_error_us;
+    std::vector<int64_t> latency_us;
+};
+
+static void print(const std::string& name, Result& result) {
+    std::cout << std::left << std::setw(10) << name << std::right
+              << " shown=" << std::setw(6) << result.latency_us.size()
+              << " dropped=" << std::setw(5) << result.dropped
+              << " interval_error p50=" << std::setw(4) << percentile(result.interval_error_us, 0.5) / 1000 << "ms"
+              << " p99=" << std::setw(4) << percentile(result.interval_error_us, 0.99) / 1000 << "ms"
+              << " latency p50=" << std::setw(4) << percentile(result.latency_us, 0.5) / 1000 << "ms"
+              << " p99=" << std::setw(4) << percentile(result.latency_us, 0.99) / 1000 << "ms"
+              << " max=" << std::setw(4) << percentile(result.latency_us, 1.0) / 1000 << "ms" << std::endl;
+}
+
+// 播出一個 frame：記下 latency，和上一個播出的 frame 比較間隔
+static void shown(Result& result, int64_t pts, int64_t when, int64_t& last_pts, int64_t& last_when) {
+    result.latency_us.push_back(when - pts);
+    if (last_when >= 0) result.interval_error_us.push_back(std::llabs((when - last_when) - (pts - last_pts)));
+    last_pts = pts;
+    last_when = when;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " [frames] [fps] [jitter_ms] [stall_ms]\n";
+        return 1;
+    }
+
+    int frames = (argc > 1) ? std::atoi(argv[1]) : 3000;
+    int fps = (argc > 2) ? std::atoi(argv[2]) : DEFAULT_VIDEO_FPS;
+    int jitter_ms = (argc > 3) ? std::atoi(argv[3]) : 40;
+    int stall_ms = (argc > 4) ? std::atoi(argv[4]) : 300;
+    if (frames < 2 || fps < 1 || jitter_ms < 0 || stall_ms < 0) {
+        std::cerr << "frames must be at least 2, fps must be positive, jitter_ms and stall_ms must not be negative\n";
+        return 1;
+    }
+
+    // capture 的時間就是 pts (sender 已經用 FramePacer 照 pts 送出)，算出每個 frame 到達 display 的時間
+    int64_t interval_us = 1000000 / fps;
+    std::vector<int64_t> arrival(frames);
+    unsigned int seed = 1;
+    int64_t last = 0;
+    for (int i = 0; i < frames; i++) {
+        int64_t pts = i * interval_us;
+        int64_t delay = NETWORK_DELAY_MS * 1000LL + (jitter_ms ? rand_r(&seed) % (jitter_ms * 1000) : 0);
+        if (i > 0 && i % (STALL_EVERY_SECONDS * fps) == 0) delay += stall_ms * 1000LL;
+        last = std::max(last, pts + delay);
+        arrival[i] = last;
+    }
+
+    std::cout << "frames=" << frames << " fps=" << fps << " jitter=" << jitter_ms << "ms stall=" << stall_ms
+              << "ms every " << STALL_EVERY_SECONDS << "s" << std::endl;
+
+    // 原本：收到就播，播完等 30ms 才拿下一個
+    Result fixed;
+    int64_t now = 0, last_pts = 0, last_when = -1;
+    for (int i = 0; i < frames; i++) {
+        now = std::max(now, arrival[i]);
+        shown(fixed, i * interval_us, now, last_pts, last_when);
+        now += FIXED_WAIT_MS * 1000LL;
+    }
+    print("fixed", fixed);
+
+    // PlayoutClock：太晚的丟掉，其他的等到預定的時間才播
+    Result playout;
+    PlayoutClock clock;
+    now = 0;
+    last_when = -1;
+    for (int i = 0; i < frames; i++) {
+        now = std::max(now, arrival[i]);
+        int64_t due = clock.due(i * interval_us, now);
+        if (due < 0) {
+            playout.dropped++;
+            continue;
+        }
+        now = std::max(now, due);
+        shown(playout, i * interval_us, now, last_pts, last_when);
+    }
+    print("playout", playout);
+    std::cout << "playout resyncs=" << clock.resyncs() << std::endl;
+    return 0;
+}
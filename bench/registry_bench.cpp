@@ -0,0 +1,159 @@
+/* Client registry contention benchmark
+<chatters> 個已登入的 client，1–64 個 thread 同時模擬 chat routing：
+- 大部分是用 to_id 找 recipient (CHAT / RELAY_SEND_FILE 的路徑)
+- 約 2% 是 login / logout (registry 的寫入)
+- 約 0.1% 是列出所有 online 的 client (REQUEST_PEER)
+GlobalRegistry 是原本「一個 std::map + 一個 mutex」的寫法，拿來當比較的基準。
+
+Usage: ./bench/registry_bench [chatters] [seconds]
+*/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <pthread.h>
+#include <unistd.h>
+#include "../server/client_registry.hpp"
+
+// 原本 client_handler.cpp 的寫法
+class GlobalRegistry {
+public:
+    int add(const std::shared_ptr<Connection>& conn, int listen_port) {
+        pthread_mutex_lock(&clients_mutex);
+        int client_id = next_client_id++;
+        clients[client_id] = {client_id, conn->ip, listen_port, true, conn, ""};
+        pthread_mutex_unlock(&clients_mutex);
+        return client_id;
+    }
+
+    void login(int client_id, const std::string& username) {
+        pthread_mutex_lock(&clients_mutex);
+        clients[client_id].username = username;
+        clients[client_id].online = true;
+        pthread_mutex_unlock(&clients_mutex);
+    }
+
+    void logout(int client_id) {
+        pthread_mutex_lock(&clients_mutex);
+        clients[client_id].username = "";
+        clients[client_id].online = false;
+        pthread_mutex_unlock(&clients_mutex);
+    }
+
+    std::shared_ptr<Connection> find_online(int client_id) {
+        std::shared_ptr<Connection> result;
+        pthread_mutex_lock(&clients_mutex);
+        auto it = clients.find(client_id);
+        if (it != clients.end() && it->second.online) result = it->second.conn;
+        pthread_mutex_unlock(&clients_mutex);
+        return result;
+    }
+
+    std::vector<ClientInfo> online_clients() {
+        std::vector<ClientInfo> result;
+        pthread_mutex_lock(&clients_mutex);
+        for (const auto& [id, info] : clients) {
+            if (info.online && info.username != "") result.push_back(info);
+        }
+        pthread_mutex_unlock(&clients_mutex);
+        return result;
+    }
+
+private:
+    std::map<int, ClientInfo> clients;
+    pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+    int next_client_id = 1;
+};
+
+static std::atomic<bool> running(false);
+
+template <typename Registry>
+struct ChatterArg {
+    Registry* registry;
+    std::vector<int>* ids;
+    unsigned seed;
+    long ops;
+};
+
+template <typename Registry>
+static void* chatter_thread(void* arg) {
+    ChatterArg<Registry>* chatter = static_cast<ChatterArg<Registry>*>(arg);
+    std::vector<int>& ids = *chatter->ids;
+    unsigned seed = chatter->seed;
+
+    while (!running) {}
+    while (running) {
+        int roll = rand_r(&seed) % 1000;
+        int client_id = ids[rand_r(&seed) % ids.size()];
+
+        if (roll == 0) {
+            chatter->registry->online_clients();
+        } else if (roll <= 10) {
+            chatter->registry->logout(client_id);
+        } else if (roll <= 20) {
+            chatter->registry->login(client_id, "user" + std::to_string(client_id));
+        } else {
+            chatter->registry->find_online(client_id);
+        }
+        chatter->ops++;
+    }
+    return nullptr;
+}
+
+template <typename Registry>
+static void run_case(const char* name, int thread_count, int chatter_count, int seconds) {
+    Registry registry;
+    std::vector<int> ids;
+    for (int i = 0; i < chatter_count; i++) {
+        // 只用來查詢，不會真的連線，所以 EventLoop / SSL 都是空的
+        auto conn = std::make_shared<Connection>(nullptr, nullptr, -1);
+        conn->ip = "127.0.0.1";
+        int client_id = registry.add(conn, 6000 + i);
+        registry.login(client_id, "user" + std::to_string(client_id));
+        ids.push_back(client_id);
+    }
+
+    std::vector<pthread_t> threads(thread_count);
+    std::vector<ChatterArg<Registry>> args(thread_count);
+    for (int i = 0; i < thread_count; i++) {
+        args[i] = {&registry, &ids, (unsigned)(i * 7919 + 1), 0};
+        pthread_create(&threads[i], nullptr, chatter_thread<Registry>, &args[i]);
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    running = true;
+    sleep(seconds);
+    running = false;
+    for (auto& t : threads) pthread_join(t, nullptr);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    long total = 0;
+    for (auto& arg : args) total += arg.ops;
+
+    std::cout << std::left << std::setw(8) << name
+              << " threads=" << std::setw(3) << thread_count
+              << " ops/sec=" << (long)(total / elapsed) << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " [chatters] [seconds]\n";
+        return 1;
+    }
+
+    int chatter_count = (argc > 1) ? std::atoi(argv[1]) : 4096;
+    int seconds = (argc > 2) ? std::atoi(argv[2]) : 1;
+    if (chatter_count < 1 || seconds < 1) {
+        std::cerr << "chatters and seconds must be positive\n";
+        return 1;
+    }
+
+    for (int threads : {1, 2, 4, 8, 16, 32, 64}) {
+        run_case<GlobalRegistry>("global", threads, chatter_count, seconds);
+        run_case<ClientRegistry>("sharded", threads, chatter_count, seconds);
+    }
+    return 0;
+}
@@ -0,0 +1,298 @@
+/* Relay throughput benchmark
+在 loopback 上分別用一般 TLS 和 kTLS 啟動 ./server_app (不開 chunk store)，一個 client 轉傳資料給另一個 client：
+- stream：用 RELAY_STREAMING 不停地送 <frame_kb> KB 的 frame
+- file：用 RELAY_SEND_FILE 一直傳 BENCH_FILE_SIZE 的檔案，chunk 是 FILE_CHUNK_SIZE (和 relay_send_file 一樣)
+量：
+- 收到的 GB/s
+- server process 每轉傳 1 GB 用掉多少 CPU 秒 (user + sys，從 /proc/<pid>/stat 讀)
+kTLS 模式下大的 frame / chunk 會用 splice 轉傳；kernel 沒有 tls module 時會退回一般的 TLS，兩組數字會差不多。
+(有 chunk store 時 server 要算每個 chunk 的 sha256，relay 傳檔案不會 splice。)
+要在專案的根目錄執行 (server_app 會讀 ./server/keys)。
+
+Usage: ./bench/relay_bench [frame_kb] [seconds] [port]
+*/
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include "../shared/ssl.hpp"
+#include "../shared/message.hpp"
+#include "../shared/protocol.hpp"
+#include "../shared/checksum.hpp"
+#include "../shared/file_transfer.hpp"
+
+#define BENCH_FILE_SIZE (64 * 1024 * 1024)
+
+struct BenchClient {
+    int fd = -1;
+    SSL* ssl = nullptr;
+};
+
+struct SenderArg {
+    BenchClient* client;
+    size_t frame_size;
+    int receiver_id;
+    std::atomic<bool>* running;
+};
+
+static SSL_CTX* ctx;
+static int port;
+
+static bool send_text(BenchClient& client, int msg_type, const std::string& text, int to_id = 0) {
+    Message msg{};
+    msg.msg_type = msg_type;
+    msg.to_id = to_id;
+    msg.payload_size = snprintf(msg.payload, MAX_PAYLOAD_SIZE, "%s", text.c_str());
+    return write_message(client.ssl, msg);
+}
+
+static bool connect_client(BenchClient& client, const std::string& username) {
+    client.fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(client.fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) return false;
+
+    client.ssl = SSL_new(ctx);
+    SSL_set_fd(client.ssl, client.fd);
+    if (SSL_connect(client.ssl) != 1 || !send_text(client, JOIN, "0")) return false;
+
+    // 註冊 (已經存在也沒關係) 再登入
+    Message reply{};
+    std::string credentials = username + " password";
+    if (!send_text(client, REGISTER, credentials) || !read_message(client.ssl, reply)) return false;
+    if (!send_text(client, LOGIN, credentials) || !read_message(client.ssl, reply)) return false;
+    return reply.msg_type == LOGIN;
+}
+
+static void close_client(BenchClient& client) {
+    if (client.ssl) {
+        SSL_shutdown(client.ssl);
+        SSL_free(client.ssl);
+    }
+    if (client.fd >= 0) close(client.fd);
+    client = BenchClient();
+}
+
+// 從 REQUEST_PEER 的回覆找出 username 的 ID
+static int find_client_id(BenchClient& client, const std::string& username) {
+    Message peers{};
+    if (!send_text(client, REQUEST_PEER, "") || !read_message(client.ssl, peers)) return -1;
+    std::string list(peers.payload, peers.payload_size);
+    size_t pos = list.find(username + " ID: ");
+    if (pos == std::string::npos) return -1;
+    return std::atoi(list.c_str() + pos + username.size() + 5);
+}
+
+// process 到目前為止用掉的 CPU 秒數 (utime + stime)
+static double process_cpu_seconds(pid_t pid) {
+    std::ifstream file("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    std::getline(file, stat);
+    size_t end = stat.rfind(')');
+    if (end == std::string::npos) return 0;
+
+    std::istringstream fields(stat.substr(end + 2));
+    std::string field;
+    unsigned long utime = 0, stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; i++) {
+        if (i == 14) utime = std::stoul(field);
+        if (i == 15) stime = std::stoul(field);
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+static void* sender_thread(void* arg) {
+    SenderArg* sender = static_cast<SenderArg*>(arg);
+    std::vector<char> frame(sizeof(uint32_t) + sender->frame_size, 'x');
+    uint32_t size_network = htonl(sender->frame_size);
+    memcpy(frame.data(), &size_network, sizeof(size_network));
+
+    while (*sender->running) {
+        if (!ssl_write_all(sender->client->ssl, frame.data(), frame.size())) break;
+    }
+    uint32_t eof = 0;
+    ssl_write_all(sender->client->ssl, &eof, sizeof(eof));
+    return nullptr;
+}
+
+/* 和 send_file_dedup 一樣：通知、metadata、manifest，等 server 回覆之後送全部的 chunk 和 trailer
+內容都一樣，manifest 全部是 0 (server 沒有 chunk store，不會檢查) */
+static bool send_bench_file(SSL* ssl, int receiver_id, const std::vector<char>& chunk, uint32_t crc) {
+    Message inform{};
+    inform.msg_type = RELAY_SEND_FILE;
+    inform.to_id = receiver_id;
+    if (!write_message(ssl, inform)) return false;
+
+    size_t count = BENCH_FILE_SIZE / FILE_CHUNK_SIZE;
+    Message metadata{};
+    metadata.msg_type = TRANSFER_FILE_CONTENT;
+    metadata.payload_size = snprintf(metadata.payload, MAX_PAYLOAD_SIZE, "relay_bench %d %d %016llx 1",
+                                     BENCH_FILE_SIZE, FILE_CHUNK_SIZE, 0ULL);
+    std::vector<char> manifest(count * CHUNK_HASH_SIZE, 0);
+    if (!write_message(ssl, metadata) || !write_chunk(ssl, TRANSFER_MANIFEST, manifest.data(), manifest.size())) {
+        return false;
+    }
+
+    WireHeader header;
+    std::vector<char> reply;
+    if (!read_chunk(ssl, header, reply) || header.msg_type != TRANSFER_RESUME) return false;
+
+    for (size_t i = 0; i < count; i++) {
+        if (!write_file_chunk(ssl, (uint64_t)i * FILE_CHUNK_SIZE, chunk.data(), chunk.size(), crc)) return false;
+    }
+    return write_file_digest(ssl, BENCH_FILE_SIZE, 0);
+}
+
+static void* file_sender_thread(void* arg) {
+    SenderArg* sender = static_cast<SenderArg*>(arg);
+    std::vector<char> chunk(FILE_CHUNK_SIZE, 'x');
+    uint32_t crc = crc32c(chunk.data(), chunk.size());
+
+    while (*sender->running) {
+        if (!send_bench_file(sender->client->ssl, sender->receiver_id, chunk, crc)) break;
+    }
+    // 告訴 receiver 最後一個檔案送完了
+    send_text(*sender->client, CHAT, "done", sender->receiver_id);
+    return nullptr;
+}
+
+// 收 relay 傳過來的檔案，直到 sender 送來 CHAT；回傳收到的檔案內容 bytes
+static size_t receive_files(SSL* ssl, std::atomic<bool>& running, std::chrono::steady_clock::time_point deadline) {
+    WireHeader header;
+    std::vector<char> payload;
+    size_t received = 0;
+    bool metadata_next = false;
+    while (read_chunk(ssl, header, payload) && header.msg_type != CHAT) {
+        if (header.msg_type == RELAY_SEND_FILE) {
+            metadata_next = true;
+        } else if (header.msg_type == TRANSFER_FILE_CONTENT) {
+            if (!metadata_next && payload.size() > FILE_CHUNK_HEADER_SIZE) received += payload.size() - FILE_CHUNK_HEADER_SIZE;
+            metadata_next = false;
+        }
+        if (running && std::chrono::steady_clock::now() >= deadline) running = false;
+    }
+    return received;
+}
+
+// stream：收 [4 bytes 長度][frame]，直到長度 0 的 EOF frame
+static size_t receive_frames(SSL* ssl, std::atomic<bool>& running, std::chrono::steady_clock::time_point deadline) {
+    std::vector<char> frame(64 * 1024);
+    size_t received = 0;
+    while (true) {
+        uint32_t size_network;
+        if (!ssl_read_all(ssl, &size_network, sizeof(size_network))) break;
+        uint32_t size = ntohl(size_network);
+        if (size == 0) break;
+        if (size > frame.size()) frame.resize(size);
+        if (!ssl_read_all(ssl, frame.data(), size)) break;
+        received += size;
+        if (running && std::chrono::steady_clock::now() >= deadline) running = false;
+    }
+    return received;
+}
+
+static pid_t start_server(bool ktls) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::string port_arg = std::to_string(port);
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        execl("./server_app", "server_app", port_arg.c_str(), "128", "2", "1", ktls ? "1" : "0", "0", (char*)nullptr);
+        perror("execl ./server_app");
+        _exit(1);
+    }
+    return pid;
+}
+
+static void run_case(bool ktls, bool file, size_t frame_size, int seconds) {
+    std::string name = std::string(file ? "file " : "stream ") + (ktls ? "ktls" : "tls");
+    pid_t server = start_server(ktls);
+
+    std::string tag = std::to_string(getpid()) + (file ? "_file" : "_stream") + (ktls ? "_ktls" : "_tls");
+    BenchClient sender, receiver;
+    bool connected = false;
+    for (int attempt = 0; attempt < 50 && !connected; attempt++) {
+        usleep(100000);     // 等 server 起來
+        close_client(receiver);
+        connected = connect_client(receiver, "relay_rx_" + tag);
+    }
+    int receiver_id = connected ? find_client_id(receiver, "relay_rx_" + tag) : -1;
+    if (receiver_id < 0 || !connect_client(sender, "relay_tx_" + tag)) {
+        std::cerr << name << ": failed to set up clients" << std::endl;
+        kill(server, SIGTERM);
+        waitpid(server, nullptr, 0);
+        return;
+    }
+
+    // stream：receiver 先收到 RELAY_STREAMING 的通知，接著就是 [4 bytes 長度][frame]
+    Message notify{};
+    if (!file && (!send_text(sender, RELAY_STREAMING, "", receiver_id) || !read_message(receiver.ssl, notify))) {
+        std::cerr << name << ": failed to open relay" << std::endl;
+    }
+
+    std::atomic<bool> running(true);
+    SenderArg arg{&sender, frame_size, receiver_id, &running};
+    pthread_t thread;
+    double cpu_begin = process_cpu_seconds(server);
+    auto begin = std::chrono::steady_clock::now();
+    pthread_create(&thread, nullptr, file ? file_sender_thread : sender_thread, &arg);
+
+    auto deadline = begin + std::chrono::seconds(seconds);
+    size_t received = file ? receive_files(receiver.ssl, running, deadline) : receive_frames(receiver.ssl, running, deadline);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    double cpu = process_cpu_seconds(server) - cpu_begin;
+    pthread_join(thread, nullptr);
+
+    double gb = received / 1e9;
+    std::cout << name << ": frame=" << (file ? FILE_CHUNK_SIZE : frame_size) / 1024 << "KB"
+              << " relayed=" << gb << "GB"
+              << " throughput=" << gb / elapsed << "GB/s"
+              << " server_cpu=" << (gb > 0 ? cpu / gb : 0) << "s/GB" << std::endl;
+
+    close_client(sender);
+    close_client(receiver);
+    kill(server, SIGTERM);
+    waitpid(server, nullptr, 0);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " [frame_kb] [seconds] [port]\n";
+        return 1;
+    }
+
+    int frame_kb = (argc > 1) ? std::atoi(argv[1]) : 1024;
+    int seconds = (argc > 2) ? std::atoi(argv[2]) : 5;
+    port = (argc > 3) ? std::atoi(argv[3]) : 19300;
+    if (frame_kb < 1 || seconds < 1 || port < 1) {
+        std::cerr << "frame_kb, seconds and port must be positive\n";
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    init_openssl();
+    ctx = create_client_context(nullptr);   // 不驗證憑證
+    if (!ctx) return 1;
+
+    for (bool file : {false, true}) {
+        run_case(false, file, (size_t)frame_kb * 1024, seconds);
+        run_case(true, file, (size_t)frame_kb * 1024, seconds);
+    }
+
+    SSL_CTX_free(ctx);
+    return 0;
+}
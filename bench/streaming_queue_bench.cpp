@@ -0,0 +1,293 @@
+/* StreamingQueue benchmark
+1. throughput：一個 thread 一直 push <frame_kb> KB 的 frame、另一個一直 pop，量 frames/sec
+2. slow display：frame 以 <producer_fps> 進來，display 只有 <consumer_fps>，跑 <seconds> 秒，量
+   - 最多排了幾個 frame / 幾 MB
+   - 從 push 到 display 拿到的 p50 / p99 latency
+   - 丟掉幾個 frame
+LockedQueue 是原本「std::queue + mutex，push / pop 各複製一次」的寫法 (沒有上限)，拿來當比較的基準。
+
+Usage: ./bench/streaming_queue_bench [seconds] [frame_kb] [producer_fps] [consumer_fps]
+*/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <queue>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include "../shared/streaming_queue.hpp"
+
+// 原本的 StreamingQueue
+class LockedQueue {
+public:
+    LockedQueue() {
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&cond, nullptr);
+    }
+
+    ~LockedQueue() {
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&cond);
+    }
+
+    void push(const std::vector<char>& frame) {
+        pthread_mutex_lock(&mutex);
+        queue.push(frame);
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    std::vector<char> pop() {
+        pthread_mutex_lock(&mutex);
+        while (queue.empty()) pthread_cond_wait(&cond, &mutex);
+        std::vector<char> frame = queue.front();
+        queue.pop();
+        pthread_mutex_unlock(&mutex);
+        return frame;
+    }
+
+    size_t size() {
+        pthread_mutex_lock(&mutex);
+        size_t count = queue.size();
+        pthread_mutex_unlock(&mutex);
+        return count;
+    }
+
+private:
+    std::queue<std::vector<char>> queue;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// frame 開頭放 push 的時間，display 拿到時算 latency
+static std::vector<char> make_frame(size_t size) {
+    std::vector<char> frame(size, 'x');
+    int64_t stamp = now_us();
+    memcpy(frame.data(), &stamp, sizeof(stamp));
+    return frame;
+}
+
+static StreamFrame make_stream_frame(size_t size) {
+    StreamFrame frame = StreamFrame::acquire();
+    frame.data.assign(size, 'x');
+    int64_t stamp = now_us();
+    memcpy(frame.data.data(), &stamp, sizeof(stamp));
+    return frame;
+}
+
+template <typename Bytes>
+static int64_t frame_age(const Bytes& frame) {
+    int64_t stamp;
+    memcpy(&stamp, frame.data(), sizeof(stamp));
+    return now_us() - stamp;
+}
+
+static void sleep_until(Clock::time_point when) {
+    auto left = when - Clock::now();
+    if (left > Clock::duration::zero()) {
+        usleep(std::chrono::duration_cast<std::chrono::microseconds>(left).count());
+    }
+}
+
+static int64_t percentile(std::vector<int64_t>& values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+struct Result {
+    uint64_t frames = 0;
+    uint64_t dropped = 0;
+    size_t max_queued = 0;
+    std::vector<int64_t> latency_us;
+};
+
+static void print(const std::string& name, Result& result, size_t frame_size) {
+    std::cout << std::left << std::setw(16) << name << std::right
+              << " shown=" << std::setw(6) << result.frames
+              << " dropped=" << std::setw(6) << result.dropped
+              << " max_queued=" << std::setw(6) << result.max_queued
+              << " (" << std::fixed << std::setprecision(1) << result.max_queued * frame_size / 1e6 << " MB)"
+              << " p50=" << percentile(result.latency_us, 0.5) / 1000 << "ms"
+              << " p99=" << percentile(result.latency_us, 0.99) / 1000 << "ms" << std::endl;
+}
+
+/* ---------- throughput ---------- */
+
+struct ThroughputArgs {
+    void* queue;
+    size_t frame_size;
+    int frames;
+};
+
+static void* locked_producer(void* arg) {
+    ThroughputArgs* args = static_cast<ThroughputArgs*>(arg);
+    LockedQueue* queue = static_cast<LockedQueue*>(args->queue);
+    for (int i = 0; i < args->frames; i++) queue->push(make_frame(args->frame_size));
+    return nullptr;
+}
+
+static void* ring_producer(void* arg) {
+    ThroughputArgs* args = static_cast<ThroughputArgs*>(arg);
+    StreamingQueue* queue = static_cast<StreamingQueue*>(args->queue);
+    for (int i = 0; i < args->frames; i++) queue->push(make_stream_frame(args->frame_size));
+    return nullptr;
+}
+
+static void throughput(size_t frame_size) {
+    int frames = std::max(1000, (int)(4096 * 1024 / frame_size) * 64);
+
+    LockedQueue locked;
+    ThroughputArgs locked_args{&locked, frame_size, frames};
+    auto begin = Clock::now();
+    pthread_t producer;
+    pthread_create(&producer, nullptr, locked_producer, &locked_args);
+    for (int i = 0; i < frames; i++) locked.pop();
+    pthread_join(producer, nullptr);
+    double locked_time = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    StreamingQueue ring(STREAMING_QUEUE_CAPACITY, OverflowPolicy::Block);
+    ThroughputArgs ring_args{&ring, frame_size, frames};
+    begin = Clock::now();
+    pthread_create(&producer, nullptr, ring_producer, &ring_args);
+    StreamFrame frame;
+    for (int i = 0; i < frames; i++) ring.pop(frame);
+    pthread_join(producer, nullptr);
+    double ring_time = std::chrono::duration<double>(Clock::now() - begin).count();
+
+    std::cout << "throughput (" << frames << " frames): locked=" << (uint64_t)(frames / locked_time)
+              << " frames/s, ring=" << (uint64_t)(frames / ring_time) << " frames/s" << std::endl;
+}
+
+/* ---------- slow display ---------- */
+
+struct PacedArgs {
+    void* queue;
+    size_t frame_size;
+    int fps;
+    double seconds;
+    std::atomic<bool> done{false};
+};
+
+static void* locked_paced_producer(void* arg) {
+    PacedArgs* args = static_cast<PacedArgs*>(arg);
+    LockedQueue* queue = static_cast<LockedQueue*>(args->queue);
+    auto begin = Clock::now();
+    int total = (int)(args->fps * args->seconds);
+    for (int i = 0; i < total; i++) {
+        sleep_until(begin + std::chrono::microseconds((int64_t)i * 1000000 / args->fps));
+        queue->push(make_frame(args->frame_size));
+    }
+    queue->push(std::vector<char>());
+    args->done = true;
+    return nullptr;
+}
+
+static void* ring_paced_producer(void* arg) {
+    PacedArgs* args = static_cast<PacedArgs*>(arg);
+    StreamingQueue* queue = static_cast<StreamingQueue*>(args->queue);
+    auto begin = Clock::now();
+    int total = (int)(args->fps * args->seconds);
+    for (int i = 0; i < total; i++) {
+        sleep_until(begin + std::chrono::microseconds((int64_t)i * 1000000 / args->fps));
+        queue->push(make_stream_frame(args->frame_size));
+    }
+    queue->push(StreamFrame());
+    args->done = true;
+    return nullptr;
+}
+
+// display 在看完 seconds 秒後就關掉 (和使用者關掉視窗一樣)，還沒播的 frame 不算
+static Result slow_locked(size_t frame_size, int producer_fps, int consumer_fps, double seconds) {
+    LockedQueue queue;
+    PacedArgs args;
+    args.queue = &queue;
+    args.frame_size = frame_size;
+    args.fps = producer_fps;
+    args.seconds = seconds;
+    pthread_t producer;
+    pthread_create(&producer, nullptr, locked_paced_producer, &args);
+
+    Result result;
+    auto begin = Clock::now();
+    while (Clock::now() - begin < std::chrono::duration<double>(seconds)) {
+        result.max_queued = std::max(result.max_queued, queue.size());
+        std::vector<char> frame = queue.pop();
+        if (frame.empty()) break;
+        result.latency_us.push_back(frame_age(frame));
+        result.frames++;
+        sleep_until(begin + std::chrono::microseconds((int64_t)result.frames * 1000000 / consumer_fps));
+    }
+    pthread_join(producer, nullptr);
+    return result;
+}
+
+static Result slow_ring(OverflowPolicy policy, size_t frame_size, int producer_fps, int consumer_fps, double seconds) {
+    StreamingQueue queue(STREAMING_QUEUE_CAPACITY, policy);
+    PacedArgs args;
+    args.queue = &queue;
+    args.frame_size = frame_size;
+    args.fps = producer_fps;
+    args.seconds = seconds;
+    pthread_t producer;
+    pthread_create(&producer, nullptr, ring_paced_producer, &args);
+
+    Result result;
+    auto begin = Clock::now();
+    StreamFrame frame;
+    while (Clock::now() - begin < std::chrono::duration<double>(seconds)) {
+        result.max_queued = std::max(result.max_queued, queue.stats().occupancy);
+        if (!queue.pop(frame, STREAMING_QUEUE_WAIT_MS)) continue;
+        if (frame.eof()) break;
+        result.latency_us.push_back(frame_age(frame.data));
+        result.frames++;
+        sleep_until(begin + std::chrono::microseconds((int64_t)result.frames * 1000000 / consumer_fps));
+    }
+    // Block 時 producer 可能還在等空位：把剩下的拿掉讓它結束
+    while (!args.done) queue.pop(frame, STREAMING_QUEUE_WAIT_MS);
+    pthread_join(producer, nullptr);
+    result.dropped = queue.stats().dropped;
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " [seconds] [frame_kb] [producer_fps] [consumer_fps]\n";
+        return 1;
+    }
+
+    double seconds = (argc > 1) ? std::atof(argv[1]) : 5;
+    int frame_kb = (argc > 2) ? std::atoi(argv[2]) : 64;
+    int producer_fps = (argc > 3) ? std::atoi(argv[3]) : 60;
+    int consumer_fps = (argc > 4) ? std::atoi(argv[4]) : 30;
+    if (seconds <= 0 || frame_kb < 1 || producer_fps < 1 || consumer_fps < 1) {
+        std::cerr << "all arguments must be positive\n";
+        return 1;
+    }
+    size_t frame_size = (size_t)frame_kb * 1024;
+
+    std::cout << "frame=" << frame_kb << "KB capacity=" << STREAMING_QUEUE_CAPACITY << std::endl;
+    throughput(frame_size);
+
+    std::cout << "slow display: " << producer_fps << " fps in, " << consumer_fps << " fps shown, " << seconds << " s" << std::endl;
+    Result locked = slow_locked(frame_size, producer_fps, consumer_fps, seconds);
+    print("locked", locked, frame_size);
+    Result block = slow_ring(OverflowPolicy::Block, frame_size, producer_fps, consumer_fps, seconds);
+    print("block", block, frame_size);
+    Result oldest = slow_ring(OverflowPolicy::DropOldest, frame_size, producer_fps, consumer_fps, seconds);
+    print("drop_oldest", oldest, frame_size);
+    Result keyframe = slow_ring(OverflowPolicy::DropToKeyframe, frame_size, producer_fps, consumer_fps, seconds);
+    print("drop_to_keyframe", keyframe, frame_size);
+    return 0;
+}
@@ -0,0 +1,172 @@
+/* ThreadPool dispatch benchmark
+<producers> 個 thread (模擬 EventLoop) 一直 add_task 空的 task，量：
+- tasks/sec：全部 task 跑完需要多久
+- p99 dispatch latency：從 add_task 到 task 開始執行的時間
+LockedPool 是原本「一個 std::queue + 一個 mutex + 一個 condvar」的寫法，拿來當比較的基準。
+
+Usage: ./bench/threadpool_bench [tasks] [producers]
+*/
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <queue>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+#include <pthread.h>
+#include <unistd.h>
+#include "../server/threadpool.hpp"
+
+// 原本的 ThreadPool
+class LockedPool {
+public:
+    LockedPool(int worker_count) : workers(worker_count), stop_flag(false) {
+        pthread_mutex_init(&queue_mutex, nullptr);
+        pthread_cond_init(&condition, nullptr);
+    }
+
+    ~LockedPool() {
+        pthread_mutex_destroy(&queue_mutex);
+        pthread_cond_destroy(&condition);
+    }
+
+    void start() {
+        for (auto& worker : workers) pthread_create(&worker, nullptr, worker_thread, this);
+    }
+
+    void stop() {
+        pthread_mutex_lock(&queue_mutex);
+        stop_flag = true;
+        pthread_cond_broadcast(&condition);
+        pthread_mutex_unlock(&queue_mutex);
+        for (auto& worker : workers) pthread_join(worker, nullptr);
+    }
+
+    void add_task(const std::function<void()>& task) {
+        pthread_mutex_lock(&queue_mutex);
+        task_queue.push(task);
+        pthread_cond_signal(&condition);
+        pthread_mutex_unlock(&queue_mutex);
+    }
+
+private:
+    std::vector<pthread_t> workers;
+    std::queue<std::function<void()>> task_queue;
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t condition;
+    bool stop_flag;
+
+    static void* worker_thread(void* arg) {
+        LockedPool* pool = static_cast<LockedPool*>(arg);
+        while (true) {
+            pthread_mutex_lock(&pool->queue_mutex);
+            while (pool->task_queue.empty() && !pool->stop_flag) {
+                pthread_cond_wait(&pool->condition, &pool->queue_mutex);
+            }
+            if (pool->stop_flag) {
+                pthread_mutex_unlock(&pool->queue_mutex);
+                break;
+            }
+            std::function<void()> task = pool->task_queue.front();
+            pool->task_queue.pop();
+            pthread_mutex_unlock(&pool->queue_mutex);
+            task();
+        }
+        return nullptr;
+    }
+};
+
+struct BenchState {
+    std::vector<long> latency_ns;
+    std::atomic<long> done;
+};
+
+template <typename Pool>
+struct ProducerArg {
+    Pool* pool;
+    BenchState* state;
+    long first;
+    long count;
+};
+
+static long now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename Pool>
+static void* producer_thread(void* arg) {
+    ProducerArg<Pool>* producer = static_cast<ProducerArg<Pool>*>(arg);
+    BenchState* state = producer->state;
+
+    for (long i = producer->first; i < producer->first + producer->count; i++) {
+        long submitted = now_ns();
+        producer->pool->add_task([state, i, submitted]() {
+            state->latency_ns[i] = now_ns() - submitted;
+            state->done.fetch_add(1, std::memory_order_relaxed);
+        });
+    }
+    return nullptr;
+}
+
+template <typename Pool>
+static void run_case(const char* name, int worker_count, long task_count, int producer_count) {
+    BenchState state;
+    state.latency_ns.assign(task_count, 0);
+    state.done = 0;
+
+    Pool pool(worker_count);
+    pool.start();
+
+    std::vector<pthread_t> producers(producer_count);
+    std::vector<ProducerArg<Pool>> args(producer_count);
+    long per_producer = task_count / producer_count;
+
+    long begin = now_ns();
+    for (int i = 0; i < producer_count; i++) {
+        args[i].pool = &pool;
+        args[i].state = &state;
+        args[i].first = i * per_producer;
+        args[i].count = (i == producer_count - 1) ? task_count - i * per_producer : per_producer;
+        pthread_create(&producers[i], nullptr, producer_thread<Pool>, &args[i]);
+    }
+    for (auto& producer : producers) pthread_join(producer, nullptr);
+
+    while (state.done.load() < task_count) {
+        usleep(100);
+    }
+    double elapsed = (now_ns() - begin) / 1e9;
+    pool.stop();
+
+    std::sort(state.latency_ns.begin(), state.latency_ns.end());
+    long p50 = state.latency_ns[task_count / 2];
+    long p99 = state.latency_ns[std::min(task_count - 1, task_count * 99 / 100)];
+
+    std::cout << std::left << std::setw(14) << name
+              << " workers=" << std::setw(3) << worker_count
+              << " tasks/sec=" << std::setw(12) << (long)(task_count / elapsed)
+              << " p50=" << std::setw(8) << p50 / 1000.0 << "us"
+              << " p99=" << p99 / 1000.0 << "us" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " [tasks] [producers]\n";
+        return 1;
+    }
+
+    long task_count = (argc > 1) ? std::atol(argv[1]) : 200000;
+    int producer_count = (argc > 2) ? std::atoi(argv[2]) : 1;
+    if (task_count < 1 || producer_count < 1) {
+        std::cerr << "tasks and producers must be positive\n";
+        return 1;
+    }
+
+    for (int workers : {1, 2, 4, 8, 16, 32, 64}) {
+        run_case<LockedPool>("locked", workers, task_count, producer_count);
+        run_case<ThreadPool>("work-stealing", workers, task_count, producer_count);
+    }
+    return 0;
+}
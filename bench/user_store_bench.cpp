@@ -0,0 +1,140 @@
+/* User store registration benchmark
+先放 N 個帳號進 log，量：
+- 重新啟動時用 mmap 把 log 載入 index 要多久
+- <threads> 個 thread 同時註冊新帳號時，每秒能完成幾次 (每次都等到 fdatasync 完成)
+- 舊的寫法 (每次註冊都重寫整個文字檔) 在同樣的帳號數量下，寫一次要多久
+帳號數量從 1,000 開始每次乘 10，直到 <accounts>。
+
+Usage: ./bench/user_store_bench [accounts] [threads] [seconds]
+*/
+#include <iostream>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <pthread.h>
+#include <unistd.h>
+#include "../server/user_store.hpp"
+
+struct BenchStore {
+    UserStore store;
+    std::unordered_map<std::string, std::string> index;
+    std::mutex index_mutex;
+};
+
+struct RegisterArg {
+    BenchStore* bench;
+    int thread_id;
+    long registered;
+};
+
+static std::atomic<bool> running(false);
+
+static double seconds_since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// 跟 Authentication::register_user 一樣：改 index、append，放開鎖之後才等 disk
+static void* register_thread(void* arg) {
+    RegisterArg* reg = static_cast<RegisterArg*>(arg);
+    BenchStore* bench = reg->bench;
+
+    while (!running) {}
+    while (running) {
+        std::string username = "new_" + std::to_string(reg->thread_id) + "_" + std::to_string(reg->registered);
+        std::string hash = std::to_string(std::hash<std::string>()(username));
+        uint64_t ticket;
+        {
+            std::lock_guard<std::mutex> lock(bench->index_mutex);
+            bench->index[username] = hash;
+            ticket = bench->store.append(username, hash);
+        }
+        bench->store.wait_durable(ticket);
+        reg->registered++;
+    }
+    return nullptr;
+}
+
+static void run_case(const std::string& dir, long accounts, int thread_count, int seconds) {
+    std::string path = dir + "/users_" + std::to_string(accounts) + ".log";
+
+    {
+        BenchStore bench;
+        bench.store.open(path, "", bench.index);
+        uint64_t ticket = 0;
+        for (long i = 0; i < accounts; i++) {
+            ticket = bench.store.append("user" + std::to_string(i), std::to_string(i * 2654435761u));
+        }
+        bench.store.wait_durable(ticket);
+    }
+
+    BenchStore bench;
+    auto load_begin = std::chrono::steady_clock::now();
+    bench.store.open(path, "", bench.index);
+    double load_time = seconds_since(load_begin);
+
+    // 舊的寫法：每註冊一個人就把所有帳號重寫一次
+    std::string legacy_path = dir + "/legacy.txt";
+    auto legacy_begin = std::chrono::steady_clock::now();
+    {
+        std::ofstream file(legacy_path, std::ios::trunc);
+        for (const auto& [username, password] : bench.index) file << username << " " << password << "\n";
+    }
+    double legacy_time = seconds_since(legacy_begin);
+
+    std::vector<pthread_t> threads(thread_count);
+    std::vector<RegisterArg> args(thread_count);
+    for (int i = 0; i < thread_count; i++) {
+        args[i] = {&bench, i, 0};
+        pthread_create(&threads[i], nullptr, register_thread, &args[i]);
+    }
+    auto begin = std::chrono::steady_clock::now();
+    running = true;
+    sleep(seconds);
+    running = false;
+    for (auto& t : threads) pthread_join(t, nullptr);
+    double elapsed = seconds_since(begin);
+
+    long total = 0;
+    for (auto& arg : args) total += arg.registered;
+
+    std::cout << "accounts=" << accounts
+              << " load=" << load_time * 1000 << "ms"
+              << " registrations/sec=" << (long)(total / elapsed)
+              << " legacy_rewrite=" << legacy_time * 1000 << "ms/registration" << std::endl;
+
+    bench.store.close();
+    unlink(path.c_str());
+    unlink(legacy_path.c_str());
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 4) {
+        std::cerr << "Usage: " << argv[0] << " [accounts] [threads] [seconds]\n";
+        return 1;
+    }
+
+    long max_accounts = (argc > 1) ? std::atol(argv[1]) : 1000000;
+    int thread_count = (argc > 2) ? std::atoi(argv[2]) : 16;
+    int seconds = (argc > 3) ? std::atoi(argv[3]) : 2;
+    if (max_accounts < 1 || thread_count < 1 || seconds < 1) {
+        std::cerr << "accounts, threads and seconds must be positive\n";
+        return 1;
+    }
+
+    char dir_template[] = "/tmp/user_store_bench.XXXXXX";
+    char* dir = mkdtemp(dir_template);
+    if (!dir) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    for (long accounts = 1000; accounts <= max_accounts; accounts *= 10) {
+        run_case(dir, accounts, thread_count, seconds);
+    }
+    rmdir(dir);
+    return 0;
+}
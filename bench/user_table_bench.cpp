@@ -0,0 +1,177 @@
+/* User table lookup benchmark
+<readers> 個 thread 不停地查帳號 (login 查 hash 的那一步)，另外一個 writer 每 10ms 一次註冊
+<burst> 個新帳號，比較：
+- 原本的寫法：一把 std::mutex 保護整個 unordered_map，註冊時整批握著鎖
+- UserTable：讀不拿鎖，註冊整批做成新的 snapshot 再換上去
+輸出每秒查詢次數和查詢的 p50 / p99 / max latency。
+
+Usage: ./bench/user_table_bench [accounts] [readers] [burst] [seconds]
+*/
+#include <iostream>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <pthread.h>
+#include <unistd.h>
+#include "../server/user_table.hpp"
+
+#define SAMPLE_INTERVAL 16      // 每幾次查詢記錄一次 latency
+
+// 原本 Authentication 的寫法
+struct MutexTable {
+    std::mutex mutex;
+    std::unordered_map<std::string, std::string> users;
+
+    bool find(const std::string& username, std::string& hash) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = users.find(username);
+        if (it == users.end()) return false;
+        hash = it->second;
+        return true;
+    }
+
+    void apply(const std::vector<UserTable::Update*>& batch) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (UserTable::Update* update : batch) {
+            update->applied = users.emplace(update->username, update->hash).second;
+        }
+    }
+};
+
+template <typename Table>
+struct BenchState {
+    Table* table;
+    long accounts;
+    int burst;
+    std::atomic<bool> running;
+};
+
+template <typename Table>
+struct ReaderArg {
+    BenchState<Table>* state;
+    int thread_id;
+    long lookups;
+    std::vector<double> samples;    // us
+};
+
+static std::string hash_of(long i) {
+    return "pbkdf2$100000$" + std::to_string(i * 2654435761u);
+}
+
+template <typename Table>
+static void* reader_thread(void* arg) {
+    ReaderArg<Table>* reader = static_cast<ReaderArg<Table>*>(arg);
+    BenchState<Table>* state = reader->state;
+    unsigned seed = reader->thread_id + 1;
+    std::string hash;
+
+    while (!state->running) {}
+    while (state->running) {
+        std::string username = "user" + std::to_string(rand_r(&seed) % state->accounts);
+        if (reader->lookups % SAMPLE_INTERVAL == 0) {
+            auto begin = std::chrono::steady_clock::now();
+            state->table->find(username, hash);
+            reader->samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+        } else {
+            state->table->find(username, hash);
+        }
+        reader->lookups++;
+    }
+    return nullptr;
+}
+
+// 每 10ms 註冊一批新帳號
+template <typename Table>
+static void* writer_thread(void* arg) {
+    BenchState<Table>* state = static_cast<BenchState<Table>*>(arg);
+    long next = state->accounts;
+
+    while (!state->running) {}
+    while (state->running) {
+        std::vector<UserTable::Update> updates(state->burst);
+        std::vector<UserTable::Update*> batch;
+        for (auto& update : updates) {
+            update = {"user" + std::to_string(next), hash_of(next), "", false};
+            next++;
+            batch.push_back(&update);
+        }
+        state->table->apply(batch);
+        usleep(10000);
+    }
+    return nullptr;
+}
+
+template <typename Table>
+static void run_case(const char* name, Table& table, long accounts, int reader_count, int burst, int seconds) {
+    BenchState<Table> state{&table, accounts, burst, {false}};
+    std::vector<pthread_t> threads(reader_count);
+    std::vector<ReaderArg<Table>> args(reader_count);
+    for (int i = 0; i < reader_count; i++) {
+        args[i].state = &state;
+        args[i].thread_id = i;
+        args[i].lookups = 0;
+        pthread_create(&threads[i], nullptr, reader_thread<Table>, &args[i]);
+    }
+    pthread_t writer;
+    pthread_create(&writer, nullptr, writer_thread<Table>, &state);
+
+    auto begin = std::chrono::steady_clock::now();
+    state.running = true;
+    sleep(seconds);
+    state.running = false;
+    for (auto& t : threads) pthread_join(t, nullptr);
+    pthread_join(writer, nullptr);
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    long total = 0;
+    std::vector<double> samples;
+    for (auto& arg : args) {
+        total += arg.lookups;
+        samples.insert(samples.end(), arg.samples.begin(), arg.samples.end());
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::cout << name << ": lookups/sec=" << (long)(total / elapsed);
+    if (!samples.empty()) {
+        std::cout << " p50=" << samples[samples.size() / 2] << "us"
+                  << " p99=" << samples[samples.size() * 99 / 100] << "us"
+                  << " max=" << samples.back() << "us";
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 5) {
+        std::cerr << "Usage: " << argv[0] << " [accounts] [readers] [burst] [seconds]\n";
+        return 1;
+    }
+
+    long accounts = (argc > 1) ? std::atol(argv[1]) : 1000000;
+    int reader_count = (argc > 2) ? std::atoi(argv[2]) : 8;
+    int burst = (argc > 3) ? std::atoi(argv[3]) : 1000;
+    int seconds = (argc > 4) ? std::atoi(argv[4]) : 3;
+    if (accounts < 1 || reader_count < 1 || burst < 1 || seconds < 1) {
+        std::cerr << "accounts, readers, burst and seconds must be positive\n";
+        return 1;
+    }
+
+    std::unordered_map<std::string, std::string> users;
+    for (long i = 0; i < accounts; i++) users["user" + std::to_string(i)] = hash_of(i);
+
+    std::cout << "accounts=" << accounts << " readers=" << reader_count << " burst=" << burst << std::endl;
+    {
+        MutexTable table;
+        table.users = users;
+        run_case("mutex map", table, accounts, reader_count, burst, seconds);
+    }
+    {
+        UserTable table;
+        table.load(users);
+        run_case("UserTable", table, accounts, reader_count, burst, seconds);
+    }
+    return 0;
+}
@@ -4,11 +4,16 @@
 #include <fstream>
 #include <cstdlib>
 #include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <algorithm>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include "../shared/message.hpp"
+#include "../shared/protocol.hpp"
 #include "../shared/ssl.hpp"
 #include "../shared/streaming.hpp"
+#include "../shared/compress.hpp"
 
 bool Client::running = true;
 
@@ -73,12 +78,12 @@ bool Client::connect_to_server() {
     std::cout << "Connected to server at " << server_ip << ":" << server_port << "\n";
 
     /* Server 期待 Client 一開始連線時先傳一個 JOIN Message，並告訴 Server 自己的 listen port */
-    Message join_msg;
-    memset(&join_msg, 0, sizeof(join_msg));
+    Message join_msg{};
     join_msg.msg_type = JOIN;
+    join_msg.flags = WIRE_FLAG_ACCEPTS_COMPRESSED;  // 送給這個 client 的東西可以壓縮
     snprintf(join_msg.payload, MAX_PAYLOAD_SIZE, "%d", my_listen_port);
     join_msg.payload_size = (int)strlen(join_msg.payload);
-    if (SSL_write(server_ssl, &join_msg, sizeof(join_msg)) < 0) {
+    if (!write_message(server_ssl, join_msg)) {
         perror("write(JOIN)");
         SSL_shutdown(server_ssl);
         SSL_free(server_ssl);
@@ -234,6 +239,28 @@ void Client::command_loop() {
             int peer_port = std::stoi(line.substr(second_space + 1, third_space - second_space - 1));
             std::string filename = line.substr(third_space + 1);
             direct_send_file(peer_ip, peer_port, filename);
+        } else if (cmd == "direct_send_file_parallel") {
+            // direct_send_file_parallel <ip> <port> <streams> <filename>
+            // 檔案切成幾段，用多條連線同時傳
+            size_t first_space = line.find(' ');
+            size_t second_space = line.find(' ', first_space + 1);
+            size_t third_space = line.find(' ', second_space + 1);
+            size_t fourth_space = line.find(' ', third_space + 1);
+            if (first_space == std::string::npos || second_space == std::string::npos ||
+                third_space == std::string::npos || fourth_space == std::string::npos) {
+                std::cout << "Usage: direct_send_file_parallel <ip> <port> <streams> <filename>\n";
+                continue;
+            }
+
+            std::string peer_ip = line.substr(first_space + 1, second_space - first_space - 1);
+            int peer_port = std::stoi(line.substr(second_space + 1, third_space - second_space - 1));
+            int streams = std::stoi(line.substr(third_space + 1, fourth_space - third_space - 1));
+            std::string filename = line.substr(fourth_space + 1);
+            if (streams < 1 || streams > MAX_FILE_STREAMS) {
+                std::cout << "streams must be between 1 and " << MAX_FILE_STREAMS << "\n";
+                continue;
+            }
+            direct_send_file_parallel(peer_ip, peer_port, streams, filename);
         } else if (cmd == "relay_send_file") {
             // Format: relay_send_file <to_id> <filename>
             size_t first_space = line.find(' ');
@@ -344,15 +371,16 @@ void Client::login(const std::string& username, const std::string& password) {
     snprintf(login_msg.payload, MAX_PAYLOAD_SIZE, "%s %s", username.c_str(), password.c_str());
     login_msg.payload_size = strlen(login_msg.payload);
 
-    if (SSL_write(server_ssl, &login_msg, sizeof(login_msg)) < 0) {
+    if (!write_message(server_ssl, login_msg)) {
         std::cerr << "SSL_write failed: " << strerror(errno) << "\n";
         ERR_print_errors_fp(stderr); // For OpenSSL-specific errors
     }
 }
 
-void Client::successful_login(const std::string& username) {
+void Client::successful_login(const std::string& username, bool compression) {
     this->logged_in = true;
     this->username = username;
+    this->server_compression = compression;
     this->first = true;
     std::cout << "Success\n";
 }
@@ -367,7 +395,7 @@ void Client::logout() {
     logout_msg.msg_type = LOGOUT;
     logout_msg.payload_size = snprintf(logout_msg.payload, MAX_PAYLOAD_SIZE, "%s", username.c_str());
 
-    if (SSL_write(server_ssl, &logout_msg, sizeof(logout_msg)) < 0) {
+    if (!write_message(server_ssl, logout_msg)) {
         perror("write(logout)");
         return;
     }
@@ -384,7 +412,7 @@ void Client::register_user(const std::string& username, const std::string& passw
     snprintf(register_msg.payload, MAX_PAYLOAD_SIZE, "%s %s", username.c_str(), password.c_str());
     register_msg.payload_size = strlen(register_msg.payload);
 
-    if (SSL_write(server_ssl, &register_msg, sizeof(register_msg)) < 0) {
+    if (!write_message(server_ssl, register_msg)) {
         perror("write(register)");
         return;
     }
@@ -396,9 +424,10 @@ void Client::chat(int to_id, const std::string& message) {
     chat_msg.to_id = to_id;
     chat_msg.from_username = username;
     std::strncpy(chat_msg.payload, message.c_str(), MAX_PAYLOAD_SIZE);
-    chat_msg.payload_size = message.size();
+    chat_msg.payload_size = std::min<int>(message.size(), MAX_PAYLOAD_SIZE);
+    if (server_compression) compress_message(chat_msg);
 
-    if (SSL_write(server_ssl, &chat_msg, sizeof(chat_msg)) < 0) {
+    if (!write_message(server_ssl, chat_msg)) {
         perror("write(chat)");
     }
 }
@@ -407,7 +436,7 @@ void Client::request_peer() {
     Message req_msg{};
     req_msg.msg_type = REQUEST_PEER;
 
-    if (SSL_write(server_ssl, &req_msg, sizeof(req_msg)) < 0) {
+    if (!write_message(server_ssl, req_msg)) {
         perror("write(request_peer)");
     }
 }
@@ -417,14 +446,13 @@ void Client::direct_send(const std::string& peer_ip, int peer_port, const std::s
     SSL* peer_ssl = ssl_connect(peer_ip, peer_port, peer_fd);
 
     // Send a message in the same Message format
-    Message direct_msg;
-    memset(&direct_msg, 0, sizeof(direct_msg));
+    Message direct_msg{};
     direct_msg.from_username = username;
     direct_msg.msg_type = DIRECT_MSG;
     strncpy(direct_msg.payload, message.c_str(), MAX_PAYLOAD_SIZE);
     direct_msg.payload_size = (int)strlen(direct_msg.payload);
 
-    if (SSL_write(peer_ssl, &direct_msg, sizeof(direct_msg)) < 0) {
+    if (!write_message(peer_ssl, direct_msg)) {
         perror("write(direct_msg)");
     }
 
@@ -435,21 +463,58 @@ void Client::direct_send_file(const std::string& peer_ip, int peer_port, const s
     int peer_fd;
     SSL* peer_ssl = ssl_connect(peer_ip, peer_port, peer_fd);
 
+    if (!peer_ssl) {
+        std::cerr << "Error: Failed to establish SSL connection.\n";
+        return;
+    }
     /* 通知對端要傳檔案了 */
-    Message inform_msg;
-    memset(&inform_msg, 0, sizeof(inform_msg));
+    Message inform_msg{};
     inform_msg.msg_type = DIRECT_SEND_FILE;
     inform_msg.from_username = username;
-    if (SSL_write(peer_ssl, &inform_msg, sizeof(inform_msg)) < 0) {
+    if (!write_message(peer_ssl, inform_msg)) {
         perror("write(direct_msg)");
         return;
     }
 
-    send_file(peer_ssl, filename);
+    send_file(peer_ssl, filename, true);
 
     ssl_free(peer_ssl, peer_fd);
 }
 
+void Client::direct_send_file_parallel(const std::string& peer_ip, int peer_port, int streams, const std::string& filename){
+    std::vector<SSL*> peer_ssls;
+    std::vector<int> peer_fds;
+    auto open_stream = [&]() -> SSL* {
+        int peer_fd;
+        SSL* peer_ssl = ssl_connect(peer_ip, peer_port, peer_fd);
+        if (peer_ssl) {
+            peer_ssls.push_back(peer_ssl);
+            peer_fds.push_back(peer_fd);
+        }
+        return peer_ssl;
+    };
+
+    SSL* control_ssl = open_stream();
+    if (!control_ssl) {
+        std::cerr << "Error: Failed to establish SSL connection.\n";
+        return;
+    }
+
+    /* 通知對端要傳檔案了 */
+    Message inform_msg{};
+    inform_msg.msg_type = DIRECT_SEND_FILE;
+    inform_msg.from_username = username;
+    if (write_message(control_ssl, inform_msg)) {
+        send_file_parallel(control_ssl, filename, streams, open_stream);
+    } else {
+        perror("write(direct_msg)");
+    }
+
+    for (size_t i = 0; i < peer_ssls.size(); i++) {
+        ssl_free(peer_ssls[i], peer_fds[i]);
+    }
+}
+
 void Client::direct_streaming(const std::string& peer_ip, int peer_port, const std::string& filename) {
     int peer_fd;
     SSL* peer_ssl = ssl_connect(peer_ip, peer_port, peer_fd);
@@ -459,10 +524,9 @@ void Client::direct_streaming(const std::string& peer_ip, int peer_port, const s
         return;
     }
     /* 通知對端要開始 streaming 了 */
-    Message inform_msg;
-    memset(&inform_msg, 0, sizeof(inform_msg));
+    Message inform_msg{};
     inform_msg.msg_type = DIRECT_STREAMING;
-    if (SSL_write(peer_ssl, &inform_msg, sizeof(inform_msg)) < 0) {
+    if (!write_message(peer_ssl, inform_msg)) {
         perror("write(direct_msg)");
         return;
     }
@@ -479,25 +543,57 @@ void Client::direct_streaming(const std::string& peer_ip, int peer_port, const s
 
 void Client::relay_send_file(int to_id, const std::string& filename){
     /* 通知對端要傳檔案了 */
-    Message inform_msg;
-    memset(&inform_msg, 0, sizeof(inform_msg));
+    Message inform_msg{};
     inform_msg.msg_type = RELAY_SEND_FILE;
     inform_msg.to_id = to_id;
     inform_msg.from_username = username;
 
-    if (SSL_write(server_ssl, &inform_msg, sizeof(inform_msg)) < 0) {
+    if (!write_message(server_ssl, inform_msg)) {
         perror("write(chat)");
     }
 
-    send_file(server_ssl, filename);
+    // 上一次沒等到的回覆不能拿來用
+    pthread_mutex_lock(&reply_mutex);
+    has_file_reply = false;
+    pthread_mutex_unlock(&reply_mutex);
+
+    send_file_dedup(server_ssl, filename, [this](std::vector<char>& reply, int& flags) { return wait_file_reply(reply, flags); });
+}
+
+void Client::post_file_reply(int flags, const char* data, size_t len) {
+    pthread_mutex_lock(&reply_mutex);
+    file_reply.assign(data, data + len);
+    file_reply_flags = flags;
+    has_file_reply = true;
+    pthread_cond_broadcast(&reply_cond);
+    pthread_mutex_unlock(&reply_mutex);
+}
+
+// 最多等 TRANSFER_REPLY_TIMEOUT 秒
+bool Client::wait_file_reply(std::vector<char>& reply, int& flags) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += TRANSFER_REPLY_TIMEOUT;
+
+    pthread_mutex_lock(&reply_mutex);
+    while (!has_file_reply && running) {
+        if (pthread_cond_timedwait(&reply_cond, &reply_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    bool received = has_file_reply;
+    if (received) {
+        reply.swap(file_reply);
+        flags = file_reply_flags;
+    }
+    has_file_reply = false;
+    pthread_mutex_unlock(&reply_mutex);
+    return received;
 }
 
 void Client::relay_streaming(int to_id, const std::string& filename) {
-    Message inform_msg;
-    memset(&inform_msg, 0, sizeof(inform_msg));
+    Message inform_msg{};
     inform_msg.msg_type = RELAY_STREAMING;
     inform_msg.to_id = to_id;
-    if (SSL_write(server_ssl, &inform_msg, sizeof(inform_msg)) < 0) {
+    if (!write_message(server_ssl, inform_msg)) {
         perror("write(direct_msg)");
         return;
     }
@@ -530,10 +626,9 @@ void Client::direct_audio_streaming(const std::string& peer_ip, int peer_port, c
         return;
     }
     /* 通知對端要開始 streaming 了 */
-    Message inform_msg;
-    memset(&inform_msg, 0, sizeof(inform_msg));
+    Message inform_msg{};
     inform_msg.msg_type = DIRECT_AUDIO_STREAMING;
-    if (SSL_write(peer_ssl, &inform_msg, sizeof(inform_msg)) < 0) {
+    if (!write_message(peer_ssl, inform_msg)) {
         perror("write(direct_msg)");
         return;
     }
@@ -545,12 +640,11 @@ void Client::direct_audio_streaming(const std::string& peer_ip, int peer_port, c
 }
 
 void Client::relay_audio_streaming(int to_id, const std::string& filename) {
-    Message inform_msg;
-    memset(&inform_msg, 0, sizeof(inform_msg));
+    Message inform_msg{};
     inform_msg.msg_type = RELAY_AUDIO_STREAMING;
     inform_msg.to_id = to_id;
 
-    if (SSL_write(server_ssl, &inform_msg, sizeof(inform_msg)) < 0) {
+    if (!write_message(server_ssl, inform_msg)) {
         perror("write(chat)");
     }
 
@@ -558,100 +652,6 @@ void Client::relay_audio_streaming(int to_id, const std::string& filename) {
     std::cout << "Streaming session ended.\n";
 }
 
-void send_file(SSL* ssl, const std::string& filename){
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open file: " << filename << std::endl;
-        return;
-    }
-
-    // 發送檔案的 metadata（檔名和大小）
-    std::string file_name = filename.substr(filename.find_last_of('/') + 1);
-    file.seekg(0, std::ios::end);
-    size_t file_size = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    Message metadata;
-    memset(&metadata, 0, sizeof(metadata));
-    metadata.msg_type = TRANSFER_FILE_CONTENT;
-    snprintf(metadata.payload, MAX_PAYLOAD_SIZE, "%s %d", file_name.c_str(), file_size);
-    metadata.payload_size = (int)strlen(metadata.payload);
-
-    if (SSL_write(ssl, &metadata, sizeof(metadata)) < 0) {
-        perror("write(direct_msg)");
-        std::cerr << "Failed to send file metadata." << std::endl;
-        return;
-    }
-
-    // 發送檔案內容
-    Message content;
-    memset(&content, 0, sizeof(content));
-    content.msg_type = TRANSFER_FILE_CONTENT;
-    while (file.read(content.payload, MAX_PAYLOAD_SIZE) || file.gcount() > 0) {
-        content.payload_size = (int)strlen(content.payload);
-        if (SSL_write(ssl, &content, sizeof(content)) < 0) {
-            std::cerr << "Failed to send file data." << std::endl;
-            break;
-        }
-    }
-
-    std::cout << "File sent successfully!" << std::endl;
-    file.close();
-}
-
-void recv_file(SSL* ssl){
-    // 先接收檔案的 metadata
-    Message metadata;
-    memset(&metadata, 0, sizeof(metadata));
-
-    int metadata_len = SSL_read(ssl, &metadata, sizeof(metadata));
-    if (metadata_len <= 0) {
-        std::cerr << "Failed to receive file metadata." << std::endl;
-        return;
-    }
-
-    std::cout << metadata.msg_type << std::endl;
-
-    char* file_name = strtok(metadata.payload, " ");
-    char* file_size_str = strtok(NULL, " ");
-    int file_size = atoi(file_size_str);
-
-    std::cout << "Receiving " << file_name << "("  << file_size << " bytes)......." << std::endl;
-
-    std::string new_file_name = file_name;
-    new_file_name = "recv_" + new_file_name; // 新增的檔名先加個 prefix 檔一下撞名
-
-    // 創建新檔案
-    std::ofstream file(new_file_name, std::ios::binary);
-    if (!file.is_open()) {
-        std::cerr << "Failed to create file: " << new_file_name << std::endl;
-        return;
-    }
-
-    // 接收檔案內容
-    size_t received_size = 0;
-    Message content;
-    memset(&content, 0, sizeof(content));
-    while (received_size < file_size) {
-        if (SSL_read(ssl, &content, sizeof(content)) <= 0) {
-            std::cerr << "Failed to receive file data." << std::endl;
-            break;
-        }
-        if(content.msg_type != TRANSFER_FILE_CONTENT){
-            std::cerr << "messgae type is not TRANSFER_FILE_CONTENT" << std::endl;
-        }
-        file.write(content.payload, content.payload_size);
-        received_size += content.payload_size;
-    }
-
-    if (received_size == file_size) {
-        std::cout << "File received successfully!" << std::endl;
-    } else {
-        std::cerr << "File transfer incomplete." << std::endl;
-    }
-    file.close();
-}
-
 SSL* Client::ssl_connect(const std::string& ip, int port, int& peer_fd){
     // Create socket and connect
     peer_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -757,6 +757,7 @@ void Client::welcome_message(bool& first){
                     "--------------------Direct mode:--------------------\n"
                     "Chat             --> direct_send <ip> <port> <message> \n"
                     "Send file        --> direct_send_file <ip> <port> <filename> \n"
+                    "Parallel send    --> direct_send_file_parallel <ip> <port> <streams> <filename> \n"
                     "Video streaming  --> direct_video_streaming <ip> <port> <video_filename> \n"
                     "Audio streaming  --> direct_audio_streaming <ip> <port> <audio_filename> \n"
                     "Webcam streaming --> direct_webcam_streaming <ip> <port>\n"
@@ -2,11 +2,13 @@
 #define CLIENT_HPP
 
 #include <string>
+#include <vector>
 #include <pthread.h>
 #include <opencv2/opencv.hpp>
 #include "../shared/message.hpp"
 #include "../shared/ssl.hpp"
 #include "../shared/streaming.hpp"
+#include "../shared/file_transfer.hpp"
 
 class Client {
 public:
@@ -22,8 +24,11 @@ public:
     SSL* get_server_ssl() const { return server_ssl; }
     SSL_CTX* get_server_ctx() const {return server_ctx; }
     int get_direct_listen_fd() const { return direct_listen_fd; }
-    void successful_login(const std::string& username);
+    // compression 是 server 的回覆帶著 WIRE_FLAG_ACCEPTS_COMPRESSED (之後的 chat 可以壓縮)
+    void successful_login(const std::string& username, bool compression);
     StreamingQueue& get_streaming_queue();
+    // server_listener_thread 收到 server 對 manifest 的回覆 (TRANSFER_RESUME) 時呼叫，交給正在 relay 傳檔案的 thread
+    void post_file_reply(int flags, const char* data, size_t len);
 
 private:
     int server_fd;
@@ -40,6 +45,7 @@ private:
 
     std::string username; // Store the logged-in user's username
     bool logged_in = false; // Track login state
+    bool server_compression = false;    // server 看得懂壓縮過的 Message
     void login(const std::string& username, const std::string& password);
     void logout();
     void register_user(const std::string& username, const std::string& password);
@@ -49,7 +55,16 @@ private:
 
     /* Transfer file feature */
     void direct_send_file(const std::string& peer_ip, int peer_port, const std::string& filename);
+    void direct_send_file_parallel(const std::string& peer_ip, int peer_port, int streams, const std::string& filename);
     void relay_send_file(int to_id, const std::string& filename);
+    bool wait_file_reply(std::vector<char>& reply, int& flags);
+
+    /* server 連線只有 server_listener_thread 在讀，relay 傳檔案時 server 的回覆由它轉交 */
+    pthread_mutex_t reply_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t reply_cond = PTHREAD_COND_INITIALIZER;
+    std::vector<char> file_reply;
+    int file_reply_flags = 0;
+    bool has_file_reply = false;
 
     /* Streaming feature */
     StreamingQueue streaming_queue;
@@ -67,8 +82,6 @@ private:
     bool first;
 };
 
-void send_file(SSL* ssl, const std::string& filename);
-void recv_file(SSL* ssl);
 void ssl_free(SSL* ssl, int fd);
 
 #endif // CLIENT_HPP
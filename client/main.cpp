@@ -1,5 +1,6 @@
 #include "client.hpp"
 #include "thread_handlers.hpp"
+#include "../shared/compress.hpp"
 #include <iostream>
 #include <string>
 #include <unistd.h>
@@ -8,13 +9,15 @@
 
 int main(int argc, char* argv[]) {
     /* 讀 terminal input */
-    if (argc != 4) {
-        std::cerr << "Usage: " << argv[0] << " <server_ip> <server_port> <my_listen_port>\n";
+    if (argc != 4 && argc != 5) {
+        std::cerr << "Usage: " << argv[0] << " <server_ip> <server_port> <my_listen_port> [compression_level]\n";
         return 1;
     }
     std::string server_ip = argv[1];            // server 的 ip address
     int server_port = std::atoi(argv[2]);       // server 的 port
     int my_listen_port = std::atoi(argv[3]);    // direct mode 下自己的 listen port
+    // 送出去的檔案和 chat 用哪個 level 壓縮 (0 = 不壓縮)
+    set_compression_level((argc > 4) ? std::atoi(argv[4]) : COMPRESS_LEVEL_DEFAULT);
 
     /* 都寫在 client.cpp */
     Client client(server_ip, server_port, my_listen_port);
@@ -1,13 +1,19 @@
 #include "thread_handlers.hpp"
 #include <iostream>
+#include <atomic>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <cstring>
 
 #include "client.hpp"
 #include "../shared/message.hpp"
+#include "../shared/protocol.hpp"
 #include "../shared/ssl.hpp"
 #include "../shared/streaming.hpp"
+#include "../shared/compress.hpp"
+#include "../shared/file_transfer.hpp"
+
+#define MAX_FILE_RECEIVERS (2 * MAX_FILE_STREAMS)   // 最多同時幾條傳檔案的連線 (每條一個 thread)
 
 /* 此 function 會開一個 socket 並聽在給定的 port (client 會傳 my_listen_port) */
 int create_listening_socket(SSL_CTX* ctx, int port) {
@@ -43,50 +49,126 @@ int create_listening_socket(SSL_CTX* ctx, int port) {
     return fd;
 }
 
+static void handle_server_message(Client* client, Message& msg, bool receiving_file);
+
+/* relay 收檔案期間夾在檔案內容中間的其他訊息：自己同時在上傳的檔案的回覆交給上傳的 thread，
+其他的照一般的訊息處理 (不算進檔案的 chunk) */
+static void handle_interleaved_frame(Client* client, const WireHeader& header, const std::string& username, std::vector<char>& payload) {
+    if (header.msg_type == TRANSFER_RESUME) {
+        client->post_file_reply(header.flags, payload.data(), payload.size());
+        return;
+    }
+
+    Message msg{};
+    msg.msg_type = header.msg_type;
+    msg.flags = header.flags;
+    msg.from_id = header.from_id;
+    msg.to_id = header.to_id;
+    msg.from_username = username;
+    if (payload.size() >= MAX_PAYLOAD_SIZE) {
+        std::cerr << "Unexpected message from server.\n";
+        return;
+    }
+    msg.payload_size = (int)payload.size();
+    memcpy(msg.payload, payload.data(), payload.size());
+    msg.payload[payload.size()] = '\0';
+    if (!decompress_message(msg)) {
+        std::cerr << "Unexpected message from server.\n";
+        return;
+    }
+    handle_server_message(client, msg, true);
+}
+
+/* 處理 server 送來的一個訊息
+receiving_file 時是 relay 收檔案期間夾在檔案內容中間的訊息，這時候連線還在傳檔案，
+後面還要接著從連線讀資料的訊息 (另一個檔案、串流) 沒辦法處理
+*/
+static void handle_server_message(Client* client, Message& msg, bool receiving_file) {
+    switch (msg.msg_type) {
+        case RESPONSE:
+            std::cout << msg.payload << "\n";
+            break;
+        case LOGIN:
+            client->successful_login(msg.payload, msg.flags & WIRE_FLAG_ACCEPTS_COMPRESSED);
+            break;
+        case CHAT:
+            std::cout << "Received from " << msg.from_username << ": " << msg.payload << "\n";
+            break;
+        case PEER_INFO:
+            std::cout << msg.payload;
+            std::cout << "====================================================\n";
+            break;
+        case RELAY_SEND_FILE:
+        case RELAY_STREAMING:
+        case RELAY_AUDIO_STREAMING:
+            if (receiving_file) {
+                std::cerr << "Ignored " << msg.from_username << "'s transfer while receiving a file.\n";
+            } else if (msg.msg_type == RELAY_SEND_FILE) {
+                std::cout << msg.from_username << " send a file to you\n";
+                recv_file(client->get_server_ssl(), false,
+                    [client](const WireHeader& header, const std::string& username, std::vector<char>& payload) {
+                        handle_interleaved_frame(client, header, username, payload);
+                    });
+            } else if (msg.msg_type == RELAY_STREAMING) {
+                enqueue_frame(client->get_streaming_queue(), client->get_server_ssl());
+            } else {
+                play_audio(client->get_server_ssl());
+            }
+            break;
+        default:
+            std::cout << "Unknown message type: " << msg.msg_type << "\n";
+    }
+}
+
 /* 此 function 會聽 Relay Mode 的訊息 */
 void* server_listener_thread_func(void* arg) {
     Client* client = static_cast<Client*>(arg);
 
+    std::vector<char> frame;
     while (client->is_running()) {
-        Message msg;
-        int r = SSL_read(client->get_server_ssl(), &msg, sizeof(msg));
-        if (r <= 0) {
+        // server 對 manifest 的回覆 (bitmap) 可能比一個 Message 大，所以先讀整個 frame
+        if (!read_frame(client->get_server_ssl(), frame)) {
             std::cerr << "Disconnected from server.\n";
             break;
         }
-
-        switch (msg.msg_type) {
-            case RESPONSE:
-                std::cout << msg.payload << "\n";
-                break;
-            case LOGIN:
-                client->successful_login(msg.payload);
-                break;
-            case CHAT:
-                std::cout << "Received from " << msg.from_username << ": " << msg.payload << "\n";
-                break;
-            case PEER_INFO:
-                std::cout << msg.payload;
-                std::cout << "====================================================\n";
-                break;
-            case RELAY_SEND_FILE:
-                std::cout << msg.from_username << " send a file to you\n";
-                recv_file(client->get_server_ssl());
-                break;
-            case RELAY_STREAMING:
-                enqueue_frame(client->get_streaming_queue(), client->get_server_ssl());
-                break;
-            case RELAY_AUDIO_STREAMING:
-                play_audio(client->get_server_ssl());
-                break;
-            default:
-                std::cout << "Unknown message type: " << msg.msg_type << "\n";
+        MessageView view;
+        if (decode_message_view(frame.data(), frame.size(), view) && view.header.msg_type == TRANSFER_RESUME) {
+            client->post_file_reply(view.header.flags, view.payload.data(), view.payload.size());
+            continue;
+        }
+        Message msg{};
+        if (!decode_message(frame.data(), frame.size(), msg) || !decompress_message(msg)) {
+            std::cerr << "Unexpected message from server.\n";
+            continue;
         }
+        handle_server_message(client, msg, false);
     }
 
     return nullptr;
 }
 
+static std::atomic<int> active_receivers{0};
+
+struct FileReceiver {
+    SSL* ssl;
+    int fd;
+    std::string join;   // stream 連線的 DIRECT_SEND_FILE payload，control 連線是空的
+};
+
+/* 每條傳檔案的連線各自一個 thread (最多 MAX_FILE_RECEIVERS 個)，parallel 傳檔案時多條 stream 可以同時收 */
+static void* file_receiver_thread_func(void* arg) {
+    FileReceiver* receiver = static_cast<FileReceiver*>(arg);
+    if (receiver->join.empty()) {
+        recv_file(receiver->ssl, true);
+    } else {
+        recv_file_stream(receiver->ssl, receiver->join);
+    }
+    ssl_free(receiver->ssl, receiver->fd);
+    delete receiver;
+    active_receivers--;
+    return nullptr;
+}
+
 /* 此 function 會聽 Direct Mode 的訊息 */
 void* direct_listener_thread_func(void* arg) {
     Client* client = static_cast<Client*>(arg);
@@ -111,9 +193,8 @@ void* direct_listener_thread_func(void* arg) {
             ;
         }
 
-        Message msg;
-        int r = SSL_read(peer_ssl, &msg, sizeof(msg));
-        if (r <= 0) {
+        Message msg{};
+        if (!read_message(peer_ssl, msg)) {
             SSL_shutdown(peer_ssl);
             SSL_free(peer_ssl);
             close(peer_fd);
@@ -124,8 +205,22 @@ void* direct_listener_thread_func(void* arg) {
         if (msg.msg_type == DIRECT_MSG) {
             std::cout << "Received from " << msg.from_username << ": " << msg.payload << "\n";
         } else if(msg.msg_type == DIRECT_SEND_FILE) {
-            std::cout << msg.from_username << " send a file to you\n";
-            recv_file(peer_ssl);   
+            // 超過上限的連線直接關掉，不會無限制地開 thread
+            if (++active_receivers > MAX_FILE_RECEIVERS) {
+                active_receivers--;
+                std::cerr << "Too many file transfers in progress, refused one from " << msg.from_username << "\n";
+                ssl_free(peer_ssl, peer_fd);
+                continue;
+            }
+            if (msg.payload[0] == '\0') std::cout << msg.from_username << " send a file to you\n";
+            FileReceiver* receiver = new FileReceiver{peer_ssl, peer_fd, msg.payload};
+            pthread_t thread;
+            if (pthread_create(&thread, nullptr, file_receiver_thread_func, receiver) == 0) {
+                pthread_detach(thread);
+            } else {
+                file_receiver_thread_func(receiver);
+            }
+            continue;
         } else if(msg.msg_type == DIRECT_STREAMING) {
             enqueue_frame(client->get_streaming_queue(), peer_ssl);
         } else if(msg.msg_type == DIRECT_AUDIO_STREAMING) {
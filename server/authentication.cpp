@@ -1,10 +1,32 @@
 #include "authentication.hpp"
 #include <sstream>
 #include <functional>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 
-std::unordered_map<std::string, std::string> Authentication::user_data;
-std::string Authentication::data_file_path = "user_data.txt";
-std::mutex Authentication::auth_mutex;
+UserTable Authentication::user_table;
+std::string Authentication::data_file_path = "user_data.log";
+std::string Authentication::legacy_file_path = "user_data.txt";
+UserStore Authentication::user_store;
+std::mutex Authentication::update_mutex;
+std::condition_variable Authentication::update_cond;
+std::vector<Authentication::PendingUpdate*> Authentication::pending_updates;
+bool Authentication::publishing = false;
+std::unique_ptr<ThreadPool> Authentication::hash_pool;
+std::atomic<int> Authentication::pending_hashes(0);
+
+// 交給 hashing pool 的一個 register / login
+struct HashJob {
+    AuthResult (*job)(const std::string&, const std::string&);
+    std::string username;
+    std::string password;
+    AuthCallback done;
+};
 
 std::string auth_result_to_string(AuthResult result) {
     switch (result) {
@@ -16,72 +38,221 @@ std::string auth_result_to_string(AuthResult result) {
             return "Username not found";
         case AuthResult::WrongPassword:
             return "Wrong password";
+        case AuthResult::ServerBusy:
+            return "Server busy";
+        case AuthResult::StorageError:
+            return "Server failed to save the account";
+        case AuthResult::HashError:
+            return "Server failed to hash the password";
         default:
             return "Unknown result";
     }
 }
 
-void Authentication::load_user_data() {
-    std::ifstream file(data_file_path);
-    if (!file.is_open()) return;
+void Authentication::load_user_data(int hash_threads) {
+    std::unordered_map<std::string, std::string> users;
+    if (user_store.open(data_file_path, legacy_file_path, users)) {
+        std::cout << "Loaded " << users.size() << " users from " << data_file_path << std::endl;
+    } else {
+        std::cerr << "Failed to open " << data_file_path << ", new accounts will not be saved" << std::endl;
+    }
+    user_table.load(users);
 
-    std::string line;
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
-        std::string username, password;
-        iss >> username >> password;
-        user_data[username] = password;
+    if (hash_threads <= 0) {
+        long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        hash_threads = (int)std::clamp<long>(cpu_count, 1, MAX_HASH_THREADS);
     }
-    file.close();
+    hash_pool = std::make_unique<ThreadPool>(hash_threads);
+    hash_pool->start();
 }
 
-void Authentication::save_user_data() {
-    std::ofstream file(data_file_path, std::ios::trunc);
-    if (!file.is_open()) return;
+static std::string to_hex(const unsigned char* data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(len * 2);
+    for (size_t i = 0; i < len; i++) {
+        hex.push_back(digits[data[i] >> 4]);
+        hex.push_back(digits[data[i] & 0xF]);
+    }
+    return hex;
+}
 
-    for (const auto& [username, password] : user_data) {
-        file << username << " " << password << "\n";
+static bool from_hex(const std::string& hex, unsigned char* out, size_t len) {
+    if (hex.size() != len * 2) return false;
+    for (size_t i = 0; i < len; i++) {
+        unsigned int byte;
+        if (sscanf(hex.c_str() + i * 2, "%2x", &byte) != 1) return false;
+        out[i] = static_cast<unsigned char>(byte);
     }
-    file.close();
+    return true;
+}
+
+static bool pbkdf2(const std::string& password, const unsigned char* salt, int iterations, unsigned char* out) {
+    return PKCS5_PBKDF2_HMAC(password.data(), (int)password.size(), salt, PBKDF2_SALT_SIZE,
+                             iterations, EVP_sha256(), PBKDF2_HASH_SIZE, out) == 1;
 }
 
+/* 存成 "pbkdf2$<iterations>$<salt hex>$<hash hex>"，每個帳號都有自己的 random salt */
 std::string Authentication::hash_password(const std::string& password) {
-    std::hash<std::string> hasher;
-    return std::to_string(hasher(password));
+    unsigned char salt[PBKDF2_SALT_SIZE];
+    unsigned char hash[PBKDF2_HASH_SIZE];
+    if (RAND_bytes(salt, sizeof(salt)) != 1 || !pbkdf2(password, salt, PBKDF2_ITERATIONS, hash)) {
+        return "";
+    }
+    return "pbkdf2$" + std::to_string(PBKDF2_ITERATIONS) + "$" + to_hex(salt, sizeof(salt)) + "$" + to_hex(hash, sizeof(hash));
+}
+
+bool Authentication::verify_password(const std::string& password, const std::string& stored) {
+    // 舊版的帳號：std::hash 的結果
+    if (stored.compare(0, 7, "pbkdf2$") != 0) {
+        return stored == std::to_string(std::hash<std::string>()(password));
+    }
+
+    size_t salt_pos = stored.find('$', 7);
+    size_t hash_pos = (salt_pos == std::string::npos) ? std::string::npos : stored.find('$', salt_pos + 1);
+    if (hash_pos == std::string::npos) return false;
+
+    int iterations = std::atoi(stored.c_str() + 7);
+    unsigned char salt[PBKDF2_SALT_SIZE];
+    unsigned char expected[PBKDF2_HASH_SIZE];
+    unsigned char actual[PBKDF2_HASH_SIZE];
+    if (iterations <= 0 ||
+        !from_hex(stored.substr(salt_pos + 1, hash_pos - salt_pos - 1), salt, sizeof(salt)) ||
+        !from_hex(stored.substr(hash_pos + 1), expected, sizeof(expected)) ||
+        !pbkdf2(password, salt, iterations, actual)) {
+        return false;
+    }
+    return CRYPTO_memcmp(expected, actual, sizeof(actual)) == 0;
+}
+
+/* 在 hashing pool 上跑 job，跑完在同一個 thread 上呼叫 done
+排隊的太多時不排隊，直接回 ServerBusy，避免一波 login 把記憶體和延遲都撐爆
+*/
+void Authentication::submit(AuthResult (*job)(const std::string&, const std::string&),
+                            const std::string& username, const std::string& password, AuthCallback done) {
+    if (!hash_pool) {
+        done(job(username, password));
+        return;
+    }
+    if (pending_hashes.fetch_add(1) >= MAX_PENDING_HASHES) {
+        pending_hashes--;
+        done(AuthResult::ServerBusy);
+        return;
+    }
+
+    auto task = std::make_shared<HashJob>(HashJob{job, username, password, std::move(done)});
+    hash_pool->add_task([task]() {
+        AuthResult result = task->job(task->username, task->password);
+        pending_hashes--;
+        task->done(result);
+    });
+}
+
+void Authentication::register_user_async(const std::string& username, const std::string& password, AuthCallback done) {
+    submit(register_user, username, password, std::move(done));
+}
+
+void Authentication::login_user_async(const std::string& username, const std::string& password, AuthCallback done) {
+    submit(login_user, username, password, std::move(done));
+}
+
+/* 把 pending 排進 pending_updates，等到它被套用完才回傳
+沒有人在套用時，自己把目前排隊的全部拿走，一次套用到 user_table (每個 shard 只複製一次)
+並 append 到 user_store；套用的時候又排進來的，由下一輪一起處理。
+*/
+void Authentication::commit_update(PendingUpdate& pending) {
+    pending.done = false;
+    std::unique_lock<std::mutex> lock(update_mutex);
+    pending_updates.push_back(&pending);
+
+    while (!pending.done) {
+        if (publishing) {
+            update_cond.wait(lock);
+            continue;
+        }
+
+        publishing = true;
+        std::vector<PendingUpdate*> batch;
+        batch.swap(pending_updates);
+        lock.unlock();
+
+        std::vector<UserTable::Update*> updates;
+        updates.reserve(batch.size());
+        for (PendingUpdate* item : batch) updates.push_back(&item->update);
+        user_table.apply(updates);
+        for (PendingUpdate* item : batch) {
+            // 只放進 log 的 buffer，不碰 disk；刪除 (撤回沒寫進 disk 的註冊) 不用寫 log
+            if (item->update.applied && !item->update.hash.empty()) {
+                item->ticket = user_store.append(item->update.username, item->update.hash, item->update.expected);
+            }
+        }
+
+        lock.lock();
+        for (PendingUpdate* item : batch) item->done = true;
+        publishing = false;
+        update_cond.notify_all();
+    }
 }
 
 AuthResult Authentication::register_user(const std::string& username, const std::string& password) {
-    std::lock_guard<std::mutex> lock(auth_mutex);
+    if (user_table.contains(username)) {
+        return AuthResult::UsernameExists; // Username exists
+    }
+
+    // 算 hash 不拿任何鎖；套用時會再檢查一次，同時註冊同一個名字的只有一個人會成功
+    // PBKDF2 / RAND 失敗時 hash 是空的，存進去的話這個帳號永遠登入不了
+    std::string hash = hash_password(password);
+    if (hash.empty()) {
+        std::cerr << "Failed to hash password for " << username << std::endl;
+        return AuthResult::HashError;
+    }
 
-    if (user_data.find(username) != user_data.end()) {
+    PendingUpdate pending;
+    pending.update = {username, hash, "", false};
+    commit_update(pending);
+    if (!pending.update.applied) {
         return AuthResult::UsernameExists; // Username exists
     }
 
-    user_data[username] = hash_password(password);
-    save_user_data();
+    // 等 fdatasync (和同時註冊的人共用一次) 的時候沒有握著任何鎖，login 不會被 disk 擋住
+    if (!user_store.wait_durable(pending.ticket)) {
+        // 沒寫進 disk 就不算註冊成功，把 user_table 裡的帳號撤回
+        std::cerr << "Failed to save user " << username << std::endl;
+        PendingUpdate rollback;
+        rollback.update = {username, "", pending.update.hash, false};
+        commit_update(rollback);
+        return AuthResult::StorageError;
+    }
     return AuthResult::Success; // Success
 }
 
 AuthResult Authentication::login_user(const std::string& username, const std::string& password) {
-    std::lock_guard<std::mutex> lock(auth_mutex);
-
-    auto it = user_data.find(username);
-    if (it == user_data.end()) {
+    // 從 snapshot 複製一份 hash 出來，不拿鎖
+    std::string stored;
+    if (!user_table.find(username, stored)) {
         return AuthResult::UsernameNotFound; // Username not found
     }
 
-    if (it->second != hash_password(password)) {
+    if (!verify_password(password, stored)) {
         return AuthResult::WrongPassword; // Wrong password
     }
 
+    // 舊版 std::hash 的帳號登入成功時順便換成 PBKDF2 (中間被別人改過就不換)
+    if (stored.compare(0, 7, "pbkdf2$") != 0) {
+        std::string upgraded = hash_password(password);
+        if (!upgraded.empty()) {
+            PendingUpdate pending;
+            pending.update = {username, upgraded, stored, false};
+            commit_update(pending);
+        }
+    }
+
     return AuthResult::Success; // Success
 }
 
 AuthResult Authentication::logout_user(const std::string& username) {
-    std::lock_guard<std::mutex> lock(auth_mutex);
     // Logic for logout if needed (e.g., maintain online status)
-    auto it = user_data.find(username);
-    if (it == user_data.end()) {
+    if (!user_table.contains(username)) {
         return AuthResult::Success;
     }
     return AuthResult::Success;
@@ -3,34 +3,84 @@
 
 #include <string>
 #include <unordered_map>
-#include <fstream>
 #include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <functional>
 #include <iostream>
+#include "user_store.hpp"
+#include "user_table.hpp"
+#include "threadpool.hpp"
+
+#define PBKDF2_ITERATIONS 100000    // PBKDF2-HMAC-SHA256 的 iteration 次數
+#define PBKDF2_SALT_SIZE 16
+#define PBKDF2_HASH_SIZE 32
+#define MAX_HASH_THREADS 8          // hashing pool 最多幾個 thread
+#define MAX_PENDING_HASHES 256      // 排隊中的 hashing 超過這個數量就直接回 ServerBusy
 
 enum class AuthResult {
     Success = 0,
     UsernameExists = -1,
     UsernameNotFound = -2,
-    WrongPassword = -3
+    WrongPassword = -3,
+    ServerBusy = -4,
+    StorageError = -5,
+    HashError = -6
 };
 
 std::string auth_result_to_string(AuthResult result);
 
+using AuthCallback = std::function<void(AuthResult)>;
+
+/* 帳號驗證
+password 用 PBKDF2 存，算一次要好幾十 ms，所以 register / login 都交給專用的 hashing pool：
+- 不佔用 EventLoop 和處理 packet 的 worker，其他訊息不會被一堆 login 卡住
+- login 查 user_table 完全不拿鎖 (見 user_table.hpp)
+- 註冊和舊 hash 的升級排進 pending_updates，由其中一個 thread 整批套用到 user_table 並寫進 log
+- 算完之後在 hashing thread 上呼叫 callback，由 callback 把結果送回連線
+*/
 class Authentication {
 public:
-    // Result Codes: 0 -> Success, -1 -> Username exists, -2 -> Username not found, -3 -> Wrong password
+    // Result Codes: 0 -> Success, -1 -> Username exists, -2 -> Username not found, -3 -> Wrong password, -4 -> Server busy, -5 -> Storage error, -6 -> Hash error
+    static void register_user_async(const std::string& username, const std::string& password, AuthCallback done);
+    static void login_user_async(const std::string& username, const std::string& password, AuthCallback done);
+
+    // 同步版本：會在呼叫的 thread 上算 hash
     static AuthResult register_user(const std::string& username, const std::string& password);
     static AuthResult login_user(const std::string& username, const std::string& password);
     static AuthResult logout_user(const std::string& username);
-    static void load_user_data();
+
+    // 載入帳號並啟動 hashing pool (hash_threads <= 0 時依照 CPU 數量決定)
+    static void load_user_data(int hash_threads = 0);
 
 private:
-    static std::unordered_map<std::string, std::string> user_data; // username -> hashed password
+    // 排隊等著套用到 user_table 的一筆更新
+    struct PendingUpdate {
+        UserTable::Update update;
+        uint64_t ticket;    // 套用成功時在 user_store 的 ticket
+        bool done;
+    };
+
+    static UserTable user_table;    // username -> hashed password
     static std::string data_file_path;
-    static std::mutex auth_mutex;
+    static std::string legacy_file_path;    // 舊版一行一個帳號的文字檔，只在第一次啟動時轉進 log
+    static UserStore user_store;
+
+    static std::mutex update_mutex;
+    static std::condition_variable update_cond;
+    static std::vector<PendingUpdate*> pending_updates;
+    static bool publishing;     // 已經有 thread 在套用一批更新
+
+    static std::unique_ptr<ThreadPool> hash_pool;
+    static std::atomic<int> pending_hashes;
 
-    static void save_user_data();
+    static void submit(AuthResult (*job)(const std::string&, const std::string&),
+                       const std::string& username, const std::string& password, AuthCallback done);
+    static void commit_update(PendingUpdate& pending);
     static std::string hash_password(const std::string& password);
+    static bool verify_password(const std::string& password, const std::string& stored);
 };
 
 #endif // AUTHENTICATION_HPP
\ No newline at end of file
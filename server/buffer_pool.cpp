@@ -0,0 +1,68 @@
+#include "buffer_pool.hpp"
+
+#include <cstring>
+#include <algorithm>
+
+BufferPool& BufferPool::instance() {
+    static BufferPool pool;
+    return pool;
+}
+
+BufferPool::BufferPool() {
+    pthread_mutex_init(&pool_mutex, nullptr);
+}
+
+BufferPool::~BufferPool() {
+    for (Buffer* buffer : free_list) {
+        delete[] buffer->data;
+        delete buffer;
+    }
+    pthread_mutex_destroy(&pool_mutex);
+}
+
+std::shared_ptr<Buffer> BufferPool::acquire(size_t min_capacity) {
+    Buffer* buffer = nullptr;
+
+    if (min_capacity <= BUFFER_BLOCK_SIZE) {
+        pthread_mutex_lock(&pool_mutex);
+        if (!free_list.empty()) {
+            buffer = free_list.back();
+            free_list.pop_back();
+        }
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    if (!buffer) {
+        buffer = new Buffer;
+        buffer->capacity = std::max<size_t>(min_capacity, BUFFER_BLOCK_SIZE);
+        buffer->data = new char[buffer->capacity];
+    }
+
+    return std::shared_ptr<Buffer>(buffer, [this](Buffer* b) { release(b); });
+}
+
+void BufferPool::release(Buffer* buffer) {
+    // 只回收標準大小的 buffer，特別大的 (例如很大的 video frame) 直接還給系統
+    if (buffer->capacity == BUFFER_BLOCK_SIZE) {
+        pthread_mutex_lock(&pool_mutex);
+        if (free_list.size() < MAX_FREE_BUFFERS) {
+            free_list.push_back(buffer);
+            buffer = nullptr;
+        }
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    if (buffer) {
+        delete[] buffer->data;
+        delete buffer;
+    }
+}
+
+BufferRef copy_to_buffer(const void* data, size_t len) {
+    BufferRef ref;
+    ref.buffer = BufferPool::instance().acquire(len);
+    memcpy(ref.buffer->data, data, len);
+    ref.data = ref.buffer->data;
+    ref.size = len;
+    return ref;
+}
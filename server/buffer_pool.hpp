@@ -0,0 +1,50 @@
+#ifndef BUFFER_POOL_HPP
+#define BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include <pthread.h>
+
+#define BUFFER_BLOCK_SIZE (64 * 1024)   // 一般 buffer 的大小，比這個大的 buffer 不回收
+#define MAX_FREE_BUFFERS 256            // pool 最多留幾個閒置的 buffer
+
+struct Buffer {
+    char* data;
+    size_t capacity;
+};
+
+/* 重複使用固定大小的 buffer
+acquire 拿到的是 shared_ptr，最後一個參照消失時 buffer 會自動回到 pool，
+所以切出去的 packet 可以安心地在不同 thread 之間傳遞。
+*/
+class BufferPool {
+public:
+    static BufferPool& instance();
+
+    std::shared_ptr<Buffer> acquire(size_t min_capacity = BUFFER_BLOCK_SIZE);
+
+private:
+    BufferPool();
+    ~BufferPool();
+
+    void release(Buffer* buffer);
+
+    pthread_mutex_t pool_mutex;
+    std::vector<Buffer*> free_list;
+};
+
+// 指向某個 Buffer 裡面一段資料的參照，複製它不會複製資料
+struct BufferRef {
+    std::shared_ptr<Buffer> buffer;
+    const char* data = nullptr;
+    size_t size = 0;
+
+    std::string_view view() const { return std::string_view(data, size); }
+};
+
+// 把 len bytes 複製進一個新的 buffer (給 server 自己產生的訊息用)
+BufferRef copy_to_buffer(const void* data, size_t len);
+
+#endif // BUFFER_POOL_HPP
@@ -0,0 +1,268 @@
+#include "chunk_store.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool pread_all(int fd, char* data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, data, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool pwrite_all(int fd, const char* data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static std::string hash_key(const unsigned char* hash) {
+    return std::string(reinterpret_cast<const char*>(hash), CHUNK_HASH_SIZE);
+}
+
+ChunkStore::ChunkStore()
+    : data_fd(-1), index_fd(-1), index(nullptr), index_size(0), slot_count(0), tick(0) {
+    pthread_mutex_init(&store_mutex, nullptr);
+}
+
+ChunkStore::~ChunkStore() {
+    close();
+    pthread_mutex_destroy(&store_mutex);
+}
+
+bool ChunkStore::open(const std::string& dir, size_t capacity) {
+    slot_count = capacity / CHUNK_STORE_SLOT_SIZE;
+    if (slot_count == 0) return false;
+
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        perror("mkdir(chunk_store)");
+        return false;
+    }
+    std::string index_path = dir + "/index.dat";
+    std::string data_path = dir + "/chunks.dat";
+    index_fd = ::open(index_path.c_str(), O_RDWR | O_CREAT, 0644);
+    data_fd = ::open(data_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (index_fd < 0 || data_fd < 0) {
+        perror("open(chunk_store)");
+        close();
+        return false;
+    }
+
+    char header[CHUNK_STORE_HEADER_SIZE] = {};
+    uint32_t slot_size = CHUNK_STORE_SLOT_SIZE;
+    memcpy(header, CHUNK_STORE_MAGIC, 8);
+    memcpy(header + 8, &slot_count, sizeof(slot_count));
+    memcpy(header + 12, &slot_size, sizeof(slot_size));
+
+    // header 對不上 (第一次用、或 slot 數量 / 大小改了) 就整個清掉重來
+    char old_header[CHUNK_STORE_HEADER_SIZE];
+    index_size = CHUNK_STORE_HEADER_SIZE + (size_t)slot_count * sizeof(ChunkEntry);
+    bool reuse = pread_all(index_fd, old_header, sizeof(old_header), 0) &&
+                 memcmp(old_header, header, sizeof(header)) == 0;
+    if (!reuse && (ftruncate(index_fd, 0) < 0 || ftruncate(data_fd, 0) < 0 ||
+                   !pwrite_all(index_fd, header, sizeof(header), 0))) {
+        perror("ftruncate(chunk_store)");
+        close();
+        return false;
+    }
+    if (ftruncate(index_fd, index_size) < 0 || ftruncate(data_fd, (off_t)slot_count * CHUNK_STORE_SLOT_SIZE) < 0) {
+        perror("ftruncate(chunk_store)");
+        close();
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, index_size, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd, 0);
+    if (mapping == MAP_FAILED) {
+        perror("mmap(chunk_store)");
+        close();
+        return false;
+    }
+    index = reinterpret_cast<ChunkEntry*>(static_cast<char*>(mapping) + CHUNK_STORE_HEADER_SIZE);
+
+    // 依照 last_used 排回 LRU 的順序
+    std::vector<std::pair<uint64_t, uint32_t>> used;
+    for (uint32_t slot = 0; slot < slot_count; slot++) {
+        if (index[slot].length > 0 && index[slot].length <= CHUNK_STORE_SLOT_SIZE) {
+            used.emplace_back(index[slot].last_used, slot);
+        } else {
+            index[slot].length = 0;
+        }
+    }
+    std::sort(used.begin(), used.end());
+
+    pins.assign(slot_count, 0);
+    lru_pos.assign(slot_count, lru.end());
+    for (auto& [last_used, slot] : used) {
+        if (!slots.emplace(hash_key(index[slot].hash), slot).second) {
+            index[slot].length = 0;     // 同一個 hash 存了兩次，留最近用過的那個
+            continue;
+        }
+        lru.push_front(slot);
+        lru_pos[slot] = lru.begin();
+        tick = std::max(tick, last_used);
+    }
+    for (uint32_t slot = slot_count; slot-- > 0;) {
+        if (lru_pos[slot] == lru.end()) {
+            index[slot].length = 0;
+            free_slots.push_back(slot);
+        }
+    }
+
+    std::cout << "Chunk store: " << slots.size() << " of " << slot_count << " chunks in " << dir << std::endl;
+    return true;
+}
+
+void ChunkStore::close() {
+    if (index) munmap(reinterpret_cast<char*>(index) - CHUNK_STORE_HEADER_SIZE, index_size);
+    if (index_fd >= 0) ::close(index_fd);
+    if (data_fd >= 0) ::close(data_fd);
+    index = nullptr;
+    index_fd = -1;
+    data_fd = -1;
+
+    slots.clear();
+    lru.clear();
+    lru_pos.clear();
+    pins.clear();
+    free_slots.clear();
+}
+
+// 以下都要拿著 store_mutex
+void ChunkStore::touch(uint32_t slot) {
+    index[slot].last_used = ++tick;
+    lru.splice(lru.begin(), lru, lru_pos[slot]);
+}
+
+void ChunkStore::forget(uint32_t slot) {
+    slots.erase(hash_key(index[slot].hash));
+    lru.erase(lru_pos[slot]);
+    lru_pos[slot] = lru.end();
+    index[slot].length = 0;
+}
+
+// 拿一個空的 slot，沒有的話淘汰最久沒用、沒被 pin 住的 chunk
+int ChunkStore::take_slot() {
+    if (!free_slots.empty()) {
+        uint32_t slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+    for (auto it = lru.rbegin(); it != lru.rend(); ++it) {
+        uint32_t slot = *it;
+        if (pins[slot] > 0) continue;
+        forget(slot);
+        return slot;
+    }
+    return -1;
+}
+
+int ChunkStore::acquire(const unsigned char* hash) {
+    if (!index) return -1;
+
+    pthread_mutex_lock(&store_mutex);
+    auto it = slots.find(hash_key(hash));
+    int slot = -1;
+    if (it != slots.end()) {
+        slot = it->second;
+        pins[slot]++;
+        touch(slot);
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return slot;
+}
+
+int ChunkStore::put(const unsigned char* hash, const char* data, size_t len, uint32_t crc) {
+    if (!index || len == 0 || len > CHUNK_STORE_SLOT_SIZE) return -1;
+
+    int existing = acquire(hash);
+    if (existing >= 0) return existing;
+
+    // 先 pin 住一個空的 slot (不在 slots / lru 裡，其他人看不到)，寫資料時不拿 lock
+    pthread_mutex_lock(&store_mutex);
+    int slot = take_slot();
+    if (slot >= 0) pins[slot] = 1;
+    pthread_mutex_unlock(&store_mutex);
+    if (slot < 0) return -1;
+
+    bool written = pwrite_all(data_fd, data, len, (off_t)slot * CHUNK_STORE_SLOT_SIZE);
+
+    pthread_mutex_lock(&store_mutex);
+    auto it = slots.find(hash_key(hash));
+    if (!written || it != slots.end()) {
+        // 寫入失敗，或是寫的時候別人已經放進同樣的 chunk
+        pins[slot] = 0;
+        free_slots.push_back(slot);
+        slot = -1;
+        if (it != slots.end()) {
+            slot = it->second;
+            pins[slot]++;
+            touch(slot);
+        }
+    } else {
+        memcpy(index[slot].hash, hash, CHUNK_HASH_SIZE);
+        index[slot].crc = crc;
+        index[slot].length = len;
+        slots.emplace(hash_key(hash), slot);
+        lru.push_front(slot);
+        lru_pos[slot] = lru.begin();
+        index[slot].last_used = ++tick;
+    }
+    pthread_mutex_unlock(&store_mutex);
+    return slot;
+}
+
+bool ChunkStore::read(int slot, char* dst, size_t& len, uint32_t& crc) {
+    if (!index || slot < 0 || (uint32_t)slot >= slot_count) return false;
+
+    // pin 住的 slot 不會被改掉，讀資料時不用拿 lock
+    pthread_mutex_lock(&store_mutex);
+    len = index[slot].length;
+    crc = index[slot].crc;
+    pthread_mutex_unlock(&store_mutex);
+
+    if (len > 0 && pread_all(data_fd, dst, len, (off_t)slot * CHUNK_STORE_SLOT_SIZE) && crc32c(dst, len) == crc) {
+        return true;
+    }
+
+    std::cerr << "Chunk store: slot " << slot << " is corrupted, dropped" << std::endl;
+    pthread_mutex_lock(&store_mutex);
+    if (lru_pos[slot] != lru.end()) forget(slot);
+    pthread_mutex_unlock(&store_mutex);
+    return false;
+}
+
+void ChunkStore::release(int slot) {
+    if (!index || slot < 0) return;
+
+    pthread_mutex_lock(&store_mutex);
+    // 被 pin 住的時候因為讀不出來而丟掉的 slot，最後一個 pin 放掉時才能重新使用
+    if (--pins[slot] == 0 && lru_pos[slot] == lru.end()) free_slots.push_back(slot);
+    pthread_mutex_unlock(&store_mutex);
+}
+
+size_t ChunkStore::size() {
+    pthread_mutex_lock(&store_mutex);
+    size_t count = slots.size();
+    pthread_mutex_unlock(&store_mutex);
+    return count;
+}
@@ -0,0 +1,85 @@
+#ifndef CHUNK_STORE_HPP
+#define CHUNK_STORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+#include "../shared/checksum.hpp"
+#include "../shared/file_transfer.hpp"
+
+/* relay 傳檔案用的 content-addressed chunk store
+
+放在 <dir>/chunks.dat 和 <dir>/index.dat：
+- chunks.dat 切成固定大小的 slot (CHUNK_STORE_SLOT_SIZE)，一個 slot 放一個 chunk
+- index.dat 是 CHUNK_STORE_HEADER_SIZE 的 header 加上每個 slot 一個 ChunkEntry，整個 mmap 進來，
+  啟動時不用掃 chunks.dat 就能知道有哪些 chunk
+
+    +----------+----------+---------+-----------+
+    | key      | length   | crc32c  | last_used |
+    | 32 bytes | 4 bytes  | 4 bytes | 8 bytes   |
+    +----------+----------+---------+-----------+
+
+key 是呼叫端給的 32 bytes (relay 傳檔案用上傳者的 username 加上 chunk 的 sha256 算出來，見 client_handler.cpp)。
+
+length 是 0 代表空的 slot。last_used 是每次用到時遞增的 tick，重新啟動後照它排回 LRU 的順序。
+- 寫入時先把 entry 清掉、寫好資料，最後才填 entry；crash 時 index 的 page 還是可能比資料先寫到 disk，
+  所以讀出來的資料會再用 crc32c 檢查一次，對不上的 chunk 直接丟掉
+- 空間滿了就淘汰最久沒用的 chunk，正在傳的檔案用到的 chunk 會被 pin 住，不會被淘汰
+*/
+#define CHUNK_STORE_MAGIC "CHUNKST2"     // key 的算法改了就換 magic，舊的 store 會整個清掉
+#define CHUNK_STORE_HEADER_SIZE 64      // magic(8) + slot 數量(4) + slot 大小(4) + reserved
+#define CHUNK_STORE_SLOT_SIZE FILE_CHUNK_SIZE
+
+struct ChunkEntry {
+    unsigned char hash[CHUNK_HASH_SIZE];
+    uint32_t length;
+    uint32_t crc;
+    uint64_t last_used;
+};
+
+class ChunkStore {
+public:
+    ChunkStore();
+    ~ChunkStore();
+
+    // 最多放 capacity bytes (capacity 是 0 時不開，之後 acquire / put 都會失敗)
+    bool open(const std::string& dir, size_t capacity);
+    void close();
+    bool is_open() const { return index != nullptr; }
+
+    // key 已經在 store 裡時 pin 住並回傳它的 slot，否則回傳 -1
+    int acquire(const unsigned char* hash);
+    // 放進一個 chunk 並 pin 住 (已經有同樣的 key 時直接 pin 住那一個)；沒有空間 (全部都被 pin 住) 時回傳 -1
+    int put(const unsigned char* hash, const char* data, size_t len, uint32_t crc);
+    // 讀出 pin 住的 slot，dst 至少要有 CHUNK_STORE_SLOT_SIZE；讀不到或 crc 對不上時回傳 false
+    bool read(int slot, char* dst, size_t& len, uint32_t& crc);
+    // 放掉 acquire / put 的 pin
+    void release(int slot);
+
+    size_t size();      // 目前放了幾個 chunk
+
+private:
+    void touch(uint32_t slot);
+    void forget(uint32_t slot);
+    int take_slot();
+
+    int data_fd;
+    int index_fd;
+    ChunkEntry* index;      // mmap 進來的 index.dat (跳過 header)
+    size_t index_size;      // 整個 mapping 的大小
+    uint32_t slot_count;
+
+    pthread_mutex_t store_mutex;
+    std::unordered_map<std::string, uint32_t> slots;    // key -> slot
+    std::list<uint32_t> lru;                            // 前面是最近用過的
+    std::vector<std::list<uint32_t>::iterator> lru_pos;
+    std::vector<uint32_t> pins;
+    std::vector<uint32_t> free_slots;
+    uint64_t tick;
+};
+
+#endif // CHUNK_STORE_HPP
@@ -2,170 +2,184 @@
 
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 #include <cstring>
 #include <unistd.h>
 #include <arpa/inet.h>
-#include <map>
-#include <pthread.h>
+#include <charconv>
+#include <string_view>
+#include <unordered_set>
 #include "authentication.hpp"
+#include "chunk_store.hpp"
 #include "../shared/message.hpp"
+#include "../shared/protocol.hpp"
 #include "../shared/ssl.hpp"
 #include "../shared/streaming.hpp"
+#include "../shared/compress.hpp"
+#include "../shared/file_transfer.hpp"
 
 /* 管理 Client 資訊*/
-static std::map<int, ClientInfo> clients;                           // 用於把 client_id 對應到 ClientInfo
-static pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;   // client 的 mutex lock
-static int next_client_id = 1;
+static ClientRegistry clients;      // client_id / username -> ClientInfo
+static ChunkStore chunk_store;      // relay 傳過的檔案內容 (chunk_key -> chunk)
 
-void handle_message(SSL *client_ssl, int client_socket, const Message& msg, int client_id);
-void send_message(SSL *client_ssl, int socket_fd, const Message& msg);
+void handle_join(const std::shared_ptr<Connection>& conn, const MessageView& msg);
+void handle_message(const std::shared_ptr<Connection>& conn, const Packet& packet, const MessageView& msg);
+void send_message(const std::shared_ptr<Connection>& conn, const Message& msg);
+std::shared_ptr<Connection> find_online_client(int client_id);
 bool get_client_info(std::stringstream& user_info);
-void handle_authentication(const Message& response);
-void transfer_file(SSL *src_client_ssl, SSL *dst_client_ssl, int socket_fd);
-
-void handle_client(SSL *client_ssl, int client_socket) {
-    Message msg;
-    int bytes_read = SSL_read(client_ssl, &msg, sizeof(msg));
-    if (bytes_read <= 0) {
-        SSL_shutdown(client_ssl);
-        SSL_free(client_ssl);
-        close(client_socket);
-        return;
+void relay_file_content(const std::shared_ptr<Connection>& conn, const Packet& packet, const MessageView& msg);
+void relay_manifest(const std::shared_ptr<Connection>& conn, const MessageView& msg);
+static void abort_relay_file(const std::shared_ptr<Connection>& conn);
+
+/* 從 text 開頭切出一個以空白分隔的 token，text 會往後移 */
+static std::string_view next_token(std::string_view& text) {
+    size_t begin = text.find_first_not_of(' ');
+    if (begin == std::string_view::npos) {
+        text = std::string_view();
+        return std::string_view();
     }
+    size_t end = text.find(' ', begin);
+    if (end == std::string_view::npos) end = text.size();
+
+    std::string_view token = text.substr(begin, end - begin);
+    text.remove_prefix(end);
+    return token;
+}
 
-    int assigned_id = -1;
+template <typename T>
+static T parse_number(std::string_view text) {
+    T value = 0;
+    std::from_chars(text.data(), text.data() + text.size(), value);
+    return value;
+}
+
+void handle_packet(const std::shared_ptr<Connection>& conn, const Packet& packet) {
+    // msg 的 username / payload 都直接指向 packet 的 buffer，不複製
+    MessageView msg;
+    if (!decode_message_view(packet.bytes.data, packet.bytes.size, msg)) {
+        conn->close();
+        return;
+    }
 
     /* 預期使用者的第一個 Message 是 JOIN
     否則直接把 connection close 掉
     */
-    if (msg.msg_type == JOIN) {
-        int listen_port = atoi(msg.payload);
-        struct sockaddr_in addr;
-        socklen_t len = sizeof(addr);
-        getpeername(client_socket, (struct sockaddr*)&addr, &len);
-        std::string client_ip = inet_ntoa(addr.sin_addr);
-
-        assigned_id = -1;
-        pthread_mutex_lock(&clients_mutex);
-        assigned_id = next_client_id++;
-        clients[assigned_id] = {assigned_id, client_socket, client_ip, listen_port, true, client_ssl};
-        pthread_mutex_unlock(&clients_mutex);
-
-        std::cout << "Client joined: ID=" << assigned_id << ", IP=" << client_ip
-                  << ", Port=" << listen_port << std::endl;
-    } else {
-        SSL_shutdown(client_ssl);
-        SSL_free(client_ssl);
-        close(client_socket);
+    if (conn->client_id < 0) {
+        handle_join(conn, msg);
         return;
     }
 
-    /* 與 connection 對面的 client 對話 */
-    while (true) {
-        int r = SSL_read(client_ssl, &msg, sizeof(msg));
-        if (r <= 0) {
-            pthread_mutex_lock(&clients_mutex);
-            for (auto& kv : clients) {
-                if (kv.second.socket_fd == client_socket) {
-                    kv.second.online = false;
-                    break;
-                }
-            }
-            pthread_mutex_unlock(&clients_mutex);
-            SSL_shutdown(client_ssl);
-            SSL_free(client_ssl);
-            close(client_socket);
-            return;
-        }
+    handle_message(conn, packet, msg);
+}
 
-        handle_message(client_ssl, client_socket, msg, assigned_id);
+void handle_join(const std::shared_ptr<Connection>& conn, const MessageView& msg) {
+    if (msg.header.msg_type != JOIN) {
+        conn->close();
+        return;
     }
+
+    int listen_port = parse_number<int>(msg.payload);
+    conn->accepts_compressed = msg.header.flags & WIRE_FLAG_ACCEPTS_COMPRESSED;
+
+    int assigned_id = clients.add(conn, listen_port);
+    conn->client_id = assigned_id;
+
+    std::cout << "Client joined: ID=" << assigned_id << ", IP=" << conn->ip
+              << ", Port=" << listen_port << std::endl;
 }
 
-void register_client(int client_socket, const std::string& ip, int listen_port, int& assigned_id) {
-    pthread_mutex_lock(&clients_mutex);
-    assigned_id = next_client_id++;
-    clients[assigned_id] = {assigned_id, client_socket, ip, listen_port, true};
-    pthread_mutex_unlock(&clients_mutex);
+void handle_disconnect(const std::shared_ptr<Connection>& conn) {
+    abort_relay_file(conn);
+    if (conn->client_id < 0) return;
+    clients.disconnect(conn->client_id, conn);
 }
 
-void handle_message(SSL *client_ssl, int client_socket, const Message& msg, int client_id) {
-    switch (msg.msg_type) {
+std::shared_ptr<Connection> find_online_client(int client_id) {
+    return clients.find_online(client_id);
+}
+
+/* CHAT / RELAY_SEND_FILE / TRANSFER_FILE_CONTENT 轉傳時直接把 packet (buffer 的參照) 放進對方的 out_queue */
+void handle_message(const std::shared_ptr<Connection>& conn, const Packet& packet, const MessageView& msg) {
+    int client_id = conn->client_id;
+    switch (msg.header.msg_type) {
         case REGISTER: {
             // Extract username and password from payload
-            std::istringstream payload_stream(msg.payload);
-            std::string username, password;
-            payload_stream >> username >> password;
-
-            AuthResult result = Authentication::register_user(username, password);
-            std::cout << "[REGISTER] " << username << " " << password  << " " << auth_result_to_string(result) << std::endl;
-            
-            // Send response back to client
-            Message response{};
-            response.msg_type = RESPONSE;
-            response.payload_size = snprintf(response.payload, MAX_PAYLOAD_SIZE, "%s", auth_result_to_string(result).c_str());
-            send_message(client_ssl, client_socket, response);
+            std::string_view payload = msg.payload;
+            std::string username(next_token(payload));
+            std::string password(next_token(payload));
+
+            // 在 hashing pool 算完 hash 之後才回覆，這個 worker 不用等
+            Authentication::register_user_async(username, password, [conn, username](AuthResult result) {
+                std::cout << "[REGISTER] " << username << " " << auth_result_to_string(result) << std::endl;
+
+                // Send response back to client
+                Message response{};
+                response.msg_type = RESPONSE;
+                response.payload_size = snprintf(response.payload, MAX_PAYLOAD_SIZE, "%s", auth_result_to_string(result).c_str());
+                send_message(conn, response);
+            });
             break;
         }
 
         case LOGIN: {
             // Extract username and password from payload
-            std::istringstream payload_stream(msg.payload);
-            std::string username, password;
-            payload_stream >> username >> password;
-
-            AuthResult result = Authentication::login_user(username, password);
-            std::cout << "[LOGIN] " << username << " " << password  << " " << auth_result_to_string(result) << std::endl;
-
-            // Send response back to client
-            Message response{};
-            if (result == AuthResult::Success) {
-                response.msg_type = LOGIN;
-                response.payload_size = snprintf(response.payload, MAX_PAYLOAD_SIZE, "%s", username.c_str());
-                pthread_mutex_lock(&clients_mutex);
-                clients[client_id].username = username;
-                clients[client_id].online = true;
-                pthread_mutex_unlock(&clients_mutex);
-            } else {    
-                response.msg_type = RESPONSE;
-                response.payload_size = snprintf(response.payload, MAX_PAYLOAD_SIZE, "%s", auth_result_to_string(result).c_str());
-            }
-            send_message(client_ssl, client_socket, response);
-            
+            std::string_view payload = msg.payload;
+            std::string username(next_token(payload));
+            std::string password(next_token(payload));
+
+            Authentication::login_user_async(username, password, [conn, client_id, username](AuthResult result) {
+                std::cout << "[LOGIN] " << username << " " << auth_result_to_string(result) << std::endl;
+                if (conn->is_closed()) return;   // 算 hash 的時候 client 已經離開了
+
+                // Send response back to client
+                Message response{};
+                if (result == AuthResult::Success) {
+                    response.msg_type = LOGIN;
+                    response.flags = WIRE_FLAG_ACCEPTS_COMPRESSED;  // 之後的 chat 可以壓縮 (轉給看不懂的 client 時由 server 解開)
+                    response.payload_size = snprintf(response.payload, MAX_PAYLOAD_SIZE, "%s", username.c_str());
+                    clients.login(client_id, username);
+                } else {
+                    response.msg_type = RESPONSE;
+                    response.payload_size = snprintf(response.payload, MAX_PAYLOAD_SIZE, "%s", auth_result_to_string(result).c_str());
+                }
+                send_message(conn, response);
+            });
             break;
         }
 
         case LOGOUT: {
             // Extract username from payload
-            std::string username(msg.payload, msg.payload_size);
+            std::string username(msg.payload);
             Authentication::logout_user(username);
-            pthread_mutex_lock(&clients_mutex);
-            clients[client_id].username = "";
-            clients[client_id].online = false;
-            pthread_mutex_unlock(&clients_mutex);
+            clients.logout(client_id);
             std::cout << "[LOGOUT] " << username << " " << auth_result_to_string(AuthResult::Success) << std::endl;
             break;
         }
 
         case CHAT: {
             // Relay mode: Find recipient socket and forward the message
-            pthread_mutex_lock(&clients_mutex);
-            auto it = clients.find(msg.to_id);
-            if (it != clients.end() && it->second.online) {
-                send_message(it->second.ssl, it->second.socket_fd, msg);
+            auto recipient = find_online_client(msg.header.to_id);
+            if (recipient && (msg.header.flags & WIRE_FLAG_COMPRESSED) && !recipient->accepts_compressed) {
+                // 壓縮過的 chat 轉給看不懂的 client：先解開再送
+                Message chat{};
+                if (decode_message(packet.bytes.data, packet.bytes.size, chat) && decompress_message(chat)) {
+                    send_message(recipient, chat);
+                } else {
+                    std::cerr << "Malformed compressed chat message." << std::endl;
+                }
+            } else if (recipient) {
+                recipient->send(packet.bytes);
             } else {
                 // Recipient not online - optionally send error back
                 std::cerr << "Recipient not online.\n";
             }
-            pthread_mutex_unlock(&clients_mutex);
             break;
         }
 
         case REQUEST_PEER: {
             // Client wants peer info to establish a direct connection
             std::stringstream user_info;
-            Message resp;
-            memset(&resp, 0, sizeof(resp));
+            Message resp{};
             resp.msg_type = PEER_INFO;
 
             if (get_client_info(user_info)) {
@@ -175,58 +189,51 @@ void handle_message(SSL *client_ssl, int client_socket, const Message& msg, int
                 snprintf(resp.payload, MAX_PAYLOAD_SIZE, "NOT_FOUND");
                 resp.payload_size = strlen(resp.payload);
             }
-            send_message(client_ssl, client_socket, resp);
+            send_message(conn, resp);
             break;
         }
 
         case RELAY_SEND_FILE: {
             // Relay mode: Find recipient socket and forward the message
-            pthread_mutex_lock(&clients_mutex);
-            auto it = clients.find(msg.to_id);
-            if (it != clients.end() && it->second.online) {
-                send_message(it->second.ssl, it->second.socket_fd, msg);
+            auto recipient = find_online_client(msg.header.to_id);
+            if (recipient) {
+                recipient->send(packet.bytes);
             } else {
                 // Recipient not online - optionally send error back
                 std::cerr << "Recipient not online.\n";
             }
-            pthread_mutex_unlock(&clients_mutex);
 
-            transfer_file(client_ssl, it->second.ssl, it->second.socket_fd);
+            // 接下來 sender 會送 TRANSFER_FILE_CONTENT，交給 relay_file_content 轉傳
+            conn->set_file_splice(nullptr);
+            conn->relay_target = recipient;
+            conn->relay_file_pending = true;
             break;
         }
 
-        case RELAY_STREAMING: {
-            // Lock the clients map to find the recipient
-            pthread_mutex_lock(&clients_mutex);
-            auto it = clients.find(msg.to_id);
-            if (it == clients.end() || !it->second.online) {
-                // Recipient not online or doesn't exist
-                std::cerr << "Recipient not online or does not exist.\n";
-                pthread_mutex_unlock(&clients_mutex);
-                break;
-            }
-
-            SSL* recipient_ssl = it->second.ssl; // Get recipient's SSL connection
-            pthread_mutex_unlock(&clients_mutex);
+        case TRANSFER_FILE_CONTENT: {
+            relay_file_content(conn, packet, msg);
+            break;
+        }
 
-            streaming(client_ssl, recipient_ssl);
+        case TRANSFER_MANIFEST: {
+            relay_manifest(conn, msg);
             break;
         }
 
+        case RELAY_STREAMING:
         case RELAY_AUDIO_STREAMING: {
-            // Lock the clients map to find the recipient
-            pthread_mutex_lock(&clients_mutex);
-            auto it = clients.find(msg.to_id);
-            if (it == clients.end() || !it->second.online) {
-                // Recipient not online or doesn't exist
+            // 找到 recipient，接下來的 frame 由 EventLoop 直接轉傳給它 (relay pipe)
+            auto recipient = find_online_client(msg.header.to_id);
+            if (recipient) {
+                // 先送通知再建 pipe，recipient 一定會先收到通知才收到 frame
+                Message notify_msg{};
+                notify_msg.msg_type = msg.header.msg_type;
+                send_message(recipient, notify_msg);
+            } else {
+                // Recipient not online or doesn't exist，之後的 frame 直接丟掉
                 std::cerr << "Recipient not online or does not exist.\n";
-                pthread_mutex_unlock(&clients_mutex);
-                break;
             }
-            SSL* recipient_ssl = it->second.ssl; // Get recipient's SSL connection
-            pthread_mutex_unlock(&clients_mutex);
-
-            audio_streaming(client_ssl, recipient_ssl);
+            conn->open_pipe(recipient);
             break;
         }
 
@@ -238,130 +245,332 @@ void handle_message(SSL *client_ssl, int client_socket, const Message& msg, int
         }
 
         default:
-            std::cerr << "Unknown message type: " << msg.msg_type << std::endl;
+            std::cerr << "Unknown message type: " << (int)msg.header.msg_type << std::endl;
     }
 }
 
 bool get_client_info(std::stringstream& user_info) {
     user_info << "Online user:\n";
-    pthread_mutex_lock(&clients_mutex);
-    if(!clients.empty()){
-        for(const auto& [id, info] : clients){
-            if(info.online && info.username != "") user_info << info.username << " ID: "  << info.client_id << " location: " << info.ip << ":" << info.listen_port << "\n"; 
-        }
-        pthread_mutex_unlock(&clients_mutex);
-        return true;
+    if (clients.empty()) return false;
+
+    // online_clients() 回傳的是複本，組字串時不會握著 registry 的鎖
+    for (const ClientInfo& info : clients.online_clients()) {
+        user_info << info.username << " ID: " << info.client_id << " location: " << info.ip << ":" << info.listen_port << "\n";
     }
-    pthread_mutex_unlock(&clients_mutex);
-    return false;
+    return true;
 }
 
-void send_message(SSL *client_ssl, int socket_fd, const Message& msg) {
-    // For simplicity, do a blocking write
-    if (SSL_write(client_ssl, &msg, sizeof(msg)) < 0) {
-        perror("send_message failed");
-    }
+void send_message(const std::shared_ptr<Connection>& conn, const Message& msg) {
+    // 編碼成網路格式後放進對方的 out_queue，由 EventLoop 寫出去
+    std::vector<char> frame;
+    encode_message(msg, frame);
+    conn->send(frame.data(), frame.size());
 }
 
-void transfer_file(SSL *src_client_ssl, SSL *dst_client_ssl, int socket_fd){
-    // 轉傳檔案的 metadata
-    Message metadata;
-    memset(&metadata, 0, sizeof(metadata));
+bool open_chunk_store(size_t capacity) {
+    return capacity > 0 && chunk_store.open(CHUNK_STORE_DIR, capacity);
+}
 
-    int metadata_len = SSL_read(src_client_ssl, &metadata, sizeof(metadata));
-    if (metadata_len <= 0) {
-        std::cerr << "Failed to receive file metadata." << std::endl;
-        return;
+/* chunk 在 store 裡的 key：sha256(<sender 的 username> '\0' <chunk 的 sha256>)
+store 是所有人共用的，只用 chunk 的 sha256 當 key 的話，任何人只要說得出 hash 就能讓 server 把別人傳過的內容
+送給自己指定的 recipient，也能試出別人有沒有 relay 過某個檔案；所以只有同一個 sender 才會用到自己上傳過的 chunk
+*/
+static void chunk_key(const std::string& owner, const unsigned char* hash, unsigned char* key) {
+    std::string input = owner;
+    input.push_back('\0');
+    input.append(reinterpret_cast<const char*>(hash), CHUNK_HASH_SIZE);
+    sha256(input.data(), input.size(), key);
+}
+
+/* 一次 relay 傳檔案的狀態 (收到 metadata 時建立)
+sender 送 TRANSFER_MANIFEST 之後，server 回覆哪些 chunk 不用上傳 (chunk store 已經有、或同一個檔案前面出現過)，
+這些 chunk 由 serve_chunks 從 store 讀出來送給 recipient；sender 上傳的 chunk 照樣直接轉傳，順便放進 store。
+不 dedup 時 (store 沒開等) 大的 chunk 由 EventLoop 直接 splice 給 recipient，不會到 relay_file_content。
+sender 的 worker 和 recipient 消化資料後接著送 chunk 的 worker 會同時用到，所以都要拿 lock
+*/
+struct RelayFile {
+    std::shared_ptr<Connection> recipient;
+    std::string name;
+    uint64_t file_size = 0;
+    uint32_t chunk_size = 0;
+    size_t count = 0;
+
+    std::string manifest;           // 每個 chunk 的 sha256
+    std::string keys;               // 每個 chunk 在 store 裡的 key (chunk_key)
+    bool manifest_done = false;     // 已經回覆 sender
+    bool dedup = false;             // 有 chunk 要從 store 送
+    std::vector<int> slots;         // 每個 chunk pin 住的 store slot (-1 = 沒有)
+    std::vector<size_t> cached;     // sender 不會上傳、要從 store 送的 chunk
+    size_t next_cached = 0;
+    size_t lost = 0;                // store 裡讀不出來、沒送到的 chunk
+    bool draining = false;          // 已經登記在 recipient 上，等它消化資料
+    BufferRef trailer;
+    bool uploads_done = false;      // sender 已經送出 trailer
+    bool finished = false;
+
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+    ~RelayFile() { pthread_mutex_destroy(&lock); }
+
+    const unsigned char* hash(size_t index) const {
+        return reinterpret_cast<const unsigned char*>(manifest.data()) + index * CHUNK_HASH_SIZE;
+    }
+    const unsigned char* key(size_t index) const {
+        return reinterpret_cast<const unsigned char*>(keys.data()) + index * CHUNK_HASH_SIZE;
     }
+    size_t chunk_length(size_t index) const {
+        return std::min<uint64_t>(chunk_size, file_size - (uint64_t)index * chunk_size);
+    }
+};
 
-    if(metadata.msg_type != TRANSFER_FILE_CONTENT){
-        std::cerr << "messgae type is not TRANSFER_FILE_CONTENT" << std::endl;
+// 放掉 pin 住的 chunk，之後不再送任何東西 (要拿著 file.lock)
+static void finish_relay_file(RelayFile& file) {
+    for (int& slot : file.slots) {
+        chunk_store.release(slot);
+        slot = -1;
     }
+    file.finished = true;
+}
 
-    if (SSL_write(dst_client_ssl, &metadata, sizeof(metadata)) < 0) {
-        perror("write(direct_msg)");
-        std::cerr << "Failed to send file metadata." << std::endl;
-        return;
+// sender 斷線或開始下一個檔案時，還沒送完 trailer 的轉傳就不會再有後續了
+static void abort_relay_file(const std::shared_ptr<Connection>& conn) {
+    conn->set_file_splice(nullptr);
+    std::shared_ptr<RelayFile> file = std::move(conn->relay_file);
+    if (!file) return;
+
+    pthread_mutex_lock(&file->lock);
+    if (!file->uploads_done) finish_relay_file(*file);
+    pthread_mutex_unlock(&file->lock);
+}
+
+// 從 store 讀出一個 chunk，組成和 sender 送的一樣的 TRANSFER_FILE_CONTENT frame
+static bool read_cached_chunk(const RelayFile& file, size_t index, int slot, BufferRef& frame) {
+    const size_t header_size = WIRE_HEADER_SIZE + FILE_CHUNK_HEADER_SIZE;
+    std::shared_ptr<Buffer> buffer = BufferPool::instance().acquire(header_size + CHUNK_STORE_SLOT_SIZE);
+
+    size_t len;
+    uint32_t crc;
+    if (!chunk_store.read(slot, buffer->data + header_size, len, crc) || len != file.chunk_length(index)) {
+        return false;
     }
+    encode_file_chunk_header(buffer->data, (uint64_t)index * file.chunk_size, len, crc);
+    frame.data = buffer->data;
+    frame.size = header_size + len;
+    frame.buffer = std::move(buffer);
+    return true;
+}
 
-    char* file_name = strtok(metadata.payload, " ");
-    char* file_size_str = strtok(NULL, " ");
-    int file_size = atoi(file_size_str);
-
-    // 轉傳檔案內容
-    size_t received_size = 0;
-    Message content;
-    memset(&content, 0, sizeof(content));
-    while (received_size < file_size) {
-        if (SSL_read(src_client_ssl, &content, sizeof(content)) <= 0) {
-            std::cerr << "Failed to receive file data." << std::endl;
+/* 把 sender 不會上傳的 chunk 從 store 送給 recipient，都送完、sender 也送完 trailer 之後轉傳 trailer
+recipient 排隊的資料超過 PIPE_HIGH_WATER 就先停下來，降到 PIPE_LOW_WATER 以下時再由 worker 接著送
+*/
+static void serve_chunks(const std::shared_ptr<RelayFile>& file) {
+    pthread_mutex_lock(&file->lock);
+    const std::shared_ptr<Connection>& recipient = file->recipient;
+    while (file->dedup && !file->finished) {
+        if (file->next_cached == file->cached.size()) {
+            if (!file->uploads_done) break;
+
+            recipient->send(file->trailer);
+            if (file->lost == 0) {
+                std::cout << "[File transfer] " << file->name << " (" << file->cached.size() << " of " << file->count
+                          << " chunks from chunk store)" << std::endl;
+            } else {
+                std::cerr << "File transfer incomplete: " << file->lost << " chunks missing from chunk store." << std::endl;
+            }
+            finish_relay_file(*file);
             break;
         }
-        if(content.msg_type != TRANSFER_FILE_CONTENT){
-            std::cerr << "messgae type is not TRANSFER_FILE_CONTENT" << std::endl;
+
+        // 和 relay pipe 一樣先登記再檢查，不會錯過 recipient 消化完的通知
+        if (recipient->queued_bytes() > PIPE_HIGH_WATER) {
+            if (!file->draining) {
+                file->draining = true;
+                recipient->add_drain_task([file] {
+                    pthread_mutex_lock(&file->lock);
+                    file->draining = false;
+                    pthread_mutex_unlock(&file->lock);
+                    serve_chunks(file);
+                });
+            }
+            if (recipient->queued_bytes() > PIPE_LOW_WATER) break;
+        }
+
+        size_t index = file->cached[file->next_cached];
+        int& slot = file->slots[index];
+        if (slot < 0) slot = chunk_store.acquire(file->key(index));
+        // 同一個檔案裡前面出現過的 chunk，等 sender 上傳前面那一個
+        if (slot < 0 && !file->uploads_done) break;
+
+        BufferRef frame;
+        file->next_cached++;
+        if (slot < 0 || !read_cached_chunk(*file, index, slot, frame)) {
+            file->lost++;
+            continue;
         }
-        if(SSL_write(dst_client_ssl, &content, sizeof(content)) < 0){
-            std::cerr << "transfer file fail : can't send content to receiver" << std::endl;
+        if (!recipient->send(frame)) {
+            finish_relay_file(*file);   // recipient 斷線了
             break;
         }
-        received_size += content.payload_size;
     }
+    pthread_mutex_unlock(&file->lock);
+}
+
+// sender 上傳的 chunk：sha256 和 manifest 對得上才放進 store，同一個檔案後面相同的 chunk 就可以從 store 送
+// 壓縮過的 chunk 解開之後才放進 store (之後從 store 送出去的都是沒壓縮的)
+static void store_uploaded_chunk(const std::shared_ptr<RelayFile>& file, const MessageView& msg) {
+    uint64_t offset;
+    uint32_t crc;
+    const char* data;
+    size_t len;
+    std::vector<char> inflated;
+    bool valid = (msg.header.flags & WIRE_FLAG_COMPRESSED)
+                     ? decompress_file_chunk(msg.payload, inflated, offset, crc, data, len)
+                     : decode_file_chunk(msg.payload, offset, crc, data, len);
+    // 格式不對的 chunk 照樣轉傳，由 recipient 檢查
+    if (!valid || offset % file->chunk_size != 0 ||
+        offset / file->chunk_size >= file->count || len != file->chunk_length(offset / file->chunk_size)) {
+        return;
+    }
+    size_t index = offset / file->chunk_size;
+
+    unsigned char hash[CHUNK_HASH_SIZE];
+    sha256(data, len, hash);
+    if (memcmp(hash, file->hash(index), CHUNK_HASH_SIZE) != 0) {
+        std::cerr << "Uploaded chunk " << index << " of " << file->name << " does not match its manifest." << std::endl;
+        return;
+    }
+    int slot = chunk_store.put(file->key(index), data, len, crc);
 
-    if (received_size == file_size) {
-        std::cout << "[File transfer] " << file_name << std::endl;
+    pthread_mutex_lock(&file->lock);
+    if (file->finished || file->slots[index] >= 0) {
+        chunk_store.release(slot);
     } else {
-        std::cerr << "File transfer incomplete." << std::endl;
+        file->slots[index] = slot;
     }
+    pthread_mutex_unlock(&file->lock);
 }
 
-void streaming(SSL *client_ssl, SSL *recipient_ssl) {
-    // std::cout << "Starting relay streaming from client " << msg.from_id << " to client " << msg.to_id << ".\n";
+void relay_file_content(const std::shared_ptr<Connection>& conn, const Packet& packet, const MessageView& msg) {
+    // 第一個 TRANSFER_FILE_CONTENT 是檔案的 metadata："<檔名> <大小> <chunk 大小> ..." (後面的欄位只有收檔案的 client 會用到)
+    if (conn->relay_file_pending) {
+        conn->relay_file_pending = false;
+
+        std::string_view metadata = msg.payload.substr(0, msg.payload.find('\0'));
+        conn->relay_file_name = std::string(next_token(metadata));
+        conn->relay_remaining = parse_number<long long>(next_token(metadata));
+        uint32_t chunk_size = parse_number<uint32_t>(next_token(metadata));
+
+        // sender 之後可能會送 manifest (chunk 大小放不進 store 的 slot 時就不 dedup，count 維持 0)
+        abort_relay_file(conn);
+        auto file = std::make_shared<RelayFile>();
+        file->recipient = conn->relay_target;
+        file->name = conn->relay_file_name;
+        file->file_size = std::max<long long>(conn->relay_remaining, 0);
+        file->chunk_size = chunk_size;
+        // 大小是 sender 給的：太大的檔案不 dedup，manifest 不會無限制地累積
+        if (chunk_size > 0 && chunk_size <= CHUNK_STORE_SLOT_SIZE && file->file_size <= MAX_TRANSFER_FILE_SIZE &&
+            (file->file_size + chunk_size - 1) / chunk_size <= MAX_TRANSFER_CHUNKS) {
+            file->count = (file->file_size + chunk_size - 1) / chunk_size;
+        }
+        conn->relay_file = file;
 
-    Message notify_msg{};
-    notify_msg.msg_type = RELAY_STREAMING;
-    if (SSL_write(recipient_ssl, &notify_msg, sizeof(notify_msg)) <= 0) {
-        std::cerr << "Failed to inform receiver about relay streaming session.\n";
+        if (conn->relay_target) conn->relay_target->send(packet.bytes);
+        return;
+    }
+
+    if (conn->relay_file_name.empty()) {
+        std::cerr << "messgae type is TRANSFER_FILE_CONTENT but no file transfer in progress" << std::endl;
         return;
     }
-    // Relay streaming frames
-    while (true) {
-        // Receive a frame from the sender
-        auto frame_data = receive_frame(client_ssl);
-
-        // Check for EOF (empty frame)
-        if (frame_data.empty()) {
-            // std::cout << "End of stream received from client " << msg.from_id << ".\n";
-            send_frame(recipient_ssl, frame_data); // Forward EOF to recipient
-            break;
-        }
 
-        // Forward the frame to the recipient
-        send_frame(recipient_ssl, frame_data);
+    // 每一塊前面有 offset + crc32c，只有後面的資料算進檔案大小
+    if (msg.payload.size() < FILE_CHUNK_HEADER_SIZE) {
+        std::cerr << "Malformed file chunk." << std::endl;
+        return;
+    }
+    std::shared_ptr<RelayFile> file = conn->relay_file;
+    bool dedup = file && file->dedup;
+    if (msg.payload.size() > FILE_CHUNK_HEADER_SIZE) {
+        if (dedup) store_uploaded_chunk(file, msg);
+        if (conn->relay_target) conn->relay_target->send(packet.bytes);
+        size_t len = msg.payload.size() - FILE_CHUNK_HEADER_SIZE;
+        if (msg.header.flags & WIRE_FLAG_COMPRESSED) compressed_chunk_size(msg.payload, len);
+        conn->relay_remaining -= len;
+        // 同一個檔案裡和這個 chunk 相同的 chunk 現在可以從 store 送了
+        if (dedup) serve_chunks(file);
+        return;
     }
 
-    // std::cout << "Relay streaming completed from client " << msg.from_id
-    //         << " to client " << msg.to_id << ".\n";
+    // 沒有資料的是 trailer (整個檔案的 digest，由收檔案的 client 檢查)
+    conn->set_file_splice(nullptr);
+    if (dedup) {
+        // 等 store 裡的 chunk 都送給 recipient 之後才轉傳 trailer
+        pthread_mutex_lock(&file->lock);
+        file->trailer = packet.bytes;
+        file->uploads_done = true;
+        pthread_mutex_unlock(&file->lock);
+        serve_chunks(file);
+    } else {
+        if (conn->relay_target) conn->relay_target->send(packet.bytes);
+        if (conn->relay_target && conn->relay_remaining == 0) {
+            std::cout << "[File transfer] " << conn->relay_file_name << std::endl;
+        } else {
+            std::cerr << "File transfer incomplete." << std::endl;
+        }
+    }
+    conn->relay_file.reset();
+    conn->relay_target.reset();
+    conn->relay_file_name.clear();
 }
 
-void audio_streaming(SSL *client_ssl, SSL *recipient_ssl) {
-    Message notify_msg{};
-    notify_msg.msg_type = RELAY_AUDIO_STREAMING;
-    if (SSL_write(recipient_ssl, &notify_msg, sizeof(notify_msg)) <= 0) {
-        std::cerr << "Failed to inform receiver about relay streaming session.\n";
+/* sender 送來每個 chunk 的 sha256 (可能分成好幾個 frame)，收齊後回覆 TRANSFER_RESUME：
+bit i = chunk i 不用上傳 (這個 sender 之前上傳過、還在 store 裡，或同一個檔案前面出現過相同的 chunk)
+沒有 recipient、store 沒開或 sender 沒有登入時回覆空的 bitmap，sender 整個上傳 (這時不 dedup，也不放進 store)
+*/
+void relay_manifest(const std::shared_ptr<Connection>& conn, const MessageView& msg) {
+    std::shared_ptr<RelayFile> file = conn->relay_file;
+    if (!file || file->manifest_done) {
+        std::cerr << "messgae type is TRANSFER_MANIFEST but no file transfer in progress" << std::endl;
         return;
     }
-    // Relay streaming frames
-    while (true) {
-        // Receive a frame from the sender
-        auto frame_data = receive_frame(client_ssl);
-
-        // Check for EOF (empty frame)
-        if (frame_data.empty()) {
-            send_frame(recipient_ssl, frame_data); // Forward EOF to recipient
-            break;
-        }
 
-        // Forward the frame to the recipient
-        send_frame(recipient_ssl, frame_data);
+    // 回覆之前只有 sender 的 worker 會用到 file
+    file->manifest.append(msg.payload);
+    size_t expected = file->count * CHUNK_HASH_SIZE;
+    if (file->manifest.size() < expected) return;
+    file->manifest_done = true;
+
+    std::vector<char> bitmap((file->count + 7) / 8, 0);
+    std::string owner = clients.username_of(conn->client_id);
+    if (file->manifest.size() != expected) {
+        std::cerr << "Malformed manifest for " << file->name << std::endl;
+    } else if (file->recipient && chunk_store.is_open() && !owner.empty()) {
+        file->keys.resize(file->manifest.size());
+        for (size_t i = 0; i < file->count; i++) {
+            chunk_key(owner, file->hash(i), reinterpret_cast<unsigned char*>(&file->keys[i * CHUNK_HASH_SIZE]));
+        }
+        file->slots.assign(file->count, -1);
+        std::unordered_set<std::string_view> seen;
+        for (size_t i = 0; i < file->count; i++) {
+            bool repeated = !seen.insert(std::string_view(file->manifest).substr(i * CHUNK_HASH_SIZE, CHUNK_HASH_SIZE)).second;
+            if (!repeated) file->slots[i] = chunk_store.acquire(file->key(i));
+            if (repeated || file->slots[i] >= 0) {
+                file->cached.push_back(i);
+                bitmap[i / 8] |= static_cast<char>(1 << (i % 8));
+            }
+        }
+        pthread_mutex_lock(&file->lock);
+        file->dedup = true;
+        pthread_mutex_unlock(&file->lock);
     }
-}
\ No newline at end of file
+    // 不 dedup 時 chunk 只是原封不動轉傳，兩端都是 kTLS 的話 EventLoop 可以直接 splice (回覆 sender 之前設好)
+    if (!file->dedup && file->recipient) conn->set_file_splice(file->recipient);
+
+    // recipient 看得懂壓縮過的 chunk 時告訴 sender 可以壓縮 (server 自己解開來放進 store)
+    std::vector<char> reply;
+    int flags = (file->recipient && file->recipient->accepts_compressed) ? WIRE_FLAG_ACCEPTS_COMPRESSED : 0;
+    encode_chunk(TRANSFER_RESUME, bitmap.data(), bitmap.size(), reply, flags);
+    conn->send(reply.data(), reply.size());
+
+    serve_chunks(file);
+}
@@ -1,23 +1,21 @@
 #ifndef CLIENT_HANDLER_HPP
 #define CLIENT_HANDLER_HPP
 
-#include "server.hpp"
+#include <cstddef>
+#include <memory>
 #include <string>
-#include "threadpool.hpp"
+#include "connection.hpp"
+#include "client_registry.hpp"
 #include "../shared/ssl.hpp"
 
-struct ClientInfo {
-    int client_id;
-    int socket_fd;
-    std::string ip;
-    int listen_port;
-    bool online;
-    SSL *ssl;
-    std::string username;
-};
+// 由 EventLoop 派給 worker：處理一個已經切好的 packet
+void handle_packet(const std::shared_ptr<Connection>& conn, const Packet& packet);
+// 由 EventLoop 在連線關閉時呼叫
+void handle_disconnect(const std::shared_ptr<Connection>& conn);
 
-void handle_client(SSL *client_ssl, int client_socket);
-void streaming(SSL *client_ssl, SSL *recipient_ssl);
-void audio_streaming(SSL *client_ssl, SSL *recipient_ssl);
+#define CHUNK_STORE_DIR "chunk_store"   // relay 傳檔案的 chunk store 放在目前目錄的這個資料夾
+
+// 啟動時呼叫：打開 relay 傳檔案用的 chunk store (capacity 是 0 時不開，每次都由 sender 整個上傳)
+bool open_chunk_store(size_t capacity);
 
 #endif // CLIENT_HANDLER_HPP
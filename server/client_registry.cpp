@@ -0,0 +1,159 @@
+#include "client_registry.hpp"
+
+#include <algorithm>
+#include <functional>
+
+static_assert((REGISTRY_SHARDS & (REGISTRY_SHARDS - 1)) == 0, "REGISTRY_SHARDS must be a power of 2");
+
+ClientRegistry::ClientRegistry() : next_client_id(1) {
+    for (int i = 0; i < REGISTRY_SHARDS; i++) {
+        pthread_rwlock_init(&id_shards[i].lock, nullptr);
+        pthread_rwlock_init(&name_shards[i].lock, nullptr);
+    }
+}
+
+ClientRegistry::~ClientRegistry() {
+    for (int i = 0; i < REGISTRY_SHARDS; i++) {
+        pthread_rwlock_destroy(&id_shards[i].lock);
+        pthread_rwlock_destroy(&name_shards[i].lock);
+    }
+}
+
+ClientRegistry::NameShard& ClientRegistry::name_shard(const std::string& username) {
+    return name_shards[std::hash<std::string>()(username) & (REGISTRY_SHARDS - 1)];
+}
+
+int ClientRegistry::add(const std::shared_ptr<Connection>& conn, int listen_port) {
+    int client_id = next_client_id.fetch_add(1);
+    IdShard& shard = id_shard(client_id);
+
+    pthread_rwlock_wrlock(&shard.lock);
+    shard.clients[client_id] = {client_id, conn->ip, listen_port, true, conn, ""};
+    pthread_rwlock_unlock(&shard.lock);
+    return client_id;
+}
+
+void ClientRegistry::disconnect(int client_id, const std::shared_ptr<Connection>& conn) {
+    IdShard& shard = id_shard(client_id);
+
+    pthread_rwlock_wrlock(&shard.lock);
+    auto it = shard.clients.find(client_id);
+    if (it != shard.clients.end() && it->second.conn == conn) {
+        it->second.online = false;
+        it->second.conn.reset();
+    }
+    pthread_rwlock_unlock(&shard.lock);
+}
+
+/* 兩種 shard 不會同時鎖住，所以不用擔心 lock 的順序 */
+void ClientRegistry::login(int client_id, const std::string& username) {
+    IdShard& shard = id_shard(client_id);
+    std::string old_username;
+
+    pthread_rwlock_wrlock(&shard.lock);
+    ClientInfo& info = shard.clients[client_id];
+    old_username.swap(info.username);
+    info.username = username;
+    info.online = true;
+    pthread_rwlock_unlock(&shard.lock);
+
+    if (!old_username.empty() && old_username != username) erase_name(old_username, client_id);
+    set_name(username, client_id);
+}
+
+void ClientRegistry::logout(int client_id) {
+    IdShard& shard = id_shard(client_id);
+    std::string old_username;
+
+    pthread_rwlock_wrlock(&shard.lock);
+    ClientInfo& info = shard.clients[client_id];
+    old_username.swap(info.username);
+    info.online = false;
+    pthread_rwlock_unlock(&shard.lock);
+
+    if (!old_username.empty()) erase_name(old_username, client_id);
+}
+
+void ClientRegistry::set_name(const std::string& username, int client_id) {
+    NameShard& shard = name_shard(username);
+    pthread_rwlock_wrlock(&shard.lock);
+    shard.ids[username] = client_id;
+    pthread_rwlock_unlock(&shard.lock);
+}
+
+void ClientRegistry::erase_name(const std::string& username, int client_id) {
+    NameShard& shard = name_shard(username);
+    pthread_rwlock_wrlock(&shard.lock);
+    auto it = shard.ids.find(username);
+    if (it != shard.ids.end() && it->second == client_id) shard.ids.erase(it);
+    pthread_rwlock_unlock(&shard.lock);
+}
+
+std::shared_ptr<Connection> ClientRegistry::find_online(int client_id) {
+    std::shared_ptr<Connection> result;
+    IdShard& shard = id_shard(client_id);
+
+    pthread_rwlock_rdlock(&shard.lock);
+    auto it = shard.clients.find(client_id);
+    if (it != shard.clients.end() && it->second.online) {
+        result = it->second.conn;
+    }
+    pthread_rwlock_unlock(&shard.lock);
+    return result;
+}
+
+std::string ClientRegistry::username_of(int client_id) {
+    std::string username;
+    IdShard& shard = id_shard(client_id);
+
+    pthread_rwlock_rdlock(&shard.lock);
+    auto it = shard.clients.find(client_id);
+    if (it != shard.clients.end()) username = it->second.username;
+    pthread_rwlock_unlock(&shard.lock);
+    return username;
+}
+
+std::shared_ptr<Connection> ClientRegistry::find_online(const std::string& username) {
+    NameShard& shard = name_shard(username);
+    int client_id = -1;
+
+    pthread_rwlock_rdlock(&shard.lock);
+    auto it = shard.ids.find(username);
+    if (it != shard.ids.end()) client_id = it->second;
+    pthread_rwlock_unlock(&shard.lock);
+
+    if (client_id < 0) return nullptr;
+    return find_online(client_id);
+}
+
+std::vector<ClientInfo> ClientRegistry::online_clients() {
+    std::vector<ClientInfo> found;
+    for (IdShard& shard : id_shards) {
+        pthread_rwlock_rdlock(&shard.lock);
+        for (const auto& [id, info] : shard.clients) {
+            if (info.online && !info.username.empty()) found.push_back(info);
+        }
+        pthread_rwlock_unlock(&shard.lock);
+    }
+
+    // 只排序 (client_id, index)，不用一直搬動整個 ClientInfo
+    std::vector<std::pair<int, size_t>> order;
+    order.reserve(found.size());
+    for (size_t i = 0; i < found.size(); i++) order.emplace_back(found[i].client_id, i);
+    std::sort(order.begin(), order.end());
+
+    std::vector<ClientInfo> result;
+    result.reserve(found.size());
+    for (const auto& [id, index] : order) result.push_back(std::move(found[index]));
+    return result;
+}
+
+bool ClientRegistry::empty() {
+    for (IdShard& shard : id_shards) {
+        pthread_rwlock_rdlock(&shard.lock);
+        bool shard_empty = shard.clients.empty();
+        pthread_rwlock_unlock(&shard.lock);
+        if (!shard_empty) return false;
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef CLIENT_REGISTRY_HPP
+#define CLIENT_REGISTRY_HPP
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+#include "connection.hpp"
+
+#define REGISTRY_SHARDS 64      // 必須是 2 的次方
+
+struct ClientInfo {
+    int client_id;
+    std::string ip;
+    int listen_port;
+    bool online;
+    std::shared_ptr<Connection> conn;
+    std::string username;
+};
+
+/* 所有 client 的資訊，用 client_id 和 username 分別分成 REGISTRY_SHARDS 個 shard
+每個 shard 有自己的 read-write lock，查詢只會鎖到那一個 shard 的 read lock，
+不同 client 之間幾乎不會搶同一把鎖。
+回傳的都是複製出來的 shared_ptr / ClientInfo，呼叫端送資料時不會握著任何 registry 的鎖。
+*/
+class ClientRegistry {
+public:
+    ClientRegistry();
+    ~ClientRegistry();
+
+    // 新增一個 client，回傳分配到的 client_id
+    int add(const std::shared_ptr<Connection>& conn, int listen_port);
+    // 連線斷掉：只有 conn 還是這個 client 目前的連線時才標記成 offline
+    void disconnect(int client_id, const std::shared_ptr<Connection>& conn);
+
+    void login(int client_id, const std::string& username);
+    void logout(int client_id);
+
+    std::shared_ptr<Connection> find_online(int client_id);
+    // client_id 目前登入的 username (沒有登入時是空字串)
+    std::string username_of(int client_id);
+    std::shared_ptr<Connection> find_online(const std::string& username);
+
+    // 依 client_id 排序的 online 且有登入的 client
+    std::vector<ClientInfo> online_clients();
+    bool empty();
+
+private:
+    // 每個 shard 各自佔一個 cache line，避免不同 shard 的鎖互相干擾
+    struct alignas(64) IdShard {
+        pthread_rwlock_t lock;
+        std::unordered_map<int, ClientInfo> clients;
+    };
+
+    struct alignas(64) NameShard {
+        pthread_rwlock_t lock;
+        std::unordered_map<std::string, int> ids;   // username -> client_id
+    };
+
+    IdShard& id_shard(int client_id) { return id_shards[client_id & (REGISTRY_SHARDS - 1)]; }
+    NameShard& name_shard(const std::string& username);
+
+    void set_name(const std::string& username, int client_id);
+    void erase_name(const std::string& username, int client_id);
+
+    IdShard id_shards[REGISTRY_SHARDS];
+    NameShard name_shards[REGISTRY_SHARDS];
+    std::atomic<int> next_client_id;
+};
+
+#endif // CLIENT_REGISTRY_HPP
@@ -0,0 +1,315 @@
+#include "connection.hpp"
+#include "event_loop.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+// 一次 SSL_write 最多寫一個 TLS record 的大小
+#define MAX_TLS_WRITE 16384
+
+SplicePipe::~SplicePipe() {
+    if (read_fd >= 0) ::close(read_fd);
+    if (write_fd >= 0) ::close(write_fd);
+}
+
+std::shared_ptr<SplicePipe> SplicePipe::create() {
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+        perror("pipe2");
+        return nullptr;
+    }
+
+    auto pipe = std::make_shared<SplicePipe>();
+    pipe->read_fd = fds[0];
+    pipe->write_fd = fds[1];
+    // 盡量讓 pipe 裝得下 PIPE_HIGH_WATER，recipient 稍微慢一點時 source 不用馬上停下來
+    int capacity = fcntl(fds[1], F_SETPIPE_SZ, PIPE_HIGH_WATER);
+    if (capacity < 0) capacity = fcntl(fds[1], F_GETPIPE_SZ);
+    pipe->capacity = (capacity > 0) ? capacity : 65536;
+    return pipe;
+}
+
+Connection::Connection(EventLoop* loop, SSL* ssl, int fd)
+    : fd(fd), ssl(ssl), loop(loop), out_queue(OUT_QUEUE_CAPACITY) {
+    pthread_mutex_init(&in_mutex, nullptr);
+    pthread_mutex_init(&pipe_mutex, nullptr);
+}
+
+Connection::~Connection() {
+    if (ssl) SSL_free(ssl);
+    pthread_mutex_destroy(&in_mutex);
+    pthread_mutex_destroy(&pipe_mutex);
+}
+
+bool Connection::send(const void* data, size_t len) {
+    return send(copy_to_buffer(data, len));
+}
+
+bool Connection::send(const BufferRef& bytes) {
+    OutSegment segment;
+    segment.bytes = bytes;
+    return push_segment(segment);
+}
+
+bool Connection::send_spliced(const std::shared_ptr<SplicePipe>& pipe, size_t size) {
+    OutSegment segment;
+    segment.pipe = pipe;
+    segment.pipe_size = size;
+    return push_segment(segment);
+}
+
+bool Connection::push_segment(OutSegment& segment) {
+    if (closing || closed) return false;
+
+    size_t size = segment.size();
+    out_bytes += size;
+    if (!out_queue.push(segment)) {
+        out_bytes -= size;
+        std::cerr << "Outbound queue full, dropping slow client " << ip << std::endl;
+        close();
+        return false;
+    }
+
+    // 同一批 send 只需要叫醒 EventLoop 一次，flush 時會一次寫出所有排好的資料
+    if (!flush_scheduled.exchange(true)) {
+        loop->schedule(shared_from_this());
+    }
+    return true;
+}
+
+void Connection::close() {
+    if (closing.exchange(true) || closed) return;
+    loop->schedule(shared_from_this());
+}
+
+bool Connection::is_closed() {
+    return closed;
+}
+
+bool Connection::close_requested() {
+    return closing;
+}
+
+void Connection::mark_closed() {
+    closed = true;
+
+    OutSegment dropped;
+    while (out_queue.pop(dropped)) {}
+    out_bytes = 0;
+    out_current = OutSegment();
+    out_offset = 0;
+    write_left = 0;
+
+    // 等著這條連線的 source 都放行，它們之後的 frame 會因為 send 失敗而被丟掉
+    notify_drained();
+}
+
+void Connection::open_pipe(const std::shared_ptr<Connection>& target) {
+    pthread_mutex_lock(&pipe_mutex);
+    pipe_resolved = target;
+    pipe_ready = true;
+    pthread_mutex_unlock(&pipe_mutex);
+
+    loop->schedule(shared_from_this());
+}
+
+bool Connection::take_opened_pipe(std::shared_ptr<Connection>& target) {
+    if (!pipe_ready) return false;
+
+    pthread_mutex_lock(&pipe_mutex);
+    target = std::move(pipe_resolved);
+    pipe_resolved.reset();
+    pipe_ready = false;
+    pthread_mutex_unlock(&pipe_mutex);
+    return true;
+}
+
+void Connection::set_file_splice(const std::shared_ptr<Connection>& target) {
+    pthread_mutex_lock(&pipe_mutex);
+    file_splice = target;
+    pthread_mutex_unlock(&pipe_mutex);
+}
+
+std::shared_ptr<Connection> Connection::file_splice_target() {
+    pthread_mutex_lock(&pipe_mutex);
+    std::shared_ptr<Connection> target = file_splice;
+    pthread_mutex_unlock(&pipe_mutex);
+    return target;
+}
+
+void Connection::request_resume() {
+    resume_requested = true;
+    loop->schedule(shared_from_this());
+}
+
+bool Connection::take_resume() {
+    return resume_requested.exchange(false);
+}
+
+void Connection::add_drain_waiter(const std::shared_ptr<Connection>& source) {
+    pthread_mutex_lock(&pipe_mutex);
+    drain_waiters.push_back(source);
+    has_drain_waiters = true;
+    pthread_mutex_unlock(&pipe_mutex);
+}
+
+void Connection::add_drain_task(Task task) {
+    pthread_mutex_lock(&pipe_mutex);
+    drain_tasks.push_back(std::move(task));
+    has_drain_waiters = true;
+    pthread_mutex_unlock(&pipe_mutex);
+}
+
+/* source 先登記再檢查 queued_bytes，這裡先更新 out_bytes 再檢查 has_drain_waiters，
+所以兩邊至少有一邊會看到對方，不會有 source 永遠停著 */
+void Connection::notify_drained() {
+    if (!has_drain_waiters) return;
+    if (!closed && out_bytes > PIPE_LOW_WATER) return;
+
+    std::vector<std::weak_ptr<Connection>> waiters;
+    std::vector<Task> tasks;
+    pthread_mutex_lock(&pipe_mutex);
+    waiters.swap(drain_waiters);
+    tasks.swap(drain_tasks);
+    has_drain_waiters = false;
+    pthread_mutex_unlock(&pipe_mutex);
+
+    for (auto& waiter : waiters) {
+        if (auto source = waiter.lock()) source->request_resume();
+    }
+    for (auto& task : tasks) loop->add_task(std::move(task));
+}
+
+// out_current 寫完了就從 out_queue 拿下一段，沒有資料時回傳 false
+bool Connection::next_segment() {
+    if (out_offset < out_current.size()) return true;
+
+    out_current = OutSegment();
+    out_offset = 0;
+    if (!out_queue.pop(out_current)) return false;
+    out_bytes -= out_current.size();
+    return true;
+}
+
+/* 用 out_current 準備下一個要寫的 TLS record
+- 很大的資料 (例如 video frame) 直接從原本的 buffer 切 MAX_TLS_WRITE 出來寫，不複製
+- 小的訊息 (例如 chat) 盡量合併進同一個 record，一次 SSL_write 寫出好幾個訊息
+- 遇到 splice 的段落就停下來，等這個 record 寫完再由 write_spliced 處理
+*/
+void Connection::next_record() {
+    size_t remaining = out_current.bytes.size - out_offset;
+    if (remaining >= MAX_TLS_WRITE) {
+        write_ptr = out_current.bytes.data + out_offset;
+        write_left = MAX_TLS_WRITE;
+        out_offset += MAX_TLS_WRITE;
+        return;
+    }
+
+    out_record.clear();
+    while (out_record.size() + remaining <= MAX_TLS_WRITE) {
+        out_record.insert(out_record.end(), out_current.bytes.data + out_offset, out_current.bytes.data + out_current.bytes.size);
+        out_current = OutSegment();
+        out_offset = 0;
+        if (!out_queue.pop(out_current)) break;
+        out_bytes -= out_current.size();
+        if (out_current.pipe) break;
+        remaining = out_current.bytes.size;
+    }
+
+    write_ptr = out_record.data();
+    write_left = out_record.size();
+}
+
+/* 把 pipe 裡屬於 out_current 的 bytes 直接 splice 到 socket，kTLS 會在 kernel 裡加密
+socket 寫不下時 would_block 設成 true，等 EPOLLOUT 再繼續
+*/
+bool Connection::write_spliced(bool& would_block) {
+    would_block = false;
+    while (out_offset < out_current.pipe_size) {
+        ssize_t n = splice(out_current.pipe->read_fd, nullptr, fd, nullptr, out_current.pipe_size - out_offset,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+        if (n > 0) {
+            out_offset += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) {
+            would_block = true;
+            return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+/* Non-blocking 的 SSL_write：
+寫到 SSL_ERROR_WANT_WRITE 就停，等 EPOLLOUT 再繼續 (重試時會用同一段資料、同樣的長度)。
+*/
+bool Connection::flush() {
+    // 先清掉 flag 再開始寫：之後才 push 進來的資料會再排一次 flush，不會被漏掉
+    flush_scheduled.exchange(false);
+
+    while (true) {
+        if (write_left == 0) {
+            if (!next_segment()) break;
+            if (out_current.pipe) {
+                bool would_block;
+                if (!write_spliced(would_block)) return false;
+                if (would_block) break;
+                continue;
+            }
+            next_record();
+            if (write_left == 0) continue;
+        }
+
+        int n = SSL_write(ssl, write_ptr, (int)write_left);
+        if (n > 0) {
+            write_ptr += n;
+            write_left -= n;
+            continue;
+        }
+
+        int err = SSL_get_error(ssl, n);
+        if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ) {
+            break;
+        }
+        return false;
+    }
+
+    notify_drained();
+    return true;
+}
+
+bool Connection::push_inbound(Packet packet) {
+    pthread_mutex_lock(&in_mutex);
+    inbox.push_back(std::move(packet));
+    bool need_dispatch = !dispatching;
+    dispatching = true;
+    pthread_mutex_unlock(&in_mutex);
+    return need_dispatch;
+}
+
+// 只有 EventLoop 會派新的 task，所以回傳 true 之後到下一次 push_inbound 之前都不會有 worker 碰這條連線
+bool Connection::inbound_idle() {
+    pthread_mutex_lock(&in_mutex);
+    bool idle = !dispatching;
+    pthread_mutex_unlock(&in_mutex);
+    return idle;
+}
+
+bool Connection::pop_inbound(Packet& packet) {
+    pthread_mutex_lock(&in_mutex);
+    if (inbox.empty()) {
+        dispatching = false;
+        pthread_mutex_unlock(&in_mutex);
+        return false;
+    }
+    packet = std::move(inbox.front());
+    inbox.pop_front();
+    pthread_mutex_unlock(&in_mutex);
+    return true;
+}
@@ -0,0 +1,193 @@
+#ifndef CONNECTION_HPP
+#define CONNECTION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "buffer_pool.hpp"
+#include "../shared/bounded_queue.hpp"
+#include "threadpool.hpp"
+#include "../shared/ssl.hpp"
+
+class EventLoop;
+struct RelayFile;
+
+#define OUT_QUEUE_CAPACITY 16384    // 每條連線最多排幾段還沒寫出去的資料 (必須是 2 的次方)
+#define PIPE_HIGH_WATER (1024 * 1024)   // relay 對象排隊的資料超過這個量，就先停止讀取來源
+#define PIPE_LOW_WATER (256 * 1024)     // 降到這個量以下再繼續讀
+#define SPLICE_MIN_FRAME (64 * 1024)    // kTLS 時，還沒讀進來的部分超過這個大小的 frame 才用 splice 轉傳
+
+/* 從 TLS 解出來的一個完整單位 */
+enum PacketKind {
+    PACKET_MESSAGE = 0, // 一個完整的 Message
+    PACKET_FRAME = 1,   // streaming 時的 frame (長度 0 代表 EOF)
+    PACKET_RAW = 2,     // 不屬於上面兩種的 raw bytes (例如 AudioMetadata)
+};
+
+// bytes 直接參照讀進來的 buffer，轉傳時也是轉傳這個參照，不會複製資料
+struct Packet {
+    PacketKind kind;
+    BufferRef bytes;
+};
+
+/* 兩端都是 kTLS 時，frame 的 payload 用 splice 從來源的 socket 搬進這個 pipe，
+再由 recipient 的 EventLoop 從 pipe 搬到 recipient 的 socket，資料完全不進 userspace
+(加解密都在 kernel 裡做)。一個 relay 共用一個 pipe，段落依序放進 recipient 的 out_queue。
+*/
+struct SplicePipe {
+    int read_fd = -1;
+    int write_fd = -1;
+    size_t capacity = 0;
+
+    ~SplicePipe();
+    static std::shared_ptr<SplicePipe> create();    // 失敗時回傳 nullptr
+};
+
+// out_queue 裡的一段資料：一般是 buffer 的參照，splice 時是 pipe 裡接下來的 pipe_size bytes
+struct OutSegment {
+    BufferRef bytes;
+    std::shared_ptr<SplicePipe> pipe;
+    size_t pipe_size = 0;
+
+    size_t size() const { return pipe ? pipe_size : bytes.size; }
+};
+
+/* Relay pipe 的狀態
+RELAY_STREAMING / RELAY_AUDIO_STREAMING 之後的 frame 由 EventLoop 直接轉給 pipe_target，不經過 worker
+*/
+enum PipeState {
+    PIPE_NONE = 0,
+    PIPE_PENDING = 1,   // 已經收到 RELAY_STREAMING，等 worker 找到 recipient
+    PIPE_OPEN = 2,      // frame 直接轉給 pipe_target (沒有 recipient 時直接丟掉)
+};
+
+/* 讀取端目前要用哪一種格式切封包 */
+enum ReadMode {
+    READ_MESSAGE = 0,
+    READ_AUDIO_METADATA = 1,
+    READ_FRAME = 2,
+};
+
+/* 一條 client 連線的所有狀態
+所有 SSL_* 的呼叫都只會發生在所屬 EventLoop 的 thread 上；
+worker thread 只能透過 send() / close() 間接操作這條連線。
+*/
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+    Connection(EventLoop* loop, SSL* ssl, int fd);
+    ~Connection();
+
+    int fd;
+    SSL* ssl;
+    EventLoop* loop;
+
+    std::string ip;
+    int client_id = -1;
+    std::atomic<bool> accepts_compressed{false};   // JOIN 帶著 WIRE_FLAG_ACCEPTS_COMPRESSED：轉給它的東西可以是壓縮過的
+
+    /* 從任何 thread 送資料給這個 client (放進 out_queue，由 EventLoop 寫出去)
+    out_queue 滿了代表對方收得太慢，直接斷線 (回傳 false)，不會讓送出端卡住
+    */
+    bool send(const void* data, size_t len);
+    bool send(const BufferRef& bytes);
+    // 接下來的 size bytes 已經在 pipe 裡 (只有 ktls 的連線可以用)
+    bool send_spliced(const std::shared_ptr<SplicePipe>& pipe, size_t size);
+    // 從任何 thread 要求關閉這條連線
+    void close();
+
+    bool is_closed();
+
+    // worker 處理完 RELAY_STREAMING 後呼叫：之後的 frame 轉給 target (nullptr 代表丟掉)
+    void open_pipe(const std::shared_ptr<Connection>& target);
+    // worker 決定這次 relay 傳檔案不 dedup 時呼叫：之後大的 chunk 可以直接 splice 給 target (nullptr 代表不行)
+    void set_file_splice(const std::shared_ptr<Connection>& target);
+    // 請 EventLoop 繼續讀這條連線 (relay 對象的資料消化掉了)
+    void request_resume();
+
+    // 還在 out_queue 裡排隊的 bytes
+    size_t queued_bytes() const { return out_bytes; }
+    // 排隊的資料降到 PIPE_LOW_WATER 以下 (或這條連線關掉) 時，叫 source 繼續讀
+    void add_drain_waiter(const std::shared_ptr<Connection>& source);
+    // 同上，但是改成把 task 交給 worker (server 自己從 chunk store 送資料給這條連線時用)
+    void add_drain_task(Task task);
+
+    /* 以下只在 EventLoop thread 使用 */
+    bool handshaking = true;                                    // TLS handshake 還沒完成
+    bool ktls = false;          // 握手完成後兩個方向的加解密都交給了 kernel，可以直接 splice
+    std::chrono::steady_clock::time_point handshake_deadline;   // 超過這個時間還沒握完手就斷線
+    /* 讀進來的 plaintext 直接放在 pooled buffer 裡：[in_begin, in_end) 是還沒切成 packet 的部分，
+    切出去的 packet 會共用同一個 buffer；buffer 用完時把沒切完的尾巴搬到新的 buffer。
+    */
+    std::shared_ptr<Buffer> in_buffer;
+    size_t in_begin = 0;
+    size_t in_end = 0;
+    size_t in_needed = 0;       // 目前這個 packet 總共需要幾 bytes (還不知道時為 0)
+    ReadMode read_mode = READ_MESSAGE;
+    bool read_paused = false;   // 等 relay pipe 建好、或等 relay 對象消化資料時暫停讀取
+    PipeState pipe_state = PIPE_NONE;
+    std::shared_ptr<Connection> pipe_target;
+    std::shared_ptr<SplicePipe> splice_pipe;    // 轉給 pipe_target 的 splice pipe (用到時才建立)
+    size_t splice_left = 0;     // 目前的 frame 還有多少 bytes 要直接從 socket splice 出去
+    std::shared_ptr<Connection> splice_target;  // splice_pipe 裡的資料是要給誰的
+    bool take_opened_pipe(std::shared_ptr<Connection>& target);    // worker 呼叫過 open_pipe 時回傳 true
+    std::shared_ptr<Connection> file_splice_target();               // set_file_splice 設定的 target
+    bool take_resume();
+    bool flush();               // 盡量把 out_queue 寫出去，失敗 (連線壞掉) 時回傳 false
+    bool close_requested();
+    void mark_closed();
+
+    /* inbox：保證同一條連線的 packet 依序、一次只被一個 worker 處理 */
+    bool push_inbound(Packet packet);   // 回傳 true 代表需要派一個新的 task
+    bool pop_inbound(Packet& packet);   // 沒東西時回傳 false 並結束這輪 dispatch
+    bool inbound_idle();                // 之前的 packet 都已經處理完 (EventLoop 可以暫時接手 worker 的狀態)
+
+    /* 以下只在處理這條連線 packet 的 worker 使用 (inbox 保證同時只有一個) */
+    std::shared_ptr<Connection> relay_target;   // 轉傳檔案的對象
+    std::string relay_file_name;
+    long long relay_remaining = 0;              // 轉傳檔案還剩多少 bytes (收到 trailer 時應該剛好是 0；splice 的 chunk 由 EventLoop 扣)
+    bool relay_file_pending = false;            // 正在等檔案的 metadata
+    std::shared_ptr<RelayFile> relay_file;      // 這次轉傳的 dedup 狀態 (client_handler.cpp)
+
+private:
+    bool push_segment(OutSegment& segment);
+    bool next_segment();
+    void next_record();
+    bool write_spliced(bool& would_block);
+    void notify_drained();
+
+    /* 多個 worker push、只有 EventLoop pop (MPSC) */
+    BoundedQueue<OutSegment> out_queue;
+    std::atomic<bool> flush_scheduled{false};  // 已經排進 EventLoop 的 pending，還沒 flush
+    std::atomic<bool> closing{false};
+    std::atomic<bool> closed{false};
+    std::atomic<size_t> out_bytes{0};
+
+    /* relay pipe：worker 交給 EventLoop 的 recipient，和等著這條連線消化資料的 source */
+    pthread_mutex_t pipe_mutex;
+    std::shared_ptr<Connection> pipe_resolved;
+    std::shared_ptr<Connection> file_splice;
+    std::atomic<bool> pipe_ready{false};
+    std::atomic<bool> resume_requested{false};
+    std::vector<std::weak_ptr<Connection>> drain_waiters;
+    std::vector<Task> drain_tasks;
+    std::atomic<bool> has_drain_waiters{false};
+
+    /* 以下只在 EventLoop thread 使用：目前正在寫的 TLS record
+    SSL_write 回傳 WANT_* 之後必須用同樣的資料重試，所以寫完之前 write_ptr / write_left 不能變
+    */
+    OutSegment out_current;     // 從 out_queue 拿出來、還沒完全寫出去的那一段
+    size_t out_offset = 0;      // out_current 已經放進 TLS record (或 splice 出去) 的 bytes
+    std::vector<char> out_record;   // 合併好幾個小訊息用的 buffer
+    const char* write_ptr = nullptr;
+    size_t write_left = 0;
+
+    pthread_mutex_t in_mutex;
+    std::deque<Packet> inbox;
+    bool dispatching = false;
+};
+
+#endif // CONNECTION_HPP
@@ -0,0 +1,618 @@
+#include "event_loop.hpp"
+#include "client_handler.hpp"
+#include "../shared/message.hpp"
+#include "../shared/protocol.hpp"
+#include "../shared/streaming.hpp"
+#include "../shared/compress.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define MAX_EVENTS 256
+#define MIN_READ_SPACE 16384        // 每次 SSL_read 至少要有一個 TLS record 的空間
+#define MAX_FRAME_SIZE (64 * 1024 * 1024)   // streaming frame 的大小上限
+#define HANDSHAKE_TIMEOUT_SEC 10    // 握手超過 10 秒還沒完成就斷線
+#define SWEEP_INTERVAL_MS 1000      // 多久檢查一次 handshake 有沒有超時
+
+EventLoop::EventLoop(ThreadPool& thread_pool)
+    : listen_fd(-1), ctx(nullptr), stop_flag(false), threaded(false), cpu(-1), thread_pool(thread_pool) {
+    pthread_mutex_init(&pending_mutex, nullptr);
+
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        throw std::runtime_error("Failed to create epoll");
+    }
+
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (wake_fd < 0) {
+        close(epoll_fd);
+        throw std::runtime_error("Failed to create eventfd");
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = wake_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+}
+
+EventLoop::~EventLoop() {
+    stop();
+    for (auto& kv : connections) {
+        ::close(kv.second->fd);
+        kv.second->mark_closed();
+    }
+    connections.clear();
+    close(wake_fd);
+    close(epoll_fd);
+    pthread_mutex_destroy(&pending_mutex);
+}
+
+void EventLoop::add_listener(int fd, SSL_CTX* ssl_ctx) {
+    listen_fd = fd;
+    ctx = ssl_ctx;
+
+    int flags = fcntl(listen_fd, F_GETFL, 0);
+    fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listen_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+}
+
+void EventLoop::set_cpu(int cpu_index) {
+    cpu = cpu_index;
+}
+
+void EventLoop::start() {
+    threaded = true;
+    pthread_create(&loop_thread, nullptr, loop_thread_func, this);
+}
+
+void EventLoop::stop() {
+    if (stop_flag.exchange(true)) return;
+    wakeup();
+    if (threaded) pthread_join(loop_thread, nullptr);
+}
+
+void EventLoop::schedule(const std::shared_ptr<Connection>& conn) {
+    pthread_mutex_lock(&pending_mutex);
+    pending_connections.push_back(conn);
+    pthread_mutex_unlock(&pending_mutex);
+    wakeup();
+}
+
+void* EventLoop::loop_thread_func(void* arg) {
+    EventLoop* loop = static_cast<EventLoop*>(arg);
+    loop->run();
+    return nullptr;
+}
+
+void EventLoop::wakeup() {
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("write(eventfd)");
+    }
+}
+
+void EventLoop::run() {
+    struct epoll_event events[MAX_EVENTS];
+
+    if (cpu >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(cpu, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0) {
+            std::cerr << "Failed to pin event loop to CPU " << cpu << std::endl;
+        }
+    }
+
+    while (!stop_flag) {
+        // 有連線還在 handshake 時才需要定期醒來檢查 deadline
+        int timeout = handshake_queue.empty() ? -1 : SWEEP_INTERVAL_MS;
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd) {
+                uint64_t count;
+                while (read(wake_fd, &count, sizeof(count)) > 0) {}
+                process_pending();
+                continue;
+            }
+            if (fd == listen_fd) {
+                accept_connections();
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end()) continue;
+            std::shared_ptr<Connection> conn = it->second;
+
+            if (conn->handshaking) {
+                continue_handshake(conn);
+                continue;
+            }
+
+            uint32_t flags = events[i].events;
+            if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                // 就算是 HUP 也要先把 SSL 裡剩下的資料讀完
+                handle_read(conn);
+                if (conn->is_closed()) continue;
+            }
+            if (flags & EPOLLOUT) {
+                if (!conn->flush()) close_connection(conn);
+            }
+        }
+
+        expire_handshakes();
+    }
+}
+
+/* Edge-triggered：一直 accept 到 EAGAIN 為止
+新連線只建立 SSL 物件並送出第一步 handshake，不會在這裡等對方
+*/
+void EventLoop::accept_connections() {
+    while (true) {
+        struct sockaddr_in client_addr;
+        socklen_t addr_len = sizeof(client_addr);
+        int fd = accept4(listen_fd, (struct sockaddr*)&client_addr, &addr_len, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+
+        // 建立 SSL 並綁定 socket
+        SSL* ssl = SSL_new(ctx);
+        SSL_set_fd(ssl, fd);
+        // 允許 partial write，並允許重試時 buffer 位址改變 (out_buf 可能重新配置)
+        SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+        auto conn = std::make_shared<Connection>(this, ssl, fd);
+        conn->ip = inet_ntoa(client_addr.sin_addr);
+        conn->handshake_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(HANDSHAKE_TIMEOUT_SEC);
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            ::close(fd);
+            conn->mark_closed();
+            continue;
+        }
+        connections[fd] = conn;
+        handshake_queue.push_back(conn);
+
+        continue_handshake(conn);
+    }
+}
+
+/* Server 端握手，WANT_READ / WANT_WRITE 就等下一次 event 再繼續 */
+void EventLoop::continue_handshake(const std::shared_ptr<Connection>& conn) {
+    int r = SSL_accept(conn->ssl);
+    if (r == 1) {
+        // 握手完成，之後就走一般的 message 路徑
+        conn->handshaking = false;
+#ifndef OPENSSL_NO_KTLS
+        // SSL_OP_ENABLE_KTLS 時 OpenSSL 會試著把 key 交給 kernel；兩個方向都成功才能 splice
+        conn->ktls = BIO_get_ktls_send(SSL_get_wbio(conn->ssl)) && BIO_get_ktls_recv(SSL_get_rbio(conn->ssl));
+#endif
+        // handshake 時 SSL 可能已經順便讀進了 application data
+        handle_read(conn);
+        return;
+    }
+
+    int err = SSL_get_error(conn->ssl, r);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        return;
+    }
+
+    ERR_print_errors_fp(stderr);
+    close_connection(conn);
+}
+
+void EventLoop::expire_handshakes() {
+    auto now = std::chrono::steady_clock::now();
+    while (!handshake_queue.empty()) {
+        std::shared_ptr<Connection> conn = handshake_queue.front();
+        if (conn->handshaking && !conn->is_closed() && conn->handshake_deadline > now) break;
+
+        handshake_queue.pop_front();
+        if (conn->handshaking && !conn->is_closed()) {
+            std::cerr << "TLS handshake timeout: " << conn->ip << std::endl;
+            close_connection(conn);
+        }
+    }
+}
+
+/* 處理其他 thread 交過來的工作：需要 flush 的連線、需要關閉的連線 */
+void EventLoop::process_pending() {
+    std::vector<std::shared_ptr<Connection>> scheduled;
+
+    pthread_mutex_lock(&pending_mutex);
+    scheduled.swap(pending_connections);
+    pthread_mutex_unlock(&pending_mutex);
+
+    for (auto& conn : scheduled) {
+        if (conn->is_closed() || conn->handshaking) continue;
+
+        bool resume = conn->take_resume();
+        std::shared_ptr<Connection> target;
+        if (conn->take_opened_pipe(target)) {
+            conn->pipe_target = target;
+            conn->pipe_state = PIPE_OPEN;
+            resume = true;
+        }
+
+        if (!conn->flush() || conn->close_requested()) {
+            close_connection(conn);
+            continue;
+        }
+        if (resume && conn->read_paused) resume_read(conn);
+    }
+}
+
+/* 暫停時 buffer 裡可能已經有完整的 packet，先切完再繼續讀 (edge-triggered 不會再通知一次) */
+void EventLoop::resume_read(const std::shared_ptr<Connection>& conn) {
+    conn->read_paused = false;
+    if (!parse_packets(conn)) {
+        std::cerr << "Invalid message header from " << conn->ip << std::endl;
+        close_connection(conn);
+        return;
+    }
+    if (!conn->read_paused) handle_read(conn);
+}
+
+/* Edge-triggered：一直讀到 SSL_ERROR_WANT_READ 為止
+SSL_read 直接讀進 connection 的 pooled buffer，每讀一次就把完整的 packet 切出去
+*/
+void EventLoop::handle_read(const std::shared_ptr<Connection>& conn) {
+    bool peer_closed = false;
+
+    while (!conn->read_paused) {
+        if (conn->splice_left > 0) {
+            if (!splice_frame(conn)) {
+                peer_closed = true;
+                break;
+            }
+            // socket 暫時沒資料，或 recipient 消化不及而暫停
+            if (conn->splice_left > 0) break;
+            continue;
+        }
+
+        reserve_read_space(conn);
+        Buffer* buffer = conn->in_buffer.get();
+        int n = SSL_read(conn->ssl, buffer->data + conn->in_end, buffer->capacity - conn->in_end);
+        if (n > 0) {
+            conn->in_end += n;
+            if (!parse_packets(conn)) {
+                std::cerr << "Invalid message header from " << conn->ip << std::endl;
+                peer_closed = true;
+                break;
+            }
+            continue;
+        }
+
+        int err = SSL_get_error(conn->ssl, n);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            break;
+        }
+        peer_closed = true;
+        break;
+    }
+
+    if (peer_closed) {
+        close_connection(conn);
+    } else if (!conn->flush()) {
+        close_connection(conn);
+    }
+}
+
+/* 確保 in_buffer 後面還有空間可以讀，而且還沒收完的 packet 放得進同一個 buffer
+- 沒有 packet 還在參照這個 buffer：把沒切完的尾巴搬回開頭，重複使用
+- 否則：跟 pool 拿新的 buffer，只複製沒切完的那一小段
+*/
+void EventLoop::reserve_read_space(const std::shared_ptr<Connection>& conn) {
+    size_t pending = conn->in_end - conn->in_begin;
+    size_t needed = std::max(conn->in_needed, pending);
+    Buffer* buffer = conn->in_buffer.get();
+
+    if (buffer && buffer->capacity - conn->in_end >= MIN_READ_SPACE && conn->in_begin + needed <= buffer->capacity) {
+        return;
+    }
+
+    if (buffer && conn->in_buffer.use_count() == 1 && needed + MIN_READ_SPACE <= buffer->capacity) {
+        memmove(buffer->data, buffer->data + conn->in_begin, pending);
+    } else {
+        std::shared_ptr<Buffer> fresh = BufferPool::instance().acquire(needed + MIN_READ_SPACE);
+        if (pending > 0) memcpy(fresh->data, buffer->data + conn->in_begin, pending);
+        conn->in_buffer = fresh;
+    }
+    conn->in_begin = 0;
+    conn->in_end = pending;
+}
+
+/* 把 [in_begin, in_end) 切成完整的 packet，packet 直接參照 in_buffer，不複製資料
+Message 用 protocol.hpp 的格式，前 4 bytes 就是長度；RELAY_STREAMING / RELAY_AUDIO_STREAMING 之後，
+client 會改送 [4 bytes 長度][frame] 格式，直到長度 0 的 EOF frame。
+格式切換一定要在這裡同步決定，不能等 worker 處理完 Message 才切。
+一個 TLS record 裡有好幾個 packet、或一個 packet 被切在好幾個 record 都沒關係，
+沒收完的部分會留在 buffer 裡，in_needed 記錄還要收到多少才是一個完整的 packet。
+收到不合法的 header 時回傳 false，呼叫端應該直接斷線。
+*/
+bool EventLoop::parse_packets(const std::shared_ptr<Connection>& conn) {
+    bool valid = true;
+
+    // splice 中的 frame 還沒結束前，buffer 裡不會有資料
+    while (!conn->read_paused && conn->splice_left == 0) {
+        size_t available = conn->in_end - conn->in_begin;
+        const char* data = conn->in_buffer->data + conn->in_begin;
+        PacketKind kind;
+        size_t packet_size;
+
+        if (conn->read_mode == READ_MESSAGE) {
+            WireHeader header;
+            if (!decode_header(data, available, header, valid)) {
+                conn->in_needed = WIRE_HEADER_SIZE;
+                break;
+            }
+            kind = PACKET_MESSAGE;
+            packet_size = header.frame_size();
+
+            // 不 dedup 的 relay 傳檔案，大的 chunk 和 streaming 的 frame 一樣 splice 給 recipient
+            if (available < packet_size && header.msg_type == TRANSFER_FILE_CONTENT &&
+                splice_file_chunk(conn, header, data, available)) {
+                break;
+            }
+        } else if (conn->read_mode == READ_AUDIO_METADATA) {
+            kind = PACKET_RAW;
+            packet_size = sizeof(AudioMetadata);
+        } else {
+            if (available < sizeof(uint32_t)) {
+                conn->in_needed = sizeof(uint32_t);
+                break;
+            }
+            uint32_t frame_size_network;
+            memcpy(&frame_size_network, data, sizeof(frame_size_network));
+            size_t frame_size = ntohl(frame_size_network);
+            if (frame_size > MAX_FRAME_SIZE) {
+                valid = false;
+                break;
+            }
+            // 長度欄位也一起留著，轉傳時不用重新組
+            kind = PACKET_FRAME;
+            packet_size = sizeof(uint32_t) + frame_size;
+
+            // 大的 frame 只轉已經讀進來的部分，剩下的直接從 socket splice 給 recipient
+            if (available < packet_size && conn->pipe_state == PIPE_OPEN &&
+                can_splice(conn, conn->pipe_target, packet_size - available)) {
+                start_splice(conn, conn->pipe_target, data, available, packet_size);
+                break;
+            }
+        }
+
+        if (available < packet_size) {
+            conn->in_needed = packet_size;
+            break;
+        }
+
+        // 有可能是舊的 resume 把我們叫醒的，pipe 還沒建好就繼續等
+        if (kind != PACKET_MESSAGE && conn->pipe_state == PIPE_PENDING) {
+            conn->read_paused = true;
+            break;
+        }
+
+        Packet packet{kind, {conn->in_buffer, data, packet_size}};
+        conn->in_begin += packet_size;
+        conn->in_needed = 0;
+
+        // 決定下一個 packet 的格式
+        if (kind == PACKET_MESSAGE) {
+            uint8_t msg_type = static_cast<uint8_t>(data[WIRE_LENGTH_SIZE]);
+            if (msg_type == RELAY_STREAMING || msg_type == RELAY_AUDIO_STREAMING) {
+                conn->read_mode = (msg_type == RELAY_STREAMING) ? READ_FRAME : READ_AUDIO_METADATA;
+                // 等 worker 找到 recipient (open_pipe) 之前先不要讀，frame 會留在 buffer / socket 裡
+                conn->pipe_state = PIPE_PENDING;
+                conn->read_paused = true;
+            }
+            dispatch(conn, std::move(packet));
+            continue;
+        }
+
+        if (kind == PACKET_RAW) {
+            conn->read_mode = READ_FRAME;
+        } else if (packet_size == sizeof(uint32_t)) {
+            conn->read_mode = READ_MESSAGE;
+        }
+        forward_to_pipe(conn, packet);
+    }
+
+    return valid;
+}
+
+/* Streaming 的 frame (含 4 bytes 長度) 原封不動轉給 pipe_target，不經過 worker */
+void EventLoop::forward_to_pipe(const std::shared_ptr<Connection>& conn, const Packet& packet) {
+    std::shared_ptr<Connection> target = conn->pipe_target;
+    if (target) target->send(packet.bytes);
+
+    // 長度為 0 的 frame 是 EOF，streaming 結束
+    if (packet.kind == PACKET_FRAME && packet.bytes.size == sizeof(uint32_t)) {
+        conn->pipe_state = PIPE_NONE;
+        conn->pipe_target.reset();
+        conn->splice_target.reset();
+        conn->splice_pipe.reset();
+        return;
+    }
+
+    throttle_pipe(conn, target);
+}
+
+/* pipe_target 排隊的資料太多時先停止讀取，等它消化到 PIPE_LOW_WATER 以下再繼續，
+所以每個 pipe 最多只會佔用 PIPE_HIGH_WATER 左右的記憶體，sender 也會被 TCP 擋住。
+*/
+void EventLoop::throttle_pipe(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Connection>& target) {
+    if (target && target->queued_bytes() > PIPE_HIGH_WATER) {
+        conn->read_paused = true;
+        target->add_drain_waiter(conn);
+        // 登記完再看一次，避免在登記之前 target 就已經消化完 (或斷線) 而沒有人叫醒我們
+        if (target->queued_bytes() <= PIPE_LOW_WATER || target->is_closed()) {
+            conn->read_paused = false;
+        }
+    }
+}
+
+/* 兩端都是 kTLS、SSL 裡沒有已經解密但還沒讀出來的資料，而且剩下的量值得 splice
+target->ktls 在 target 握手完成時就決定了，之後不會再變，所以可以從這個 thread 讀
+*/
+bool EventLoop::can_splice(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Connection>& target,
+                           size_t remaining) {
+    return conn->ktls && target && target->ktls && !target->is_closed() && remaining >= SPLICE_MIN_FRAME &&
+           SSL_pending(conn->ssl) == 0;
+}
+
+/* 已經讀進來的部分照常排進 target 的 out_queue，剩下的 packet_size - available bytes 由 splice_frame 搬 */
+void EventLoop::start_splice(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Connection>& target,
+                             const char* data, size_t available, size_t packet_size) {
+    // 換了 recipient 就用新的 pipe：舊的 pipe 裡可能還有資料等著舊的 recipient 送出去
+    if (conn->splice_target != target) {
+        conn->splice_pipe.reset();
+        conn->splice_target = target;
+    }
+    target->send(BufferRef{conn->in_buffer, data, available});
+    conn->in_begin += available;
+    conn->in_needed = 0;
+    conn->splice_left = packet_size - available;
+    throttle_pipe(conn, target);
+}
+
+/* relay 傳檔案沒有 dedup 時 (chunk store 沒開、chunk 放不進 store 的 slot、manifest 不對)，
+worker 對 chunk 做的事只有原封不動轉給 recipient、從 relay_remaining 扣掉 chunk 的大小，
+這時 worker 會用 set_file_splice 告訴我們 recipient，大的 chunk 就不經過 worker，直接 splice 過去。
+- 只有這條連線的 worker 閒著時才可以：前面的 packet (metadata、前面的 chunk) 一定已經排進 recipient 的 out_queue，
+  relay_remaining 也可以由這個 thread 扣 (下一次 dispatch 的 in_mutex 保證 worker 看得到)
+- chunk header 和壓縮前的大小必須已經讀進來；其他情況回傳 false，照一般的 packet 交給 worker
+dedup 的時候 server 要算每個 chunk 的 sha256 並放進 chunk store，一定要把整個 chunk 讀進 userspace，所以不 splice。
+*/
+bool EventLoop::splice_file_chunk(const std::shared_ptr<Connection>& conn, const WireHeader& header, const char* data,
+                                  size_t available) {
+    size_t offset = WIRE_HEADER_SIZE + header.username_len;
+    size_t prefix = offset + FILE_CHUNK_HEADER_SIZE;
+    if (header.flags & WIRE_FLAG_COMPRESSED) prefix += COMPRESS_SIZE_HEADER;
+    if (available < prefix || header.payload_size() <= FILE_CHUNK_HEADER_SIZE) return false;
+
+    std::shared_ptr<Connection> target = conn->file_splice_target();
+    if (!can_splice(conn, target, header.frame_size() - available) || !conn->inbound_idle()) return false;
+
+    size_t len = header.payload_size() - FILE_CHUNK_HEADER_SIZE;
+    if (header.flags & WIRE_FLAG_COMPRESSED) {
+        compressed_chunk_size(std::string_view(data + offset, available - offset), len);
+    }
+    conn->relay_remaining -= len;
+    start_splice(conn, target, data, available, header.frame_size());
+    return true;
+}
+
+/* kTLS：目前 frame 剩下的 splice_left bytes 從 socket splice 進 splice_pipe (kernel 解密)，
+每搬一段就把那一段排進 splice_target 的 out_queue，由 target 的 EventLoop 從 pipe splice 出去 (kernel 加密)。
+- socket 暫時沒資料：回傳 true，splice_left 還大於 0，等下一次 EPOLLIN
+- pipe 滿了 (target 消化不及)：暫停讀取，target 每次寫出資料後都會檢查要不要叫醒我們
+- target 在中途斷線：剩下的 payload 讀出來丟掉
+*/
+bool EventLoop::splice_frame(const std::shared_ptr<Connection>& conn) {
+    std::shared_ptr<Connection> target = conn->splice_target;
+
+    while (conn->splice_left > 0 && !conn->read_paused) {
+        if (!target || target->is_closed()) {
+            // kTLS 的 socket 直接 recv 就是解密後的資料
+            char scratch[16384];
+            ssize_t n = recv(conn->fd, scratch, std::min(conn->splice_left, sizeof(scratch)), 0);
+            if (n > 0) {
+                conn->splice_left -= n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            return n < 0 && errno == EAGAIN;
+        }
+
+        if (!conn->splice_pipe) {
+            conn->splice_pipe = SplicePipe::create();
+            if (!conn->splice_pipe) return false;
+        }
+        SplicePipe* pipe = conn->splice_pipe.get();
+
+        ssize_t n = splice(conn->fd, nullptr, pipe->write_fd, nullptr, std::min(conn->splice_left, pipe->capacity),
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            conn->splice_left -= n;
+            // target 斷線時 pipe 裡的資料已經沒有人要了，之後用新的 pipe
+            if (!target->send_spliced(conn->splice_pipe, n)) conn->splice_pipe.reset();
+            throttle_pipe(conn, target);
+            continue;
+        }
+        if (n == 0) return false;   // 對方關掉連線
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN) return false;  // 例如中途收到 TLS alert
+
+        // EAGAIN：socket 沒有資料，或是 pipe 已經滿了
+        int in_pipe = 0;
+        if (ioctl(pipe->read_fd, FIONREAD, &in_pipe) < 0 || (size_t)in_pipe + MIN_READ_SPACE <= pipe->capacity) {
+            return true;
+        }
+        conn->read_paused = true;
+        target->add_drain_waiter(conn);
+        // 登記完再看一次，避免 target 在登記之前就把 pipe 清空了
+        if (ioctl(pipe->read_fd, FIONREAD, &in_pipe) == 0 && (size_t)in_pipe + MIN_READ_SPACE <= pipe->capacity) {
+            conn->read_paused = false;
+        }
+        if (target->is_closed()) conn->read_paused = false;
+    }
+    return true;
+}
+
+/* 同一條連線同時只會有一個 task 在跑，保證 packet 依序處理 */
+void EventLoop::dispatch(const std::shared_ptr<Connection>& conn, Packet packet) {
+    if (!conn->push_inbound(std::move(packet))) return;
+
+    thread_pool.add_task([conn]() {
+        Packet packet;
+        while (conn->pop_inbound(packet)) {
+            handle_packet(conn, packet);
+        }
+    });
+}
+
+void EventLoop::close_connection(const std::shared_ptr<Connection>& conn) {
+    auto it = connections.find(conn->fd);
+    if (it == connections.end() || it->second != conn) return;
+
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    if (!conn->handshaking) SSL_shutdown(conn->ssl);
+    ::close(conn->fd);
+    conn->mark_closed();
+    conn->pipe_target.reset();
+    conn->splice_target.reset();
+    conn->splice_pipe.reset();
+    connections.erase(it);
+
+    handle_disconnect(conn);
+}
@@ -0,0 +1,88 @@
+#ifndef EVENT_LOOP_HPP
+#define EVENT_LOOP_HPP
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+#include "connection.hpp"
+#include "threadpool.hpp"
+#include "../shared/ssl.hpp"
+
+struct WireHeader;
+
+/* Edge-triggered epoll reactor
+- 自己 accept listen socket 上的連線，TLS handshake 也在這裡 non-blocking 地做完
+- 擁有所有 client socket，socket 都設成 non-blocking
+- 用 SSL_ERROR_WANT_READ / SSL_ERROR_WANT_WRITE 驅動 non-blocking 的 OpenSSL
+- 只把切好的完整 packet 丟給 ThreadPool，worker 不會再卡在 SSL_read 上
+- Streaming 的 frame 直接在這裡轉給 recipient (relay pipe)，不佔用任何 worker；
+  兩端都是 kTLS 時，大的 frame 用 splice 在 kernel 裡轉，不經過 userspace (不 dedup 的 relay 傳檔案的 chunk 也是)
+*/
+class EventLoop {
+public:
+    EventLoop(ThreadPool& thread_pool);
+    ~EventLoop();
+
+    // 在 run() / start() 之前呼叫：由這個 EventLoop 負責 accept listen_fd
+    void add_listener(int listen_fd, SSL_CTX* ctx);
+
+    // 在 run() / start() 之前呼叫：跑 run() 的 thread 會被綁在這顆 CPU 上
+    void set_cpu(int cpu);
+
+    void run();     // 在目前的 thread 跑，直到 stop()
+    void start();   // 開一個新的 thread 跑 run()
+    void stop();
+
+    // 請 EventLoop 幫這條連線 flush / close / 建立 relay pipe / 繼續讀 (可以從任何 thread 呼叫)
+    void schedule(const std::shared_ptr<Connection>& conn);
+    // 把 task 交給這個 EventLoop 的 ThreadPool (可以從任何 thread 呼叫)
+    void add_task(Task task) { thread_pool.add_task(std::move(task)); }
+
+private:
+    int epoll_fd;
+    int wake_fd;    // eventfd，讓其他 thread 可以叫醒 epoll_wait
+    int listen_fd;
+    SSL_CTX* ctx;
+    std::atomic<bool> stop_flag;    // stop() 從別的 thread 設，run() 讀
+    bool threaded;
+    int cpu;        // -1 代表不綁 CPU
+    pthread_t loop_thread;
+
+    ThreadPool& thread_pool;
+
+    // 只有 loop thread 會碰
+    std::unordered_map<int, std::shared_ptr<Connection>> connections;
+    // 還在 handshake 的連線，依照 deadline 排序 (timeout 都一樣，所以 FIFO 就是排序好的)
+    std::deque<std::shared_ptr<Connection>> handshake_queue;
+
+    // 其他 thread 交過來的工作，用 pending_mutex 保護
+    pthread_mutex_t pending_mutex;
+    std::vector<std::shared_ptr<Connection>> pending_connections;
+
+    static void* loop_thread_func(void* arg);
+    void wakeup();
+    void process_pending();
+
+    void accept_connections();
+    void continue_handshake(const std::shared_ptr<Connection>& conn);
+    void expire_handshakes();
+    void handle_read(const std::shared_ptr<Connection>& conn);
+    void reserve_read_space(const std::shared_ptr<Connection>& conn);
+    bool parse_packets(const std::shared_ptr<Connection>& conn);
+    void resume_read(const std::shared_ptr<Connection>& conn);
+    void forward_to_pipe(const std::shared_ptr<Connection>& conn, const Packet& packet);
+    void throttle_pipe(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Connection>& target);
+    bool can_splice(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Connection>& target, size_t remaining);
+    void start_splice(const std::shared_ptr<Connection>& conn, const std::shared_ptr<Connection>& target,
+                      const char* data, size_t available, size_t packet_size);
+    bool splice_file_chunk(const std::shared_ptr<Connection>& conn, const WireHeader& header, const char* data,
+                           size_t available);
+    bool splice_frame(const std::shared_ptr<Connection>& conn);
+    void dispatch(const std::shared_ptr<Connection>& conn, Packet packet);
+    void close_connection(const std::shared_ptr<Connection>& conn);
+};
+
+#endif // EVENT_LOOP_HPP
@@ -2,20 +2,28 @@
 #include <cstdlib>
 #include "server.hpp"
 #include "authentication.hpp"
+#include "client_handler.hpp"
 
 int main(int argc, char* argv[]) {
     /* 讀 terminal input */
-    if (argc < 2 || argc > 4) {
-        std::cerr << "Usage: " << argv[0] << " <server_port> [<max_clients> <worker_count>]\n";
+    if (argc < 2 || argc > 7) {
+        std::cerr << "Usage: " << argv[0] << " <server_port> [<max_clients> <worker_count> <listener_count> <ktls> <chunk_store_mb>]\n";
         return 1;
     }
     int server_port = std::atoi(argv[1]);                    // 要開在哪個 port
     int max_clients = (argc > 2) ? std::atoi(argv[2]) : 10;  // 控制 listen 時最多可以有幾個 pending connection，預設為 10
     int worker_count = (argc > 3) ? std::atoi(argv[3]) : 10; // 控制 worker thread 的數量，預設為 10
+    int listener_count = (argc > 4) ? std::atoi(argv[4]) : 1; // 用 SO_REUSEPORT 開幾個 listener (各自一個 EventLoop)，預設為 1
+    if (listener_count < 1) listener_count = 1;
+    bool ktls = (argc > 5) && std::atoi(argv[5]) != 0;      // 1 代表用 kernel TLS (relay 可以 splice)，預設為 0
+    long chunk_store_mb = (argc > 6) ? std::atol(argv[6]) : 1024; // relay 傳檔案的 chunk store 最多用幾 MB 的 disk，0 代表不用，預設為 1024
 
     Authentication::load_user_data();
+    if (chunk_store_mb > 0 && !open_chunk_store((size_t)chunk_store_mb * 1024 * 1024)) {
+        std::cerr << "Failed to open chunk store, relayed files will not be deduplicated" << std::endl;
+    }
     try {
-        Server server(server_port, max_clients, worker_count);
+        Server server(server_port, max_clients, worker_count, listener_count, ktls);
         server.start();
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
@@ -7,11 +7,17 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <stdexcept>
+#include <csignal>
 
-/* 開 socket，bind，listen */
-Server::Server(int port, int max_clients, int worker_count)
+/* 開 listener_count 個 socket，各自 bind 同一個 port 並 listen
+listener_count > 1 時用 SO_REUSEPORT，由 kernel 把新連線分散到各個 listener
+*/
+Server::Server(int port, int max_clients, int worker_count, int listener_count, bool ktls)
     : port(port), max_clients(max_clients), thread_pool(worker_count) {
 
+    // 對方斷線時 SSL_write 不要讓整個 process 被 SIGPIPE 殺掉
+    signal(SIGPIPE, SIG_IGN);
+
     // 1) 初始化 OpenSSL
     init_openssl();
 
@@ -20,16 +26,61 @@ Server::Server(int port, int max_clients, int worker_count)
     if (!ctx) {
         throw std::runtime_error("Failed to create SSL context");
     }
+    if (ktls) enable_ktls();
+
+    // 3) 每個 listener 都有自己的 socket 和 EventLoop
+    for (int i = 0; i < listener_count; i++) {
+        int fd = create_listener(listener_count > 1);
+        if (fd < 0) {
+            for (int opened : server_fds) close(opened);
+            SSL_CTX_free(ctx);
+            throw std::runtime_error("Failed to create listener");
+        }
+        server_fds.push_back(fd);
+        event_loops.push_back(std::make_unique<EventLoop>(thread_pool));
+    }
+}
+
+Server::~Server() {
+    event_loops.clear();
+    for (int fd : server_fds) close(fd);
+    SSL_CTX_free(ctx);
+    cleanup_openssl();
+}
 
+/* kTLS：握手還是由 OpenSSL 做，之後的 record 加解密交給 kernel，
+這樣兩端都是 kTLS 的 streaming relay (和沒有 dedup 的 relay 傳檔案) 可以用 splice 轉傳，資料不用進出 userspace。
+實際上有沒有成功要看 kernel 有沒有 tls module、協商出來的 cipher，每條連線握手完才知道。
+*/
+void Server::enable_ktls() {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#if OPENSSL_VERSION_NUMBER < 0x30200000L
+    // OpenSSL 3.2 之前 TLS 1.3 只有送出的方向能交給 kernel，兩個方向都要就只能用 TLS 1.2
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+#endif
+    // kernel 只支援 AES-GCM / ChaCha20-Poly1305
+    SSL_CTX_set_cipher_list(ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    std::cout << "Kernel TLS enabled" << std::endl;
+#else
+    std::cerr << "OpenSSL was built without kTLS support, using userspace TLS" << std::endl;
+#endif
+}
 
-    server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0) {
-        SSL_CTX_free(ctx);
-        throw std::runtime_error("Failed to create socket");
+int Server::create_listener(bool reuse_port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
     }
 
     int opt = 1;
-    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+        perror("setsockopt(SO_REUSEPORT)");
+        close(fd);
+        return -1;
+    }
 
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
@@ -37,57 +88,41 @@ Server::Server(int port, int max_clients, int worker_count)
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(port);
 
-    if (bind(server_fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
-        close(server_fd);
-        SSL_CTX_free(ctx);
-        throw std::runtime_error("Bind failed");
+    if (bind(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
     }
 
-    if (listen(server_fd, max_clients) < 0) {
-        close(server_fd);
-        SSL_CTX_free(ctx);
-        throw std::runtime_error("Listen failed");
+    if (listen(fd, max_clients) < 0) {
+        perror("listen");
+        close(fd);
+        return -1;
     }
-}
-
-Server::~Server() {
-    close(server_fd);
-    SSL_CTX_free(ctx);
-    cleanup_openssl();
+    return fd;
 }
 
 void Server::start() {
     thread_pool.start();
-    std::cout << "Server listening on port " << port << std::endl;
-    accept_clients();
-    thread_pool.stop();
-}
 
-void Server::accept_clients() {
-    while (true) {
-        struct sockaddr_in client_addr;
-        socklen_t addr_len = sizeof(client_addr);
-        int client_socket = accept(server_fd, (struct sockaddr*)&client_addr, &addr_len);
-        if (client_socket < 0) {
-            perror("accept");
-            continue;
-        }
-
-        // 建立 SSL 並綁定 socket
-        SSL* client_ssl_fd = SSL_new(ctx);
-        SSL_set_fd(client_ssl_fd, client_socket);
+    // accept 和 TLS handshake 都交給 EventLoop，不會被單一個慢的 client 卡住
+    // 只有一個 listener 時維持原本的行為，不綁 CPU
+    bool pin = event_loops.size() > 1;
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    for (size_t i = 0; i < event_loops.size(); i++) {
+        event_loops[i]->add_listener(server_fds[i], ctx);
+        if (pin) event_loops[i]->set_cpu(i % cpu_count);
+    }
+    std::cout << "Server listening on port " << port << " with " << event_loops.size() << " listener(s)" << std::endl;
 
-        // Server 端握手
-        if (SSL_accept(client_ssl_fd) <= 0) {
-            ERR_print_errors_fp(stderr);
-        } else {
-            // std::cout << "SSL handshake success (Server)!\n";
-            ;
-        }
+    // 第 0 個 EventLoop 跑在目前的 thread，其他的各開一個 thread
+    for (size_t i = 1; i < event_loops.size(); i++) {
+        event_loops[i]->start();
+    }
+    event_loops[0]->run();
 
-        // 在 accept 時利用 add_task 傳入 lambda function
-        thread_pool.add_task([client_ssl_fd, client_socket]() {
-            handle_client(client_ssl_fd, client_socket);
-        });
+    for (size_t i = 1; i < event_loops.size(); i++) {
+        event_loops[i]->stop();
     }
+    thread_pool.stop();
 }
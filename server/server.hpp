@@ -2,27 +2,33 @@
 #define SERVER_HPP
 
 #include "threadpool.hpp"
-#include "client_handler.hpp"
+#include "event_loop.hpp"
 #include "../shared/ssl.hpp"
+#include <memory>
 #include <string>
+#include <vector>
 
 class Server {
 public:
-    Server(int port, int max_clients, int worker_count);
+    // ktls：握手完成後把加解密交給 kernel (kernel / OpenSSL 不支援時自動退回一般的 TLS)
+    Server(int port, int max_clients, int worker_count, int listener_count = 1, bool ktls = false);
     ~Server();
 
     void start();
 
 private:
-    int server_fd;
+    std::vector<int> server_fds;    // 每個 listener 一個 socket，都 bind 在同一個 port
     int port;
     int max_clients;
 
     ThreadPool thread_pool;
+    // 每個 listener 一個 EventLoop，各自擁有自己 accept 進來的連線，只把完整的 packet 派給 thread_pool
+    std::vector<std::unique_ptr<EventLoop>> event_loops;
 
     SSL_CTX* ctx;
 
-    void accept_clients();
+    int create_listener(bool reuse_port);
+    void enable_ktls();
 };
 
 #endif // SERVER_HPP
@@ -1,11 +1,30 @@
 #include "threadpool.hpp"
 #include <iostream>
 #include <stdexcept>
+#include <sched.h>
 
-ThreadPool::ThreadPool(int worker_count) : stop_flag(false) {
+static_assert((WORKER_QUEUE_SIZE & (WORKER_QUEUE_SIZE - 1)) == 0, "WORKER_QUEUE_SIZE must be a power of 2");
+
+// 目前這個 thread 是哪個 pool 的第幾個 worker (不是 worker 的話是 nullptr / -1)
+static thread_local const ThreadPool* current_pool = nullptr;
+static thread_local int current_worker = -1;
+
+// 外部 thread (EventLoop) 下一個要放的 queue，每個 thread 從不同的位置開始輪
+static std::atomic<unsigned> submitter_count(0);
+static thread_local unsigned submit_cursor = submitter_count.fetch_add(1);
+
+ThreadPool::ThreadPool(int worker_count)
+    : overflow_size(0), pending_tasks(0), idle_workers(0), stop_flag(false), started(false) {
     pthread_mutex_init(&queue_mutex, nullptr);
     pthread_cond_init(&condition, nullptr);
-    workers.resize(worker_count);
+
+    if (worker_count < 1) worker_count = 1;
+    for (int i = 0; i < worker_count; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->pool = this;
+        worker->index = i;
+        workers.push_back(std::move(worker));
+    }
 }
 
 ThreadPool::~ThreadPool() {
@@ -15,12 +34,18 @@ ThreadPool::~ThreadPool() {
 }
 
 void ThreadPool::start() {
+    if (started) return;
+    started = true;
+    stop_flag = false;
     for (auto& worker : workers) {
-        pthread_create(&worker, nullptr, worker_thread, this);
+        pthread_create(&worker->thread, nullptr, worker_thread, worker.get());
     }
 }
 
 void ThreadPool::stop() {
+    if (!started) return;
+    started = false;
+
     {
         pthread_mutex_lock(&queue_mutex);
         stop_flag = true;
@@ -29,50 +54,108 @@ void ThreadPool::stop() {
     }
 
     for (auto& worker : workers) {
-        pthread_join(worker, nullptr);
+        pthread_join(worker->thread, nullptr);
     }
 }
 
-void ThreadPool::add_task(const Task& task) {
-    pthread_mutex_lock(&queue_mutex);
-    task_queue.push(task);
-    pthread_cond_signal(&condition);        // 通知說有新的 task 進來了！
-    pthread_mutex_unlock(&queue_mutex);
+void ThreadPool::add_task(Task task) {
+    // 先加 pending 再放進 queue：準備睡覺的 worker 只要看到 pending > 0 就不會睡
+    pending_tasks.fetch_add(1);
+
+    size_t count = workers.size();
+    size_t first = (current_pool == this) ? (size_t)current_worker : submit_cursor++ % count;
+
+    bool queued = false;
+    for (size_t i = 0; i < count && !queued; i++) {
+        queued = workers[(first + i) % count]->queue.push(task);
+    }
+
+    if (!queued) {
+        pthread_mutex_lock(&queue_mutex);
+        overflow_queue.push_back(std::move(task));
+        overflow_size.fetch_add(1);
+        pthread_mutex_unlock(&queue_mutex);
+    }
+
+    if (idle_workers.load() > 0) {
+        pthread_mutex_lock(&queue_mutex);
+        pthread_cond_signal(&condition);        // 通知說有新的 task 進來了！
+        pthread_mutex_unlock(&queue_mutex);
+    }
 }
 
 /* 因為 pthread_create 要求 thread function 為：
 
     void* (*start_routine)(void*);
 
-因此利用傳入 this，就可以呼叫到 process_tasks 這個 function。
+因此傳入 Worker，就可以呼叫到 process_tasks 這個 function。
 */
 void* ThreadPool::worker_thread(void* arg) {
-    ThreadPool* pool = static_cast<ThreadPool*>(arg);
-    pool->process_tasks();
+    Worker* worker = static_cast<Worker*>(arg);
+    current_pool = worker->pool;
+    current_worker = worker->index;
+    worker->pool->process_tasks(worker);
     return nullptr;
 }
 
+/* 找下一個 task：自己的 queue -> overflow queue -> 從隨機的 victim 開始偷 */
+bool ThreadPool::next_task(Worker* worker, Task& task, unsigned& seed) {
+    bool found = worker->queue.pop(task);
+
+    if (!found && overflow_size.load(std::memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&queue_mutex);
+        if (!overflow_queue.empty()) {
+            task = std::move(overflow_queue.front());
+            overflow_queue.pop_front();
+            overflow_size.fetch_sub(1);
+            found = true;
+        }
+        pthread_mutex_unlock(&queue_mutex);
+    }
+
+    if (!found) {
+        size_t count = workers.size();
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        size_t victim = seed % count;
+        for (size_t i = 0; i < count && !found; i++) {
+            Worker* other = workers[(victim + i) % count].get();
+            if (other != worker) found = other->queue.pop(task);
+        }
+    }
+
+    if (found) pending_tasks.fetch_sub(1);
+    return found;
+}
+
 /* 此 function 的目的為：
-1. 在正確的時機利用 condition variable 離開 wait
-2. 利用 mutex lock 正確的從 queue 中把 task pop 出來
+1. 從自己的 queue 拿 task，沒有的話去偷別人的
+2. 真的沒有 task 時，在正確的時機利用 condition variable 睡覺 / 離開 wait
 3. 執行 task 的內容
 */
-void ThreadPool::process_tasks() {
-    while (true) {
-        Task task;
+void ThreadPool::process_tasks(Worker* worker) {
+    unsigned seed = 2463534242u + worker->index * 7919u;
 
-        /* Condition Variables 的標準寫法*/
-        pthread_mutex_lock(&queue_mutex);
-        while (task_queue.empty() && !stop_flag) {
-            pthread_cond_wait(&condition, &queue_mutex);    // 等新的 task
-        }
-        if (stop_flag) {
+    while (!stop_flag) {
+        Task task;
+        if (!next_task(worker, task, seed)) {
+            /* idle_workers 和 pending_tasks 的順序保證不會漏掉 signal：
+            add_task 先加 pending 才看 idle，這裡先加 idle 才看 pending。*/
+            pthread_mutex_lock(&queue_mutex);
+            idle_workers.fetch_add(1);
+            bool waited = false;
+            while (pending_tasks.load() == 0 && !stop_flag) {
+                pthread_cond_wait(&condition, &queue_mutex);    // 等新的 task
+                waited = true;
+            }
+            idle_workers.fetch_sub(1);
             pthread_mutex_unlock(&queue_mutex);
-            break;
+
+            // pending > 0 但 task 還沒放進 queue (或被別人先拿走了)，讓出 CPU 再找一次
+            if (!waited) sched_yield();
+            continue;
         }
-        task = task_queue.front();              // 把 queue 的一個 task pop 出來
-        task_queue.pop();
-        pthread_mutex_unlock(&queue_mutex);     // 解除 queue 的 mutex lock
 
         /* 執行 task 的內容 */
         try {
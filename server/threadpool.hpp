@@ -2,14 +2,94 @@
 #define THREADPOOL_HPP
 
 #include <pthread.h>
-#include <queue>
-#include <functional>
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include "../shared/bounded_queue.hpp"
 
-// Represents a task to be handled by the thread pool
-using Task = std::function<void()>;
+#define TASK_INLINE_SIZE 48         // Task 內建的空間，capture 超過這個大小會編譯失敗
+#define WORKER_QUEUE_SIZE 1024      // 每個 worker queue 的容量 (必須是 2 的次方)
 
-// Thread pool class
+/* Represents a task to be handled by the thread pool
+只能 move 的 callable，capture 直接放在 Task 內部的空間裡，不會像 std::function 一樣配置記憶體。
+*/
+class Task {
+public:
+    Task() = default;
+
+    template <typename F, typename Fn = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<Fn, Task>>>
+    Task(F&& f) {
+        static_assert(sizeof(Fn) <= TASK_INLINE_SIZE, "Task capture is too large");
+        static_assert(alignof(Fn) <= alignof(std::max_align_t), "Task capture is over-aligned");
+        new (storage) Fn(std::forward<F>(f));
+        ops = &ops_for<Fn>;
+    }
+
+    Task(Task&& other) noexcept { move_from(other); }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    void operator()() { ops->invoke(storage); }
+    explicit operator bool() const { return ops != nullptr; }
+
+private:
+    struct Ops {
+        void (*invoke)(void* fn);
+        void (*move)(void* dst, void* src);     // move 到 dst 並且 destroy src
+        void (*destroy)(void* fn);
+    };
+
+    template <typename Fn>
+    static inline const Ops ops_for = {
+        [](void* fn) { (*static_cast<Fn*>(fn))(); },
+        [](void* dst, void* src) {
+            new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        },
+        [](void* fn) { static_cast<Fn*>(fn)->~Fn(); },
+    };
+
+    void move_from(Task& other) {
+        if (!other.ops) return;
+        other.ops->move(storage, other.storage);
+        ops = other.ops;
+        other.ops = nullptr;
+    }
+
+    void reset() {
+        if (!ops) return;
+        ops->destroy(storage);
+        ops = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char storage[TASK_INLINE_SIZE];
+    const Ops* ops = nullptr;
+};
+
+/* Thread pool class
+每個 worker 有自己的 lock-free queue：
+- 從 worker 自己送出的 task 放進自己的 queue
+- 從外面 (EventLoop) 送出的 task 由每個送出的 thread 輪流放進各個 worker 的 queue
+- worker 自己的 queue 空了，就從隨機的一個 worker 開始偷
+只有在有 worker 閒置時，add_task 才需要拿 mutex 叫醒它。
+*/
 class ThreadPool {
 public:
     ThreadPool(int worker_count);
@@ -17,17 +97,34 @@ public:
 
     void start();
     void stop();
-    void add_task(const Task& task);
+    void add_task(Task task);
 
 private:
-    std::vector<pthread_t> workers;
-    std::queue<Task> task_queue;
+    struct Worker {
+        Worker() : queue(WORKER_QUEUE_SIZE) {}
+
+        pthread_t thread;
+        ThreadPool* pool;
+        int index;
+        BoundedQueue<Task> queue;   // reactor push、owner pop、其他 worker steal 都用同一個 queue
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    // 所有 worker queue 都滿的時候才會用到
+    std::deque<Task> overflow_queue;
+    std::atomic<size_t> overflow_size;
+
+    std::atomic<long> pending_tasks;    // 已送出但還沒被拿走的 task 數量
+    std::atomic<int> idle_workers;
     pthread_mutex_t queue_mutex;
     pthread_cond_t condition;
-    bool stop_flag;
+    std::atomic<bool> stop_flag;
+    bool started;
 
     static void* worker_thread(void* arg);
-    void process_tasks();
+    void process_tasks(Worker* worker);
+    bool next_task(Worker* worker, Task& task, unsigned& seed);
 };
 
 #endif // THREADPOOL_HPP
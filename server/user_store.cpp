@@ -0,0 +1,372 @@
+#include "user_store.hpp"
+#include "../shared/checksum.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static void encode_record(std::vector<char>& out, const std::string& username, const std::string& password_hash) {
+    size_t start = out.size();
+    out.resize(start + USER_RECORD_HEADER_SIZE + username.size() + password_hash.size());
+    char* p = out.data() + start;
+
+    uint16_t username_len = htons(static_cast<uint16_t>(username.size()));
+    uint16_t hash_len = htons(static_cast<uint16_t>(password_hash.size()));
+    memcpy(p + 4, &username_len, sizeof(username_len));
+    memcpy(p + 6, &hash_len, sizeof(hash_len));
+    memcpy(p + USER_RECORD_HEADER_SIZE, username.data(), username.size());
+    memcpy(p + USER_RECORD_HEADER_SIZE + username.size(), password_hash.data(), password_hash.size());
+
+    uint32_t crc = htonl(crc32(p + 4, out.size() - start - 4));
+    memcpy(p, &crc, sizeof(crc));
+}
+
+/* 解析 data 開頭的一筆 record；資料不完整或 checksum 不對時回傳 false */
+static bool decode_record(const char* data, size_t len, size_t& record_size,
+                          std::string_view& username, std::string_view& password_hash) {
+    if (len < USER_RECORD_HEADER_SIZE) return false;
+
+    uint32_t crc;
+    uint16_t username_len, hash_len;
+    memcpy(&crc, data, sizeof(crc));
+    memcpy(&username_len, data + 4, sizeof(username_len));
+    memcpy(&hash_len, data + 6, sizeof(hash_len));
+    username_len = ntohs(username_len);
+    hash_len = ntohs(hash_len);
+
+    record_size = USER_RECORD_HEADER_SIZE + username_len + hash_len;
+    if (len < record_size || crc32(data + 4, record_size - 4) != ntohl(crc)) return false;
+
+    username = std::string_view(data + USER_RECORD_HEADER_SIZE, username_len);
+    password_hash = std::string_view(data + USER_RECORD_HEADER_SIZE + username_len, hash_len);
+    return true;
+}
+
+static bool write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+UserStore::UserStore()
+    : fd(-1), running(false), pending_superseded(0), next_ticket(1), durable_ticket(0), stop_flag(false),
+      durable_size(0), truncate_needed(false), live_bytes(0), dead_bytes(0) {
+    pthread_mutex_init(&store_mutex, nullptr);
+    pthread_cond_init(&pending_cond, nullptr);
+    pthread_cond_init(&durable_cond, nullptr);
+}
+
+UserStore::~UserStore() {
+    close();
+    pthread_mutex_destroy(&store_mutex);
+    pthread_cond_destroy(&pending_cond);
+    pthread_cond_destroy(&durable_cond);
+}
+
+bool UserStore::open(const std::string& log_path, const std::string& legacy_path,
+                     std::unordered_map<std::string, std::string>& index) {
+    path = log_path;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (fd < 0) {
+        perror("open user log");
+        return false;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    size_t size = st.st_size;
+
+    if (size == 0) {
+        // 新的 log：寫 magic，有舊的文字檔就一起轉過來
+        std::vector<char> initial(USER_LOG_MAGIC, USER_LOG_MAGIC + USER_LOG_MAGIC_SIZE);
+        std::ifstream legacy(legacy_path);
+        std::string line;
+        while (std::getline(legacy, line)) {
+            std::istringstream iss(line);
+            std::string username, password_hash;
+            if (!(iss >> username >> password_hash)) continue;
+            if (index.count(username)) dead_bytes += USER_RECORD_HEADER_SIZE + username.size() + index[username].size();
+            index[username] = password_hash;
+            encode_record(initial, username, password_hash);
+        }
+        if (!write_all(fd, initial.data(), initial.size()) || fdatasync(fd) < 0) {
+            perror("write user log");
+            return false;
+        }
+        live_bytes = initial.size() - USER_LOG_MAGIC_SIZE - dead_bytes;
+        durable_size = initial.size();
+        if (!index.empty()) std::cout << "Imported " << index.size() << " users from " << legacy_path << std::endl;
+    } else {
+        void* mapped = (size >= USER_LOG_MAGIC_SIZE) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (mapped == MAP_FAILED || memcmp(mapped, USER_LOG_MAGIC, USER_LOG_MAGIC_SIZE) != 0) {
+            std::cerr << path << " is not a user log" << std::endl;
+            if (mapped != MAP_FAILED) munmap(mapped, size);
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+
+        const char* data = static_cast<const char*>(mapped);
+        madvise(mapped, size, MADV_SEQUENTIAL);
+
+        size_t offset = USER_LOG_MAGIC_SIZE;
+        size_t record_size;
+        std::string_view username, password_hash;
+        while (offset < size && decode_record(data + offset, size - offset, record_size, username, password_hash)) {
+            auto [it, inserted] = index.try_emplace(std::string(username));
+            if (!inserted) {
+                size_t old_size = USER_RECORD_HEADER_SIZE + it->first.size() + it->second.size();
+                dead_bytes += old_size;
+                live_bytes -= old_size;
+            }
+            it->second.assign(password_hash);
+            live_bytes += record_size;
+            offset += record_size;
+        }
+        munmap(mapped, size);
+
+        // 後面是寫到一半 (crash) 或壞掉的 record，截掉之後才能繼續 append
+        if (offset < size) {
+            std::cerr << "Truncating " << size - offset << " damaged bytes at the end of " << path << std::endl;
+            if (ftruncate(fd, offset) < 0) perror("ftruncate user log");
+        }
+        durable_size = offset;
+    }
+
+    stop_flag = false;
+    running = true;
+    pthread_create(&flush_thread, nullptr, flush_thread_func, this);
+    return true;
+}
+
+void UserStore::close() {
+    if (running) {
+        pthread_mutex_lock(&store_mutex);
+        stop_flag = true;
+        pthread_cond_signal(&pending_cond);
+        pthread_mutex_unlock(&store_mutex);
+        pthread_join(flush_thread, nullptr);
+        running = false;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+uint64_t UserStore::append(const std::string& username, const std::string& password_hash, const std::string& superseded_hash) {
+    pthread_mutex_lock(&store_mutex);
+    encode_record(pending, username, password_hash);
+    live_bytes += USER_RECORD_HEADER_SIZE + username.size() + password_hash.size();
+    if (!superseded_hash.empty()) {
+        size_t old_size = USER_RECORD_HEADER_SIZE + username.size() + superseded_hash.size();
+        live_bytes -= old_size;
+        dead_bytes += old_size;
+        pending_superseded += old_size;
+    }
+    uint64_t ticket = next_ticket++;
+    pthread_cond_signal(&pending_cond);
+    pthread_mutex_unlock(&store_mutex);
+    return ticket;
+}
+
+bool UserStore::wait_durable(uint64_t ticket) {
+    pthread_mutex_lock(&store_mutex);
+    // 沒有 flush thread (log 開不起來) 時不等，資料只會留在記憶體
+    while (running && durable_ticket < ticket) {
+        pthread_cond_wait(&durable_cond, &store_mutex);
+    }
+    bool ok = running && !ticket_failed(ticket);
+    pthread_mutex_unlock(&store_mutex);
+    return ok;
+}
+
+// 呼叫時要握著 store_mutex
+bool UserStore::ticket_failed(uint64_t ticket) {
+    for (const auto& range : failed_tickets) {
+        if (ticket >= range.first && ticket <= range.second) return true;
+    }
+    return false;
+}
+
+void* UserStore::flush_thread_func(void* arg) {
+    static_cast<UserStore*>(arg)->flush_loop();
+    return nullptr;
+}
+
+/* Group commit：
+fdatasync 的時候新的 record 會繼續累積在 pending，下一輪再一次寫出去，
+所以同時註冊的人越多，平均每個人分到的 fdatasync 就越少。
+*/
+void UserStore::flush_loop() {
+    std::vector<char> batch;
+
+    pthread_mutex_lock(&store_mutex);
+    while (true) {
+        while (pending.empty() && !stop_flag) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += COMPACT_CHECK_SEC;
+            int r = pthread_cond_timedwait(&pending_cond, &store_mutex, &deadline);
+
+            // 閒下來的時候才做 compaction，期間新的 record 只是先留在 pending
+            if (r == ETIMEDOUT && needs_compaction()) {
+                pthread_mutex_unlock(&store_mutex);
+                compact();
+                pthread_mutex_lock(&store_mutex);
+            }
+        }
+        if (pending.empty()) break;     // stop_flag 而且都寫完了
+
+        batch.swap(pending);
+        size_t batch_superseded = pending_superseded;
+        pending_superseded = 0;
+        uint64_t first_ticket = durable_ticket + 1;
+        uint64_t batch_ticket = next_ticket - 1;
+        pthread_mutex_unlock(&store_mutex);
+
+        bool ok = write_batch(batch);
+        size_t batch_size = batch.size();
+        batch.clear();
+
+        pthread_mutex_lock(&store_mutex);
+        if (!ok) {
+            // 只有這一批的 ticket 算失敗，之後的批次各自回報；這些 record 不在檔案裡，蓋掉的 record 還是最新的
+            failed_tickets.emplace_back(first_ticket, batch_ticket);
+            live_bytes = live_bytes - batch_size + batch_superseded;
+            dead_bytes -= batch_superseded;
+        }
+        durable_ticket = batch_ticket;
+        pthread_cond_broadcast(&durable_cond);
+    }
+    pthread_mutex_unlock(&store_mutex);
+}
+
+/* 寫一批 record 並 fdatasync
+失敗時 (可能只寫了一半) 把檔案截回上一批成功之後的大小：寫了一半的 record 留在中間的話，
+下次啟動會從那裡截掉，後面成功的 record 全部都會不見；沒有 fdatasync 成功的 record 也不應該在重開之後出現。
+截不回去時這一批之後的寫入都先不做，每一批都再試一次。
+*/
+bool UserStore::write_batch(const std::vector<char>& batch) {
+    if (truncate_needed) {
+        if (ftruncate(fd, durable_size) < 0) {
+            perror("ftruncate user log");
+            return false;
+        }
+        truncate_needed = false;
+    }
+
+    if (write_all(fd, batch.data(), batch.size()) && fdatasync(fd) == 0) {
+        durable_size += batch.size();
+        return true;
+    }
+    perror("write user log");
+    if (ftruncate(fd, durable_size) < 0 || fdatasync(fd) < 0) {
+        perror("ftruncate user log");
+        truncate_needed = true;
+    }
+    return false;
+}
+
+// 呼叫時要握著 store_mutex
+bool UserStore::needs_compaction() {
+    return dead_bytes >= COMPACT_MIN_DEAD_BYTES && dead_bytes > live_bytes;
+}
+
+/* 把 log 重寫成每個 username 只剩最新的一筆，寫到暫存檔再 rename 蓋過去
+只在 flush thread 上跑，不會跟 append 的寫入同時發生
+*/
+bool UserStore::compact() {
+    // compaction 期間 append 進來的 record 還在 pending，它們蓋掉的 record 可能還在新的檔案裡，下一次再算
+    pthread_mutex_lock(&store_mutex);
+    size_t compacted_dead_bytes = dead_bytes;
+    pthread_mutex_unlock(&store_mutex);
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) return false;
+    size_t size = st.st_size;
+
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) return false;
+    const char* data = static_cast<const char*>(mapped);
+
+    // 每個 username 最後一筆 record 的位置
+    std::unordered_map<std::string_view, size_t> latest;
+    size_t offset = USER_LOG_MAGIC_SIZE;
+    size_t record_size;
+    std::string_view username, password_hash;
+    while (offset < size && decode_record(data + offset, size - offset, record_size, username, password_hash)) {
+        latest[username] = offset;
+        offset += record_size;
+    }
+
+    std::string tmp_path = path + ".compact";
+    int tmp_fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (tmp_fd < 0) {
+        munmap(mapped, size);
+        return false;
+    }
+
+    std::vector<char> out(USER_LOG_MAGIC, USER_LOG_MAGIC + USER_LOG_MAGIC_SIZE);
+    bool ok = true;
+    offset = USER_LOG_MAGIC_SIZE;
+    while (ok && offset < size && decode_record(data + offset, size - offset, record_size, username, password_hash)) {
+        if (latest[username] == offset) out.insert(out.end(), data + offset, data + offset + record_size);
+        offset += record_size;
+        if (out.size() >= 1024 * 1024) {
+            ok = write_all(tmp_fd, out.data(), out.size());
+            out.clear();
+        }
+    }
+    ok = ok && write_all(tmp_fd, out.data(), out.size()) && fdatasync(tmp_fd) == 0;
+    ::close(tmp_fd);
+    munmap(mapped, size);
+
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) < 0) {
+        perror("compact user log");
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    // rename 本身也要 fsync 所在的目錄才算寫進 disk
+    size_t slash = path.find_last_of('/');
+    std::string dir = (slash == std::string::npos) ? "." : path.substr(0, slash);
+    int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        ::close(dir_fd);
+    }
+
+    int new_fd = ::open(path.c_str(), O_RDWR | O_APPEND);
+    if (new_fd < 0) {
+        perror("reopen user log");
+        return false;
+    }
+    ::close(fd);
+    fd = new_fd;
+
+    fstat(fd, &st);
+    durable_size = st.st_size;
+    truncate_needed = false;
+    pthread_mutex_lock(&store_mutex);
+    dead_bytes -= compacted_dead_bytes;
+    pthread_mutex_unlock(&store_mutex);
+    std::cout << "Compacted " << path << " from " << size << " to " << st.st_size << " bytes" << std::endl;
+    return true;
+}
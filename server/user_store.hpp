@@ -0,0 +1,83 @@
+#ifndef USER_STORE_HPP
+#define USER_STORE_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+
+/* 帳號資料的 append-only log
+
+檔案開頭是 8 bytes 的 USER_LOG_MAGIC，後面接著一筆一筆的 record (全部都是 network byte order)：
+
+    +---------+--------------+----------+----------+---------------+
+    | crc32   | username_len | hash_len | username | password_hash |
+    | 4 bytes | 2 bytes      | 2 bytes  | n bytes  | m bytes       |
+    +---------+--------------+----------+----------+---------------+
+
+crc32 涵蓋 crc 後面的所有欄位。同一個 username 出現很多次時以最後一筆為準。
+- 註冊只會在檔尾 append 一筆 record，不會重寫整個檔案
+- 背景的 flush thread 把同一段時間內的 record 一次 write + fdatasync (group commit)
+- 一批寫入失敗時把檔案截回上一批成功的地方，只有這一批的註冊算失敗
+- 啟動時用 mmap 讀整個 log；檔尾寫到一半的 record (crash) 會被截掉
+- 被覆蓋掉的 record 太多時，flush thread 會在背景把 log 重寫成只剩最新的 record
+*/
+#define USER_LOG_MAGIC "USRLOG01"
+#define USER_LOG_MAGIC_SIZE 8
+#define USER_RECORD_HEADER_SIZE 8
+#define COMPACT_CHECK_SEC 60                    // flush thread 多久檢查一次要不要 compaction
+#define COMPACT_MIN_DEAD_BYTES (1024 * 1024)    // 被覆蓋的 record 至少要這麼多才值得 compaction
+
+class UserStore {
+public:
+    UserStore();
+    ~UserStore();
+
+    /* 把 path 的 log 全部載入 index，並啟動 flush thread
+    log 不存在但 legacy_path (舊的文字格式) 存在時，會先把舊資料轉進 log
+    */
+    bool open(const std::string& path, const std::string& legacy_path,
+              std::unordered_map<std::string, std::string>& index);
+    void close();
+
+    /* 放進下一批要寫入的 record，回傳這筆 record 的 ticket (不會等 disk)
+    superseded_hash 是這筆 record 蓋掉的 hash (新帳號是空字串)，用來算有多少被覆蓋的 record 可以 compaction */
+    uint64_t append(const std::string& username, const std::string& password_hash, const std::string& superseded_hash = "");
+    // 等到 ticket 之前的 record 都 fdatasync 完成；這筆 record 所在的那一批寫入失敗時回傳 false
+    bool wait_durable(uint64_t ticket);
+
+private:
+    static void* flush_thread_func(void* arg);
+    void flush_loop();
+    bool compact();
+    bool needs_compaction();
+    bool write_batch(const std::vector<char>& batch);
+    bool ticket_failed(uint64_t ticket);
+
+    std::string path;
+    int fd;
+    pthread_t flush_thread;
+    bool running;
+
+    pthread_mutex_t store_mutex;
+    pthread_cond_t pending_cond;    // 有新的 record 要寫
+    pthread_cond_t durable_cond;    // 有一批 record 寫完了
+    std::vector<char> pending;      // 還沒寫到檔案的 record
+    size_t pending_superseded;      // pending 裡的 record 蓋掉的 record 大小總和
+    uint64_t next_ticket;
+    uint64_t durable_ticket;        // 這個 ticket 之前的 record 都已經處理完 (寫進 disk 或確定失敗)
+    std::vector<std::pair<uint64_t, uint64_t>> failed_tickets;  // 寫入失敗的批次 [first, last]
+    bool stop_flag;
+
+    // 只有 flush thread 使用
+    off_t durable_size;     // 最後一批成功 fdatasync 之後的檔案大小，寫入失敗時截回這裡
+    bool truncate_needed;   // 截回 durable_size 也失敗了，下一批寫入之前要再試一次
+
+    // open() 之後由 store_mutex 保護 (append 和 flush thread 都會改)
+    size_t live_bytes;      // 每個 username 最新那筆 record 的大小總和 (包括還在 pending 的)
+    size_t dead_bytes;      // 被後面的 record 覆蓋掉的大小總和
+};
+
+#endif // USER_STORE_HPP
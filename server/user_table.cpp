@@ -0,0 +1,134 @@
+#include "user_table.hpp"
+
+#include <functional>
+#include <pthread.h>
+#include <sched.h>
+
+static_assert((USER_TABLE_SHARDS & (USER_TABLE_SHARDS - 1)) == 0, "USER_TABLE_SHARDS must be a power of 2");
+
+// 上次拿到的 slot，下次先試同一個，通常一次 CAS 就成功
+static thread_local unsigned slot_hint = std::hash<pthread_t>()(pthread_self()) % MAX_TABLE_READERS;
+
+UserTable::UserTable() : global_epoch(1) {
+    for (auto& shard : shards) shard.store(new Shard());
+    for (auto& reader : readers) {
+        reader.in_use.store(false);
+        reader.epoch.store(0);
+    }
+}
+
+UserTable::~UserTable() {
+    for (auto& shard : shards) delete shard.load();
+    for (auto& item : retired) delete item.shard;
+}
+
+size_t UserTable::shard_index(const std::string& username) {
+    return std::hash<std::string>()(username) & (USER_TABLE_SHARDS - 1);
+}
+
+/* 佔一個 reader slot 並記下目前的 epoch
+writer 先換 pointer 才把 epoch 加一，所以記到新 epoch 的 reader 一定只看得到新的 snapshot；
+記到舊 epoch 的 reader 可能還拿著舊的，writer 就不會 delete 那個 epoch 換掉的 snapshot。
+*/
+int UserTable::enter() {
+    unsigned slot = slot_hint;
+    while (true) {
+        for (int i = 0; i < MAX_TABLE_READERS; i++, slot = (slot + 1) % MAX_TABLE_READERS) {
+            bool expected = false;
+            if (!readers[slot].in_use.load(std::memory_order_relaxed) &&
+                readers[slot].in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                slot_hint = slot;
+                readers[slot].epoch.store(global_epoch.load());
+                return slot;
+            }
+        }
+        sched_yield();
+    }
+}
+
+void UserTable::leave(int slot) {
+    readers[slot].epoch.store(0, std::memory_order_release);
+    readers[slot].in_use.store(false, std::memory_order_release);
+}
+
+bool UserTable::find(const std::string& username, std::string& hash) {
+    int slot = enter();
+    const Shard* shard = shards[shard_index(username)].load();
+    auto it = shard->find(username);
+    bool found = (it != shard->end());
+    if (found) hash = it->second;
+    leave(slot);
+    return found;
+}
+
+bool UserTable::contains(const std::string& username) {
+    int slot = enter();
+    const Shard* shard = shards[shard_index(username)].load();
+    bool found = (shard->find(username) != shard->end());
+    leave(slot);
+    return found;
+}
+
+void UserTable::publish(size_t index, const Shard* shard) {
+    const Shard* old = shards[index].exchange(shard);
+    retired.push_back({global_epoch.load(), old});
+}
+
+// 換完 pointer 之後把 epoch 加一，delete 所有 reader 都已經離開的 snapshot
+void UserTable::reclaim() {
+    uint64_t current = global_epoch.fetch_add(1) + 1;
+
+    uint64_t oldest = current;
+    for (auto& reader : readers) {
+        uint64_t epoch = reader.epoch.load();
+        if (epoch != 0 && epoch < oldest) oldest = epoch;
+    }
+
+    size_t kept = 0;
+    for (auto& item : retired) {
+        if (item.epoch < oldest) {
+            delete item.shard;
+        } else {
+            retired[kept++] = item;
+        }
+    }
+    retired.resize(kept);
+}
+
+void UserTable::load(const std::unordered_map<std::string, std::string>& users) {
+    std::vector<Shard*> fresh(USER_TABLE_SHARDS);
+    for (auto& shard : fresh) shard = new Shard();
+    for (const auto& [username, hash] : users) {
+        fresh[shard_index(username)]->emplace(username, hash);
+    }
+    for (size_t i = 0; i < USER_TABLE_SHARDS; i++) publish(i, fresh[i]);
+    reclaim();
+}
+
+void UserTable::apply(const std::vector<Update*>& batch) {
+    // writer 只有一個，直接讀目前的 snapshot 不會被別人 delete
+    std::vector<Shard*> copies(USER_TABLE_SHARDS, nullptr);
+    for (Update* update : batch) {
+        size_t index = shard_index(update->username);
+        if (!copies[index]) copies[index] = new Shard(*shards[index].load());
+        Shard& shard = *copies[index];
+
+        auto it = shard.find(update->username);
+        if (update->expected.empty()) {
+            update->applied = (it == shard.end());
+            if (update->applied) shard.emplace(update->username, update->hash);
+        } else {
+            update->applied = (it != shard.end() && it->second == update->expected);
+            if (update->applied && update->hash.empty()) {
+                shard.erase(it);
+            } else if (update->applied) {
+                it->second = update->hash;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < USER_TABLE_SHARDS; i++) {
+        if (copies[i]) publish(i, copies[i]);
+    }
+    reclaim();
+}
@@ -0,0 +1,68 @@
+#ifndef USER_TABLE_HPP
+#define USER_TABLE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define USER_TABLE_SHARDS 256       // 必須是 2 的次方
+#define MAX_TABLE_READERS 256       // 同時在讀的 thread 超過這個數量時，多出來的要等空出來的 slot
+
+/* username -> password hash，給 login 查詢用
+每個 shard 是一份不會再被修改的 snapshot，放在 atomic pointer 後面：
+- 讀的人不拿鎖，只在自己的 reader slot 記下目前的 epoch，讀完再清掉
+- 寫的人複製整個 shard、改好之後換掉 pointer，舊的 snapshot 等到沒有 reader
+  還停在更早的 epoch 時才 delete (epoch-based reclamation)
+同一時間只能有一個 writer (load / apply)，由呼叫端保證。
+*/
+class UserTable {
+public:
+    struct Update {
+        std::string username;
+        std::string hash;
+        std::string expected;   // 空字串：新增帳號；否則只有目前的 hash 還是 expected 時才換掉 (hash 是空字串時刪掉)
+        bool applied;           // apply() 的結果
+    };
+
+    UserTable();
+    ~UserTable();
+
+    // 不拿鎖；找到時把 hash 複製出來
+    bool find(const std::string& username, std::string& hash);
+    bool contains(const std::string& username);
+
+    // writer：用 users 換掉整個 table
+    void load(const std::unordered_map<std::string, std::string>& users);
+    // writer：套用一批更新，每個被改到的 shard 只複製、換掉一次
+    void apply(const std::vector<Update*>& batch);
+
+private:
+    using Shard = std::unordered_map<std::string, std::string>;
+
+    // 每個 slot 各自佔一個 cache line，reader 之間不會互相干擾
+    struct alignas(64) ReaderSlot {
+        std::atomic<bool> in_use;
+        std::atomic<uint64_t> epoch;    // 0 表示沒有在讀
+    };
+
+    struct Retired {
+        uint64_t epoch;                 // 被換掉時的 epoch
+        const Shard* shard;
+    };
+
+    static size_t shard_index(const std::string& username);
+
+    int enter();
+    void leave(int slot);
+    void publish(size_t index, const Shard* shard);
+    void reclaim();
+
+    std::atomic<const Shard*> shards[USER_TABLE_SHARDS];
+    ReaderSlot readers[MAX_TABLE_READERS];
+    std::atomic<uint64_t> global_epoch;
+    std::vector<Retired> retired;       // 只有 writer 會碰
+};
+
+#endif // USER_TABLE_HPP
@@ -0,0 +1,64 @@
+#include "bitrate.hpp"
+
+#include <algorithm>
+
+#define ABR_LOAD_SMOOTHING 8        // 移動平均大約看最近幾個 frame
+#define ABR_UP_BACKOFF_MAX 8        // 升級之後馬上又要降級時，下一次升級要等的時間加倍，最多幾倍
+
+BitrateController::BitrateController(double fps) {
+    if (fps <= 0) fps = 30;
+    frame_interval_us = static_cast<int64_t>(1e6 / fps);
+
+    // 先降 quality，再降解析度，最後降 frame rate
+    for (int quality = ABR_QUALITY_MAX; quality >= ABR_QUALITY_MIN; quality -= ABR_QUALITY_STEP) {
+        levels.push_back({quality, 100, 1});
+    }
+    int quality = levels.back().quality;
+    for (int scale = 100 - ABR_SCALE_STEP_PERCENT; scale >= ABR_SCALE_MIN_PERCENT; scale -= ABR_SCALE_STEP_PERCENT) {
+        levels.push_back({quality, scale, 1});
+    }
+    int scale = levels.back().scale_percent;
+    for (int divisor = 2; fps / divisor >= ABR_FPS_MIN; divisor++) {
+        levels.push_back({quality, scale, divisor});
+    }
+}
+
+bool BitrateController::on_frame_sent(int64_t send_us, int64_t behind_us, int64_t now_us) {
+    int index = current.load(std::memory_order_relaxed);
+    int64_t budget_us = frame_interval_us * levels[index].frame_divisor;
+    double sample = std::min(4.0, static_cast<double>(send_us) / budget_us);
+    load += (sample - load) / ABR_LOAD_SMOOTHING;
+
+    if (load > ABR_CONGESTED_LOAD || behind_us > ABR_BEHIND_MS * 1000LL) {
+        clear_since_us = -1;
+        if (index + 1 >= (int)levels.size() || now_us - last_change_us < ABR_DOWN_INTERVAL_MS * 1000LL) return false;
+
+        // 剛升級就跟不上：這一級的 bitrate 超過連線的速度，下次要等久一點再試
+        if (upgraded && now_us - last_change_us < up_backoff * ABR_UP_INTERVAL_MS * 1000LL) {
+            up_backoff = std::min(up_backoff * 2, ABR_UP_BACKOFF_MAX);
+        }
+        upgraded = false;
+        current.store(index + 1, std::memory_order_relaxed);
+        last_change_us = now_us;
+        downgrade_count++;
+        lowest_index = std::max(lowest_index, index + 1);
+        return true;
+    }
+
+    if (load >= ABR_CLEAR_LOAD || behind_us > ABR_BEHIND_MS * 1000LL / 4) {
+        clear_since_us = -1;
+        return false;
+    }
+    if (clear_since_us < 0) clear_since_us = now_us;
+
+    int64_t wait_us = up_backoff * ABR_UP_INTERVAL_MS * 1000LL;
+    if (index == 0 || now_us - clear_since_us < wait_us || now_us - last_change_us < wait_us) return false;
+
+    // 上一次升級撐住了，下一次可以等短一點
+    if (upgraded) up_backoff = std::max(1, up_backoff / 2);
+    current.store(index - 1, std::memory_order_relaxed);
+    last_change_us = now_us;
+    clear_since_us = now_us;
+    upgraded = true;
+    return true;
+}
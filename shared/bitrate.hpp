@@ -0,0 +1,64 @@
+#ifndef BITRATE_HPP
+#define BITRATE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#define ABR_QUALITY_MAX 90          // 連線夠快時的 JPEG quality (OpenCV 預設是 95，90 以上肉眼幾乎看不出差別)
+#define ABR_QUALITY_MIN 40          // quality 最低降到這裡，再不夠才降解析度
+#define ABR_QUALITY_STEP 10
+#define ABR_SCALE_MIN_PERCENT 50    // 解析度最低降到原本的幾 %
+#define ABR_SCALE_STEP_PERCENT 25
+#define ABR_FPS_MIN 10              // 降 frame rate 時最少還要有幾 FPS
+#define ABR_CONGESTED_LOAD 0.8      // send 卡住的時間佔了 frame 間隔的這麼多 → 連線跟不上
+#define ABR_CLEAR_LOAD 0.3          // 低於這個才算連線有餘裕
+#define ABR_BEHIND_MS 200           // sender 比 timestamp 的節奏落後超過這麼多 → 連線跟不上
+#define ABR_DOWN_INTERVAL_MS 500    // 兩次降級之間至少隔多久 (等上一次降級的效果出來)
+#define ABR_UP_INTERVAL_MS 2000     // 連線一直有餘裕這麼久才升一級
+#define ABR_UNSENT_LIMIT (256 * 1024)   // live video 時 kernel 裡最多留多少還沒送出的資料 (TCP_NOTSENT_LOWAT)
+
+/* live video 的 adaptive bitrate
+sender 每送出一個 frame 就回報 send 卡了多久 (TLS / TCP 的 send buffer 滿了才會卡) 和比 timestamp 的節奏落後多少，
+連線跟不上時一級一級降：先降 JPEG quality，再降解析度，最後降 frame rate (只送每 N 個 frame 中的一個)，
+連線有餘裕夠久之後再一級一級升回去。降得快、升得慢，不會在兩級之間來回跳。
+level 是 atomic，sender thread 更新、capture / encoder thread 讀，其他狀態只有 sender thread 碰。
+*/
+
+// 一級的設定
+struct BitrateLevel {
+    int quality;            // IMWRITE_JPEG_QUALITY
+    int scale_percent;      // 解析度 (原本的幾 %)
+    int frame_divisor;      // 每幾個 frame 送一個
+};
+
+class BitrateController {
+public:
+    explicit BitrateController(double fps);
+
+    // 目前這一級的設定
+    BitrateLevel level() const { return levels[current.load(std::memory_order_relaxed)]; }
+    // 第 frame_index 個 frame 要不要送 (降 frame rate 時跳過其他的)
+    bool should_send(uint64_t frame_index) const { return frame_index % level().frame_divisor == 0; }
+
+    /* 每送出一個 frame 之後呼叫：send 卡了多久、比預定的時間落後多少 (µs)，now_us 是 monotonic_us
+    回傳 level 有沒有改變 */
+    bool on_frame_sent(int64_t send_us, int64_t behind_us, int64_t now_us);
+
+    uint64_t downgrades() const { return downgrade_count; }
+    BitrateLevel lowest() const { return levels[lowest_index]; }
+
+private:
+    std::vector<BitrateLevel> levels;   // levels[0] 是最好的
+    std::atomic<int> current{0};
+    int64_t frame_interval_us;
+    double load = 0;                    // send 卡住的時間 / frame 間隔 (移動平均)
+    int64_t last_change_us = 0;
+    int64_t clear_since_us = -1;        // 從什麼時候開始連線一直有餘裕
+    bool upgraded = false;              // 上一次改變是升級
+    int up_backoff = 1;                 // 升級要等 ABR_UP_INTERVAL_MS 的幾倍
+    uint64_t downgrade_count = 0;
+    int lowest_index = 0;
+};
+
+#endif // BITRATE_HPP
@@ -0,0 +1,93 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/* 固定大小的 lock-free queue (Vyukov bounded MPMC)
+每個 slot 有自己的 sequence，push / pop 只需要在 tail / head 上 CAS 一次。
+capacity 必須是 2 的次方；T 必須可以 default construct 和 move assign。
+*/
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : slots(new Slot[capacity]), mask(capacity - 1), head(0), tail(0) {
+        for (size_t i = 0; i < capacity; i++) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // queue 滿了回傳 false (item 不會被動到)
+    bool push(T& item) {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            size_t seq = slot.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0) {
+                // slot 是空的，搶到 tail 就是我們的
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.item = std::move(item);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;       // 繞一圈回來還沒被 pop：queue 滿了
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // queue 空了回傳 false
+    bool pop(T& item) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots[pos & mask];
+            size_t seq = slot.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    item = std::move(slot.item);
+                    slot.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;       // 還沒有人放東西進來：queue 空了
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 大約有幾個 item (其他 thread 同時在 push / pop 時只是個估計)
+    size_t size() const {
+        size_t h = head.load(std::memory_order_acquire);
+        size_t t = tail.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif // BOUNDED_QUEUE_HPP
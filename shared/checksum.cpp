@@ -0,0 +1,202 @@
+#include "checksum.hpp"
+
+#include <cstring>
+#include <openssl/evp.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define CRC32C_X86 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CRC32C_ARM 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u     // Castagnoli (reflected)
+#define CRC32C_LANE_SIZE 4096       // 硬體 crc32c 三段同時算時每一段的大小
+
+/* 用 table 一次處理一個 byte */
+uint32_t crc32(const void* data, size_t len) {
+    static uint32_t table[256];
+    static bool table_ready = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)table_ready;
+
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; i++) {
+        crc = table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+/* slicing-by-8：table[k][b] 是 byte b 後面再接 k 個 0 byte 的 crc，一次查 8 個 table 處理 8 bytes */
+static uint32_t crc32c_table[8][256];
+
+static bool init_crc32c_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? CRC32C_POLY ^ (c >> 1) : c >> 1;
+        crc32c_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t c = crc32c_table[k - 1][i];
+            crc32c_table[k][i] = crc32c_table[0][c & 0xFF] ^ (c >> 8);
+        }
+    }
+    return true;
+}
+
+uint32_t crc32c_software(const void* data, size_t len, uint32_t crc) {
+    static bool table_ready = init_crc32c_table();
+    (void)table_ready;
+
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc;    // little endian：低 4 bytes 和 crc 對齊
+        crc = crc32c_table[7][word & 0xFF] ^ crc32c_table[6][(word >> 8) & 0xFF] ^
+              crc32c_table[5][(word >> 16) & 0xFF] ^ crc32c_table[4][(word >> 24) & 0xFF] ^
+              crc32c_table[3][(word >> 32) & 0xFF] ^ crc32c_table[2][(word >> 40) & 0xFF] ^
+              crc32c_table[1][(word >> 48) & 0xFF] ^ crc32c_table[0][word >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/* crc32c_combine 用 GF(2) 上的多項式乘法：crc(A + B) = crc(A) * x^(8 * len(B)) mod P 再 xor crc(B)
+(和 zlib 的 crc32_combine 一樣的做法，只是換成 Castagnoli 的多項式)
+*/
+static uint32_t multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    while (true) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+// x^(2^k) mod P，k = 0..31
+static uint32_t x2n_table[32];
+
+static bool init_x2n_table() {
+    uint32_t p = 1u << 30;      // x^1
+    x2n_table[0] = p;
+    for (int k = 1; k < 32; k++) {
+        p = multmodp(p, p);
+        x2n_table[k] = p;
+    }
+    return true;
+}
+
+// x^(8 * n) mod P：把 crc 往後推 n 個 0 byte 要乘上的多項式
+static uint32_t x8nmodp(size_t n) {
+    static bool table_ready = init_x2n_table();
+    (void)table_ready;
+
+    uint32_t p = 1u << 31;      // x^0
+    for (unsigned k = 3; n > 0; n >>= 1, k++) {
+        if (n & 1) p = multmodp(x2n_table[k & 31], p);
+    }
+    return p;
+}
+
+#if defined(CRC32C_X86)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(const void* data, size_t len, uint32_t crc) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+#if defined(__x86_64__)
+    /* crc32 指令的 latency 是 3 個 cycle、throughput 是 1 個 cycle，只有一條 dependency chain 時只用到 1/3，
+    所以大的資料切成三段同時算，最後把前兩段的結果往後推 (乘上 x^(8 * 長度)) 再 xor 起來 */
+    static const uint32_t shift1 = x8nmodp(CRC32C_LANE_SIZE);
+    static const uint32_t shift2 = x8nmodp(2 * CRC32C_LANE_SIZE);
+    while (len >= 3 * CRC32C_LANE_SIZE) {
+        uint64_t c0 = crc, c1 = 0, c2 = 0;
+        for (size_t i = 0; i < CRC32C_LANE_SIZE; i += 8) {
+            uint64_t w0, w1, w2;
+            memcpy(&w0, p + i, 8);
+            memcpy(&w1, p + CRC32C_LANE_SIZE + i, 8);
+            memcpy(&w2, p + 2 * CRC32C_LANE_SIZE + i, 8);
+            c0 = _mm_crc32_u64(c0, w0);
+            c1 = _mm_crc32_u64(c1, w1);
+            c2 = _mm_crc32_u64(c2, w2);
+        }
+        crc = multmodp(shift2, (uint32_t)c0) ^ multmodp(shift1, (uint32_t)c1) ^ (uint32_t)c2;
+        p += 3 * CRC32C_LANE_SIZE;
+        len -= 3 * CRC32C_LANE_SIZE;
+    }
+
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len-- > 0) crc = _mm_crc32_u8(crc, *p++);
+    return ~crc;
+}
+
+bool crc32c_hardware() {
+    static bool supported = __builtin_cpu_supports("sse4.2");
+    return supported;
+}
+#elif defined(CRC32C_ARM)
+static uint32_t crc32c_hw(const void* data, size_t len, uint32_t crc) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc = __crc32cd(crc, word);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) crc = __crc32cb(crc, *p++);
+    return ~crc;
+}
+
+bool crc32c_hardware() {
+    return true;
+}
+#else
+bool crc32c_hardware() {
+    return false;
+}
+#endif
+
+uint32_t crc32c(const void* data, size_t len, uint32_t crc) {
+#if defined(CRC32C_X86) || defined(CRC32C_ARM)
+    if (crc32c_hardware()) return crc32c_hw(data, len, crc);
+#endif
+    return crc32c_software(data, len, crc);
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2) {
+    return multmodp(x8nmodp(len2), crc1) ^ crc2;
+}
+
+void sha256(const void* data, size_t len, unsigned char* out) {
+    EVP_Digest(data, len, out, nullptr, EVP_sha256(), nullptr);
+}
@@ -0,0 +1,37 @@
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/* CRC-32 (IEEE 802.3)
+user log 的 record 用它檢查資料有沒有壞掉 (檔案格式已經固定，不改成 CRC32C)
+*/
+uint32_t crc32(const void* data, size_t len);
+
+/* CRC-32C (Castagnoli)
+傳檔案時每個 chunk 和整個檔案的 digest 用它：
+x86 有 SSE4.2 (執行時檢查) 或 ARMv8 有 CRC extension 時用硬體指令，一個 cycle 可以處理 8 bytes；
+都沒有時退回 slicing-by-8 的 table。
+crc 傳上一段的結果就可以接著算 (第一段傳 0)。
+*/
+uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0);
+
+// crc32c 能不能用硬體指令 (benchmark 用)
+bool crc32c_hardware();
+// 只用 table 算 (benchmark 用)
+uint32_t crc32c_software(const void* data, size_t len, uint32_t crc = 0);
+
+/* 把兩段的 CRC-32C 接起來：crc1 = crc32c(A)，crc2 = crc32c(B)，len2 = B 的長度，回傳 crc32c(A + B)
+不用再讀一次資料，所以整個檔案的 digest 可以由各個 chunk 的 crc 算出來 (chunk 到達的順序不重要)
+*/
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+/* SHA-256 (OpenSSL)
+relay 傳檔案時 server 用它當 chunk 的 content address：crc32c 只能抓傳輸錯誤，
+不同內容撞在同一個 crc 的機率太高，不能拿來判斷 server 是不是已經有這個 chunk
+*/
+#define CHUNK_HASH_SIZE 32
+void sha256(const void* data, size_t len, unsigned char* out);
+
+#endif // CHECKSUM_HPP
@@ -0,0 +1,311 @@
+#include "compress.hpp"
+#include "protocol.hpp"
+#include "checksum.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <arpa/inet.h>
+
+/* LZ4 block 格式：一串 sequence，每個 sequence 是
+    | token (高 4 bits = literal 長度，低 4 bits = match 長度 - 4) | literal 長度的延伸 | literals | match offset (2 bytes, little endian) | match 長度的延伸 |
+長度是 15 時後面再接 byte 加上去，直到某個 byte 不是 255；最後一個 sequence 只有 literals
+*/
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12             // hash table 4096 個位置 (16 KB，放得進 L1)
+#define LZ_LAST_LITERALS 5          // 最後 5 bytes 一定是 literal
+#define LZ_MATCH_LIMIT 12           // 最後一個 match 至少要在結尾前 12 bytes 開始
+#define LZ_MAX_DISTANCE 65535
+#define LZ_SKIP_TRIGGER 6           // 連續找不到 match 64 次，每次往前跳的距離就加 1
+#define LZ_WILD_COPY 16             // 解壓縮時離結尾夠遠就一次複製這麼多
+
+#define ENTROPY_SAMPLE_SIZE 4096    // 算 entropy 時每段抽樣的大小
+#define ENTROPY_SAMPLES 4
+
+static std::atomic<int> current_level{COMPRESS_LEVEL_DEFAULT};
+
+void set_compression_level(int new_level) {
+    current_level = std::clamp(new_level, 0, COMPRESS_LEVEL_MAX);
+}
+
+int compression_level() {
+    return current_level;
+}
+
+static void put_u32(char* dst, uint32_t value) {
+    value = htonl(value);
+    memcpy(dst, &value, sizeof(value));
+}
+
+static uint32_t get_u32(const char* src) {
+    uint32_t value;
+    memcpy(&value, src, sizeof(value));
+    return ntohl(value);
+}
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t lz_hash(uint32_t value) {
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// 從 a / b 開始有幾個 byte 一樣 (a 不超過 limit)
+static size_t match_length(const uint8_t* a, const uint8_t* b, const uint8_t* limit) {
+    const uint8_t* start = a;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (a + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y) return a - start + (__builtin_ctzll(x ^ y) >> 3);
+        a += 8;
+        b += 8;
+    }
+#endif
+    while (a < limit && *a == *b) {
+        a++;
+        b++;
+    }
+    return a - start;
+}
+
+// token 放不下的長度：接著放 255 …，最後一個 byte 小於 255
+static uint8_t* put_length(uint8_t* op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = static_cast<uint8_t>(len);
+    return op;
+}
+
+static bool read_length(const uint8_t*& ip, const uint8_t* end, size_t& len) {
+    uint8_t byte;
+    do {
+        if (ip >= end) return false;
+        byte = *ip++;
+        len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// 一個 sequence 最多需要的空間
+static size_t sequence_bound(size_t literals, size_t match) {
+    return 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+}
+
+size_t compress_bound(size_t len) {
+    return sequence_bound(len, 0);
+}
+
+size_t compress_block(const char* source, size_t len, char* dest, size_t capacity, int level) {
+    const uint8_t* src = reinterpret_cast<const uint8_t*>(source);
+    const uint8_t* end = src + len;
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    uint8_t* op = reinterpret_cast<uint8_t*>(dest);
+    uint8_t* op_end = op + capacity;
+    level = std::clamp(level, 1, COMPRESS_LEVEL_MAX);
+
+    if (len > LZ_MATCH_LIMIT) {
+        const uint8_t* match_limit = end - LZ_MATCH_LIMIT;
+        uint32_t table[1 << LZ_HASH_BITS] = {};     // 4 bytes 的 hash -> 上次出現的位置
+        ip++;
+        while (ip <= match_limit) {
+            // 找 match：一直找不到時越跳越遠，已經壓縮過的資料很快就掃完
+            const uint8_t* ref = nullptr;
+            unsigned attempts = (unsigned)level << LZ_SKIP_TRIGGER;
+            while (ip <= match_limit) {
+                uint32_t h = lz_hash(read32(ip));
+                ref = src + table[h];
+                table[h] = ip - src;
+                if (ip - ref <= LZ_MAX_DISTANCE && ref < ip && read32(ref) == read32(ip)) break;
+                ip += attempts++ >> LZ_SKIP_TRIGGER;
+            }
+            if (ip > match_limit) break;
+
+            // match 往前延伸到上一個 sequence 的結尾
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            size_t match = LZ_MIN_MATCH + match_length(ip + LZ_MIN_MATCH, ref + LZ_MIN_MATCH, end - LZ_LAST_LITERALS);
+            size_t literals = ip - anchor;
+            if (sequence_bound(literals, match) > (size_t)(op_end - op)) return 0;
+
+            uint8_t* token = op++;
+            *token = static_cast<uint8_t>(std::min<size_t>(literals, 15) << 4);
+            if (literals >= 15) op = put_length(op, literals - 15);
+            memcpy(op, anchor, literals);
+            op += literals;
+
+            size_t offset = ip - ref;
+            *op++ = static_cast<uint8_t>(offset);
+            *op++ = static_cast<uint8_t>(offset >> 8);
+            *token |= static_cast<uint8_t>(std::min<size_t>(match - LZ_MIN_MATCH, 15));
+            if (match - LZ_MIN_MATCH >= 15) op = put_length(op, match - LZ_MIN_MATCH - 15);
+
+            ip += match;
+            anchor = ip;
+            if (ip <= match_limit) table[lz_hash(read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+    // 剩下的都是 literal
+    size_t literals = end - anchor;
+    if (compress_bound(literals) > (size_t)(op_end - op)) return 0;
+    *op++ = static_cast<uint8_t>(std::min<size_t>(literals, 15) << 4);
+    if (literals >= 15) op = put_length(op, literals - 15);
+    memcpy(op, anchor, literals);
+    op += literals;
+    return op - reinterpret_cast<uint8_t*>(dest);
+}
+
+bool decompress_block(const char* source, size_t len, char* dest, size_t raw_len) {
+    const uint8_t* ip = reinterpret_cast<const uint8_t*>(source);
+    const uint8_t* end = ip + len;
+    uint8_t* begin = reinterpret_cast<uint8_t*>(dest);
+    uint8_t* op = begin;
+    uint8_t* op_end = op + raw_len;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !read_length(ip, end, literals)) return false;
+        if (literals > (size_t)(end - ip) || literals > (size_t)(op_end - op)) return false;
+        // 短的 literal 一次複製 16 bytes，多寫的部分之後會被蓋掉
+        if (literals <= LZ_WILD_COPY && end - ip >= LZ_WILD_COPY && op_end - op >= LZ_WILD_COPY) {
+            memcpy(op, ip, LZ_WILD_COPY);
+        } else {
+            memcpy(op, ip, literals);
+        }
+        ip += literals;
+        op += literals;
+        if (ip == end) break;   // 最後一個 sequence 只有 literal
+
+        if (end - ip < 2) return false;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t match = token & 15;
+        if (match == 15 && !read_length(ip, end, match)) return false;
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - begin) || match > (size_t)(op_end - op)) return false;
+
+        // offset 比 match 短時來源和目的重疊 (重複的 pattern)，要照順序複製
+        const uint8_t* ref = op - offset;
+        if (offset >= LZ_WILD_COPY && (size_t)(op_end - op) >= match + LZ_WILD_COPY) {
+            for (size_t i = 0; i < match; i += LZ_WILD_COPY) memcpy(op + i, ref + i, LZ_WILD_COPY);
+        } else if (offset >= match) {
+            memcpy(op, ref, match);
+        } else if (offset >= 8) {
+            size_t i = 0;
+            for (; i + 8 <= match; i += 8) memcpy(op + i, ref + i, 8);
+            for (; i < match; i++) op[i] = ref[i];
+        } else {
+            for (size_t i = 0; i < match; i++) op[i] = ref[i];
+        }
+        op += match;
+    }
+    return op == op_end;
+}
+
+static void count_bytes(const uint8_t* data, size_t len, size_t* counts) {
+    for (size_t i = 0; i < len; i++) counts[data[i]]++;
+}
+
+bool looks_compressible(const char* data, size_t len) {
+    if (len == 0) return false;
+
+    // 小的整段算，大的平均抽幾段
+    size_t counts[256] = {};
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    size_t total = 0;
+    if (len <= ENTROPY_SAMPLE_SIZE * ENTROPY_SAMPLES) {
+        count_bytes(p, len, counts);
+        total = len;
+    } else {
+        for (int i = 0; i < ENTROPY_SAMPLES; i++) {
+            size_t offset = (len - ENTROPY_SAMPLE_SIZE) / (ENTROPY_SAMPLES - 1) * i;
+            count_bytes(p + offset, ENTROPY_SAMPLE_SIZE, counts);
+        }
+        total = ENTROPY_SAMPLE_SIZE * ENTROPY_SAMPLES;
+    }
+
+    double entropy = 0;
+    for (size_t count : counts) {
+        if (count == 0) continue;
+        double probability = (double)count / total;
+        entropy -= probability * std::log2(probability);
+    }
+    return entropy < COMPRESS_ENTROPY_LIMIT;
+}
+
+bool compress_payload(const char* data, size_t len, std::vector<char>& out, double* time) {
+    if (compression_level() == 0 || len <= COMPRESS_SIZE_HEADER + 1 || !looks_compressible(data, len)) return false;
+
+    auto begin = std::chrono::steady_clock::now();
+    // 加上原始長度之後要比原本小才值得
+    size_t start = out.size();
+    size_t capacity = len - COMPRESS_SIZE_HEADER - 1;
+    out.resize(start + COMPRESS_SIZE_HEADER + capacity);
+    put_u32(out.data() + start, static_cast<uint32_t>(len));
+    size_t compressed = compress_block(data, len, out.data() + start + COMPRESS_SIZE_HEADER, capacity, compression_level());
+    out.resize(compressed ? start + COMPRESS_SIZE_HEADER + compressed : start);
+    if (time) *time += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return compressed > 0;
+}
+
+bool decompress_payload(std::string_view payload, std::vector<char>& out, size_t max_len) {
+    if (payload.size() < COMPRESS_SIZE_HEADER) return false;
+    size_t raw_len = get_u32(payload.data());
+    if (raw_len > max_len) return false;
+
+    out.resize(raw_len);
+    return decompress_block(payload.data() + COMPRESS_SIZE_HEADER, payload.size() - COMPRESS_SIZE_HEADER, out.data(), raw_len);
+}
+
+void compress_message(Message& msg) {
+    if (msg.payload_size < COMPRESS_MIN_MESSAGE || (msg.flags & WIRE_FLAG_COMPRESSED)) return;
+
+    std::vector<char> out;
+    if (!compress_payload(msg.payload, msg.payload_size, out)) return;
+    memcpy(msg.payload, out.data(), out.size());
+    msg.payload_size = static_cast<int>(out.size());
+    msg.flags |= WIRE_FLAG_COMPRESSED;
+}
+
+bool decompress_message(Message& msg) {
+    if (!(msg.flags & WIRE_FLAG_COMPRESSED)) return true;
+
+    std::vector<char> out;
+    if (!decompress_payload(std::string_view(msg.payload, msg.payload_size), out, MAX_PAYLOAD_SIZE)) return false;
+    memcpy(msg.payload, out.data(), out.size());
+    msg.payload_size = static_cast<int>(out.size());
+    if (out.size() < MAX_PAYLOAD_SIZE) msg.payload[out.size()] = '\0';
+    msg.flags &= ~WIRE_FLAG_COMPRESSED;
+    return true;
+}
+
+bool decompress_file_chunk(std::string_view payload, std::vector<char>& out,
+                           uint64_t& offset, uint32_t& crc, const char*& data, size_t& len) {
+    if (payload.size() < FILE_CHUNK_HEADER_SIZE + COMPRESS_SIZE_HEADER) return false;
+    offset = (static_cast<uint64_t>(get_u32(payload.data())) << 32) | get_u32(payload.data() + 4);
+    crc = get_u32(payload.data() + 8);
+    if (!decompress_payload(payload.substr(FILE_CHUNK_HEADER_SIZE), out, MAX_WIRE_CHUNK_SIZE)) return false;
+
+    data = out.data();
+    len = out.size();
+    return crc32c(data, len) == crc;
+}
+
+bool compressed_chunk_size(std::string_view payload, size_t& len) {
+    if (payload.size() < FILE_CHUNK_HEADER_SIZE + COMPRESS_SIZE_HEADER) return false;
+    len = get_u32(payload.data() + FILE_CHUNK_HEADER_SIZE);
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef COMPRESS_HPP
+#define COMPRESS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "message.hpp"
+
+/* 送進 TLS 之前的壓縮 (LZ4 的 block 格式，自己實作，不多一個 library)
+
+- 兩端先說好看得懂才壓縮：client 的 JOIN、server 的 LOGIN 回覆、receiver 的 TRANSFER_RESUME
+  帶 WIRE_FLAG_ACCEPTS_COMPRESSED 表示「可以送壓縮過的給我」
+- 壓縮過的 frame 設 WIRE_FLAG_COMPRESSED，payload 開頭是 4 bytes 的原始長度，後面是 LZ4 block；
+  檔案的 chunk 只壓縮 data，offset 和 crc32c (原始資料的) 留在前面，server 不用解壓縮就知道是哪個 chunk
+- 先抽樣算 byte 的 entropy，已經壓縮過的內容 (JPEG、zip、影片 …) 直接原樣送，不浪費時間
+- 壓完沒有變小也原樣送
+*/
+#define COMPRESS_LEVEL_DEFAULT 1        // 和 LZ4 的 acceleration 一樣：1 壓得最多，數字越大越快、壓得越少
+#define COMPRESS_LEVEL_MAX 64
+#define COMPRESS_SIZE_HEADER 4          // 壓縮過的 payload 開頭的原始長度
+#define COMPRESS_MIN_MESSAGE 64         // 比這個短的 Message 不壓縮
+#define COMPRESS_ENTROPY_LIMIT 7.5      // 抽樣的 entropy (bits / byte) 超過這個值就當成已經壓縮過
+
+// 這個 process 送出去的資料用哪個 level 壓縮，0 = 不壓縮 (收到壓縮過的照樣可以解)
+void set_compression_level(int level);
+int compression_level();
+
+// 壓縮 len bytes 最多需要多少空間
+size_t compress_bound(size_t len);
+// 把 src 壓縮進 dst，回傳壓縮後的大小；放不進 capacity 或沒有比較小時回傳 0
+size_t compress_block(const char* src, size_t len, char* dst, size_t capacity, int level);
+// 把 src 解壓縮進 dst，解出來必須剛好是 raw_len bytes
+bool decompress_block(const char* src, size_t len, char* dst, size_t raw_len);
+// 抽樣算 byte 的 entropy，太高 (看起來已經壓縮過或加密過) 時回傳 false
+bool looks_compressible(const char* data, size_t len);
+
+/* 壓縮成 [原始長度][LZ4 block] 接在 out 的後面，不值得壓縮時不動 out、回傳 false
+time 不是 nullptr 時加上花掉的秒數
+*/
+bool compress_payload(const char* data, size_t len, std::vector<char>& out, double* time = nullptr);
+// 解開 compress_payload 的結果，原始長度超過 max_len 時回傳 false
+bool decompress_payload(std::string_view payload, std::vector<char>& out, size_t max_len);
+
+// 送出之前：msg 的 payload 值得壓縮就壓縮並設 WIRE_FLAG_COMPRESSED
+void compress_message(Message& msg);
+// 收到之後：有 WIRE_FLAG_COMPRESSED 就解回原本的 payload；格式不對時回傳 false
+bool decompress_message(Message& msg);
+
+/* 壓縮過的檔案 chunk：
+    +----------+---------+-------------+-----------+
+    | offset   | crc32c  | 原始長度     | LZ4 block |
+    | 8 bytes  | 4 bytes | 4 bytes     |           |
+    +----------+---------+-------------+-----------+
+解壓縮後檢查 crc32c，data 指向 out 裡面
+*/
+bool decompress_file_chunk(std::string_view payload, std::vector<char>& out,
+                           uint64_t& offset, uint32_t& crc, const char*& data, size_t& len);
+// 不用解壓縮，只讀出原始長度 (server 記錄轉傳進度用)
+bool compressed_chunk_size(std::string_view payload, size_t& len);
+
+#endif // COMPRESS_HPP
@@ -0,0 +1,263 @@
+#include "delta.hpp"
+#include "message.hpp"
+#include "protocol.hpp"
+#include "checksum.hpp"
+
+#include <cmath>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#define DELTA_OP_COPY 0
+#define DELTA_OP_LITERAL 1
+#define DELTA_SIGNATURE_HEADER_SIZE 8   // block_size + block_count
+
+static void put_u32(std::vector<char>& out, uint32_t value) {
+    value = htonl(value);
+    out.insert(out.end(), reinterpret_cast<char*>(&value), reinterpret_cast<char*>(&value) + sizeof(value));
+}
+
+static void put_u64(std::vector<char>& out, uint64_t value) {
+    put_u32(out, static_cast<uint32_t>(value >> 32));
+    put_u32(out, static_cast<uint32_t>(value));
+}
+
+static uint32_t get_u32(const char* src) {
+    uint32_t value;
+    memcpy(&value, src, sizeof(value));
+    return ntohl(value);
+}
+
+static uint64_t get_u64(const char* src) {
+    return (static_cast<uint64_t>(get_u32(src)) << 32) | get_u32(src + 4);
+}
+
+static bool pread_all(int fd, char* data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, data, len, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+uint32_t delta_block_size(uint64_t file_size) {
+    uint64_t block = (uint64_t)std::sqrt((double)file_size) & ~(uint64_t)1023;
+    return (uint32_t)std::clamp<uint64_t>(block, DELTA_MIN_BLOCK_SIZE, DELTA_MAX_BLOCK_SIZE);
+}
+
+uint32_t rolling_checksum(const char* data, size_t len) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; i++) {
+        a += p[i];
+        b += (uint32_t)(len - i) * p[i];
+    }
+    return (a & 0xFFFF) | (b << 16);
+}
+
+static void strong_checksum(const char* data, size_t len, unsigned char* out) {
+    unsigned char digest[CHUNK_HASH_SIZE];
+    sha256(data, len, digest);
+    memcpy(out, digest, DELTA_STRONG_SIZE);
+}
+
+bool compute_signatures(int fd, uint64_t size, DeltaSignatures& signatures) {
+    signatures.block_size = delta_block_size(size);
+    signatures.blocks.resize(size / signatures.block_size);
+
+    std::vector<char> block(signatures.block_size);
+    for (size_t i = 0; i < signatures.blocks.size(); i++) {
+        if (!pread_all(fd, block.data(), block.size(), (off_t)i * block.size())) return false;
+        signatures.blocks[i].weak = rolling_checksum(block.data(), block.size());
+        strong_checksum(block.data(), block.size(), signatures.blocks[i].strong);
+    }
+    return true;
+}
+
+/* 一個 frame 放不下時分成好幾個 frame，至少送一個 (沒有舊檔案時 block_count 是 0) */
+bool write_signatures(SSL* ssl, const DeltaSignatures& signatures) {
+    const size_t per_frame = (MAX_WIRE_CHUNK_SIZE - DELTA_SIGNATURE_HEADER_SIZE) / DELTA_SIGNATURE_SIZE;
+    std::vector<char> frame;
+    size_t index = 0;
+    do {
+        frame.clear();
+        if (index == 0) {
+            put_u32(frame, signatures.block_size);
+            put_u32(frame, (uint32_t)signatures.blocks.size());
+        }
+        size_t end = std::min(signatures.blocks.size(), index + per_frame);
+        for (; index < end; index++) {
+            put_u32(frame, signatures.blocks[index].weak);
+            frame.insert(frame.end(), signatures.blocks[index].strong, signatures.blocks[index].strong + DELTA_STRONG_SIZE);
+        }
+        if (!write_chunk(ssl, TRANSFER_SIGNATURES, frame.data(), frame.size())) return false;
+    } while (index < signatures.blocks.size());
+    return true;
+}
+
+bool read_signatures(SSL* ssl, DeltaSignatures& signatures) {
+    WireHeader header;
+    std::vector<char> payload;
+    if (!read_chunk(ssl, header, payload) || header.msg_type != TRANSFER_SIGNATURES ||
+        payload.size() < DELTA_SIGNATURE_HEADER_SIZE) {
+        return false;
+    }
+    signatures.block_size = get_u32(payload.data());
+    size_t count = get_u32(payload.data() + 4);
+    signatures.blocks.clear();
+    if (count > 0 && (signatures.block_size < DELTA_MIN_BLOCK_SIZE || signatures.block_size > DELTA_MAX_BLOCK_SIZE)) {
+        return false;
+    }
+
+    size_t offset = DELTA_SIGNATURE_HEADER_SIZE;
+    while (true) {
+        if ((payload.size() - offset) % DELTA_SIGNATURE_SIZE != 0) return false;
+        for (; offset < payload.size(); offset += DELTA_SIGNATURE_SIZE) {
+            BlockSignature block;
+            block.weak = get_u32(payload.data() + offset);
+            memcpy(block.strong, payload.data() + offset + 4, DELTA_STRONG_SIZE);
+            signatures.blocks.push_back(block);
+        }
+        if (signatures.blocks.size() >= count) return signatures.blocks.size() == count;
+
+        if (!read_chunk(ssl, header, payload) || header.msg_type != TRANSFER_SIGNATURES) return false;
+        offset = 0;
+    }
+}
+
+// weak 打散成 20 bits，先用它擋掉大部分不存在的 weak，不用每個 byte 都查 hash table
+#define DELTA_TAG_BITS 20
+
+static uint32_t weak_tag(uint32_t weak) {
+    return (weak * 0x9E3779B1u) >> (32 - DELTA_TAG_BITS);
+}
+
+std::vector<DeltaCopy> find_matches(const char* data, size_t size, const DeltaSignatures& signatures) {
+    std::vector<DeltaCopy> copies;
+    const size_t block = signatures.block_size;
+    if (signatures.blocks.empty() || block == 0 || size < block) return copies;
+
+    std::unordered_map<uint32_t, std::vector<uint32_t>> by_weak;
+    std::vector<uint8_t> tags(1 << DELTA_TAG_BITS, 0);
+    for (uint32_t i = 0; i < signatures.blocks.size(); i++) {
+        by_weak[signatures.blocks[i].weak].push_back(i);
+        tags[weak_tag(signatures.blocks[i].weak)] = 1;
+    }
+
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+    size_t pos = 0;
+    uint32_t weak = rolling_checksum(data, block);
+    uint32_t a = weak & 0xFFFF, b = weak >> 16;
+    while (pos + block <= size) {
+        weak = (a & 0xFFFF) | (b << 16);
+        auto it = tags[weak_tag(weak)] ? by_weak.find(weak) : by_weak.end();
+        if (it != by_weak.end()) {
+            unsigned char strong[DELTA_STRONG_SIZE];
+            strong_checksum(data + pos, block, strong);
+
+            // 同樣內容的 block 有好幾個時，優先用緊接在上一個 copy 後面的那個，才能合併成一個 copy
+            bool extends = !copies.empty() && copies.back().offset + copies.back().length == pos;
+            uint64_t expected = extends ? copies.back().old_offset + copies.back().length : UINT64_MAX;
+            uint64_t found = UINT64_MAX;
+            for (uint32_t index : it->second) {
+                if (memcmp(signatures.blocks[index].strong, strong, DELTA_STRONG_SIZE) != 0) continue;
+                found = (uint64_t)index * block;
+                if (found == expected) break;
+            }
+
+            if (found != UINT64_MAX) {
+                if (found == expected) {
+                    copies.back().length += block;
+                } else {
+                    copies.push_back(DeltaCopy{pos, found, block});
+                }
+                pos += block;
+                if (pos + block <= size) {
+                    weak = rolling_checksum(data + pos, block);
+                    a = weak & 0xFFFF;
+                    b = weak >> 16;
+                }
+                continue;
+            }
+        }
+
+        // window 往後滑一個 byte
+        if (pos + block >= size) break;
+        uint32_t out = p[pos], in = p[pos + block];
+        a = a - out + in;
+        b = b - (uint32_t)block * out + a;
+        pos++;
+    }
+    return copies;
+}
+
+void encode_delta_chunk(const char* data, uint64_t offset, size_t len, uint32_t crc,
+                        const DeltaCopy* copies, size_t count, std::vector<char>& out) {
+    out.clear();
+    put_u64(out, offset);
+    put_u32(out, crc);
+
+    uint64_t cursor = offset, end = offset + len;
+    auto literal = [&](uint64_t stop) {
+        if (stop <= cursor) return;
+        out.push_back(DELTA_OP_LITERAL);
+        put_u32(out, (uint32_t)(stop - cursor));
+        out.insert(out.end(), data + cursor, data + stop);
+        cursor = stop;
+    };
+    for (size_t i = 0; i < count; i++) {
+        uint64_t begin = std::max(copies[i].offset, offset);
+        uint64_t stop = std::min(copies[i].offset + copies[i].length, end);
+        if (begin >= stop) continue;
+
+        literal(begin);
+        out.push_back(DELTA_OP_COPY);
+        put_u64(out, copies[i].old_offset + (begin - copies[i].offset));
+        put_u32(out, (uint32_t)(stop - begin));
+        cursor = stop;
+    }
+    literal(end);
+}
+
+bool apply_delta_chunk(const std::vector<char>& payload, int old_fd, uint64_t old_size,
+                       std::vector<char>& chunk, uint64_t& offset, uint32_t& crc) {
+    if (payload.size() < FILE_CHUNK_HEADER_SIZE) return false;
+    offset = get_u64(payload.data());
+    crc = get_u32(payload.data() + 8);
+
+    chunk.clear();
+    size_t pos = FILE_CHUNK_HEADER_SIZE;
+    while (pos < payload.size()) {
+        char op = payload[pos++];
+        if (op == DELTA_OP_COPY) {
+            if (payload.size() - pos < 12) return false;
+            uint64_t old_offset = get_u64(payload.data() + pos);
+            uint32_t len = get_u32(payload.data() + pos + 8);
+            pos += 12;
+            if (old_fd < 0 || old_offset > old_size || len > old_size - old_offset ||
+                chunk.size() + len > MAX_WIRE_CHUNK_SIZE) {
+                return false;
+            }
+            size_t start = chunk.size();
+            chunk.resize(start + len);
+            if (!pread_all(old_fd, chunk.data() + start, len, old_offset)) return false;
+        } else if (op == DELTA_OP_LITERAL) {
+            if (payload.size() - pos < 4) return false;
+            uint32_t len = get_u32(payload.data() + pos);
+            pos += 4;
+            if (len > payload.size() - pos) return false;
+            chunk.insert(chunk.end(), payload.data() + pos, payload.data() + pos + len);
+            pos += len;
+        } else {
+            return false;
+        }
+    }
+    return crc32c(chunk.data(), chunk.size()) == crc;
+}
@@ -0,0 +1,72 @@
+#ifndef DELTA_HPP
+#define DELTA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <openssl/ssl.h>
+
+/* rsync 式的 delta：再傳一次改過的檔案時，只送和 receiver 手上的舊檔案不一樣的部分
+
+1. receiver 把舊的 recv_<檔名> 切成固定大小的 block，每個 block 算一個 rolling checksum (weak) 和 SHA-256 的前 16 bytes (strong)，
+   用 TRANSFER_SIGNATURES 送給 sender (block 太多時分成好幾個 frame，第一個 frame 開頭是 block 大小和數量)：
+
+    +------------+-------------+--------------------------------+
+    | block_size | block_count | weak (4 bytes) + strong (16) … |
+    | 4 bytes    | 4 bytes     |                                |
+    +------------+-------------+--------------------------------+
+
+2. sender 在新檔案上一個 byte 一個 byte 地滑動 block 大小的 window，weak 可以 O(1) 更新，
+   weak 對上之後再算 strong 確認，找出新檔案裡哪些範圍可以直接從舊檔案複製
+3. 有可以複製的範圍的 chunk 改用 TRANSFER_DELTA 送，payload 開頭和一般的 chunk 一樣是 offset + crc32c (整個 chunk 的)，
+   後面是一串指令：
+
+    copy:    | 0 (1 byte) | 舊檔案的 offset (8 bytes) | 長度 (4 bytes) |
+    literal: | 1 (1 byte) | 長度 (4 bytes) | 資料 |
+
+   receiver 照著指令從舊檔案和 literal 組出整個 chunk，crc32c 對得上才寫進 .part，
+   所以進度、續傳和整個檔案的 digest 都和一般的 chunk 一樣
+*/
+#define DELTA_STRONG_SIZE 16
+#define DELTA_MIN_BLOCK_SIZE 2048
+#define DELTA_MAX_BLOCK_SIZE (64 * 1024)
+#define DELTA_SIGNATURE_SIZE (4 + DELTA_STRONG_SIZE)
+
+struct BlockSignature {
+    uint32_t weak;
+    unsigned char strong[DELTA_STRONG_SIZE];
+};
+
+struct DeltaSignatures {
+    uint32_t block_size = 0;
+    std::vector<BlockSignature> blocks;     // 只有完整的 block，檔尾不滿一個 block 的部分不算
+};
+
+// 新檔案 [offset, offset + length) 和舊檔案 [old_offset, old_offset + length) 一樣
+struct DeltaCopy {
+    uint64_t offset;
+    uint64_t old_offset;
+    uint64_t length;
+};
+
+// 大約是 sqrt(檔案大小)，夾在 DELTA_MIN_BLOCK_SIZE 和 DELTA_MAX_BLOCK_SIZE 之間
+uint32_t delta_block_size(uint64_t file_size);
+// rsync 的 weak checksum：低 16 bits 是所有 byte 的和，高 16 bits 是加權的和
+uint32_t rolling_checksum(const char* data, size_t len);
+
+// receiver：算 fd (大小為 size) 每個 block 的 signature
+bool compute_signatures(int fd, uint64_t size, DeltaSignatures& signatures);
+bool write_signatures(SSL* ssl, const DeltaSignatures& signatures);
+bool read_signatures(SSL* ssl, DeltaSignatures& signatures);
+
+// sender：找出 data 裡和舊檔案相同的範圍 (依照 offset 排好、不重疊，相鄰的會合併)
+std::vector<DeltaCopy> find_matches(const char* data, size_t size, const DeltaSignatures& signatures);
+
+// sender：把新檔案 [offset, offset + len) 編成 TRANSFER_DELTA 的 payload，copies 是和這個範圍重疊的 copy
+void encode_delta_chunk(const char* data, uint64_t offset, size_t len, uint32_t crc,
+                        const DeltaCopy* copies, size_t count, std::vector<char>& out);
+// receiver：照著 payload 從 old_fd 和 literal 組出 chunk；指令不合法、舊檔案讀不到或 crc32c 對不上時回傳 false
+bool apply_delta_chunk(const std::vector<char>& payload, int old_fd, uint64_t old_size,
+                       std::vector<char>& chunk, uint64_t& offset, uint32_t& crc);
+
+#endif // DELTA_HPP
@@ -0,0 +1,185 @@
+#ifndef ENCODE_PIPELINE_HPP
+#define ENCODE_PIPELINE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include "frame_pool.hpp"
+
+#define ENCODE_WORKERS_MAX 16           // encoder thread 最多幾個
+#define ENCODE_SLOTS_PER_WORKER 2       // 每個 encoder 平均可以有幾個 frame 在途 (決定 pipeline 的長度)
+
+/* 把 capture、encode、送出拆成三段，讓 encode 可以用很多個 core
+- capture (呼叫 next_input / submit 的 thread) 把原始 frame 直接讀進 slot 裡，slot 的 buffer 一直重複使用
+- N 個 encoder thread 依照順序各自拿下一個還沒 encode 的 slot，encode 進 FramePool 的 buffer
+- 一個 sender thread 依照 frame 的順序送出，送完 slot 才空出來給 capture
+slot 的數量固定 (workers * ENCODE_SLOTS_PER_WORKER)，所以在途的 frame 和記憶體都有上限；
+送出失敗 (連線斷了) 之後 next_input 回傳 nullptr，capture 就可以停下來。
+每個 frame 只在換手時碰一次 mutex，60 FPS 下不會是瓶頸。
+*/
+template <typename Raw>
+class EncodePipeline {
+public:
+    typedef std::function<bool(const Raw&, StreamFrame&)> EncodeFunction;    // encode 進 frame.data，順便填 pts_us
+    typedef std::function<bool(const StreamFrame&)> SendFunction;
+
+    EncodePipeline(int workers, EncodeFunction encode, SendFunction send)
+        : encode(encode), send(send) {
+        workers = std::max(1, std::min(workers, ENCODE_WORKERS_MAX));
+        slots.resize(workers * ENCODE_SLOTS_PER_WORKER);
+        pthread_mutex_init(&mutex, nullptr);
+        pthread_cond_init(&cond, nullptr);
+
+        threads.resize(workers + 1);
+        pthread_create(&threads[0], nullptr, sender_thread, this);
+        for (int i = 1; i <= workers; i++) pthread_create(&threads[i], nullptr, encoder_thread, this);
+    }
+
+    ~EncodePipeline() {
+        finish();
+        pthread_mutex_destroy(&mutex);
+        pthread_cond_destroy(&cond);
+    }
+
+    EncodePipeline(const EncodePipeline&) = delete;
+    EncodePipeline& operator=(const EncodePipeline&) = delete;
+
+    // 等到有空的 slot，回傳給 capture 填的 frame；送出已經失敗時回傳 nullptr
+    Raw* next_input() {
+        pthread_mutex_lock(&mutex);
+        while (next_submit - next_send >= slots.size() && !failed) pthread_cond_wait(&cond, &mutex);
+        Raw* raw = failed ? nullptr : &slots[next_submit % slots.size()].raw;
+        pthread_mutex_unlock(&mutex);
+        return raw;
+    }
+
+    // next_input 的 frame 填好了，交給 encoder
+    void submit() {
+        pthread_mutex_lock(&mutex);
+        slots[next_submit % slots.size()].state = SLOT_RAW;
+        next_submit++;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // 等已經 submit 的 frame 全部送完再停掉 thread，回傳是不是每個 frame 都送出去了
+    bool finish() {
+        pthread_mutex_lock(&mutex);
+        bool running = !closing;
+        closing = true;
+        pthread_cond_broadcast(&cond);
+        pthread_mutex_unlock(&mutex);
+        if (running) {
+            for (pthread_t thread : threads) pthread_join(thread, nullptr);
+        }
+        return !failed;
+    }
+
+    uint64_t frames_sent() {
+        pthread_mutex_lock(&mutex);
+        uint64_t sent = next_send;
+        pthread_mutex_unlock(&mutex);
+        return sent;
+    }
+
+    int workers() const { return (int)threads.size() - 1; }
+
+private:
+    enum SlotState { SLOT_EMPTY, SLOT_RAW, SLOT_ENCODING, SLOT_DONE, SLOT_FAILED };
+
+    struct Slot {
+        Raw raw;
+        StreamFrame encoded;
+        SlotState state = SLOT_EMPTY;
+    };
+
+    EncodeFunction encode;
+    SendFunction send;
+    std::vector<Slot> slots;
+    std::vector<pthread_t> threads;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint64_t next_submit = 0;   // 下一個給 capture 填的 frame
+    uint64_t next_encode = 0;   // 下一個要 encode 的 frame
+    uint64_t next_send = 0;     // 下一個要送出的 frame
+    bool closing = false;
+    bool failed = false;
+
+    static void* encoder_thread(void* arg) {
+        EncodePipeline* pipeline = static_cast<EncodePipeline*>(arg);
+        pthread_mutex_lock(&pipeline->mutex);
+        while (true) {
+            while (pipeline->next_encode == pipeline->next_submit && !pipeline->closing) {
+                pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+            }
+            if (pipeline->next_encode == pipeline->next_submit) break;
+
+            Slot& slot = pipeline->slots[pipeline->next_encode % pipeline->slots.size()];
+            pipeline->next_encode++;
+            slot.state = SLOT_ENCODING;
+            pthread_mutex_unlock(&pipeline->mutex);
+
+            // 送出已經失敗時不用再 encode，slot 交給 sender 清掉
+            StreamFrame encoded = StreamFrame::acquire();
+            bool ok = !pipeline->failed_now() && pipeline->encode(slot.raw, encoded);
+
+            pthread_mutex_lock(&pipeline->mutex);
+            slot.encoded = std::move(encoded);
+            slot.state = ok ? SLOT_DONE : SLOT_FAILED;
+            pthread_cond_broadcast(&pipeline->cond);
+        }
+        pthread_mutex_unlock(&pipeline->mutex);
+        return nullptr;
+    }
+
+    static void* sender_thread(void* arg) {
+        EncodePipeline* pipeline = static_cast<EncodePipeline*>(arg);
+        pthread_mutex_lock(&pipeline->mutex);
+        while (true) {
+            Slot& slot = pipeline->slots[pipeline->next_send % pipeline->slots.size()];
+            while (pipeline->next_send < pipeline->next_submit && slot.state != SLOT_DONE && slot.state != SLOT_FAILED) {
+                pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+            }
+            if (pipeline->next_send == pipeline->next_submit) {
+                if (pipeline->closing) break;
+                pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+                continue;
+            }
+
+            StreamFrame encoded = std::move(slot.encoded);
+            bool ok = slot.state == SLOT_DONE;
+            pthread_mutex_unlock(&pipeline->mutex);
+
+            // encode 失敗的 frame 跳過 (和原本一樣)，送出失敗就整個停下來
+            bool sent = !ok || pipeline->failed_now() || pipeline->send(encoded);
+            encoded.release();
+
+            pthread_mutex_lock(&pipeline->mutex);
+            if (!sent) pipeline->failed = true;
+            slot.state = SLOT_EMPTY;
+            pipeline->next_send++;
+            pthread_cond_broadcast(&pipeline->cond);
+        }
+        pthread_mutex_unlock(&pipeline->mutex);
+        return nullptr;
+    }
+
+    bool failed_now() {
+        pthread_mutex_lock(&mutex);
+        bool result = failed;
+        pthread_mutex_unlock(&mutex);
+        return result;
+    }
+};
+
+// 預設用幾個 encoder：留一個 core 給 capture、一個給 sender (TLS 加密)
+inline int default_encode_workers() {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return (int)std::max(1L, std::min<long>(cores - 2, ENCODE_WORKERS_MAX));
+}
+
+#endif // ENCODE_PIPELINE_HPP
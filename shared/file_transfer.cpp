@@ -0,0 +1,898 @@
+#include "file_transfer.hpp"
+#include "message.hpp"
+#include "protocol.hpp"
+#include "checksum.hpp"
+#include "delta.hpp"
+#include "compress.hpp"
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+#include <memory>
+#include <ctime>
+#include <chrono>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static size_t chunk_count(uint64_t file_size, uint32_t chunk_size) {
+    return (file_size + chunk_size - 1) / chunk_size;
+}
+
+// metadata 裡的數字：整個字串都要是數字、不能超出範圍
+static bool parse_number(const char* text, int base, uint64_t& value) {
+    char* end = nullptr;
+    errno = 0;
+    unsigned long long parsed = strtoull(text, &end, base);
+    if (errno != 0 || end == text || *end != '\0' || text[0] == '-') return false;
+    value = parsed;
+    return true;
+}
+
+static bool chunk_present(const std::vector<char>& bitmap, size_t index) {
+    return index / 8 < bitmap.size() && ((bitmap[index / 8] >> (index % 8)) & 1);
+}
+
+static bool pwrite_all(int fd, const char* data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// 整個檔案的 digest：依照順序把每個 chunk 的 crc32c 接起來，不用再讀一次檔案
+static uint32_t file_digest(const std::vector<uint32_t>& crcs, uint64_t file_size, uint32_t chunk_size) {
+    uint32_t digest = 0;
+    for (size_t i = 0; i < crcs.size(); i++) {
+        uint64_t offset = (uint64_t)i * chunk_size;
+        digest = crc32c_combine(digest, crcs[i], std::min<uint64_t>(chunk_size, file_size - offset));
+    }
+    return digest;
+}
+
+/* .part.map 的內容：TRANSFER_MAP_HEADER_SIZE 的 header，後面每個 chunk 一個 byte (1 = 已經寫進 .part)，
+再後面是每個 chunk 的 crc32c (4 bytes)，續傳時不用重讀 .part 也能算出整個檔案的 digest
+一個 chunk 一個 byte，標記的時候只要 pwrite 一個 byte，不用讀出來改一個 bit 再寫回去
+*/
+struct ProgressMap {
+    int fd = -1;
+    std::vector<char> done;
+    std::vector<uint32_t> crcs;
+
+    ~ProgressMap() {
+        if (fd >= 0) close(fd);
+    }
+
+    // 讀取舊的進度；header 對不上 (不同的檔案或 chunk 大小) 就從頭開始，resumed 設成 false
+    bool open_map(const std::string& path, uint64_t file_size, uint32_t chunk_size, uint64_t file_id, bool& resumed) {
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return false;
+
+        char header[TRANSFER_MAP_HEADER_SIZE] = {};
+        memcpy(header, TRANSFER_MAP_MAGIC, 8);
+        memcpy(header + 8, &file_size, sizeof(file_size));
+        memcpy(header + 16, &chunk_size, sizeof(chunk_size));
+        memcpy(header + 24, &file_id, sizeof(file_id));
+
+        char old_header[TRANSFER_MAP_HEADER_SIZE];
+        size_t count = chunk_count(file_size, chunk_size);
+        size_t crc_bytes = count * sizeof(uint32_t);
+        done.assign(count, 0);
+        crcs.assign(count, 0);
+        resumed = pread(fd, old_header, sizeof(old_header), 0) == (ssize_t)sizeof(old_header) &&
+                  memcmp(old_header, header, sizeof(header)) == 0 &&
+                  pread(fd, done.data(), count, TRANSFER_MAP_HEADER_SIZE) == (ssize_t)count &&
+                  pread(fd, crcs.data(), crc_bytes, crc_offset(0)) == (ssize_t)crc_bytes;
+        if (resumed) return true;
+
+        reset();
+        return ftruncate(fd, 0) == 0 &&
+               pwrite_all(fd, header, sizeof(header), 0) &&
+               pwrite_all(fd, done.data(), count, TRANSFER_MAP_HEADER_SIZE) &&
+               pwrite_all(fd, reinterpret_cast<const char*>(crcs.data()), crc_bytes, crc_offset(0));
+    }
+
+    off_t crc_offset(size_t index) const {
+        return TRANSFER_MAP_HEADER_SIZE + done.size() + index * sizeof(uint32_t);
+    }
+
+    // crc 先寫，再標記完成
+    bool mark(size_t index, uint32_t crc) {
+        done[index] = 1;
+        crcs[index] = crc;
+        return pwrite_all(fd, reinterpret_cast<const char*>(&crc), sizeof(crc), crc_offset(index)) &&
+               pwrite_all(fd, &done[index], 1, TRANSFER_MAP_HEADER_SIZE + index);
+    }
+
+    // 全部當成還沒收到 (digest 對不上時，下次續傳整個重送)
+    bool clear() {
+        reset();
+        return pwrite_all(fd, done.data(), done.size(), TRANSFER_MAP_HEADER_SIZE);
+    }
+
+    void reset() {
+        std::fill(done.begin(), done.end(), 0);
+        std::fill(crcs.begin(), crcs.end(), 0);
+    }
+
+    size_t missing() const {
+        return std::count(done.begin(), done.end(), 0);
+    }
+
+    // 壓成 TRANSFER_RESUME 的 bitmap
+    std::vector<char> bitmap() const {
+        std::vector<char> bits((done.size() + 7) / 8, 0);
+        for (size_t i = 0; i < done.size(); i++) {
+            if (done[i]) bits[i / 8] |= static_cast<char>(1 << (i % 8));
+        }
+        return bits;
+    }
+};
+
+/* 收一個檔案的狀態。parallel 模式下由 control 連線建立、登記在 recv_sessions，
+每條 stream 各自的 thread 拿同一個 session 把 chunk pwrite 到自己的 offset (不同 chunk 不會重疊，不用鎖)，
+只有 progress 和計數要拿 lock
+*/
+struct RecvSession {
+    std::string name;           // recv_<檔名>
+    uint64_t file_size = 0;
+    uint32_t chunk_size = 0;
+    int fd = -1;
+    ProgressMap progress;
+
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+    size_t corrupted = 0;
+    int streams_done = 0;
+    std::vector<char> trailer;  // 在所有 chunk 到齊之前就收到的 trailer
+    int old_fd = -1;            // delta 時的舊檔案
+    uint64_t old_size = 0;
+    uint64_t received_bytes = 0;    // 這次收到的 chunk 的大小
+    uint64_t wire_bytes = 0;        // 它們在連線上的大小 (壓縮、delta 之後)
+    OtherFrameHandler other_frame;  // relay mode：夾在檔案內容中間的其他訊息
+
+    ~RecvSession() {
+        if (fd >= 0) close(fd);
+        if (old_fd >= 0) close(old_fd);
+        pthread_mutex_destroy(&lock);
+        pthread_cond_destroy(&cond);
+    }
+
+    size_t missing() {
+        pthread_mutex_lock(&lock);
+        size_t count = progress.missing();
+        pthread_mutex_unlock(&lock);
+        return count;
+    }
+};
+
+static std::map<uint64_t, std::shared_ptr<RecvSession>> recv_sessions;     // file id -> 正在 parallel 接收的檔案
+static std::set<std::string> recv_names;    // 正在接收的 recv_<檔名> (不管哪一種模式)，同一個名字同時只能有一個
+static pthread_mutex_t recv_sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 在打開 .part 之前登記檔名，離開 recv_file 時 (包括 rename 之後) 才放掉，
+兩個 sender 送同名的檔案時不會同時寫同一個 .part / .part.map，也不會和 delta 的 open_previous 搶 rename */
+struct RecvNameLock {
+    std::string name;
+    bool locked;
+
+    explicit RecvNameLock(const std::string& name) : name(name) {
+        pthread_mutex_lock(&recv_sessions_mutex);
+        locked = recv_names.insert(name).second;
+        pthread_mutex_unlock(&recv_sessions_mutex);
+    }
+    ~RecvNameLock() {
+        if (!locked) return;
+        pthread_mutex_lock(&recv_sessions_mutex);
+        recv_names.erase(name);
+        pthread_mutex_unlock(&recv_sessions_mutex);
+    }
+};
+
+// 檔名、大小、mtime 或 inode 任何一個變了，就當成不同的檔案
+static uint64_t compute_file_id(const std::string& file_name, const struct stat& st) {
+    std::string identity = file_name + ":" + std::to_string(st.st_size) + ":" +
+                           std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec) + ":" +
+                           std::to_string(st.st_ino);
+    return std::hash<std::string>{}(identity);
+}
+
+/* 要送出去的檔案，整個 mmap 進來，所有 stream 共用 */
+struct SendSource {
+    std::string name;
+    int fd = -1;
+    const char* data = nullptr;
+    size_t size = 0;
+    uint64_t file_id = 0;
+
+    bool open_file(const std::string& filename) {
+        struct stat st;
+        fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            std::cerr << "Failed to open file: " << filename << std::endl;
+            return false;
+        }
+        name = filename.substr(filename.find_last_of('/') + 1);
+        size = st.st_size;
+        file_id = compute_file_id(name, st);
+
+        if (size > 0) {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                perror("mmap");
+                return false;
+            }
+            madvise(mapping, size, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapping);
+        }
+        return true;
+    }
+
+    ~SendSource() {
+        if (data) munmap(const_cast<char*>(data), size);
+        if (fd >= 0) close(fd);
+    }
+};
+
+static uint32_t chunk_crc(const SendSource& source, size_t index) {
+    uint64_t offset = (uint64_t)index * FILE_CHUNK_SIZE;
+    return crc32c(source.data + offset, std::min<uint64_t>(FILE_CHUNK_SIZE, source.size - offset));
+}
+
+/* 一次傳檔案 (或 parallel 的一條 stream) 送了多少，結束時印出來 */
+struct SendStats {
+    uint64_t file_bytes = 0;        // 送出去的 chunk 原本的大小
+    uint64_t wire_bytes = 0;        // 實際送出去的大小 (壓縮、delta 之後)
+    uint64_t compressed_in = 0;     // 壓縮過的 chunk 原本的大小
+    uint64_t compressed_out = 0;    // 和壓縮後的大小
+    size_t incompressible = 0;      // 看起來已經壓縮過 (或壓了沒變小)、原樣送的 chunk
+    double compress_time = 0;
+
+    void add(const SendStats& other) {
+        file_bytes += other.file_bytes;
+        wire_bytes += other.wire_bytes;
+        compressed_in += other.compressed_in;
+        compressed_out += other.compressed_out;
+        incompressible += other.incompressible;
+        compress_time += other.compress_time;
+    }
+};
+
+/* 送一個 chunk：
+- 對方看得懂壓縮過的 chunk、而且這個 chunk 壓得小時，header 和壓縮的結果放在 scratch 裡一次送出
+- 一般情況直接從 mapping SSL_write，不經過 ifstream 的 buffer
+- 連線有 kTLS 時用 SSL_sendfile，檔案內容不用再複製進 SSL 的 buffer
+crc 在送之前從 mapping 算 (硬體 CRC32C 比 TLS 加密快很多)，算完這個 chunk 正好在 cache 裡，接著壓縮或 SSL_write 加密
+*/
+static bool send_chunk(SSL* ssl, const SendSource& source, size_t index, bool use_sendfile, bool compress,
+                       std::vector<char>& scratch, SendStats& stats, uint32_t& crc) {
+    uint64_t offset = (uint64_t)index * FILE_CHUNK_SIZE;
+    size_t len = std::min<uint64_t>(FILE_CHUNK_SIZE, source.size - offset);
+    crc = chunk_crc(source, index);
+    stats.file_bytes += len;
+    if (compress) {
+        const size_t header_size = WIRE_HEADER_SIZE + FILE_CHUNK_HEADER_SIZE;
+        scratch.resize(header_size);
+        if (compress_payload(source.data + offset, len, scratch, &stats.compress_time)) {
+            size_t compressed = scratch.size() - header_size;
+            encode_file_chunk_header(scratch.data(), offset, compressed, crc, WIRE_FLAG_COMPRESSED);
+            stats.compressed_in += len;
+            stats.compressed_out += compressed;
+            stats.wire_bytes += compressed;
+            return ssl_write_all(ssl, scratch.data(), scratch.size());
+        }
+        stats.incompressible++;
+    }
+    stats.wire_bytes += len;
+#ifndef OPENSSL_NO_KTLS
+    if (use_sendfile) {
+        return write_file_chunk(ssl, offset, nullptr, len, crc) &&
+               SSL_sendfile(ssl, source.fd, offset, len, 0) == (ossl_ssize_t)len;
+    }
+#else
+    (void)use_sendfile;
+#endif
+    return write_file_chunk(ssl, offset, source.data + offset, len, crc);
+}
+
+/* 有和舊檔案相同的範圍的 chunk 改送 TRANSFER_DELTA
+沒有這種範圍時回傳 false，由呼叫端照一般的 chunk 送
+*/
+static bool send_delta_chunk(SSL* ssl, const SendSource& source, size_t index, const std::vector<DeltaCopy>& copies,
+                             uint32_t& crc, bool& ok, SendStats& stats) {
+    uint64_t begin = (uint64_t)index * FILE_CHUNK_SIZE;
+    uint64_t end = std::min<uint64_t>(begin + FILE_CHUNK_SIZE, source.size);
+    auto first = std::partition_point(copies.begin(), copies.end(), [begin](const DeltaCopy& copy) {
+        return copy.offset + copy.length <= begin;
+    });
+    auto last = first;
+    while (last != copies.end() && last->offset < end) ++last;
+    if (first == last) return false;
+
+    crc = chunk_crc(source, index);
+    std::vector<char> payload;
+    encode_delta_chunk(source.data, begin, end - begin, crc, &*first, last - first, payload);
+    ok = write_chunk(ssl, TRANSFER_DELTA, payload.data(), payload.size());
+    stats.file_bytes += end - begin;
+    stats.wire_bytes += payload.size();
+    return true;
+}
+
+/* 送 chunks 裡的每個 chunk，它們的 crc 記在 crcs[chunk 編號]
+compress 是對方看得懂壓縮過的 chunk (而且這邊有開壓縮)，copies 是 delta 時新檔案和舊檔案相同的範圍
+*/
+static bool send_chunks(SSL* ssl, const SendSource& source, const size_t* chunks, size_t count, uint32_t* crcs,
+                        bool compress, SendStats& stats, const std::vector<DeltaCopy>& copies = {}) {
+    bool use_sendfile = false;
+#ifndef OPENSSL_NO_KTLS
+    use_sendfile = BIO_get_ktls_send(SSL_get_wbio(ssl));
+#endif
+    std::vector<char> scratch;
+    for (size_t i = 0; i < count; i++) {
+        bool ok = true;
+        if (!copies.empty() && send_delta_chunk(ssl, source, chunks[i], copies, crcs[chunks[i]], ok, stats)) {
+            if (!ok) return false;
+            continue;
+        }
+        if (!send_chunk(ssl, source, chunks[i], use_sendfile, compress, scratch, stats, crcs[chunks[i]])) return false;
+    }
+    return true;
+}
+
+// 對方已經有的 chunk 不用送，但 digest 還是要有它們的 crc
+static void hash_present_chunks(const SendSource& source, const std::vector<size_t>& missing, uint32_t* crcs) {
+    size_t next = 0;
+    for (size_t i = 0; i < chunk_count(source.size, FILE_CHUNK_SIZE); i++) {
+        if (next < missing.size() && missing[next] == i) {
+            next++;
+        } else {
+            crcs[i] = chunk_crc(source, i);
+        }
+    }
+}
+
+// present 是對方的 bitmap，回傳還要送的 chunk
+static void missing_chunks(const SendSource& source, const std::vector<char>& present, std::vector<size_t>& chunks) {
+    chunks.clear();
+    size_t total = chunk_count(source.size, FILE_CHUNK_SIZE);
+    for (size_t i = 0; i < total; i++) {
+        if (!chunk_present(present, i)) chunks.push_back(i);
+    }
+}
+
+/* 送 metadata，resumable 時再等對方回報已經有哪些 chunk，回傳還要送的 chunk
+對方的回報帶著 WIRE_FLAG_ACCEPTS_COMPRESSED 而且這邊有開壓縮時 compress 設成 true
+*/
+static bool negotiate_send(SSL* ssl, const SendSource& source, bool resumable, int streams, std::vector<size_t>& chunks,
+                           bool& compress) {
+    // 發送檔案的 metadata（檔名、大小、chunk 大小、file id 和 stream 數量）
+    Message metadata{};
+    metadata.msg_type = TRANSFER_FILE_CONTENT;
+    snprintf(metadata.payload, MAX_PAYLOAD_SIZE, "%s %zu %d %016llx %d", source.name.c_str(), source.size,
+             FILE_CHUNK_SIZE, (unsigned long long)source.file_id, streams);
+    metadata.payload_size = (int)strlen(metadata.payload);
+
+    if (!write_message(ssl, metadata)) {
+        perror("write(direct_msg)");
+        std::cerr << "Failed to send file metadata." << std::endl;
+        return false;
+    }
+
+    // 對方回報已經有哪些 chunk
+    std::vector<char> present;
+    compress = false;
+    if (resumable) {
+        WireHeader header;
+        if (!read_chunk(ssl, header, present) || header.msg_type != TRANSFER_RESUME) {
+            std::cerr << "Receiver did not report transfer progress." << std::endl;
+            return false;
+        }
+        compress = (header.flags & WIRE_FLAG_ACCEPTS_COMPRESSED) && compression_level() > 0;
+    }
+    missing_chunks(source, present, chunks);
+    return true;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+// 送了多少、花多久，有壓縮時再加上壓縮率和壓縮的速度
+static void report_sent(bool ok, size_t sent, size_t total, const SendStats& stats, double seconds,
+                        const char* reason = "resumed") {
+    if (!ok) {
+        std::cerr << "Failed to send file data." << std::endl;
+        return;
+    }
+    if (sent < total) {
+        std::cout << "File sent successfully! (" << reason << ": " << sent << " of " << total << " chunks sent)" << std::endl;
+    } else {
+        std::cout << "File sent successfully!" << std::endl;
+    }
+
+    char line[256];
+    int n = snprintf(line, sizeof(line), "Sent %.1f MB as %.1f MB in %.2f s (%.1f MB/s)", stats.file_bytes / 1e6,
+                     stats.wire_bytes / 1e6, seconds, seconds > 0 ? stats.file_bytes / 1e6 / seconds : 0.0);
+    if (stats.compressed_in > 0 && n > 0 && (size_t)n < sizeof(line)) {
+        n += snprintf(line + n, sizeof(line) - n, ", compression %.2fx at %.0f MB/s",
+                      (double)stats.compressed_in / stats.compressed_out,
+                      stats.compress_time > 0 ? stats.compressed_in / 1e6 / stats.compress_time : 0.0);
+    }
+    if (stats.incompressible > 0 && n > 0 && (size_t)n < sizeof(line)) {
+        snprintf(line + n, sizeof(line) - n, ", %zu chunks not compressible", stats.incompressible);
+    }
+    std::cout << line << std::endl;
+}
+
+void send_file(SSL* ssl, const std::string& filename, bool resumable){
+    auto begin = std::chrono::steady_clock::now();
+    SendSource source;
+    std::vector<size_t> chunks;
+    bool compress;
+    if (!source.open_file(filename) || !negotiate_send(ssl, source, resumable, 0, chunks, compress)) return;
+
+    // direct mode 接著收 receiver 舊檔案的 block signature，找出可以從舊檔案複製的範圍
+    DeltaSignatures signatures;
+    if (resumable && !read_signatures(ssl, signatures)) {
+        std::cerr << "Receiver did not send block signatures." << std::endl;
+        return;
+    }
+    std::vector<DeltaCopy> copies = find_matches(source.data, source.size, signatures);
+
+    // 發送檔案內容 (只送對方還沒有的 chunk)，最後是整個檔案的 digest
+    std::vector<uint32_t> crcs(chunk_count(source.size, FILE_CHUNK_SIZE));
+    SendStats stats;
+    bool ok = send_chunks(ssl, source, chunks.data(), chunks.size(), crcs.data(), compress, stats, copies);
+    if (ok) {
+        hash_present_chunks(source, chunks, crcs.data());
+        ok = write_file_digest(ssl, source.size, file_digest(crcs, source.size, FILE_CHUNK_SIZE));
+    }
+    report_sent(ok, chunks.size(), crcs.size(), stats, seconds_since(begin));
+    if (ok && !copies.empty()) {
+        std::cout << "Delta: " << stats.wire_bytes << " of " << source.size << " bytes sent" << std::endl;
+    }
+}
+
+/* 每個 chunk 的 sha256 依照順序接起來，每個 frame 最多放 MAX_WIRE_CHUNK_SIZE (至少送一個 frame，空的檔案也一樣) */
+static bool send_manifest(SSL* ssl, const SendSource& source) {
+    size_t total = chunk_count(source.size, FILE_CHUNK_SIZE);
+    const size_t per_frame = MAX_WIRE_CHUNK_SIZE / CHUNK_HASH_SIZE;
+    std::vector<unsigned char> hashes;
+    size_t index = 0;
+    do {
+        size_t count = std::min(per_frame, total - index);
+        hashes.resize(count * CHUNK_HASH_SIZE);
+        for (size_t i = 0; i < count; i++, index++) {
+            uint64_t offset = (uint64_t)index * FILE_CHUNK_SIZE;
+            sha256(source.data + offset, std::min<uint64_t>(FILE_CHUNK_SIZE, source.size - offset),
+                   hashes.data() + i * CHUNK_HASH_SIZE);
+        }
+        if (!write_chunk(ssl, TRANSFER_MANIFEST, hashes.data(), hashes.size())) return false;
+    } while (index < total);
+    return true;
+}
+
+void send_file_dedup(SSL* ssl, const std::string& filename, const std::function<bool(std::vector<char>&, int&)>& wait_reply){
+    auto begin = std::chrono::steady_clock::now();
+    SendSource source;
+    std::vector<size_t> chunks;
+    bool compress;
+    if (!source.open_file(filename) || !negotiate_send(ssl, source, false, 0, chunks, compress)) return;
+
+    if (!send_manifest(ssl, source)) {
+        std::cerr << "Failed to send file manifest." << std::endl;
+        return;
+    }
+    // server 已經有的 chunk 不用上傳；等不到回覆 (舊的 server) 就整個上傳
+    // 回覆帶著 WIRE_FLAG_ACCEPTS_COMPRESSED 代表 recipient 看得懂壓縮過的 chunk
+    std::vector<char> present;
+    int flags = 0;
+    if (wait_reply(present, flags)) {
+        missing_chunks(source, present, chunks);
+        compress = (flags & WIRE_FLAG_ACCEPTS_COMPRESSED) && compression_level() > 0;
+    } else {
+        std::cerr << "Server did not answer the file manifest, uploading the whole file." << std::endl;
+    }
+
+    std::vector<uint32_t> crcs(chunk_count(source.size, FILE_CHUNK_SIZE));
+    SendStats stats;
+    bool ok = send_chunks(ssl, source, chunks.data(), chunks.size(), crcs.data(), compress, stats);
+    if (ok) {
+        hash_present_chunks(source, chunks, crcs.data());
+        ok = write_file_digest(ssl, source.size, file_digest(crcs, source.size, FILE_CHUNK_SIZE));
+    }
+    report_sent(ok, chunks.size(), crcs.size(), stats, seconds_since(begin), "deduplicated");
+}
+
+struct StreamSender {
+    SSL* ssl;
+    const SendSource* source;
+    const size_t* chunks;
+    size_t count;
+    uint32_t* crcs;
+    bool compress;
+    bool ok;
+    SendStats stats;
+};
+
+static void* stream_sender_thread(void* arg) {
+    StreamSender* sender = static_cast<StreamSender*>(arg);
+    // 送完自己那一段後送一個空的 chunk 表示結束
+    sender->ok = send_chunks(sender->ssl, *sender->source, sender->chunks, sender->count, sender->crcs,
+                             sender->compress, sender->stats) &&
+                 write_chunk(sender->ssl, TRANSFER_FILE_CONTENT, nullptr, 0);
+    return nullptr;
+}
+
+void send_file_parallel(SSL* control, const std::string& filename, int streams, const std::function<SSL*()>& open_stream){
+    auto begin = std::chrono::steady_clock::now();
+    SendSource source;
+    std::vector<size_t> chunks;
+    bool compress;
+    if (!source.open_file(filename) || !negotiate_send(control, source, true, streams, chunks, compress)) return;
+
+    // receiver 的 listener 一次處理一條連線的握手和第一個 Message，所以每條 stream 連上後馬上送 DIRECT_SEND_FILE
+    std::vector<SSL*> stream_ssls;
+    for (int i = 0; i < streams; i++) {
+        SSL* ssl = open_stream();
+        if (!ssl) break;
+
+        Message join{};
+        join.msg_type = DIRECT_SEND_FILE;
+        join.payload_size = snprintf(join.payload, MAX_PAYLOAD_SIZE, "%016llx", (unsigned long long)source.file_id);
+        if (!write_message(ssl, join)) break;
+        stream_ssls.push_back(ssl);
+    }
+    if (stream_ssls.empty()) {
+        std::cerr << "Failed to open file transfer streams." << std::endl;
+        return;
+    }
+
+    // 還缺的 chunk 切成連續的幾段，每條 stream 一段，各自一個 thread 送
+    // 每條 stream 算自己那一段的 crc，不會寫到同一個位置
+    std::vector<uint32_t> crcs(chunk_count(source.size, FILE_CHUNK_SIZE));
+    size_t count = stream_ssls.size();
+    std::vector<StreamSender> senders(count);
+    std::vector<pthread_t> threads(count);
+    for (size_t i = 0; i < count; i++) {
+        size_t begin = chunks.size() * i / count;
+        size_t end = chunks.size() * (i + 1) / count;
+        senders[i] = StreamSender{stream_ssls[i], &source, chunks.data() + begin, end - begin, crcs.data(), compress, false, {}};
+        pthread_create(&threads[i], nullptr, stream_sender_thread, &senders[i]);
+    }
+
+    // stream 在送的時候，這個 thread 順便算對方已經有的 chunk 的 crc
+    hash_present_chunks(source, chunks, crcs.data());
+
+    bool ok = true;
+    SendStats stats;
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(threads[i], nullptr);
+        ok = ok && senders[i].ok;
+        stats.add(senders[i].stats);
+    }
+    // 所有 stream 都送完後，digest 從 control 連線送
+    ok = ok && write_file_digest(control, source.size, file_digest(crcs, source.size, FILE_CHUNK_SIZE));
+    report_sent(ok, chunks.size(), crcs.size(), stats, seconds_since(begin));
+}
+
+// 讀下一個檔案內容的 frame，中間夾著的其他訊息交給 session.other_frame
+static bool read_transfer_chunk(SSL* ssl, RecvSession& session, WireHeader& header, std::vector<char>& payload) {
+    std::string username;
+    while (read_chunk(ssl, header, payload, session.other_frame ? &username : nullptr)) {
+        if (!session.other_frame || header.msg_type == TRANSFER_FILE_CONTENT || header.msg_type == TRANSFER_DELTA) return true;
+        session.other_frame(header, username, payload);
+    }
+    return false;
+}
+
+// 接收 count 個 chunk (或收到空的 chunk 為止)，每個 chunk 檢查 crc 後寫到自己的 offset；連線斷掉時回傳 false
+static bool receive_chunks(SSL* ssl, RecvSession& session, size_t count) {
+    size_t total = session.progress.done.size();
+    WireHeader header;
+    std::vector<char> payload;
+    std::vector<char> chunk;     // delta 或壓縮過的 chunk 還原之後的內容
+    for (size_t i = 0; i < count; i++) {
+        if (!read_transfer_chunk(ssl, session, header, payload)) {
+            std::cerr << "Failed to receive file data." << std::endl;
+            return false;
+        }
+        if (header.msg_type == TRANSFER_FILE_CONTENT && payload.empty()) break;
+        // relay 時 server 沒辦法從 chunk store 送出的 chunk 就不會到，trailer 提早到了就不再等
+        if (header.msg_type == TRANSFER_FILE_CONTENT && payload.size() == FILE_CHUNK_HEADER_SIZE) {
+            session.trailer.swap(payload);
+            break;
+        }
+
+        uint64_t offset;
+        uint32_t crc;
+        const char* data;
+        size_t len;
+        bool valid = false;
+        if (header.msg_type == TRANSFER_DELTA) {
+            // 從舊檔案組出整個 chunk (crc 在裡面檢查)
+            valid = apply_delta_chunk(payload, session.old_fd, session.old_size, chunk, offset, crc);
+            data = chunk.data();
+            len = chunk.size();
+        } else if (header.msg_type == TRANSFER_FILE_CONTENT && (header.flags & WIRE_FLAG_COMPRESSED)) {
+            valid = decompress_file_chunk(std::string_view(payload.data(), payload.size()), chunk, offset, crc, data, len);
+        } else if (header.msg_type == TRANSFER_FILE_CONTENT) {
+            valid = decode_file_chunk(payload, offset, crc, data, len);
+        }
+        if (!valid || offset % session.chunk_size != 0 || offset / session.chunk_size >= total ||
+            len != std::min<uint64_t>(session.chunk_size, session.file_size - offset)) {
+            pthread_mutex_lock(&session.lock);
+            session.corrupted++;
+            pthread_mutex_unlock(&session.lock);
+            continue;
+        }
+        if (!pwrite_all(session.fd, data, len, offset)) {
+            perror("pwrite");
+            return false;
+        }
+
+        pthread_mutex_lock(&session.lock);
+        bool marked = session.progress.mark(offset / session.chunk_size, crc);
+        session.received_bytes += len;
+        session.wire_bytes += payload.size() - FILE_CHUNK_HEADER_SIZE;
+        pthread_cond_broadcast(&session.cond);
+        pthread_mutex_unlock(&session.lock);
+        if (!marked) {
+            perror("pwrite");
+            return false;
+        }
+    }
+    return true;
+}
+
+// 等到收齊或所有 stream 都結束；sender 沒開滿 stream 時，TRANSFER_STREAM_TIMEOUT 秒都沒有進度就放棄
+static void wait_streams(RecvSession& session, int streams) {
+    pthread_mutex_lock(&session.lock);
+    size_t last_missing = session.progress.missing();
+    while (last_missing > 0 && session.streams_done < streams) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += TRANSFER_STREAM_TIMEOUT;
+        bool timeout = pthread_cond_timedwait(&session.cond, &session.lock, &deadline) == ETIMEDOUT;
+        size_t missing = session.progress.missing();
+        if (timeout && missing == last_missing) break;
+        last_missing = missing;
+    }
+    pthread_mutex_unlock(&session.lock);
+}
+
+// 之前收過的同名檔案 (delta 的舊檔案)，太小就不值得比對
+static bool open_previous(RecvSession& session) {
+    struct stat st;
+    session.old_fd = open(session.name.c_str(), O_RDONLY);
+    if (session.old_fd < 0) return false;
+    if (fstat(session.old_fd, &st) < 0 || (uint64_t)st.st_size < DELTA_MIN_BLOCK_SIZE) {
+        close(session.old_fd);
+        session.old_fd = -1;
+        return false;
+    }
+    session.old_size = st.st_size;
+    return true;
+}
+
+// 讀檔案的 metadata；relay mode 時它前面也可能夾著其他訊息
+static bool read_metadata(SSL* ssl, const OtherFrameHandler& other_frame, Message& metadata) {
+    if (!other_frame) return read_message(ssl, metadata);
+
+    WireHeader header;
+    std::vector<char> payload;
+    std::string username;
+    while (true) {
+        if (!read_chunk(ssl, header, payload, &username)) return false;
+        if (header.msg_type == TRANSFER_FILE_CONTENT) break;
+        other_frame(header, username, payload);
+    }
+    if (payload.size() >= MAX_PAYLOAD_SIZE) return false;
+    metadata.msg_type = header.msg_type;
+    metadata.payload_size = (int)payload.size();
+    memcpy(metadata.payload, payload.data(), payload.size());
+    metadata.payload[payload.size()] = '\0';
+    return true;
+}
+
+void recv_file(SSL* ssl, bool resumable, const OtherFrameHandler& other_frame){
+    auto begin = std::chrono::steady_clock::now();
+    // 先接收檔案的 metadata
+    Message metadata{};
+    if (!read_metadata(ssl, other_frame, metadata)) {
+        std::cerr << "Failed to receive file metadata." << std::endl;
+        return;
+    }
+
+    char* file_name = strtok(metadata.payload, " ");
+    char* file_size_str = strtok(NULL, " ");
+    char* chunk_size_str = strtok(NULL, " ");
+    char* file_id_str = strtok(NULL, " ");
+    char* streams_str = strtok(NULL, " ");
+    if (!file_name || !file_size_str || !chunk_size_str || !file_id_str || strchr(file_name, '/')) {
+        std::cerr << "Invalid file metadata." << std::endl;
+        return;
+    }
+    uint64_t file_size = 0, chunk_size = 0, file_id = 0, streams = 0;
+    if (!parse_number(file_size_str, 10, file_size) || !parse_number(chunk_size_str, 10, chunk_size) ||
+        !parse_number(file_id_str, 16, file_id) || (streams_str && !parse_number(streams_str, 10, streams))) {
+        std::cerr << "Invalid file metadata." << std::endl;
+        return;
+    }
+    if (chunk_size == 0 || chunk_size > MAX_WIRE_CHUNK_SIZE - FILE_CHUNK_HEADER_SIZE) {
+        std::cerr << "Invalid chunk size: " << chunk_size << std::endl;
+        return;
+    }
+    // 在配置進度、ftruncate 之前先擋掉太大的檔案
+    if (file_size > MAX_TRANSFER_FILE_SIZE || chunk_count(file_size, chunk_size) > MAX_TRANSFER_CHUNKS) {
+        std::cerr << "File too large: " << file_size << " bytes in chunks of " << chunk_size << std::endl;
+        return;
+    }
+    // 只有 direct mode 能開多條連線
+    if (streams > MAX_FILE_STREAMS || (streams > 0 && !resumable)) {
+        std::cerr << "Invalid stream count: " << streams << std::endl;
+        return;
+    }
+
+    auto session = std::make_shared<RecvSession>();
+    session->name = "recv_" + std::string(file_name); // 新增的檔名先加個 prefix 檔一下撞名
+    session->file_size = file_size;
+    session->chunk_size = chunk_size;
+    session->other_frame = other_frame;
+    std::string part_name = session->name + ".part";
+
+    RecvNameLock name_lock(session->name);
+    if (!name_lock.locked) {
+        std::cerr << "Already receiving " << file_name << std::endl;
+        return;
+    }
+
+    // 打開 (或接著用) 上次沒收完的 .part 和它的進度
+    bool resumed = false;
+    session->fd = open(part_name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (session->fd < 0 || !session->progress.open_map(part_name + ".map", file_size, chunk_size, file_id, resumed) ||
+        (!resumed && ftruncate(session->fd, 0) < 0) || ftruncate(session->fd, file_size) < 0) {
+        std::cerr << "Failed to create file: " << part_name << std::endl;
+        return;
+    }
+
+    size_t total = session->progress.done.size();
+    size_t expected = total;
+    if (resumed && session->progress.missing() < total) {
+        std::cout << "Resuming " << file_name << ": " << total - session->progress.missing() << " of " << total
+                  << " chunks already received" << std::endl;
+    }
+    std::cout << "Receiving " << file_name << "("  << file_size << " bytes";
+    if (streams > 0) std::cout << ", " << streams << " streams";
+    std::cout << ")......." << std::endl;
+
+    // 其他 stream 的連線用 file id 找到這個 session (要在回覆 sender 之前登記好)
+    if (streams > 0) {
+        pthread_mutex_lock(&recv_sessions_mutex);
+        bool busy = !recv_sessions.emplace(file_id, session).second;
+        pthread_mutex_unlock(&recv_sessions_mutex);
+        if (busy) {
+            std::cerr << "Already receiving " << file_name << std::endl;
+            return;
+        }
+    }
+
+    // direct mode 告訴 sender 只要送缺的 chunk，順便告訴它可以送壓縮過的 chunk
+    bool replied = true;
+    if (resumable) {
+        std::vector<char> bitmap = session->progress.bitmap();
+        replied = write_chunk(ssl, TRANSFER_RESUME, bitmap.data(), bitmap.size(), WIRE_FLAG_ACCEPTS_COMPRESSED);
+        if (!replied) std::cerr << "Failed to send transfer progress." << std::endl;
+        expected = session->progress.missing();
+    }
+
+    // 單一連線、沒有進行到一半的 .part 時，告訴 sender 舊檔案有哪些 block (沒有舊檔案時送空的)
+    if (replied && resumable && streams == 0) {
+        DeltaSignatures signatures;
+        if (expected == total && open_previous(*session)) {
+            if (compute_signatures(session->old_fd, session->old_size, signatures)) {
+                std::cout << "Comparing with existing " << session->name << " (" << signatures.blocks.size() << " blocks of "
+                          << signatures.block_size << " bytes)" << std::endl;
+            } else {
+                signatures.blocks.clear();
+            }
+        }
+        replied = write_signatures(ssl, signatures);
+        if (!replied) std::cerr << "Failed to send block signatures." << std::endl;
+    }
+
+    bool connected = replied;
+    if (connected && streams == 0) {
+        connected = receive_chunks(ssl, *session, expected);
+    } else if (connected) {
+        wait_streams(*session, streams);
+    }
+
+    if (streams > 0) {
+        pthread_mutex_lock(&recv_sessions_mutex);
+        recv_sessions.erase(file_id);
+        pthread_mutex_unlock(&recv_sessions_mutex);
+    }
+
+    // 最後是 sender 算的整個檔案的 digest
+    WireHeader header;
+    std::vector<char> payload;
+    uint64_t digest_size = 0;
+    uint32_t digest = 0;
+    if (connected && !session->trailer.empty()) {
+        payload.swap(session->trailer);
+    } else if (!connected || !read_transfer_chunk(ssl, *session, header, payload) || header.msg_type != TRANSFER_FILE_CONTENT) {
+        payload.clear();
+    }
+    bool has_digest = decode_file_digest(payload, digest_size, digest) && digest_size == file_size;
+
+    size_t missing = session->missing();
+    if (missing > 0) {
+        std::cerr << "File transfer incomplete: " << missing << " of " << total << " chunks missing ("
+                  << session->corrupted << " failed checksum), kept " << part_name << " for resume." << std::endl;
+        return;
+    }
+    if (!has_digest) {
+        std::cerr << "File transfer incomplete: no file digest, kept " << part_name << " for resume." << std::endl;
+        return;
+    }
+
+    // 收到的每個 chunk 都檢查過 crc，這裡再確認整個檔案 (包括上次收到的 chunk) 和 sender 的一樣
+    pthread_mutex_lock(&session->lock);
+    bool matched = file_digest(session->progress.crcs, file_size, chunk_size) == digest;
+    if (!matched) session->progress.clear();
+    pthread_mutex_unlock(&session->lock);
+    if (!matched) {
+        std::cerr << "File digest mismatch, " << part_name << " will be received again." << std::endl;
+        return;
+    }
+
+    if (rename(part_name.c_str(), session->name.c_str()) < 0) {
+        perror("rename");
+        return;
+    }
+    unlink((part_name + ".map").c_str());
+    std::cout << "File received successfully! (crc32c " << std::hex << digest << std::dec << ")" << std::endl;
+
+    double seconds = seconds_since(begin);
+    char line[128];
+    snprintf(line, sizeof(line), "Received %.1f MB as %.1f MB in %.2f s (%.1f MB/s)", session->received_bytes / 1e6,
+             session->wire_bytes / 1e6, seconds, seconds > 0 ? session->received_bytes / 1e6 / seconds : 0.0);
+    std::cout << line << std::endl;
+}
+
+void recv_file_stream(SSL* ssl, const std::string& join){
+    // join 是 "<file id>"
+    uint64_t file_id = strtoull(join.c_str(), nullptr, 16);
+
+    pthread_mutex_lock(&recv_sessions_mutex);
+    auto it = recv_sessions.find(file_id);
+    std::shared_ptr<RecvSession> session = (it != recv_sessions.end()) ? it->second : nullptr;
+    pthread_mutex_unlock(&recv_sessions_mutex);
+    if (!session) {
+        std::cerr << "Unknown file transfer stream." << std::endl;
+        return;
+    }
+
+    receive_chunks(ssl, *session, SIZE_MAX);
+
+    pthread_mutex_lock(&session->lock);
+    session->streams_done++;
+    pthread_cond_broadcast(&session->cond);
+    pthread_mutex_unlock(&session->lock);
+}
@@ -0,0 +1,69 @@
+#ifndef FILE_TRANSFER_HPP
+#define FILE_TRANSFER_HPP
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <openssl/ssl.h>
+
+struct WireHeader;
+
+#define FILE_CHUNK_SIZE (256 * 1024)    // 每個 chunk 的大小 (加上 FILE_CHUNK_HEADER_SIZE 不能超過 MAX_WIRE_CHUNK_SIZE)
+#define TRANSFER_MAP_MAGIC "XFERMAP2"
+#define TRANSFER_MAP_HEADER_SIZE 32     // magic(8) + 檔案大小(8) + chunk 大小(4) + reserved(4) + file id(8)
+#define MAX_FILE_STREAMS 16             // parallel 傳檔案最多幾條 stream
+#define TRANSFER_STREAM_TIMEOUT 10      // parallel 接收時，幾秒都沒有進度就不再等還沒結束的 stream
+#define TRANSFER_REPLY_TIMEOUT 30       // relay 傳檔案時最多等 server 回覆 manifest 幾秒，等不到就整個上傳
+#define MAX_TRANSFER_FILE_SIZE (1ULL << 40)     // metadata 裡的檔案大小最多 1 TB (大小是對方給的，不能直接拿來配置)
+#define MAX_TRANSFER_CHUNKS (4 * 1024 * 1024)   // 最多幾個 chunk (.part.map 和記憶體裡的進度是每個 chunk 5 bytes)
+
+/* 可以續傳的檔案傳輸 (direct / relay 共用)
+
+1. sender 先送 metadata："<檔名> <大小> <chunk 大小> <file id> <stream 數量>"
+   file id 由檔名、大小、mtime 和 inode 算出來，檔案改過之後就不會接著舊的進度續傳；
+   stream 數量是 0 時檔案內容就跟在同一條連線上
+2. receiver 把內容寫進 recv_<檔名>.part，旁邊的 recv_<檔名>.part.map 記錄哪些 chunk 已經寫好和它們的 crc32c
+3. resumable (direct mode) 時 receiver 先回一個 TRANSFER_RESUME，payload 是 bitmap (第 i 個 bit = 第 i 個 chunk 已經有了)，
+   sender 只送缺的 chunk；relay mode 沒有回頭的路，sender 每個 chunk 都送，receiver 照樣檢查並記錄進度
+4. 每個 chunk 帶自己的 offset 和 crc32c，crc 不對的 chunk 不寫入，下次續傳時會再要一次
+5. 最後 sender 送出整個檔案的 crc32c (由每個 chunk 的 crc 用 crc32c_combine 接起來，不用再讀一次檔案)，
+   receiver 用 .part.map 裡記的 crc 算出自己的 digest 比對；對不上就清掉進度，下次整個重送
+6. 全部 chunk 都到齊、digest 也對後 .part 改名成 recv_<檔名>，刪掉 .part.map；中途斷線則兩個檔案都留著
+
+Delta (direct mode，單一連線)：receiver 已經有舊版的 recv_<檔名>、而且沒有進行到一半的 .part 時
+- receiver 回完 bitmap 後送舊檔案每個 block 的 signature (TRANSFER_SIGNATURES，沒有舊檔案時是空的)
+- sender 用 rolling checksum 找出新檔案裡和舊檔案相同的範圍，有這種範圍的 chunk 改送 TRANSFER_DELTA (複製指令 + literal)
+- receiver 從舊檔案組出 chunk，crc32c 對得上才寫進 .part，之後的流程 (進度、digest、改名) 完全一樣
+
+壓縮 (compress.hpp)：receiver (relay mode 時是 server 替 recipient) 的 TRANSFER_RESUME 帶著 WIRE_FLAG_ACCEPTS_COMPRESSED 時，
+sender 把每個看起來還能壓縮的 chunk 用 LZ4 壓縮後送 (offset、crc32c 不壓縮，crc 是原始資料的)，
+已經壓縮過的內容由 entropy 判斷後原樣送；結束時兩邊都印出原始大小、連線上的大小和速度
+
+Dedup (relay mode)：server 有一個 content-addressed 的 chunk store，同一個檔案轉給很多人時 sender 只要上傳一次
+- sender 送完 metadata 後接著送 TRANSFER_MANIFEST (每個 chunk 的 SHA-256)
+- server 回覆 TRANSFER_RESUME，bitmap 標記 store 裡已經有的 chunk，sender 只上傳其他的
+- recipient 收到的和一般的 relay 一樣：store 裡的 chunk 由 server 讀出來送，crc 和 digest 照樣由 recipient 檢查
+
+Parallel (direct mode)：一條 control 連線加上 N 條 stream 連線，讓多個 TCP window 和多個 core 的 AES 一起跑
+- control 連線照上面的流程送 metadata (stream 數量 = N)、收 bitmap，但不帶檔案內容
+- 收到 bitmap 後才一條一條連上 stream，連上就送 DIRECT_SEND_FILE："<file id>"
+- 還缺的 chunk 切成連續的幾段，每條 stream 由自己的 thread 送它那一段，最後送一個空的 chunk 表示結束
+- receiver 每條連線各自一個 thread，用 file id 找到同一個 session，pwrite 到各自的 offset；
+  control 的 thread 等到收齊 (或 N 條 stream 都結束)，再從 control 連線收 digest
+*/
+void send_file(SSL* ssl, const std::string& filename, bool resumable);
+// relay mode 的 dedup：wait_reply 等 server 對 manifest 的 TRANSFER_RESUME (由讀 server 連線的 thread 收) 的 payload 和 flags，
+// 等不到時回傳 false
+void send_file_dedup(SSL* ssl, const std::string& filename, const std::function<bool(std::vector<char>&, int&)>& wait_reply);
+/* relay mode 時檔案內容和 server 送給這個 client 的其他訊息 (別人的 chat、自己同時在上傳的檔案的 TRANSFER_RESUME …)
+走同一條連線，other_frame 不是空的時，收檔案期間讀到的其他訊息交給它處理，不算進 chunk */
+typedef std::function<void(const WireHeader& header, const std::string& username, std::vector<char>& payload)> OtherFrameHandler;
+void recv_file(SSL* ssl, bool resumable, const OtherFrameHandler& other_frame = nullptr);
+
+// control 是已經送過 DIRECT_SEND_FILE 的連線，open_stream 每呼叫一次開一條新的 stream 連線 (失敗回傳 nullptr)
+void send_file_parallel(SSL* control, const std::string& filename, int streams, const std::function<SSL*()>& open_stream);
+// 接收一條 stream 連線，join 是它的 DIRECT_SEND_FILE 的 payload
+void recv_file_stream(SSL* ssl, const std::string& join);
+
+#endif // FILE_TRANSFER_HPP
@@ -0,0 +1,61 @@
+#include "frame_pool.hpp"
+
+FramePool& FramePool::instance() {
+    static FramePool pool;
+    return pool;
+}
+
+FramePool::FramePool() {
+    pthread_mutex_init(&pool_mutex, nullptr);
+    free_list.reserve(MAX_FREE_FRAMES);     // release 時 push_back 不會再 allocate
+}
+
+FramePool::~FramePool() {
+    pthread_mutex_destroy(&pool_mutex);
+}
+
+std::vector<unsigned char> FramePool::acquire() {
+    std::vector<unsigned char> buffer;
+
+    pthread_mutex_lock(&pool_mutex);
+    bool found = !free_list.empty();
+    if (found) {
+        buffer.swap(free_list.back());
+        free_list.pop_back();
+        reused_count++;
+    } else {
+        allocated_count++;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (!found) buffer.reserve(FRAME_BUFFER_RESERVE);
+    return buffer;
+}
+
+void FramePool::release(std::vector<unsigned char>& buffer) {
+    // 特別大的 frame 和 pool 已經滿了時直接還給系統
+    std::vector<unsigned char> dropped;
+    pthread_mutex_lock(&pool_mutex);
+    if (buffer.capacity() <= MAX_POOLED_FRAME && free_list.size() < MAX_FREE_FRAMES) {
+        buffer.clear();
+        free_list.emplace_back();
+        free_list.back().swap(buffer);
+    } else {
+        dropped.swap(buffer);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+uint64_t FramePool::allocated() {
+    pthread_mutex_lock(&pool_mutex);
+    uint64_t count = allocated_count;
+    pthread_mutex_unlock(&pool_mutex);
+    return count;
+}
+
+uint64_t FramePool::reused() {
+    pthread_mutex_lock(&pool_mutex);
+    uint64_t count = reused_count;
+    pthread_mutex_unlock(&pool_mutex);
+    return count;
+}
@@ -0,0 +1,77 @@
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+
+#define FRAME_BUFFER_RESERVE (256 * 1024)       // 新的 frame buffer 先預留多少 (640x480 的 JPEG 一般放得下)
+#define MAX_POOLED_FRAME (8 * 1024 * 1024)      // capacity 比這個大的 buffer 不回收，直接還給系統
+#define MAX_FREE_FRAMES 32                      // pool 最多留幾個閒置的 frame buffer
+
+/* 重複使用 video frame 的 buffer (和 server 的 BufferPool 一樣的想法，只是 frame 大小不固定)
+encode、送出、接收、排隊、decode 全部用同一個 StreamFrame 傳下去，
+用完時 buffer 連同 capacity 回到 pool，下一個 frame 的 resize 不用再跟系統要記憶體；
+穩定之後每個 frame 都不會 allocate (OpenCV 的 codec 自己內部用的除外)。
+*/
+class FramePool {
+public:
+    static FramePool& instance();
+
+    // 拿一個空的 buffer (size 是 0，capacity 是之前用過的大小)
+    std::vector<unsigned char> acquire();
+    // 把 buffer 還回來 (buffer 會被清成 capacity 0)
+    void release(std::vector<unsigned char>& buffer);
+
+    // 開始到現在新配置了幾個 buffer / 有幾次拿到回收的 buffer
+    uint64_t allocated();
+    uint64_t reused();
+
+private:
+    FramePool();
+    ~FramePool();
+
+    pthread_mutex_t pool_mutex;
+    std::vector<std::vector<unsigned char>> free_list;
+    uint64_t allocated_count = 0;
+    uint64_t reused_count = 0;
+};
+
+// 一個 frame：move-only，destroy 時 buffer 自動回到 FramePool；data 是空的代表 stream 結束 (EOF)
+struct StreamFrame {
+    std::vector<unsigned char> data;
+    bool keyframe = true;   // 不需要前面的 frame 就能 decode (JPEG 每個都是)
+    int64_t pts_us = 0;     // presentation timestamp (playout.hpp)
+
+    StreamFrame() = default;
+    explicit StreamFrame(std::vector<unsigned char>&& frame, bool is_keyframe = true)
+        : data(std::move(frame)), keyframe(is_keyframe) {}
+    StreamFrame(StreamFrame&& other) noexcept : keyframe(other.keyframe), pts_us(other.pts_us) {
+        data.swap(other.data);
+    }
+    StreamFrame& operator=(StreamFrame&& other) noexcept {
+        if (this != &other) {
+            release();
+            data.swap(other.data);
+            keyframe = other.keyframe;
+            pts_us = other.pts_us;
+        }
+        return *this;
+    }
+    StreamFrame(const StreamFrame&) = delete;
+    StreamFrame& operator=(const StreamFrame&) = delete;
+    ~StreamFrame() { release(); }
+
+    // 從 pool 拿一個 buffer 來裝新的 frame
+    static StreamFrame acquire() { return StreamFrame(FramePool::instance().acquire()); }
+
+    void release() {
+        if (data.capacity() > 0) FramePool::instance().release(data);
+    }
+
+    bool eof() const { return data.empty(); }
+};
+
+#endif // FRAME_POOL_HPP
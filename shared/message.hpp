@@ -28,11 +28,16 @@ enum MsgType {
     RELAY_SEND_FILE = 7,
     
     TRANSFER_FILE_CONTENT = 8,
+    TRANSFER_RESUME = 9,    // 收檔案的一方回報已經有哪些 chunk (bitmap)
 
     REGISTER = 10,
     LOGIN = 11,
     LOGOUT = 12,
 
+    TRANSFER_MANIFEST = 13, // relay 傳檔案時 sender 先送每個 chunk 的 SHA-256，server 用 TRANSFER_RESUME 回覆它已經有哪些
+    TRANSFER_SIGNATURES = 14,   // direct 傳檔案時 receiver 送舊檔案每個 block 的 checksum (delta.hpp)
+    TRANSFER_DELTA = 15,        // 用舊檔案的 block 和 literal 組成的 chunk
+
     DIRECT_STREAMING = 16,
     RELAY_STREAMING = 17,
     DIRECT_AUDIO_STREAMING = 18,
@@ -40,8 +45,13 @@ enum MsgType {
     // Add more types: FILE_INIT, FILE_CHUNK, VIDEO_FRAME, etc.
 };
 
+/* 程式內部使用的 Message
+不可以直接把這個 struct 的 bytes 送出去 (from_username 是 std::string)，
+要用 protocol.hpp 的 encode_message / write_message 轉成網路格式。
+*/
 struct Message {
     int msg_type;
+    int flags;         // WIRE_FLAG_* (protocol.hpp)
     int from_id;       // Sender ID
     int to_id;         // Receiver ID
     int payload_size;
@@ -0,0 +1,41 @@
+#include "playout.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+
+int64_t monotonic_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t FramePacer::wait(int64_t pts_us) {
+    int64_t now = monotonic_us();
+    int64_t behind = now - (base_us + pts_us);
+    if (!started || behind > PACER_RESYNC_MS * 1000LL) {
+        base_us = now - pts_us;
+        bool resync = started;
+        started = true;
+        return resync ? behind : 0;
+    }
+
+    if (behind < 0) usleep(static_cast<useconds_t>(-behind));
+    return std::max<int64_t>(behind, 0);
+}
+
+int64_t PlayoutClock::due(int64_t pts_us, int64_t now_us) {
+    bool resync = !started || pts_us < last_pts_us || now_us - (base_us + pts_us) > PLAYOUT_RESYNC_MS * 1000LL;
+    if (resync) {
+        if (started) resync_count++;
+        base_us = now_us + PLAYOUT_DELAY_MS * 1000LL - pts_us;
+        started = true;
+    }
+    last_pts_us = pts_us;
+
+    int64_t when = base_us + pts_us;
+    if (now_us - when > PLAYOUT_LATE_MS * 1000LL) {
+        late++;
+        return -1;
+    }
+    return when;
+}
@@ -0,0 +1,49 @@
+#ifndef PLAYOUT_HPP
+#define PLAYOUT_HPP
+
+#include <cstdint>
+
+#define DEFAULT_VIDEO_FPS 30        // 影片檔沒有 timestamp 也沒有 FPS 時當成幾 FPS
+#define PACER_RESYNC_MS 500         // sender 落後超過這麼多 (encode 太慢) 就重新對時，不一口氣把落後的 frame 全部送出
+#define PLAYOUT_DELAY_MS 100        // jitter buffer：每個 frame 都在 timestamp 之後固定晚這麼久播，晚到這麼多以內都還來得及
+#define PLAYOUT_LATE_MS 50          // 比預定時間晚超過這麼多的 frame 直接丟掉 (不 decode)，讓畫面追上
+#define PLAYOUT_RESYNC_MS 1000      // 晚超過這麼多 (sender 停過、網路斷過) 就重新對時
+
+/* video frame 的播放時間
+每個 frame 帶著 presentation timestamp (pts，µs，從 stream 開始算，影片檔用 CAP_PROP_POS_MSEC，webcam 用 capture 的時間)
+- sender 用 FramePacer 照 pts 的節奏送，影片檔不會用 encode 的速度衝出去
+- receiver 用 PlayoutClock 把 pts 對應到自己的時鐘：第一個 frame 在收到之後 PLAYOUT_DELAY_MS 播，
+  之後每個 frame 都在「同樣的延遲 + pts 的差」時播，所以播放速度等於原本的 FPS、延遲固定
+*/
+
+// steady clock 的 µs
+int64_t monotonic_us();
+
+class FramePacer {
+public:
+    // 等到 pts 的 frame 該送出的時間 (第一個 frame 馬上送)，回傳比該送出的時間晚了多少 µs (沒有晚就是 0)
+    int64_t wait(int64_t pts_us);
+
+private:
+    bool started = false;
+    int64_t base_us = 0;    // pts 0 對應到的 monotonic_us
+};
+
+class PlayoutClock {
+public:
+    /* 回傳 pts 的 frame 要在什麼時候 (monotonic_us) 播，太晚的回傳 -1 (丟掉它)
+    第一個 frame、pts 倒退 (新的 stream) 或晚太多時重新對時 */
+    int64_t due(int64_t pts_us, int64_t now_us);
+
+    uint64_t late_frames() const { return late; }
+    uint64_t resyncs() const { return resync_count; }
+
+private:
+    bool started = false;
+    int64_t base_us = 0;
+    int64_t last_pts_us = 0;
+    uint64_t late = 0;
+    uint64_t resync_count = 0;
+};
+
+#endif // PLAYOUT_HPP
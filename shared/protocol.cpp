@@ -0,0 +1,230 @@
+#include "protocol.hpp"
+#include "checksum.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <arpa/inet.h>
+
+static void put_u32(char* dst, uint32_t value) {
+    value = htonl(value);
+    memcpy(dst, &value, sizeof(value));
+}
+
+static uint32_t get_u32(const char* src) {
+    uint32_t value;
+    memcpy(&value, src, sizeof(value));
+    return ntohl(value);
+}
+
+static void put_u64(char* dst, uint64_t value) {
+    put_u32(dst, static_cast<uint32_t>(value >> 32));
+    put_u32(dst + 4, static_cast<uint32_t>(value));
+}
+
+static uint64_t get_u64(const char* src) {
+    return (static_cast<uint64_t>(get_u32(src)) << 32) | get_u32(src + 4);
+}
+
+// 沒有 username 的 header (write_chunk 系列用)
+static void put_chunk_header(char* dst, int msg_type, size_t payload_len, int flags = 0) {
+    memset(dst, 0, WIRE_HEADER_SIZE);
+    put_u32(dst, WIRE_HEADER_SIZE - WIRE_LENGTH_SIZE + payload_len);
+    dst[4] = static_cast<char>(msg_type);
+    dst[5] = static_cast<char>(flags);
+}
+
+size_t encode_message(const Message& msg, std::vector<char>& out) {
+    size_t username_len = std::min<size_t>(msg.from_username.size(), MAX_WIRE_USERNAME_SIZE);
+    size_t payload_len = std::min<size_t>(std::max(msg.payload_size, 0), MAX_WIRE_PAYLOAD_SIZE);
+    size_t frame_size = WIRE_HEADER_SIZE + username_len + payload_len;
+
+    size_t start = out.size();
+    out.resize(start + frame_size);
+    char* p = out.data() + start;
+
+    put_u32(p, frame_size - WIRE_LENGTH_SIZE);
+    p[4] = static_cast<char>(msg.msg_type);
+    p[5] = static_cast<char>(msg.flags);
+    p[6] = static_cast<char>(username_len);
+    p[7] = 0;
+    put_u32(p + 8, static_cast<uint32_t>(msg.from_id));
+    put_u32(p + 12, static_cast<uint32_t>(msg.to_id));
+    memcpy(p + WIRE_HEADER_SIZE, msg.from_username.data(), username_len);
+    memcpy(p + WIRE_HEADER_SIZE + username_len, msg.payload, payload_len);
+
+    return frame_size;
+}
+
+bool decode_header(const char* data, size_t len, WireHeader& header, bool& valid) {
+    valid = true;
+    if (len < WIRE_HEADER_SIZE) return false;
+
+    header.length = get_u32(data);
+    header.msg_type = static_cast<uint8_t>(data[4]);
+    header.flags = static_cast<uint8_t>(data[5]);
+    header.username_len = static_cast<uint8_t>(data[6]);
+    header.from_id = static_cast<int32_t>(get_u32(data + 8));
+    header.to_id = static_cast<int32_t>(get_u32(data + 12));
+
+    // length 至少要包含 header 和 username，payload 也不能超過上限
+    size_t min_length = WIRE_HEADER_SIZE - WIRE_LENGTH_SIZE + header.username_len;
+    bool chunk = header.msg_type == TRANSFER_FILE_CONTENT || header.msg_type == TRANSFER_RESUME ||
+                 header.msg_type == TRANSFER_MANIFEST || header.msg_type == TRANSFER_SIGNATURES ||
+                 header.msg_type == TRANSFER_DELTA;
+    size_t max_payload = chunk ? MAX_WIRE_CHUNK_SIZE : MAX_WIRE_PAYLOAD_SIZE;
+    if (header.length < min_length || header.length - min_length > max_payload) {
+        valid = false;
+        return false;
+    }
+    return true;
+}
+
+bool decode_message(const char* data, size_t len, Message& msg) {
+    WireHeader header;
+    bool valid;
+    if (!decode_header(data, len, header, valid) || len < header.frame_size()) return false;
+
+    size_t payload_len = header.payload_size();
+    if (payload_len > MAX_PAYLOAD_SIZE) return false;
+    msg.msg_type = header.msg_type;
+    msg.flags = header.flags;
+    msg.from_id = header.from_id;
+    msg.to_id = header.to_id;
+    msg.from_username.assign(data + WIRE_HEADER_SIZE, header.username_len);
+    msg.payload_size = static_cast<int>(payload_len);
+    memcpy(msg.payload, data + WIRE_HEADER_SIZE + header.username_len, payload_len);
+    if (payload_len < MAX_PAYLOAD_SIZE) msg.payload[payload_len] = '\0';
+    return true;
+}
+
+bool decode_message_view(const char* data, size_t len, MessageView& view) {
+    bool valid;
+    if (!decode_header(data, len, view.header, valid) || len < view.header.frame_size()) return false;
+
+    view.username = std::string_view(data + WIRE_HEADER_SIZE, view.header.username_len);
+    view.payload = std::string_view(data + WIRE_HEADER_SIZE + view.header.username_len, view.header.payload_size());
+    return true;
+}
+
+bool ssl_write_all(SSL* ssl, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    size_t total_written = 0;
+    while (total_written < len) {
+        int n = SSL_write(ssl, p + total_written, len - total_written);
+        if (n <= 0) return false;
+        total_written += n;
+    }
+    return true;
+}
+
+bool ssl_read_all(SSL* ssl, void* data, size_t len) {
+    char* p = static_cast<char*>(data);
+    size_t total_read = 0;
+    while (total_read < len) {
+        int n = SSL_read(ssl, p + total_read, len - total_read);
+        if (n <= 0) return false;
+        total_read += n;
+    }
+    return true;
+}
+
+bool write_message(SSL* ssl, const Message& msg) {
+    // 整個 frame 一次 SSL_write，變成一個 TLS record
+    std::vector<char> frame;
+    encode_message(msg, frame);
+    return ssl_write_all(ssl, frame.data(), frame.size());
+}
+
+bool read_message(SSL* ssl, Message& msg) {
+    char buf[WIRE_HEADER_SIZE + MAX_WIRE_USERNAME_SIZE + MAX_WIRE_PAYLOAD_SIZE];
+    if (!ssl_read_all(ssl, buf, WIRE_HEADER_SIZE)) return false;
+
+    WireHeader header;
+    bool valid;
+    if (!decode_header(buf, WIRE_HEADER_SIZE, header, valid)) return false;
+    // 大塊的檔案內容要用 read_chunk 讀
+    if (header.frame_size() > sizeof(buf)) return false;
+    if (!ssl_read_all(ssl, buf + WIRE_HEADER_SIZE, header.frame_size() - WIRE_HEADER_SIZE)) return false;
+
+    return decode_message(buf, header.frame_size(), msg);
+}
+
+bool write_chunk(SSL* ssl, int msg_type, const void* data, size_t len, int flags) {
+    if (len > MAX_WIRE_CHUNK_SIZE) return false;
+
+    char header[WIRE_HEADER_SIZE];
+    put_chunk_header(header, msg_type, len, flags);
+    return ssl_write_all(ssl, header, sizeof(header)) && ssl_write_all(ssl, data, len);
+}
+
+void encode_chunk(int msg_type, const void* data, size_t len, std::vector<char>& out, int flags) {
+    size_t start = out.size();
+    out.resize(start + WIRE_HEADER_SIZE + len);
+    put_chunk_header(out.data() + start, msg_type, len, flags);
+    memcpy(out.data() + start + WIRE_HEADER_SIZE, data, len);
+}
+
+void encode_file_chunk_header(char* dst, uint64_t offset, size_t len, uint32_t crc, int flags) {
+    put_chunk_header(dst, TRANSFER_FILE_CONTENT, FILE_CHUNK_HEADER_SIZE + len, flags);
+    put_u64(dst + WIRE_HEADER_SIZE, offset);
+    put_u32(dst + WIRE_HEADER_SIZE + 8, crc);
+}
+
+bool write_file_chunk(SSL* ssl, uint64_t offset, const void* data, size_t len, uint32_t crc) {
+    if (len > MAX_WIRE_CHUNK_SIZE - FILE_CHUNK_HEADER_SIZE) return false;
+
+    char header[WIRE_HEADER_SIZE + FILE_CHUNK_HEADER_SIZE];
+    encode_file_chunk_header(header, offset, len, crc);
+    if (!ssl_write_all(ssl, header, sizeof(header))) return false;
+    return data == nullptr || ssl_write_all(ssl, data, len);
+}
+
+bool write_file_digest(SSL* ssl, uint64_t file_size, uint32_t digest) {
+    return write_file_chunk(ssl, file_size, nullptr, 0, digest);
+}
+
+bool read_chunk(SSL* ssl, WireHeader& header, std::vector<char>& payload, std::string* username) {
+    char buf[WIRE_HEADER_SIZE + MAX_WIRE_USERNAME_SIZE];
+    if (!ssl_read_all(ssl, buf, WIRE_HEADER_SIZE)) return false;
+
+    bool valid;
+    if (!decode_header(buf, WIRE_HEADER_SIZE, header, valid)) return false;
+    if (!ssl_read_all(ssl, buf + WIRE_HEADER_SIZE, header.username_len)) return false;
+    if (username) username->assign(buf + WIRE_HEADER_SIZE, header.username_len);
+
+    payload.resize(header.payload_size());
+    return ssl_read_all(ssl, payload.data(), payload.size());
+}
+
+bool read_frame(SSL* ssl, std::vector<char>& frame) {
+    frame.resize(WIRE_HEADER_SIZE);
+    if (!ssl_read_all(ssl, frame.data(), WIRE_HEADER_SIZE)) return false;
+
+    WireHeader header;
+    bool valid;
+    if (!decode_header(frame.data(), WIRE_HEADER_SIZE, header, valid)) return false;
+    frame.resize(header.frame_size());
+    return ssl_read_all(ssl, frame.data() + WIRE_HEADER_SIZE, frame.size() - WIRE_HEADER_SIZE);
+}
+
+bool decode_file_chunk(const std::vector<char>& payload, uint64_t& offset, uint32_t& crc, const char*& data, size_t& len) {
+    return decode_file_chunk(std::string_view(payload.data(), payload.size()), offset, crc, data, len);
+}
+
+bool decode_file_chunk(std::string_view payload, uint64_t& offset, uint32_t& crc, const char*& data, size_t& len) {
+    if (payload.size() < FILE_CHUNK_HEADER_SIZE) return false;
+
+    offset = get_u64(payload.data());
+    crc = get_u32(payload.data() + 8);
+    data = payload.data() + FILE_CHUNK_HEADER_SIZE;
+    len = payload.size() - FILE_CHUNK_HEADER_SIZE;
+    return crc32c(data, len) == crc;
+}
+
+bool decode_file_digest(const std::vector<char>& payload, uint64_t& file_size, uint32_t& digest) {
+    if (payload.size() != FILE_CHUNK_HEADER_SIZE) return false;
+
+    file_size = get_u64(payload.data());
+    digest = get_u32(payload.data() + 8);
+    return true;
+}
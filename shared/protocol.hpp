@@ -0,0 +1,110 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include <openssl/ssl.h>
+#include "message.hpp"
+
+/* Message 在網路上的格式 (全部都是 network byte order)
+
+    +----------+----------+-------+--------------+----------+---------+---------+----------+---------+
+    | length   | msg_type | flags | username_len | reserved | from_id | to_id   | username | payload |
+    | 4 bytes  | 1 byte   | 1 byte| 1 byte       | 1 byte   | 4 bytes | 4 bytes | n bytes  | m bytes |
+    +----------+----------+-------+--------------+----------+---------+---------+----------+---------+
+
+length 是 length 欄位之後所有 bytes 的長度 (12 + n + m)，
+payload 的長度不用另外送：m = length - 12 - n。
+檔案內容 (TRANSFER_FILE_CONTENT) 和續傳的 bitmap (TRANSFER_RESUME) 的 payload 可以到 MAX_WIRE_CHUNK_SIZE，
+不受 Message 的 payload 大小限制，要用 write_chunk / read_chunk 讀寫。
+
+metadata 之後的每一塊檔案內容，payload 前面再加上這一塊在檔案裡的位置和 checksum (CRC-32C)：
+
+    +----------+---------+------+
+    | offset   | crc32c  | data |
+    | 8 bytes  | 4 bytes | ...  |
+    +----------+---------+------+
+
+所有內容送完後是一個沒有 data 的 trailer：offset 放檔案大小，crc32c 放整個檔案的 digest。
+
+relay mode 的 metadata 之後，sender 先送 TRANSFER_MANIFEST：依照順序把每個 chunk 的 SHA-256 (CHUNK_HASH_SIZE bytes) 接起來，
+一個 frame 放不下時分成好幾個 frame 送。
+direct mode 的 delta (TRANSFER_SIGNATURES / TRANSFER_DELTA) 的格式在 delta.hpp。
+
+flags：
+- WIRE_FLAG_COMPRESSED：payload 是壓縮過的 (格式在 compress.hpp)
+- WIRE_FLAG_ACCEPTS_COMPRESSED：「可以送壓縮過的給我」，只出現在 JOIN、LOGIN 回覆和 TRANSFER_RESUME，payload 本身沒有壓縮
+*/
+#define WIRE_LENGTH_SIZE 4
+#define WIRE_HEADER_SIZE 16                         // 包含 length 欄位的固定 header 大小
+#define MAX_WIRE_USERNAME_SIZE 255                  // username_len 只有 1 byte
+#define MAX_WIRE_PAYLOAD_SIZE MAX_PAYLOAD_SIZE      // 一個 Message 的 payload 上限
+#define MAX_WIRE_CHUNK_SIZE (1024 * 1024)           // TRANSFER_FILE_CONTENT 的 payload 上限 (一大塊檔案內容)
+#define FILE_CHUNK_HEADER_SIZE 12                   // 檔案內容 payload 開頭的 offset + crc32
+
+#define WIRE_FLAG_COMPRESSED 0x01
+#define WIRE_FLAG_ACCEPTS_COMPRESSED 0x02
+
+struct WireHeader {
+    uint32_t length;
+    uint8_t msg_type;
+    uint8_t flags;
+    uint8_t username_len;
+    int32_t from_id;
+    int32_t to_id;
+
+    size_t frame_size() const { return WIRE_LENGTH_SIZE + length; }
+    size_t payload_size() const { return length - (WIRE_HEADER_SIZE - WIRE_LENGTH_SIZE) - username_len; }
+};
+
+// 直接指向 frame 裡面的資料，不複製；frame 的 buffer 必須比 view 活得久
+struct MessageView {
+    WireHeader header;
+    std::string_view username;
+    std::string_view payload;
+};
+
+// 把 msg 編碼後接在 out 的後面，回傳這個 frame 的大小
+size_t encode_message(const Message& msg, std::vector<char>& out);
+
+// 解析 data 開頭的 header；資料不夠一個 header 或欄位不合法時回傳 false
+// (不合法時 valid 會被設成 false，呼叫端應該直接斷線)
+bool decode_header(const char* data, size_t len, WireHeader& header, bool& valid);
+
+// 把一個完整的 frame 解回 Message，payload 後面會補上 '\0' (如果放得下)
+bool decode_message(const char* data, size_t len, Message& msg);
+
+// 把一個完整的 frame 解成 MessageView
+bool decode_message_view(const char* data, size_t len, MessageView& view);
+
+// Blocking 版本：直接對 SSL 讀寫一個完整的 Message
+bool write_message(SSL* ssl, const Message& msg);
+bool read_message(SSL* ssl, Message& msg);
+
+// Blocking 版本：直接送出一個 payload 為 data 的 frame，data 不會先複製進 Message
+bool write_chunk(SSL* ssl, int msg_type, const void* data, size_t len, int flags = 0);
+// 送一塊檔案內容：header 和 offset / crc 一次送出，data 為 nullptr 時接下來的 len bytes 由呼叫端自己送 (例如 SSL_sendfile)
+bool write_file_chunk(SSL* ssl, uint64_t offset, const void* data, size_t len, uint32_t crc);
+// 送檔案的 trailer
+bool write_file_digest(SSL* ssl, uint64_t file_size, uint32_t digest);
+// Blocking 版本：讀一個任意大小的 frame，payload 放進 payload (會重複使用它的空間)，username 不是 nullptr 時順便存 username
+bool read_chunk(SSL* ssl, WireHeader& header, std::vector<char>& payload, std::string* username = nullptr);
+// Blocking 版本：讀一個任意大小的完整 frame (包含 header 和 username)，可以再用 decode_message_view 解開
+bool read_frame(SSL* ssl, std::vector<char>& frame);
+// 把 payload 為 data 的 frame 接在 out 的後面 (server 自己產生的大 frame 用)
+void encode_chunk(int msg_type, const void* data, size_t len, std::vector<char>& out, int flags = 0);
+// 在 dst 寫入一塊檔案內容的 header 和 offset / crc (WIRE_HEADER_SIZE + FILE_CHUNK_HEADER_SIZE bytes)，後面接著放 len bytes 的資料
+void encode_file_chunk_header(char* dst, uint64_t offset, size_t len, uint32_t crc, int flags = 0);
+// 解開 read_chunk 讀到的一塊檔案內容；格式不對或 crc32c 對不上時回傳 false
+bool decode_file_chunk(const std::vector<char>& payload, uint64_t& offset, uint32_t& crc, const char*& data, size_t& len);
+bool decode_file_chunk(std::string_view payload, uint64_t& offset, uint32_t& crc, const char*& data, size_t& len);
+// 解開檔案的 trailer；payload 不是 trailer 時回傳 false
+bool decode_file_digest(const std::vector<char>& payload, uint64_t& file_size, uint32_t& digest);
+
+// Blocking 版本：讀 / 寫剛好 len bytes
+bool ssl_write_all(SSL* ssl, const void* data, size_t len);
+bool ssl_read_all(SSL* ssl, void* data, size_t len);
+
+#endif // PROTOCOL_HPP
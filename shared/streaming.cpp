@@ -1,18 +1,30 @@
 #include "streaming.hpp"
+#include "bitrate.hpp"
+#include "encode_pipeline.hpp"
+#include "playout.hpp"
+#include "protocol.hpp"
 #include <openssl/ssl.h>
 #include <opencv2/opencv.hpp>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <vector>
 #include <unistd.h> 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
 
 #define MINIAUDIO_IMPLEMENTATION
 #include "miniaudio.h"
 
 /* OpenCV for video streaming */
 
-void send_frame(SSL* ssl, const std::vector<char>& frame) {
-    uint32_t frame_size = htonl(static_cast<uint32_t>(frame.size())); // Convert to network byte order
+bool send_frame(SSL* ssl, const std::vector<char>& frame) {
+    return send_frame(ssl, frame.data(), frame.size());
+}
+
+bool send_frame(SSL* ssl, const void* data, size_t size) {
+    uint32_t frame_size = htonl(static_cast<uint32_t>(size)); // Convert to network byte order
     size_t total_written = 0;
 
     // Send frame size
@@ -20,21 +32,22 @@ void send_frame(SSL* ssl, const std::vector<char>& frame) {
         int bytes_written = SSL_write(ssl, reinterpret_cast<const char*>(&frame_size) + total_written, sizeof(frame_size) - total_written);
         if (bytes_written <= 0) {
             std::cerr << "Error: Failed to send frame size. SSL_write returned " << bytes_written << "\n";
-            return;
+            return false;
         }
         total_written += bytes_written;
     }
 
     // Send frame data
     total_written = 0;
-    while (total_written < frame.size()) {
-        int bytes_written = SSL_write(ssl, frame.data() + total_written, frame.size() - total_written);
+    while (total_written < size) {
+        int bytes_written = SSL_write(ssl, static_cast<const char*>(data) + total_written, size - total_written);
         if (bytes_written <= 0) {
             std::cerr << "Error: Failed to send frame data. SSL_write returned " << bytes_written << "\n";
-            return;
+            return false;
         }
         total_written += bytes_written;
     }
+    return true;
 }
 
 
@@ -72,6 +85,108 @@ std::vector<char> receive_frame(SSL* ssl) {
     return frame;
 }
 
+bool send_frame(SSL* ssl, const StreamFrame& frame) {
+    char header[sizeof(uint32_t) + FRAME_PTS_SIZE];
+    uint32_t frame_size = htonl(frame.eof() ? 0 : static_cast<uint32_t>(FRAME_PTS_SIZE + frame.data.size()));
+    uint64_t pts = static_cast<uint64_t>(frame.pts_us);
+    uint32_t pts_high = htonl(static_cast<uint32_t>(pts >> 32));
+    uint32_t pts_low = htonl(static_cast<uint32_t>(pts));
+    memcpy(header, &frame_size, sizeof(frame_size));
+    memcpy(header + sizeof(uint32_t), &pts_high, sizeof(pts_high));
+    memcpy(header + sizeof(uint32_t) + 4, &pts_low, sizeof(pts_low));
+
+    size_t header_size = frame.eof() ? sizeof(uint32_t) : sizeof(header);
+    if (!ssl_write_all(ssl, header, header_size) || !ssl_write_all(ssl, frame.data.data(), frame.data.size())) {
+        std::cerr << "Error: Failed to send frame.\n";
+        return false;
+    }
+    return true;
+}
+
+bool receive_frame(SSL* ssl, StreamFrame& frame) {
+    frame.data.clear();
+    uint32_t frame_size_network = 0;
+    if (!ssl_read_all(ssl, &frame_size_network, sizeof(frame_size_network))) {
+        std::cerr << "Error: Failed to read frame size.\n";
+        return false;
+    }
+
+    uint32_t frame_size = ntohl(frame_size_network);
+    if (frame_size == 0) return true;   // EOF
+    if (frame_size < FRAME_PTS_SIZE) {
+        std::cerr << "Error: Invalid frame size " << frame_size << "\n";
+        return false;
+    }
+
+    uint32_t pts[2];
+    if (!ssl_read_all(ssl, pts, sizeof(pts))) {
+        std::cerr << "Error: Failed to read frame timestamp.\n";
+        return false;
+    }
+    frame.pts_us = static_cast<int64_t>((static_cast<uint64_t>(ntohl(pts[0])) << 32) | ntohl(pts[1]));
+
+    // capacity 夠的話 resize 不會 allocate
+    frame.data.resize(frame_size - FRAME_PTS_SIZE);
+    if (!ssl_read_all(ssl, frame.data.data(), frame.data.size())) {
+        std::cerr << "Error: Failed to read frame data.\n";
+        frame.data.clear();
+        return false;
+    }
+    return true;
+}
+
+// pipeline 的 slot：capture 讀進來的畫面、它的 timestamp 和 capture 時 BitrateController 決定的設定
+struct CapturedFrame {
+    cv::Mat image;
+    int64_t pts_us = 0;
+    int quality = ABR_QUALITY_MAX;
+    int scale_percent = 100;
+};
+
+// 依照 bitrate 的設定縮小 (scaled 是重複使用的 buffer) 再壓成 JPEG
+static bool encode_jpeg(const cv::Mat& image, int quality, int scale_percent, cv::Mat& scaled, std::vector<unsigned char>& out) {
+    const cv::Mat* source = &image;
+    if (scale_percent < 100) {
+        double scale = scale_percent / 100.0;
+        cv::resize(image, scaled, cv::Size(), scale, scale, cv::INTER_AREA);
+        source = &scaled;
+    }
+    return cv::imencode(".jpg", *source, out, {cv::IMWRITE_JPEG_QUALITY, quality});
+}
+
+// 送出一個 frame，把 send 卡了多久回報給 BitrateController
+static bool send_measured(SSL* ssl, const StreamFrame& encoded, BitrateController& bitrate, int64_t behind_us) {
+    int64_t start_us = monotonic_us();
+    bool sent = send_frame(ssl, encoded);
+    int64_t now_us = monotonic_us();
+    bitrate.on_frame_sent(now_us - start_us, behind_us, now_us);
+    return sent;
+}
+
+/* live video 時限制 kernel 裡還沒送出的資料，連線跟不上時 send 很快就會卡住讓 BitrateController 看到，
+不會先在 send buffer 裡排好幾秒的 frame 才發現 (relay 時 server 對 recipient 送不出去就會停止讀 sender，一樣會卡住)。
+old_bytes 不是 nullptr 時存原本的值，結束時用同一個函式還原；不支援時回傳 false */
+static bool limit_unsent(SSL* ssl, unsigned int bytes, unsigned int* old_bytes) {
+#ifdef TCP_NOTSENT_LOWAT
+    int fd = SSL_get_fd(ssl);
+    socklen_t length = sizeof(*old_bytes);
+    if (old_bytes && getsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, old_bytes, &length) < 0) return false;
+    return setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytes, sizeof(bytes)) == 0;
+#else
+    (void)ssl;
+    (void)bytes;
+    (void)old_bytes;
+    return false;
+#endif
+}
+
+static void print_bitrate_summary(const BitrateController& bitrate) {
+    if (bitrate.downgrades() == 0) return;
+    BitrateLevel lowest = bitrate.lowest();
+    std::cout << "Lowered video bitrate " << bitrate.downgrades() << " times because the connection could not keep up (lowest: JPEG quality "
+              << lowest.quality << ", " << lowest.scale_percent << "% resolution, 1 of every " << lowest.frame_divisor << " frames).\n";
+}
+
 void stream_video(SSL* ssl, const std::string& video_path) {
     cv::VideoCapture cap(video_path);
     if (!cap.isOpened()) {
@@ -79,15 +194,51 @@ void stream_video(SSL* ssl, const std::string& video_path) {
         return;
     }
 
-    cv::Mat frame;
-    while (cap.read(frame)) {
-        std::vector<uchar> buffer;
-        cv::imencode(".jpg", frame, buffer); // Compress frame to JPEG
-        send_frame(ssl, std::vector<char>(buffer.begin(), buffer.end()));
+    // 影片檔沒有 timestamp 時 (有些 backend 一直回傳 0) 用 FPS 算
+    double fps = cap.get(cv::CAP_PROP_FPS);
+    int64_t frame_interval_us = static_cast<int64_t>(1e6 / (fps > 0 ? fps : DEFAULT_VIDEO_FPS));
+
+    // capture 在這個 thread，JPEG encode 分給多個 encoder thread，再由 sender thread 依照順序、照 timestamp 的節奏送出；
+    // sender 回報 send 卡住和落後的情況，連線跟不上時 capture 降 quality / 解析度 / frame rate
+    FramePacer pacer;
+    BitrateController bitrate(fps > 0 ? fps : DEFAULT_VIDEO_FPS);
+    unsigned int unsent_limit = 0;
+    bool limited = limit_unsent(ssl, ABR_UNSENT_LIMIT, &unsent_limit);
+    EncodePipeline<CapturedFrame> pipeline(default_encode_workers(),
+        [](const CapturedFrame& frame, StreamFrame& encoded) {
+            thread_local cv::Mat scaled;    // 每個 encoder thread 自己的縮圖 buffer
+            encoded.pts_us = frame.pts_us;
+            return encode_jpeg(frame.image, frame.quality, frame.scale_percent, scaled, encoded.data); // Compress frame to JPEG
+        },
+        [ssl, &pacer, &bitrate](const StreamFrame& encoded) {
+            int64_t behind_us = pacer.wait(encoded.pts_us);  // 照影片原本的速度送，不是 encode 多快就送多快
+            return send_measured(ssl, encoded, bitrate, behind_us);
+        });
+    int64_t last_pts_us = -frame_interval_us;
+    for (uint64_t frame_index = 0; ; frame_index++) {
+        CapturedFrame* frame = pipeline.next_input();     // 讀進 pipeline 的 slot，Mat 的 buffer 重複使用
+        if (!frame || !cap.read(frame->image)) break;
+        frame->pts_us = static_cast<int64_t>(cap.get(cv::CAP_PROP_POS_MSEC) * 1000);
+        if (frame->pts_us <= last_pts_us) frame->pts_us = last_pts_us + frame_interval_us;
+        last_pts_us = frame->pts_us;
+
+        // 降 frame rate 時跳過的 frame 不 submit，slot 留給下一個 frame (receiver 照 timestamp 播，不受影響)
+        if (!bitrate.should_send(frame_index)) continue;
+        BitrateLevel level = bitrate.level();
+        frame->quality = level.quality;
+        frame->scale_percent = level.scale_percent;
+        pipeline.submit();
+    }
+    bool finished = pipeline.finish();
+    if (limited) limit_unsent(ssl, unsent_limit, nullptr);
+    print_bitrate_summary(bitrate);
+    if (!finished) {
+        std::cerr << "Error: Video streaming stopped after " << pipeline.frames_sent() << " frames.\n";
+        return;
     }
 
     // Send an empty frame as EOF
-    send_frame(ssl, std::vector<char>());
+    send_frame(ssl, StreamFrame());
 
     // Ensure all data is sent
     int flush_status = SSL_write(ssl, nullptr, 0);
@@ -106,12 +257,20 @@ void stream_webcam(SSL* ssl) {
     }
 
     cv::Mat frame;
-    while (true) {
+    cv::Mat scaled;
+    StreamFrame encoded = StreamFrame::acquire();
+    double fps = cap.get(cv::CAP_PROP_FPS);
+    BitrateController bitrate(fps > 0 ? fps : DEFAULT_VIDEO_FPS);
+    unsigned int unsent_limit = 0;
+    bool limited = limit_unsent(ssl, ABR_UNSENT_LIMIT, &unsent_limit);
+    int64_t start_us = monotonic_us();
+    for (uint64_t frame_index = 0; ; frame_index++) {
         cap >> frame; // Capture a frame
         if (frame.empty()) {
             std::cerr << "Error: Failed to capture frame from webcam.\n";
             break;
         }
+        encoded.pts_us = monotonic_us() - start_us;    // webcam 的 timestamp 就是 capture 的時間
 
         // crop the center 640x480 region of a 1280x720 frame
         int crop_x = (frame.cols - 640) / 2;
@@ -127,15 +286,16 @@ void stream_webcam(SSL* ssl) {
             cv::Rect crop_rect(crop_x, crop_y, crop_width, crop_height);
             cv::Mat cropped_frame = frame(crop_rect); // Crop the frame
 
-            // Compress the cropped frame to JPEG
-            std::vector<uchar> buffer;
-            if (!cv::imencode(".jpg", cropped_frame, buffer)) {
-                std::cerr << "Error: Failed to encode frame.\n";
-                continue;
+            // Compress the cropped frame to JPEG (連線跟不上時降 quality / 解析度，或是只送一部分的 frame；本機還是每個都顯示)
+            if (bitrate.should_send(frame_index)) {
+                BitrateLevel level = bitrate.level();
+                if (!encode_jpeg(cropped_frame, level.quality, level.scale_percent, scaled, encoded.data)) {
+                    std::cerr << "Error: Failed to encode frame.\n";
+                    continue;
+                }
+                send_measured(ssl, encoded, bitrate, 0);
             }
 
-            send_frame(ssl, std::vector<char>(buffer.begin(), buffer.end()));
-
             // Display the cropped frame
             cv::imshow("Webcam Streaming", cropped_frame);
         } else {
@@ -150,7 +310,7 @@ void stream_webcam(SSL* ssl) {
     }
 
     // Send an empty frame as EOF
-    send_frame(ssl, std::vector<char>());
+    send_frame(ssl, StreamFrame());
 
     // Ensure all data is sent
     int flush_status = SSL_write(ssl, nullptr, 0);
@@ -158,6 +318,8 @@ void stream_webcam(SSL* ssl) {
         std::cerr << "Error: Failed to flush SSL write buffer.\n";
     }
 
+    if (limited) limit_unsent(ssl, unsent_limit, nullptr);
+    print_bitrate_summary(bitrate);
     std::cout << "Webcam streaming finished. Initiating SSL shutdown...\n";
     cap.release(); // Release the webcam
 
@@ -171,43 +333,53 @@ void stream_webcam(SSL* ssl) {
 
 void display(StreamingQueue& queue, bool& running) {
     bool streaming_complete = false;
+    cv::Mat frame;      // decode 進同一個 Mat，大小不變時不用重新配置
+    PlayoutClock clock; // 照 frame 的 timestamp 播，不是收到多快就播多快
 
     while (running) {
-        if (!queue.empty()) {
-            auto frame_data = queue.pop();
-
+        StreamFrame frame_data;
+        if (queue.pop(frame_data, STREAMING_QUEUE_WAIT_MS)) {
             // Check for EOF signal
-            if (frame_data.empty()) {
+            if (frame_data.eof()) {
                 std::cout << "Received EOF. Stopping video playback.\n";
                 streaming_complete = true;
                 break; // Exit the loop
             }
 
-            cv::Mat frame = cv::imdecode(cv::Mat(frame_data), cv::IMREAD_COLOR);
+            // 已經來不及播的 frame 不 decode，讓畫面追上
+            int64_t due_us = clock.due(frame_data.pts_us, monotonic_us());
+            if (due_us < 0) continue;
+
+            // decode 失敗時回傳空的 Mat，不會留著上一個 frame
+            frame = cv::imdecode(frame_data.data, cv::IMREAD_COLOR, &frame);
             if (frame.empty()) {
                 std::cerr << "Error: Failed to decode frame.\n";
                 continue;
             }
 
+            // 等到預定的時間才顯示 (waitKey 等的時候也會處理視窗的事件)
+            int delay_ms = static_cast<int>((due_us - monotonic_us()) / 1000);
+            if (delay_ms > 0 && cv::waitKey(delay_ms) >= 0) {
+                std::cout << "User interrupted streaming. Exiting...\n";
+                break;
+            }
             cv::imshow("Video Stream", frame);
-            if (cv::waitKey(30) >= 0) {
+            if (cv::waitKey(1) >= 0) {
                 std::cout << "User interrupted streaming. Exiting...\n";
                 break;
             }
         } else if (streaming_complete) {
             // Exit if streaming is marked as complete and the queue is empty
             break;
-        } else {
-            usleep(10000); // Add a slight delay to reduce CPU usage
         }
     }
 
     // Flush remaining frames in the queue
     std::cout << "Flushing remaining frames...\n";
-    while (!queue.empty()) {
-        auto frame_data = queue.pop();
-        if (!frame_data.empty()) {
-            cv::Mat frame = cv::imdecode(cv::Mat(frame_data), cv::IMREAD_COLOR);
+    StreamFrame frame_data;
+    while (queue.pop(frame_data, 0)) {
+        if (!frame_data.eof()) {
+            frame = cv::imdecode(frame_data.data, cv::IMREAD_COLOR, &frame);
             if (!frame.empty()) {
                 cv::imshow("Video Stream", frame);
                 cv::waitKey(1); // Show frame briefly
@@ -219,33 +391,39 @@ void display(StreamingQueue& queue, bool& running) {
     for (int i = 0; i < 5; i++) {
         cv::waitKey(1);
     }
+    StreamingQueueStats stats = queue.stats();
+    if (stats.dropped > 0) {
+        std::cout << "Dropped " << stats.dropped << " of " << stats.pushed << " frames (display fell behind, queue capacity "
+                  << stats.capacity << ").\n";
+    }
+    if (clock.late_frames() > 0) {
+        std::cout << "Skipped " << clock.late_frames() << " frames that arrived too late to play, resynced "
+                  << clock.resyncs() << " times.\n";
+    }
     std::cout << "Streaming window closed.\n";
 }
 
 
 void enqueue_frame(StreamingQueue& queue, SSL* ssl) {
     while (true) {
-        auto frame_data = receive_frame(ssl);
+        // 收進 pool 的 buffer，display 用完後回到 pool 給下一個 frame
+        StreamFrame frame_data = StreamFrame::acquire();
+        receive_frame(ssl, frame_data);
 
         // Push EOF signal (empty frame) to the queue
-        if (frame_data.empty()) {
+        if (frame_data.eof()) {
             std::cout << "Received EOF. Exiting frame receiving loop.\n";
-            queue.push(frame_data); // Push EOF to signal the end of the stream
+            queue.push(std::move(frame_data)); // Push EOF to signal the end of the stream
             break;
         }
 
-        queue.push(frame_data);
+        // 每個 JPEG 都可以自己 decode，所以都是 keyframe；display 跟不上時由 queue 的 OverflowPolicy 丟 frame
+        queue.push(std::move(frame_data));
     }
 }
 
 /* miniaudio for audio streaming */
 
-struct AudioMetadata {
-    uint32_t sampleRate;
-    uint32_t channels;
-    uint32_t format; // Use constants like `ma_format_f32` to indicate format
-};
-
 void stream_audio(SSL* ssl, const std::string& audio_path) {
     ma_decoder decoder;
     ma_result result = ma_decoder_init_file(audio_path.c_str(), nullptr, &decoder);
@@ -282,7 +460,7 @@ void stream_audio(SSL* ssl, const std::string& audio_path) {
         usleep(static_cast<useconds_t>(chunk_duration * 1e6)); // Convert seconds to microseconds
     }
 
-    send_frame(ssl, {}); // Send an empty frame as EOF
+    send_frame(ssl, std::vector<char>()); // Send an empty frame as EOF
     ma_decoder_uninit(&decoder);
 
     int flush_status = SSL_write(ssl, nullptr, 0);
@@ -2,21 +2,43 @@
 #define STREAMING_HPP
 
 #include <openssl/ssl.h>
+#include <cstdint>
 #include <vector>
 #include <string>
 #include "streaming_queue.hpp" // Include the StreamingQueue definition
 
 // Function declarations for streaming
-void send_frame(SSL* ssl, const std::vector<char>& frame);
+/* streaming 的 frame 都是 [4 bytes 長度][內容]，長度 0 是 EOF (server 只看長度轉傳)
+video 的內容開頭多了 FRAME_PTS_SIZE bytes 的 presentation timestamp (µs，playout.hpp)：
+    +----------+---------+------+
+    | 長度      | pts     | JPEG |
+    | 4 bytes  | 8 bytes | ...  |
+    +----------+---------+------+
+*/
+#define FRAME_PTS_SIZE 8
+
+// 送出失敗 (連線斷了) 時回傳 false
+bool send_frame(SSL* ssl, const std::vector<char>& frame);
+bool send_frame(SSL* ssl, const void* data, size_t size);
 void stream_video(SSL* ssl, const std::string& video_path);
 void stream_webcam(SSL* ssl);
 std::vector<char> receive_frame(SSL* ssl);
+// video frame：帶著 frame.pts_us 送出 / 收進 frame (重複使用 data 的 capacity)，EOF 時 frame 是空的，失敗時回傳 false
+bool send_frame(SSL* ssl, const StreamFrame& frame);
+bool receive_frame(SSL* ssl, StreamFrame& frame);
 
 // Display frames from the streaming queue
 void display(StreamingQueue& queue, bool& running);
 // Enqueue frames from SSL connection into the streaming queue
 void enqueue_frame(StreamingQueue& queue, SSL* ssl);
 
+// 音訊串流開頭會先送這個 metadata，之後才是一個個 frame
+struct AudioMetadata {
+    uint32_t sampleRate;
+    uint32_t channels;
+    uint32_t format; // Use constants like `ma_format_f32` to indicate format
+};
+
 // Function declarations for audio streaming
 void stream_audio(SSL* ssl, const std::string& audio_file_path); // For file-based audio streaming
 void play_audio(SSL* ssl);
@@ -1,18 +1,43 @@
 #ifndef STREAMING_QUEUE_HPP
 #define STREAMING_QUEUE_HPP
 
-#include <queue>
-#include <vector>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <time.h>
 #include <pthread.h>
+#include "bounded_queue.hpp"
+#include "frame_pool.hpp"
 
-class StreamingQueue {
-private:
-    std::queue<std::vector<char>> queue;
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
+#define STREAMING_QUEUE_CAPACITY 16     // 最多排幾個 frame (必須是 2 的次方)；要放得下 jitter buffer (PLAYOUT_DELAY_MS) 裡的 frame，60 FPS 時大約 0.27 秒
+#define STREAMING_QUEUE_WAIT_MS 10      // 等 frame / 空位時每次最多睡多久 (萬一錯過通知也不會卡住)
+
+/* 收到的 frame 排隊等 display 拿
+- 固定容量的 lock-free ring (BoundedQueue)，display 跟不上時記憶體和延遲都有上限
+- frame 是 move-only 的 StreamFrame (frame_pool.hpp)，push / pop 都不複製內容
+- 滿了怎麼辦由 OverflowPolicy 決定；push EOF 時一定等到有空位，不會丟掉它
+  (排隊中的 EOF 還是可能被後面下一個 stream 的 frame 擠掉，display 就直接接著播下一個 stream)
+- 只有睡覺 (等 frame 或 Block 時等空位) 才用到 mutex，一般的 push / pop 不會碰到
+*/
+enum class OverflowPolicy {
+    Block,              // 等 display 拿走 frame (TCP 的 backpressure 會一路傳回 sender)
+    DropOldest,         // 丟掉最舊的 frame，放進新的
+    DropToKeyframe,     // 丟掉排隊中的 frame 和之後的非 keyframe，從下一個 keyframe 重新開始
+};
+
+struct StreamingQueueStats {
+    size_t capacity;
+    size_t occupancy;       // 現在排了幾個 frame
+    uint64_t pushed;        // push 過幾個 frame (包含被丟掉的)
+    uint64_t dropped;       // 因為滿了被丟掉幾個
+};
 
+class StreamingQueue {
 public:
-    StreamingQueue() {
+    explicit StreamingQueue(size_t capacity = STREAMING_QUEUE_CAPACITY,
+                            OverflowPolicy policy = OverflowPolicy::DropOldest)
+        : queue(capacity), policy(policy) {
         pthread_mutex_init(&mutex, nullptr);
         pthread_cond_init(&cond, nullptr);
     }
@@ -22,33 +47,94 @@ public:
         pthread_cond_destroy(&cond);
     }
 
-    void push(const std::vector<char>& frame) {
-        pthread_mutex_lock(&mutex);
-        queue.push(frame);
-        pthread_cond_signal(&cond); // Notify waiting threads
-        pthread_mutex_unlock(&mutex);
-    }
+    StreamingQueue(const StreamingQueue&) = delete;
+    StreamingQueue& operator=(const StreamingQueue&) = delete;
 
-    std::vector<char> pop() {
-        pthread_mutex_lock(&mutex);
+    void push(StreamFrame&& frame) {
+        pushed.fetch_add(1, std::memory_order_relaxed);
+        if (policy == OverflowPolicy::DropToKeyframe && !frame.eof()) {
+            // 前面丟過 frame 之後，非 keyframe 沒辦法 decode，一直丟到下一個 keyframe
+            if (!frame.keyframe && skipping.load(std::memory_order_relaxed)) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            skipping.store(false, std::memory_order_relaxed);
+        }
 
-        // Wait until the queue is not empty
-        while (queue.empty()) {
-            pthread_cond_wait(&cond, &mutex);
+        StreamFrame victim;
+        while (!queue.push(frame)) {
+            if (policy == OverflowPolicy::Block || frame.eof()) {
+                sleep([this] { return queue.size() < queue.capacity(); });
+            } else if (policy == OverflowPolicy::DropOldest) {
+                if (queue.pop(victim)) dropped.fetch_add(1, std::memory_order_relaxed);
+            } else if (!frame.keyframe) {
+                skipping.store(true, std::memory_order_relaxed);
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                while (queue.pop(victim)) dropped.fetch_add(1, std::memory_order_relaxed);
+            }
         }
+        wake();
+    }
+
+    // 等到有 frame 或過了 timeout_ms (< 0 代表一直等)，沒拿到時回傳 false
+    bool pop(StreamFrame& frame, int timeout_ms = -1) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (!queue.pop(frame)) {
+            if (timeout_ms >= 0 && std::chrono::steady_clock::now() >= deadline) return false;
+            sleep([this] { return queue.size() > 0; });
+        }
+        wake();     // Block 時 push 端可能在等空位
+        return true;
+    }
+
+    bool empty() const {
+        return queue.size() == 0;
+    }
+
+    StreamingQueueStats stats() const {
+        return {queue.capacity(), queue.size(),
+                pushed.load(std::memory_order_relaxed), dropped.load(std::memory_order_relaxed)};
+    }
 
-        std::vector<char> frame = queue.front();
-        queue.pop();
+private:
+    BoundedQueue<StreamFrame> queue;
+    OverflowPolicy policy;
+    std::atomic<bool> skipping{false};
+    std::atomic<uint64_t> pushed{0};
+    std::atomic<uint64_t> dropped{0};
 
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    std::atomic<int> sleepers{0};
+
+    /* 先登記 sleepers 再檢查一次 ready，wake 在 push / pop 之後才看 sleepers，
+    所以不會兩邊都錯過；最多睡 STREAMING_QUEUE_WAIT_MS 只是保險 */
+    template <typename Ready>
+    void sleep(Ready ready) {
+        pthread_mutex_lock(&mutex);
+        sleepers.fetch_add(1);
+        if (!ready()) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += STREAMING_QUEUE_WAIT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&cond, &mutex, &deadline);
+        }
+        sleepers.fetch_sub(1);
         pthread_mutex_unlock(&mutex);
-        return frame;
     }
 
-    bool empty() {
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load() == 0) return;
         pthread_mutex_lock(&mutex);
-        bool is_empty = queue.empty();
+        pthread_cond_broadcast(&cond);
         pthread_mutex_unlock(&mutex);
-        return is_empty;
     }
 };
 